@@ -0,0 +1,428 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "evaluate.h"
+#include "movegen.h"
+#include "packed.h"
+#include "pgn.h"
+#include "search.h"
+#include "tt.h"
+
+// The annotator replays the games of a PGN file and searches every
+// position of them with a fixed budget. Games go into a ring of slots like
+// the records of the batch mode: the main thread reads a game, resolves its
+// moves and stores the positions in its slot, the worker threads take the
+// positions one at a time, from any game in the ring, and the main thread
+// writes each game back as soon as it and all games before it are done.
+// A game that cannot be replayed is written unchanged. A game longer than
+// PGN_GAME_LIMIT is kept only in part, so it is skipped instead; both are
+// reported.
+//
+// Every move gets the evaluation of the position it leads to, from white's
+// point of view, as a "[%eval]" comment. A move that loses a pawn or more
+// against the best move of the search is marked "?", three pawns or more
+// "??", and followed by the best move as a variation. The annotations
+// replace the movetext of the input: its comments, variations, NAGs and
+// move suffixes are dropped, and the number of games that had any is
+// reported.
+
+enum { GAMES_PER_THREAD = 4, PGN_WIDTH = 79 };
+
+enum { SLOT_FREE, SLOT_READY, SLOT_DONE };
+
+typedef struct {
+  PackedPos pos;         // Position before the move
+  Key key;
+  Move move;             // Move played, MOVE_NONE after the last one
+  char san[8];
+  Value score;           // Search score for the side to move
+  Move best;
+  char bestSan[8];
+} PlyRecord;
+
+typedef struct {
+  PgnGame game;
+  PlyRecord *plies;
+  int plyCount;          // Positions to search, 0 if the game is invalid
+  int plyCap;
+  int pending;           // Positions not searched yet
+  bool valid;
+  bool commentary;       // The input had commentary, which is dropped
+  char result[8];
+  char error[16];
+  uint64_t nodes;
+  int state;
+} GameSlot;
+
+typedef struct {
+  PgnReader reader;
+  GameSlot *slots;
+  size_t size;
+  uint64_t read, written;
+  uint64_t taskGame;     // Next position to search: game and ply
+  int taskPly;
+  bool eof;
+  SearchLimits limits;
+  AnalysisCache *cache;
+  pthread_mutex_t mutex;
+  pthread_cond_t workCond, doneCond;
+} Annotator;
+
+// read_game() reads the next game into the slot and replays it, storing the
+// positions with the moves in SAN. It returns false at the end of the file.
+
+static bool read_game(Annotator *a, GameSlot *s) {
+  PgnCursor c;
+  Position pos;
+  int n = 0;
+
+  if (!pgn_read_game(&a->reader, &s->game))
+    return false;
+  s->plyCount = s->pending = 0;
+  s->valid = s->commentary = false;
+  s->error[0] = '\0';
+  s->nodes = 0;
+  if (s->game.overlong) {
+    strcpy(s->error, "overlong");
+    return true;
+  }
+  if (!pgn_start(&s->game, &pos, &c)) {
+    strcpy(s->error, "FEN");
+    return true;
+  }
+  pos.history = NULL;
+
+  for (; ; ++n) {
+    if (n == MAX_GAME_PLIES) {
+      strcpy(s->error, "too many plies");
+      return true;
+    }
+    if (n == s->plyCap) {
+      s->plyCap = s->plyCap ? 2 * s->plyCap : 256;
+      s->plies = realloc(s->plies, s->plyCap * sizeof(PlyRecord));
+    }
+    PlyRecord *r = &s->plies[n];
+    pack_position(&pos, &r->pos);
+    r->key = pos.key;
+    if (!(r->move = pgn_next_move(&c, &pos)))
+      break;
+    move_san(&pos, r->move, r->san);
+    do_move(&pos, r->move);
+  }
+  if (c.error) {
+    strcpy(s->error, c.token);
+    return true;
+  }
+  s->plyCount = s->pending = n + 1;
+  s->valid = true;
+  s->commentary = c.commentary;
+  strcpy(s->result, c.result);
+  return true;
+}
+
+// search_ply() searches the position before the given move of a game, with
+// the keys of the game so far for the detection of repetitions. Unlike the
+// batch mode it keeps the move ordering tables from one search to the next:
+// the positions are related, and clearing the tables would cost more than
+// a small search.
+
+static void search_ply(Annotator *a, SearchInfo *si, GameSlot *s, int ply) {
+  PlyRecord *r = &s->plies[ply];
+  Key keys[MAX_HISTORY];
+  Position pos;
+
+  unpack_position(&r->pos, &pos);
+  pos.historyLen = ply < MAX_HISTORY ? ply : MAX_HISTORY;
+  pos.history = keys;
+  for (int i = 0; i < pos.historyLen; ++i)
+    keys[i] = s->plies[ply - pos.historyLen + i].key;
+
+  if (!cache_lookup(a->cache, &pos, &a->limits, si)) {
+    search_init(si, &pos, &a->limits);
+    search_start(si);
+    cache_save(a->cache, &pos, si);
+  }
+  else
+    si->nodes = 0;
+  r->score = si->score;
+  r->best = si->pvlen ? si->pv[0] : MOVE_NONE;
+  if (r->best)
+    move_san(&pos, r->best, r->bestSan);
+}
+
+static void *annotate_worker(void *arg) {
+  Annotator *a = arg;
+  SearchInfo *si = search_new();
+
+  pthread_mutex_lock(&a->mutex);
+  while (true) {
+    // Take the next position of the oldest game that has one left
+    while (   a->taskGame < a->read
+           && a->taskPly == a->slots[a->taskGame % a->size].plyCount)
+      ++a->taskGame, a->taskPly = 0;
+    if (a->taskGame == a->read) {
+      if (a->eof)
+        break;
+      pthread_cond_wait(&a->workCond, &a->mutex);
+      continue;
+    }
+    GameSlot *s = &a->slots[a->taskGame % a->size];
+    int ply = a->taskPly++;
+    pthread_mutex_unlock(&a->mutex);
+
+    search_ply(a, si, s, ply);
+
+    pthread_mutex_lock(&a->mutex);
+    s->nodes += si->nodes;
+    if (!--s->pending) {
+      s->state = SLOT_DONE;
+      pthread_cond_signal(&a->doneCond);
+    }
+  }
+  pthread_mutex_unlock(&a->mutex);
+  search_delete(si);
+  return NULL;
+}
+
+// Emitter writes the movetext token by token, wrapping the lines.
+
+typedef struct {
+  FILE *out;
+  int col;
+} Emitter;
+
+static void emit(Emitter *e, const char *token) {
+  int len = strlen(token);
+  if (e->col && e->col + 1 + len > PGN_WIDTH) {
+    fputc('\n', e->out);
+    e->col = 0;
+  }
+  else if (e->col) {
+    fputc(' ', e->out);
+    ++e->col;
+  }
+  fputs(token, e->out);
+  e->col += len;
+}
+
+// clamp_cp() returns the value in centipawns, with mates and large scores
+// capped so that the loss of a move can be measured.
+
+INLINE int clamp_cp(Value v) {
+  int cp = abs(v) >= VALUE_MATE_IN_MAX_PLY ? (v > 0 ? 1000 : -1000) : to_cp(v);
+  return cp < -1000 ? -1000 : cp > 1000 ? 1000 : cp;
+}
+
+// format_eval() writes the comment with the value of a position, given the
+// search score for the side to move, from white's point of view.
+
+static void format_eval(Value v, bool whiteToMove, char *str) {
+  int sign = whiteToMove ? 1 : -1;
+  if (abs(v) >= VALUE_MATE_IN_MAX_PLY)
+    sprintf(str, "{[%%eval #%d]}", sign * (v > 0 ? (VALUE_MATE - v + 1) / 2 : -(VALUE_MATE + v) / 2));
+  else
+    sprintf(str, "{[%%eval %.2f]}", sign * to_cp(v) / 100.0);
+}
+
+// write_game() writes the tag pairs of the game as they were read, then the
+// annotated movetext. The final position is searched only for the value of
+// the last move, which is left out if the game ended in mate or stalemate.
+
+static void write_game(FILE *out, GameSlot *s) {
+  Emitter e = { out, 0 };
+  char token[64];
+  bool number = true;
+
+  fwrite(s->game.text, 1, s->game.tagsLen, out);
+  if (s->game.tagsLen)
+    fputc('\n', out);
+
+  for (int i = 0; i + 1 < s->plyCount; ++i) {
+    PlyRecord *r = &s->plies[i], *next = r + 1;
+    int moveNumber = 1 + r->pos.ply / 2;
+    bool white = !(r->pos.flags & 1);
+
+    // What the move lost against the best move, for the side that made it
+    int loss = r->move == r->best ? 0 : clamp_cp(r->score) - clamp_cp(-next->score);
+    const char *mark = loss >= 300 ? "??" : loss >= 100 ? "?" : "";
+
+    if (white || number) {
+      sprintf(token, white ? "%d." : "%d...", moveNumber);
+      emit(&e, token);
+    }
+    sprintf(token, "%s%s", r->san, mark);
+    emit(&e, token);
+    number = false;
+
+    if (next->best) {
+      format_eval(next->score, !white, token);
+      emit(&e, token);
+      number = true;
+    }
+    if (*mark && r->best) {
+      sprintf(token, white ? "(%d. %s)" : "(%d... %s)", moveNumber, r->bestSan);
+      emit(&e, token);
+      number = true;
+    }
+  }
+  emit(&e, s->result);
+  fputs("\n\n", out);
+}
+
+// write_invalid() writes a game that cannot be replayed as it was read,
+// but for the blank lines.
+
+static void write_invalid(FILE *out, GameSlot *s) {
+  fwrite(s->game.text, 1, s->game.tagsLen, out);
+  if (s->game.tagsLen && s->game.len > s->game.tagsLen)
+    fputc('\n', out);
+  fwrite(s->game.text + s->game.tagsLen, 1, s->game.len - s->game.tagsLen, out);
+  if (s->game.len && s->game.text[s->game.len - 1] != '\n')
+    fputc('\n', out);
+  fputc('\n', out);
+}
+
+// annotate_cmd() parses "annotate [<file>] [output <file>] [depth N]
+// [nodes N] [movetime MS] [threads N] [hash MB] [cache <file>] [cachesize
+// MB]". Input and output default to stdin and stdout, the budget to 20000
+// nodes per position.
+
+void annotate_cmd(int argc, char **argv) {
+  const char *input = "-", *output = "-", *cachePath = NULL;
+  int threads = cpu_count(), cacheSize = 64;
+  AnalysisCache cache;
+  Annotator a;
+
+  memset(&a, 0, sizeof(a));
+  for (int i = 0; i < argc; ++i) {
+    if (!strcmp(argv[i], "depth") && i + 1 < argc)
+      a.limits.depth = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "nodes") && i + 1 < argc)
+      a.limits.nodes = strtoull(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "movetime") && i + 1 < argc)
+      a.limits.movetime = atoll(argv[++i]);
+    else if (!strcmp(argv[i], "threads") && i + 1 < argc)
+      threads = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "hash") && i + 1 < argc)
+      tt_resize(atoi(argv[++i]));
+    else if (!strcmp(argv[i], "output") && i + 1 < argc)
+      output = argv[++i];
+    else if (!strcmp(argv[i], "cache") && i + 1 < argc)
+      cachePath = argv[++i];
+    else if (!strcmp(argv[i], "cachesize") && i + 1 < argc)
+      cacheSize = atoi(argv[++i]);
+    else
+      input = argv[i];
+  }
+  if (!a.limits.depth && !a.limits.nodes && !a.limits.movetime)
+    a.limits.nodes = 20000;
+  if (threads < 1)
+    threads = 1;
+
+  FILE *in = strcmp(input, "-") ? fopen(input, "r") : stdin;
+  FILE *out = strcmp(output, "-") ? fopen(output, "w") : stdout;
+  if (!in || !out) {
+    fprintf(stderr, "annotate: cannot open %s\n", in ? output : input);
+    exit(EXIT_FAILURE);
+  }
+  pgn_reader_init(&a.reader, in);
+  if (cachePath) {
+    if (!cache_open(&cache, cachePath, cacheSize))
+      exit(EXIT_FAILURE);
+    a.cache = &cache;
+  }
+
+  a.size = (size_t)threads * GAMES_PER_THREAD;
+  a.slots = calloc(a.size, sizeof(GameSlot));
+  pthread_mutex_init(&a.mutex, NULL);
+  pthread_cond_init(&a.workCond, NULL);
+  pthread_cond_init(&a.doneCond, NULL);
+
+  pthread_t *workers = malloc(threads * sizeof(pthread_t));
+  for (int i = 0; i < threads; ++i)
+    pthread_create(&workers[i], NULL, annotate_worker, &a);
+
+  uint64_t invalid = 0, skipped = 0, commentary = 0, positions = 0, nodes = 0;
+  TimePoint start = now();
+
+  pthread_mutex_lock(&a.mutex);
+  while (!a.eof || a.written < a.read) {
+    // Write finished games in input order
+    while (a.written < a.read && a.slots[a.written % a.size].state == SLOT_DONE) {
+      GameSlot *s = &a.slots[a.written++ % a.size];
+      pthread_mutex_unlock(&a.mutex);
+      if (s->valid)
+        write_game(out, s);
+      else if (s->game.overlong)
+        fprintf(stderr, "annotate: game %llu: skipped (longer than %d bytes)\n",
+                (unsigned long long)a.written, PGN_GAME_LIMIT);
+      else {
+        write_invalid(out, s);
+        fprintf(stderr, "annotate: game %llu: invalid (%s)\n",
+                (unsigned long long)a.written, s->error);
+      }
+      pthread_mutex_lock(&a.mutex);
+      skipped += s->game.overlong;
+      invalid += !s->valid && !s->game.overlong;
+      commentary += s->commentary;
+      positions += s->plyCount;
+      nodes += s->nodes;
+      s->state = SLOT_FREE;
+    }
+
+    if (!a.eof && a.read - a.written < a.size) {
+      GameSlot *s = &a.slots[a.read % a.size];
+      pthread_mutex_unlock(&a.mutex);
+      bool more = read_game(&a, s);
+      pthread_mutex_lock(&a.mutex);
+      if (more) {
+        s->state = s->pending ? SLOT_READY : SLOT_DONE;
+        ++a.read;
+        pthread_cond_broadcast(&a.workCond);
+      }
+      else {
+        a.eof = true;
+        pthread_cond_broadcast(&a.workCond);
+      }
+    }
+    else if (a.written < a.read)
+      pthread_cond_wait(&a.doneCond, &a.mutex);
+  }
+  pthread_mutex_unlock(&a.mutex);
+
+  for (int i = 0; i < threads; ++i)
+    pthread_join(workers[i], NULL);
+
+  TimePoint elapsed = now() - start + 1;
+  fflush(out);
+  fprintf(stderr, "games %llu invalid %llu skipped %llu positions %llu threads %d"
+          " time %lld ms games/sec %.1f MB/sec %.2f nodes %llu nps %llu\n",
+          (unsigned long long)a.written, (unsigned long long)invalid,
+          (unsigned long long)skipped, (unsigned long long)positions, threads,
+          (long long)elapsed, a.written * 1000.0 / elapsed,
+          a.reader.bytes / 1048.576 / elapsed,
+          (unsigned long long)nodes, (unsigned long long)(nodes * 1000 / elapsed));
+  if (commentary)
+    fprintf(stderr, "annotate: comments, variations and NAGs of %llu games dropped\n",
+            (unsigned long long)commentary);
+  if (a.cache) {
+    fprintf(stderr, "cache hits %llu of %llu stores %llu\n",
+            (unsigned long long)a.cache->hits, (unsigned long long)a.cache->probes,
+            (unsigned long long)a.cache->stores);
+    cache_close(a.cache);
+  }
+
+  if (in != stdin)
+    fclose(in);
+  if (out != stdout)
+    fclose(out);
+  for (size_t i = 0; i < a.size; ++i) {
+    pgn_game_free(&a.slots[i].game);
+    free(a.slots[i].plies);
+  }
+  free(workers);
+  free(a.slots);
+}
@@ -0,0 +1,284 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "batch.h"
+#include "cache.h"
+#include "evaluate.h"
+#include "movegen.h"
+#include "packed.h"
+#include "search.h"
+#include "tt.h"
+#include "stats.h"
+#include "trace.h"
+
+// The batch mode streams FEN/EPD records, or packed records from a .bin
+// file, through a pool of search threads. Records go into a ring of
+// slots: the main thread reads and parses into free slots and writes
+// finished slots back in input order, so memory stays bounded however long
+// the input is. With "cache FILE" every record is looked up in the
+// persistent analysis cache first and searched only if the cached result
+// does not satisfy the limits. A worker keeps its ordering tables from one
+// record to the next: clearing them would cost more than a shallow search.
+
+enum { LINE_LENGTH = 512, OUTPUT_LENGTH = 8192, SLOTS_PER_THREAD = 64 };
+
+enum { SLOT_FREE, SLOT_READY, SLOT_DONE };
+
+typedef struct {
+  char line[LINE_LENGTH];
+  char output[OUTPUT_LENGTH];
+  Position pos;
+  uint64_t nodes;
+  bool valid;
+  int state;
+} BatchSlot;
+
+typedef struct {
+  FILE *in;
+  bool packedInput;      // Records come from packed, not from in
+  PackedReader packed;
+  size_t packedNext;
+  BatchSlot *slots;
+  size_t size;
+  uint64_t read, next, written;
+  bool eof;
+  SearchLimits limits;
+  AnalysisCache *cache;
+  pthread_mutex_t mutex;
+  pthread_cond_t workCond, doneCond;
+} Batch;
+
+// format_result() appends the EPD analysis opcodes for a finished search:
+// acd (depth), acn (nodes), ce (centipawns) or dm (mate distance), pm
+// (predicted move) and pv. With MultiPV every line i is added as an
+// opcode "mpv<i> cp <score>|mate <moves> <pv>;".
+
+static void format_result(BatchSlot *slot, SearchInfo *si) {
+  char *out = slot->output, move[6];
+  int n = snprintf(out, OUTPUT_LENGTH, "%s%s acd %d; acn %llu;", slot->line,
+                   strchr(slot->line, ';') ? "" : " ;", si->depth,
+                   (unsigned long long)si->nodes);
+  if (abs(si->score) >= VALUE_MATE_IN_MAX_PLY)
+    n += snprintf(out + n, OUTPUT_LENGTH - n, " dm %d;", si->score > 0
+                  ? (VALUE_MATE - si->score + 1) / 2 : -(VALUE_MATE + si->score) / 2);
+  else
+    n += snprintf(out + n, OUTPUT_LENGTH - n, " ce %d;", to_cp(si->score));
+  if (si->pvlen) {
+    n += snprintf(out + n, OUTPUT_LENGTH - n, " pm %s; pv", move_str(si->pv[0], move));
+    for (int i = 0; i < si->pvlen && n < OUTPUT_LENGTH - 8; ++i)
+      n += snprintf(out + n, OUTPUT_LENGTH - n, " %s", move_str(si->pv[i], move));
+    n += snprintf(out + n, OUTPUT_LENGTH - n, ";");
+  }
+  for (int i = 0; si->lineCount > 1 && i < si->lineCount && n < OUTPUT_LENGTH - 32; ++i) {
+    RootMove *line = &si->lines[i];
+    n += snprintf(out + n, OUTPUT_LENGTH - n, " mpv%d", i + 1);
+    if (abs(line->score) >= VALUE_MATE_IN_MAX_PLY)
+      n += snprintf(out + n, OUTPUT_LENGTH - n, " mate %d", line->score > 0
+                    ? (VALUE_MATE - line->score + 1) / 2 : -(VALUE_MATE + line->score) / 2);
+    else
+      n += snprintf(out + n, OUTPUT_LENGTH - n, " cp %d", to_cp(line->score));
+    for (int j = 0; j < line->pvlen && n < OUTPUT_LENGTH - 8; ++j)
+      n += snprintf(out + n, OUTPUT_LENGTH - n, " %s", move_str(line->pv[j], move));
+    n += snprintf(out + n, OUTPUT_LENGTH - n, ";");
+  }
+}
+
+static void *batch_worker(void *arg) {
+  Batch *b = arg;
+  SearchInfo *si = search_new();
+
+  pthread_mutex_lock(&b->mutex);
+  while (true) {
+    while (b->next == b->read && !b->eof)
+      pthread_cond_wait(&b->workCond, &b->mutex);
+    if (b->next == b->read)
+      break;
+    BatchSlot *slot = &b->slots[b->next++ % b->size];
+    pthread_mutex_unlock(&b->mutex);
+
+    slot->nodes = 0;
+    if (slot->valid && cache_lookup(b->cache, &slot->pos, &b->limits, si))
+      format_result(slot, si);
+    else if (slot->valid) {
+      search_init(si, &slot->pos, &b->limits);
+      search_start(si);
+      slot->nodes = si->nodes;
+      cache_save(b->cache, &slot->pos, si);
+      format_result(slot, si);
+    }
+    else
+      snprintf(slot->output, OUTPUT_LENGTH, "# invalid: %s", slot->line);
+
+    pthread_mutex_lock(&b->mutex);
+    slot->state = SLOT_DONE;
+    pthread_cond_signal(&b->doneCond);
+  }
+  pthread_mutex_unlock(&b->mutex);
+  search_delete(si);
+  return NULL;
+}
+
+// read_record() reads the next record into the slot. Text input skips
+// empty and comment lines and strips the line terminator and the opcodes
+// that format_result() writes; overlong lines are marked invalid. Packed records are echoed as FEN in the output.
+
+static bool read_record(Batch *b, BatchSlot *slot) {
+  FILE *in = b->in;
+
+  if (b->packedInput) {
+    if (b->packedNext == b->packed.count)
+      return false;
+    slot->valid = unpack_position(&b->packed.data[b->packedNext++], &slot->pos);
+    if (slot->valid)
+      pos_fen(&slot->pos, slot->line);
+    else
+      strcpy(slot->line, "corrupt packed record");
+    return true;
+  }
+  while (fgets(slot->line, LINE_LENGTH, in)) {
+    size_t len = strcspn(slot->line, "\r\n");
+    bool overlong = slot->line[len] == '\0' && !feof(in);
+    slot->line[len] = '\0';
+    if (overlong) {
+      int c;
+      while ((c = fgetc(in)) != EOF && c != '\n') {}
+    }
+    if (!slot->line[0] || slot->line[0] == '#')
+      continue;
+    const char *ops = overlong ? NULL : parse_fen(&slot->pos, slot->line);
+    if ((slot->valid = ops))
+      epd_strip(slot->line, ops, "acd acn ce dm pm pv mpv#");
+    return true;
+  }
+  return false;
+}
+
+void batch_cmd(int argc, char **argv) {
+  const char *input = "-", *output = "-", *cachePath = NULL, *tracePath = NULL;
+  int threads = cpu_count(), cacheSize = 64;
+  AnalysisCache cache;
+  Batch b;
+
+  memset(&b, 0, sizeof(b));
+  for (int i = 0; i < argc; ++i) {
+    if (!strcmp(argv[i], "depth") && i + 1 < argc)
+      b.limits.depth = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "nodes") && i + 1 < argc)
+      b.limits.nodes = strtoull(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "movetime") && i + 1 < argc)
+      b.limits.movetime = atoll(argv[++i]);
+    else if (!strcmp(argv[i], "multipv") && i + 1 < argc)
+      b.limits.multiPV = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "threads") && i + 1 < argc)
+      threads = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "hash") && i + 1 < argc)
+      tt_resize(atoi(argv[++i]));
+    else if (!strcmp(argv[i], "output") && i + 1 < argc)
+      output = argv[++i];
+    else if (!strcmp(argv[i], "cache") && i + 1 < argc)
+      cachePath = argv[++i];
+    else if (!strcmp(argv[i], "cachesize") && i + 1 < argc)
+      cacheSize = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "trace") && i + 1 < argc)
+      tracePath = argv[++i];
+    else
+      input = argv[i];
+  }
+  if (!b.limits.depth && !b.limits.nodes && !b.limits.movetime)
+    b.limits.depth = 8;
+  if (threads < 1)
+    threads = 1;
+
+  size_t len = strlen(input);
+  bool packed = len > 4 && !strcmp(input + len - 4, ".bin");
+  FILE *in = packed ? NULL : strcmp(input, "-") ? fopen(input, "r") : stdin;
+  FILE *out = strcmp(output, "-") ? fopen(output, "w") : stdout;
+  if ((packed ? !packed_reader_open(&b.packed, input) : !in) || !out) {
+    fprintf(stderr, "batch: cannot open %s\n", out ? input : output);
+    exit(EXIT_FAILURE);
+  }
+  b.in = in;
+  b.packedInput = packed;
+  if (cachePath) {
+    if (!cache_open(&cache, cachePath, cacheSize))
+      exit(EXIT_FAILURE);
+    b.cache = &cache;
+  }
+
+  b.size = (size_t)threads * SLOTS_PER_THREAD;
+  b.slots = calloc(b.size, sizeof(BatchSlot));
+  pthread_mutex_init(&b.mutex, NULL);
+  pthread_cond_init(&b.workCond, NULL);
+  pthread_cond_init(&b.doneCond, NULL);
+
+  if (tracePath)
+    trace_start();
+  pthread_t *workers = malloc(threads * sizeof(pthread_t));
+  for (int i = 0; i < threads; ++i)
+    pthread_create(&workers[i], NULL, batch_worker, &b);
+
+  uint64_t invalid = 0, nodes = 0;
+  TimePoint start = now();
+
+  pthread_mutex_lock(&b.mutex);
+  while (!b.eof || b.written < b.read) {
+    // Flush finished records in input order
+    while (b.written < b.read && b.slots[b.written % b.size].state == SLOT_DONE) {
+      BatchSlot *slot = &b.slots[b.written++ % b.size];
+      fprintf(out, "%s\n", slot->output);
+      invalid += !slot->valid;
+      nodes += slot->nodes;
+      slot->state = SLOT_FREE;
+    }
+
+    if (!b.eof && b.read - b.written < b.size) {
+      BatchSlot *slot = &b.slots[b.read % b.size];
+      pthread_mutex_unlock(&b.mutex);
+      bool more = read_record(&b, slot);
+      pthread_mutex_lock(&b.mutex);
+      if (more) {
+        slot->state = SLOT_READY;
+        ++b.read;
+        pthread_cond_signal(&b.workCond);
+      }
+      else {
+        b.eof = true;
+        pthread_cond_broadcast(&b.workCond);
+      }
+    }
+    else if (b.written < b.read)
+      pthread_cond_wait(&b.doneCond, &b.mutex);
+  }
+  pthread_mutex_unlock(&b.mutex);
+
+  for (int i = 0; i < threads; ++i)
+    pthread_join(workers[i], NULL);
+
+  TimePoint elapsed = now() - start + 1;
+  fflush(out);
+  fprintf(stderr, "positions %llu invalid %llu threads %d time %lld ms"
+          " positions/sec %.1f nodes %llu nps %llu\n",
+          (unsigned long long)b.written, (unsigned long long)invalid, threads,
+          (long long)elapsed, b.written * 1000.0 / elapsed,
+          (unsigned long long)nodes, (unsigned long long)(nodes * 1000 / elapsed));
+  if (b.cache) {
+    fprintf(stderr, "cache hits %llu of %llu stores %llu\n",
+            (unsigned long long)b.cache->hits, (unsigned long long)b.cache->probes,
+            (unsigned long long)b.cache->stores);
+    cache_close(b.cache);
+  }
+  if (HasStats)
+    stats_report(stderr, false);
+  if (tracePath)
+    trace_dump(tracePath);
+
+  if (packed)
+    packed_reader_close(&b.packed);
+  else if (in != stdin)
+    fclose(in);
+  if (out != stdout)
+    fclose(out);
+  free(workers);
+  free(b.slots);
+}
@@ -0,0 +1,6 @@
+#ifndef BATCH_H_INCLUDED
+#define BATCH_H_INCLUDED
+
+void batch_cmd(int argc, char **argv);
+
+#endif
@@ -0,0 +1,478 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HasTsc 1
+#else
+#define HasTsc 0
+#define __rdtsc() 0
+#endif
+
+#include "benchmark.h"
+#include "misc.h"
+#include "movegen.h"
+#include "search.h"
+#include "trace.h"
+#include "tt.h"
+
+// BenchFens[] is the fixed corpus of positions used by the benchmarks:
+// openings, middlegames with tactics and pins, and endgames.
+
+const char *BenchFens[] = {
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+  "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10",
+  "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 11",
+  "4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+  "rq3rk1/ppp2ppp/1bnpb3/3N2B1/3NP3/7P/PPPQ1PP1/2KR3R w - - 7 14",
+  "r1bq1r1k/1pp1n1pp/1p1p4/4p2Q/4Pp2/1BNP4/PPP2PPP/3R1RK1 w - - 2 14",
+  "r3r1k1/2p2ppp/p1p1bn2/8/1q2P3/2NPQN2/PPP3PP/R4RK1 b - - 2 15",
+  "r1bbk1nr/pp3p1p/2n5/1N4p1/2Np1B2/8/PPP2PPP/2KR1B1R w kq - 0 13",
+  "r1bq1rk1/ppp1nppp/4n3/3p3Q/3P4/1BP1B3/PP1N2PP/R4RK1 w - - 1 16",
+  "4r1k1/r1q2ppp/ppp2n2/4P3/5Rb1/1N1BQ3/PPP3PP/R5K1 w - - 1 17",
+  "2rqkb1r/ppp2p2/2npb1p1/1N1Nn2p/2P1PP2/8/PP2B1PP/R1BQK2R b KQ - 0 11",
+  "r1bq1r1k/b1p1npp1/p2p3p/1p6/3PP3/1B2NN2/PP3PPP/R2Q1RK1 w - - 1 16",
+  "3r1rk1/p5pp/bpp1pp2/8/q1PP1P2/b3P3/P2NQRPP/1R2B1K1 b - - 6 22",
+  "r1q2rk1/2p1bppp/2Pp4/p6b/Q1PNp3/4B3/PP1R1PPP/2K4R w - - 2 18",
+  "4k2r/1pb2ppp/1p2p3/1R1p4/3P4/2r1PN2/P4PPP/1R4K1 b - - 3 22",
+  "3q2k1/pb3p1p/4pbp1/2r5/PpN2N2/1P2P2P/5PP1/Q2R2K1 b - - 4 26",
+  "6k1/6p1/6Pp/ppp5/3pn2P/1P3K2/1PP2P2/3N4 b - - 0 1",
+  "3b4/5kp1/1p1p1p1p/pP1PpP1P/P1P1P3/3KN3/8/8 w - - 0 1",
+  "2K5/p7/7P/5pR1/8/5k2/r7/8 w - - 0 1",
+  "8/6pk/1p6/8/PP3p1p/5P2/4KP1q/3Q4 w - - 0 1",
+  "7k/3p2pp/4q3/8/4Q3/5Kp1/P6b/8 w - - 0 1",
+  "8/2p5/8/2kPKp1p/2p4P/2P5/3P4/8 w - - 0 1",
+  "8/1p3pp1/7p/5P1P/2k3P1/8/2K2P2/8 w - - 0 1",
+  "8/pp2r1k1/2p1p3/3pP2p/1P1P1P1P/P5KR/8/8 w - - 0 1",
+  "5k2/7R/4P2p/5K2/p1r2P1p/8/8/8 b - - 0 1",
+  "6k1/6p1/P6p/r1N5/5p2/7P/1b3PP1/4R1K1 w - - 0 1",
+  "8/3k4/8/8/8/4B3/4KB2/2B5 w - - 0 1",
+  "8/8/1P6/5pr1/8/4R3/7k/2K5 w - - 0 1",
+  "8/2p4P/8/kr6/6R1/8/8/1K6 w - - 0 1",
+  "1r3k2/4q3/2Pp3b/3Bp3/2Q2p2/1p1P2P1/1P2KP2/3N4 w - - 0 1",
+};
+
+const int BenchFenCount = sizeof(BenchFens) / sizeof(BenchFens[0]);
+
+// bench_cmd() parses "bench [depth N] [multipv N] [trace FILE]" and
+// searches every corpus position to a fixed depth from cleared tables. The
+// total node count is the nodes-to-depth measure of search efficiency and
+// works as a signature of the search: any change to it is a functional
+// change.
+
+void bench_cmd(int argc, char **argv) {
+  SearchLimits limits = { .depth = 8 };
+  SearchInfo *si = search_new();
+  uint64_t nodes = 0;
+  const char *tracePath = NULL;
+  Position pos;
+
+  for (int i = 0; i + 1 < argc; i += 2)
+    if (!strcmp(argv[i], "depth"))
+      limits.depth = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "multipv"))
+      limits.multiPV = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "trace"))
+      tracePath = argv[i + 1];
+  if (tracePath)
+    trace_start();
+
+  TimePoint start = now();
+  for (int i = 0; i < BenchFenCount; ++i) {
+    parse_fen(&pos, BenchFens[i]);
+    tt_clear();
+    search_clear(si);
+    search_init(si, &pos, &limits);
+    search_start(si);
+    nodes += si->nodes;
+    fprintf(stderr, "Position %d/%d: %llu nodes\n", i + 1, BenchFenCount,
+            (unsigned long long)si->nodes);
+  }
+  TimePoint elapsed = now() - start + 1;
+
+  fprintf(stderr, "\n===========================\n"
+          "Total time (ms) : %lld\nNodes searched  : %llu\nNodes/second    : %llu\n",
+          (long long)elapsed, (unsigned long long)nodes,
+          (unsigned long long)(nodes * 1000 / elapsed));
+  if (tracePath)
+    trace_dump(tracePath);
+  search_delete(si);
+}
+
+// The microbenchmarks time the bitboard and move generation primitives
+// over the corpus. Each kernel makes one pass over the corpus and returns
+// the number of operations done; results go to a volatile sink so that
+// the compiler cannot drop the work.
+
+typedef uint64_t (KernelFn)(void);
+
+static Position Corpus[64];
+static Movelist CorpusMoves[64];
+static volatile uint64_t Sink;
+
+static uint64_t kernel_rook_attacks(void) {
+  Bitboard acc = 0;
+  for (int i = 0; i < BenchFenCount; ++i) {
+    Bitboard occ = pieces(&Corpus[i]);
+    for (Square s = 0; s < 64; ++s)
+      acc ^= attacks_bb_rook(s, occ);
+  }
+  Sink = acc;
+  return BenchFenCount * 64;
+}
+
+static uint64_t kernel_bishop_attacks(void) {
+  Bitboard acc = 0;
+  for (int i = 0; i < BenchFenCount; ++i) {
+    Bitboard occ = pieces(&Corpus[i]);
+    for (Square s = 0; s < 64; ++s)
+      acc ^= attacks_bb_bishop(s, occ);
+  }
+  Sink = acc;
+  return BenchFenCount * 64;
+}
+
+// The fill kernels time the table-free occluded fills for single squares,
+// whatever backend attacks_bb_*() uses, and for the union of the attacks
+// of all sliders of a side, which the tables can only produce one piece
+// at a time (slider_attacks_loop).
+
+static uint64_t kernel_rook_attacks_fill(void) {
+  Bitboard acc = 0;
+  for (int i = 0; i < BenchFenCount; ++i) {
+    Bitboard occ = pieces(&Corpus[i]);
+    for (Square s = 0; s < 64; ++s)
+      acc ^= rook_attacks_bb(sq_bb(s), occ);
+  }
+  Sink = acc;
+  return BenchFenCount * 64;
+}
+
+static uint64_t kernel_bishop_attacks_fill(void) {
+  Bitboard acc = 0;
+  for (int i = 0; i < BenchFenCount; ++i) {
+    Bitboard occ = pieces(&Corpus[i]);
+    for (Square s = 0; s < 64; ++s)
+      acc ^= bishop_attacks_bb(sq_bb(s), occ);
+  }
+  Sink = acc;
+  return BenchFenCount * 64;
+}
+
+static uint64_t kernel_slider_attacks_set(void) {
+  Bitboard acc = 0;
+  for (int i = 0; i < BenchFenCount; ++i) {
+    Position *pos = &Corpus[i];
+    for (int c = WHITE; c <= BLACK; ++c) {
+      Bitboard queens = pieces_cpt(pos, c, QUEEN);
+      acc ^= rook_attacks_bb(pieces_cpt(pos, c, ROOK) | queens, pieces(pos))
+           | bishop_attacks_bb(pieces_cpt(pos, c, BISHOP) | queens, pieces(pos));
+    }
+  }
+  Sink = acc;
+  return BenchFenCount * 2;
+}
+
+static uint64_t kernel_slider_attacks_loop(void) {
+  Bitboard acc = 0;
+  for (int i = 0; i < BenchFenCount; ++i) {
+    Position *pos = &Corpus[i];
+    for (int c = WHITE; c <= BLACK; ++c) {
+      Bitboard queens = pieces_cpt(pos, c, QUEEN), att = 0;
+      Bitboard b = pieces_cpt(pos, c, ROOK) | queens;
+      while (b)
+        att |= attacks_bb_rook(pop_lsb(&b), pieces(pos));
+      b = pieces_cpt(pos, c, BISHOP) | queens;
+      while (b)
+        att |= attacks_bb_bishop(pop_lsb(&b), pieces(pos));
+      acc ^= att;
+    }
+  }
+  Sink = acc;
+  return BenchFenCount * 2;
+}
+
+// The index kernels time the index computation alone: the multiply-shift
+// of magic bitboards, and PEXT when the build supports it. In a PEXT build
+// the magics are not searched, but the arithmetic costs the same.
+
+static uint64_t kernel_rook_index_magic(void) {
+  unsigned acc = 0;
+  for (int i = 0; i < BenchFenCount; ++i) {
+    Bitboard occ = pieces(&Corpus[i]);
+    for (Square s = 0; s < 64; ++s)
+      acc += (unsigned)(((occ & RookMasks[s]) * RookMagics[s]) >> RookShifts[s]);
+  }
+  Sink = acc;
+  return BenchFenCount * 64;
+}
+
+static uint64_t kernel_rook_index_pext(void) {
+  unsigned acc = 0;
+  for (int i = 0; i < BenchFenCount; ++i)
+    for (Square s = 0; s < 64; ++s)
+      acc += (unsigned)pext(pieces(&Corpus[i]), RookMasks[s]);
+  Sink = acc;
+  return BenchFenCount * 64;
+}
+
+static uint64_t kernel_bishop_index_magic(void) {
+  unsigned acc = 0;
+  for (int i = 0; i < BenchFenCount; ++i) {
+    Bitboard occ = pieces(&Corpus[i]);
+    for (Square s = 0; s < 64; ++s)
+      acc += (unsigned)(((occ & BishopMasks[s]) * BishopMagics[s]) >> BishopShifts[s]);
+  }
+  Sink = acc;
+  return BenchFenCount * 64;
+}
+
+static uint64_t kernel_bishop_index_pext(void) {
+  unsigned acc = 0;
+  for (int i = 0; i < BenchFenCount; ++i)
+    for (Square s = 0; s < 64; ++s)
+      acc += (unsigned)pext(pieces(&Corpus[i]), BishopMasks[s]);
+  Sink = acc;
+  return BenchFenCount * 64;
+}
+
+static uint64_t kernel_popcount(void) {
+  uint64_t acc = 0;
+  for (int i = 0; i < BenchFenCount; ++i)
+    for (int c = WHITE; c <= BLACK; ++c)
+      acc += popcount(Corpus[i].occupied[c]) + popcount(Corpus[i].pawns[c]);
+  Sink = acc;
+  return BenchFenCount * 4;
+}
+
+static uint64_t kernel_lsb(void) {
+  uint64_t acc = 0;
+  for (int i = 0; i < BenchFenCount; ++i)
+    for (int c = WHITE; c <= BLACK; ++c)
+      acc += lsb(Corpus[i].occupied[c]);
+  Sink = acc;
+  return BenchFenCount * 2;
+}
+
+static uint64_t kernel_pop_lsb(void) {
+  uint64_t acc = 0, ops = 0;
+  for (int i = 0; i < BenchFenCount; ++i) {
+    Bitboard b = pieces(&Corpus[i]);
+    while (b) {
+      acc += pop_lsb(&b);
+      ++ops;
+    }
+  }
+  Sink = acc;
+  return ops;
+}
+
+static uint64_t kernel_sq_attacked(void) {
+  uint64_t acc = 0;
+  for (int i = 0; i < BenchFenCount; ++i)
+    for (Square s = 0; s < 64; ++s)
+      acc += sq_attacked(&Corpus[i], s, !Corpus[i].side);
+  Sink = acc;
+  return BenchFenCount * 64;
+}
+
+static uint64_t kernel_sq_pinned(void) {
+  uint64_t acc = 0, ops = 0;
+  for (int i = 0; i < BenchFenCount; ++i) {
+    Bitboard b = Corpus[i].occupied[Corpus[i].side];
+    while (b) {
+      acc += sq_pinned(&Corpus[i], pop_lsb(&b), Corpus[i].side);
+      ++ops;
+    }
+  }
+  Sink = acc;
+  return ops;
+}
+
+static uint64_t kernel_generate_all_moves(void) {
+  Movelist list;
+  uint64_t acc = 0;
+  for (int i = 0; i < BenchFenCount; ++i) {
+    generate_all_moves(&Corpus[i], &list);
+    acc += list.count;
+  }
+  Sink = acc;
+  return BenchFenCount;
+}
+
+// do_move is timed together with the copy of the position, as the search
+// uses it (copy-make).
+
+static uint64_t kernel_do_move(void) {
+  uint64_t acc = 0, ops = 0;
+  for (int i = 0; i < BenchFenCount; ++i)
+    for (int j = 0; j < CorpusMoves[i].count; ++j) {
+      Position pos = Corpus[i];
+      do_move(&pos, CorpusMoves[i].moves[j].move);
+      acc += pos.key;
+      ++ops;
+    }
+  Sink = acc;
+  return ops;
+}
+
+static uint64_t kernel_update_key(void) {
+  uint64_t acc = 0;
+  for (int i = 0; i < BenchFenCount; ++i) {
+    update_key(&Corpus[i]);
+    acc += Corpus[i].key;
+  }
+  Sink = acc;
+  return BenchFenCount;
+}
+
+typedef struct {
+  const char *name;
+  KernelFn *fn;
+  bool enabled;
+} Kernel;
+
+static uint64_t elapsed_ns(struct timespec *t0, struct timespec *t1) {
+  return (t1->tv_sec - t0->tv_sec) * 1000000000ULL + t1->tv_nsec - t0->tv_nsec;
+}
+
+// evict_caches() walks a buffer larger than the last level cache so that
+// the next pass starts with cold tables.
+
+static void evict_caches(void) {
+  enum { EVICT_SIZE = 64 << 20 };
+  static uint8_t *buffer;
+  if (!buffer)
+    buffer = calloc(EVICT_SIZE, 1);
+  uint64_t acc = 0;
+  for (size_t i = 0; i < EVICT_SIZE; i += 64) {
+    buffer[i]++;
+    acc += buffer[i];
+  }
+  Sink = acc;
+}
+
+static int compare_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// run_kernel() takes 'samples' measurements of the kernel. A warm sample
+// repeats the pass until it lasts at least a millisecond; a cold sample is
+// a single pass after evicting the caches. It prints one record with the
+// median, mean, standard deviation and minimum of ns/op, and the median
+// of TSC cycles/op.
+
+static void run_kernel(Kernel *k, bool cold, int samples, bool json) {
+  double *ns = malloc(samples * sizeof(double));
+  double *cycles = malloc(samples * sizeof(double));
+  int passes = 1;
+  uint64_t ops = 0;
+
+  if (!cold) {
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    do {
+      for (int p = 0; p < passes; ++p)
+        k->fn();
+      clock_gettime(CLOCK_MONOTONIC, &t1);
+      passes *= 2;
+    } while (elapsed_ns(&t0, &t1) < 1000000);
+  }
+
+  for (int i = 0; i < samples; ++i) {
+    struct timespec t0, t1;
+    if (cold)
+      evict_caches();
+    ops = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    uint64_t c0 = __rdtsc();
+    for (int p = 0; p < passes; ++p)
+      ops += k->fn();
+    uint64_t c1 = __rdtsc();
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    ns[i] = (double)elapsed_ns(&t0, &t1) / ops;
+    cycles[i] = (double)(c1 - c0) / ops;
+  }
+
+  double mean = 0, var = 0;
+  for (int i = 0; i < samples; ++i)
+    mean += ns[i] / samples;
+  for (int i = 0; i < samples; ++i)
+    var += (ns[i] - mean) * (ns[i] - mean) / (samples > 1 ? samples - 1 : 1);
+  qsort(ns, samples, sizeof(double), compare_double);
+  qsort(cycles, samples, sizeof(double), compare_double);
+
+  if (json)
+    printf("{\"name\":\"%s\",\"cache\":\"%s\",\"samples\":%d,\"ops\":%llu,"
+           "\"ns_per_op\":%.3f,\"ns_mean\":%.3f,\"ns_stddev\":%.3f,\"ns_min\":%.3f,"
+           "\"cycles_per_op\":%.2f}\n",
+           k->name, cold ? "cold" : "warm", samples, (unsigned long long)ops,
+           ns[samples / 2], mean, sqrt(var), ns[0], HasTsc ? cycles[samples / 2] : 0.0);
+  else
+    printf("%-22s %-4s %10.3f %10.3f %10.3f %10.2f\n", k->name, cold ? "cold" : "warm",
+           ns[samples / 2], sqrt(var), ns[0], HasTsc ? cycles[samples / 2] : 0.0);
+  free(ns);
+  free(cycles);
+}
+
+// microbench_cmd() parses "microbench [samples N] [cache warm|cold|both]
+// [format json|text] [filter NAME]" and runs the kernels. JSON output has
+// one object per line.
+
+void microbench_cmd(int argc, char **argv) {
+  Kernel kernels[] = {
+    { "attacks_bb_rook",     kernel_rook_attacks,        true },
+    { "attacks_bb_bishop",   kernel_bishop_attacks,      true },
+    { "rook_attacks_fill",   kernel_rook_attacks_fill,   true },
+    { "bishop_attacks_fill", kernel_bishop_attacks_fill, true },
+    { "slider_attacks_set",  kernel_slider_attacks_set,  true },
+    { "slider_attacks_loop", kernel_slider_attacks_loop, true },
+    { "rook_index_magic",    kernel_rook_index_magic,    !HasFillAttacks },
+    { "rook_index_pext",     kernel_rook_index_pext,     HasPext && !HasFillAttacks },
+    { "bishop_index_magic",  kernel_bishop_index_magic,  !HasFillAttacks },
+    { "bishop_index_pext",   kernel_bishop_index_pext,   HasPext && !HasFillAttacks },
+    { "popcount",            kernel_popcount,            true },
+    { "lsb",                 kernel_lsb,                 true },
+    { "pop_lsb",             kernel_pop_lsb,             true },
+    { "sq_attacked",         kernel_sq_attacked,         true },
+    { "sq_pinned",           kernel_sq_pinned,           true },
+    { "generate_all_moves",  kernel_generate_all_moves,  true },
+    { "do_move",             kernel_do_move,             true },
+    { "update_key",          kernel_update_key,          true },
+  };
+  int samples = 25;
+  bool warm = true, cold = true, json = true;
+  const char *filter = NULL;
+
+  for (int i = 0; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "samples"))
+      samples = atoi(argv[i + 1]) > 0 ? atoi(argv[i + 1]) : 1;
+    else if (!strcmp(argv[i], "cache")) {
+      warm = strcmp(argv[i + 1], "cold");
+      cold = strcmp(argv[i + 1], "warm");
+    }
+    else if (!strcmp(argv[i], "format"))
+      json = strcmp(argv[i + 1], "text");
+    else if (!strcmp(argv[i], "filter"))
+      filter = argv[i + 1];
+  }
+
+  for (int i = 0; i < BenchFenCount; ++i) {
+    parse_fen(&Corpus[i], BenchFens[i]);
+    generate_all_moves(&Corpus[i], &CorpusMoves[i]);
+  }
+
+  if (!json)
+    printf("%-22s %-4s %10s %10s %10s %10s\n", "primitive", "", "ns/op",
+           "stddev", "min", "cycles/op");
+  for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i) {
+    if (!kernels[i].enabled || (filter && !strstr(kernels[i].name, filter)))
+      continue;
+    if (warm)
+      run_kernel(&kernels[i], false, samples, json);
+    if (cold)
+      run_kernel(&kernels[i], true, samples, json);
+  }
+}
@@ -0,0 +1,10 @@
+#ifndef BENCHMARK_H_INCLUDED
+#define BENCHMARK_H_INCLUDED
+
+extern const char *BenchFens[];
+extern const int BenchFenCount;
+
+void bench_cmd(int argc, char **argv);
+void microbench_cmd(int argc, char **argv);
+
+#endif
@@ -0,0 +1,109 @@
+#include <stdlib.h>
+
+#include "bitbase.h"
+#include "bitboard.h"
+
+// There are 24 possible pawn squares: files A-D and ranks 2-7. The index
+// packs the white king square in bits 0-5, the black king square in bits
+// 6-11, the side to move in bit 12, the pawn file in bits 13-14 and
+// RANK_7 - rank of the pawn in bits 15-17.
+
+enum { MAX_INDEX = 2 * 24 * 64 * 64 };
+
+static uint32_t KPKBitbase[MAX_INDEX / 32];
+
+// Results are flags, so that those of the children can be or-ed together.
+
+enum { INVALID = 0, UNKNOWN = 1, DRAW = 2, WIN = 4 };
+
+INLINE unsigned kpk_index(Color stm, Square bksq, Square wksq, Square psq) {
+  return wksq | (bksq << 6) | (stm << 12) | (file_of(psq) << 13) | ((RANK_7 - rank_of(psq)) << 15);
+}
+
+bool kpk_probe(Square wksq, Square wpsq, Square bksq, Color stm) {
+  assert(file_of(wpsq) <= FILE_D);
+
+  unsigned idx = kpk_index(stm, bksq, wksq, wpsq);
+  return KPKBitbase[idx / 32] & (1u << (idx & 31));
+}
+
+// kpk_init_result() classifies a position by the rules alone: illegal
+// positions, immediate promotions that cannot be stopped, and positions
+// where black can take the pawn or has no legal move. The rest is unknown.
+
+static uint8_t kpk_init_result(unsigned idx) {
+  Square wksq = idx & 0x3F, bksq = (idx >> 6) & 0x3F;
+  Color stm = (idx >> 12) & 1;
+  Square psq = make_square((idx >> 13) & 3, RANK_7 - ((idx >> 15) & 7));
+
+  if (   distance(wksq, bksq) <= 1
+      || wksq == psq || bksq == psq
+      || (stm == WHITE && (PawnAttacks[WHITE][psq] & SquareBB[bksq])))
+    return INVALID;
+
+  // White promotes without losing the queen at once
+  if (   stm == WHITE && rank_of(psq) == RANK_7
+      && wksq != psq + 8 && bksq != psq + 8
+      && (distance(bksq, psq + 8) > 1 || (PseudoAttacks[KING][wksq] & SquareBB[psq + 8])))
+    return WIN;
+
+  // Stalemate, or black takes an undefended pawn
+  if (   stm == BLACK
+      && (   !(PseudoAttacks[KING][bksq] & ~(PseudoAttacks[KING][wksq] | PawnAttacks[WHITE][psq]))
+          || (PseudoAttacks[KING][bksq] & ~PseudoAttacks[KING][wksq] & SquareBB[psq])))
+    return DRAW;
+
+  return UNKNOWN;
+}
+
+// kpk_classify() derives the result of a position from its children. White
+// to move wins if any child wins; black to move draws if any child draws.
+// A position stays unknown while a child is unknown.
+
+static uint8_t kpk_classify(const uint8_t *db, unsigned idx) {
+  Square wksq = idx & 0x3F, bksq = (idx >> 6) & 0x3F;
+  Color stm = (idx >> 12) & 1;
+  Square psq = make_square((idx >> 13) & 3, RANK_7 - ((idx >> 15) & 7));
+  uint8_t good = stm == WHITE ? WIN : DRAW, bad = stm == WHITE ? DRAW : WIN;
+  uint8_t r = INVALID;
+
+  Bitboard b = PseudoAttacks[KING][stm == WHITE ? wksq : bksq];
+  while (b) {
+    Square s = pop_lsb(&b);
+    r |= stm == WHITE ? db[kpk_index(BLACK, bksq, s, psq)]
+                      : db[kpk_index(WHITE, s, wksq, psq)];
+  }
+
+  if (stm == WHITE) {
+    // A push onto a king gives an invalid index, which adds nothing
+    if (rank_of(psq) < RANK_7)
+      r |= db[kpk_index(BLACK, bksq, wksq, psq + 8)];
+    if (rank_of(psq) == RANK_2 && psq + 8 != wksq && psq + 8 != bksq)
+      r |= db[kpk_index(BLACK, bksq, wksq, psq + 16)];
+  }
+
+  return r & good ? good : r & UNKNOWN ? UNKNOWN : bad;
+}
+
+// bitbase_init() classifies all positions by the rules, then iterates over
+// the unknown ones until none changes. Those left unknown are draws.
+
+void bitbase_init(void) {
+  uint8_t *db = malloc(MAX_INDEX);
+  bool repeat = true;
+
+  for (unsigned idx = 0; idx < MAX_INDEX; ++idx)
+    db[idx] = kpk_init_result(idx);
+
+  while (repeat) {
+    repeat = false;
+    for (unsigned idx = 0; idx < MAX_INDEX; ++idx)
+      if (db[idx] == UNKNOWN && (db[idx] = kpk_classify(db, idx)) != UNKNOWN)
+        repeat = true;
+  }
+
+  for (unsigned idx = 0; idx < MAX_INDEX; ++idx)
+    if (db[idx] == WIN)
+      KPKBitbase[idx / 32] |= 1u << (idx & 31);
+  free(db);
+}
@@ -0,0 +1,19 @@
+#ifndef BITBASE_H_INCLUDED
+#define BITBASE_H_INCLUDED
+
+#include "types.h"
+
+// The KPK bitbase holds one bit, win or draw, for every position of king
+// and pawn versus king with the pawn on files A-D: 2 sides to move x 24
+// pawn squares x 64 x 64 king squares = 196608 bits, 24 KB. It is built by
+// retrograde analysis in bitbase_init(), which needs the attack tables.
+
+void bitbase_init(void);
+
+// kpk_probe() returns true if the position with white king on wksq, white
+// pawn on wpsq, black king on bksq and stm to move is a win for white.
+// The pawn must be on files A-D; callers mirror the board otherwise.
+
+bool kpk_probe(Square wksq, Square wpsq, Square bksq, Color stm);
+
+#endif
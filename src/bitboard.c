@@ -1,6 +1,8 @@
 #include <stdio.h>
+#include <string.h>
 
 #include "bitboard.h"
+#include "misc.h"
 
 uint8_t SquareDistance[64][64];
 Bitboard SquareBB[64];
@@ -26,6 +28,9 @@ Bitboard  BishopMagics [64];
 Bitboard *BishopAttacks[64];
 uint8_t   BishopShifts [64];
 
+#ifndef USE_FILL_ATTACKS
+bool SliderFills;
+
 static Bitboard RookTable[0x19000];
 static Bitboard BishopTable[0x1480];
 
@@ -48,31 +53,6 @@ static Bitboard sliding_attack(int dirs[], Square sq, Bitboard occupied)
   return attack;
 }
 
-void prng_init(Bitboard *rng, uint64_t seed)
-{
-  *rng = seed;
-}
-
-Bitboard prng_rand(Bitboard *rng)
-{
-  Bitboard s = *rng;
-
-  s ^= s >> 12;
-  s ^= s << 25;
-  s ^= s >> 27;
-  *rng = s;
-
-  return s * 2685821657736338717LL;
-}
-
-Bitboard prng_sparse_rand(Bitboard *rng)
-{
-  Bitboard r1 = prng_rand(rng);
-  Bitboard r2 = prng_rand(rng);
-  Bitboard r3 = prng_rand(rng);
-  return r1 & r2 & r3;
-}
-
 typedef unsigned (Fn)(Square, Bitboard);
 
 static void init_magics(Bitboard table[], Bitboard *attacks[], Bitboard magics[], Bitboard masks[], uint8_t shifts[], int deltas[], Fn index) {
@@ -121,6 +101,26 @@ static void init_sliding_attacks(void)
   init_magics(RookTable, RookAttacks, RookMagics, RookMasks, RookShifts, RookDirs, magic_index_rook);
   init_magics(BishopTable, BishopAttacks, BishopMagics, BishopMasks, BishopShifts, BishopDirs, magic_index_bishop);
 }
+#endif
+
+// sliders_select() switches the slider attacks to the magic tables
+// ("magic") or to the occluded fills ("fill"). It returns false if the
+// name is unknown or the build has no magic tables.
+
+bool sliders_select(const char *name)
+{
+  bool fills = !strcmp(name, "fill");
+
+  if (!fills && strcmp(name, "magic"))
+    return false;
+
+#ifdef USE_FILL_ATTACKS
+  return fills;
+#else
+  SliderFills = fills;
+  return true;
+#endif
+}
 
 void bitboards_pretty(Bitboard b)
 {
@@ -184,7 +184,9 @@ void bitboards_init(void) {
           }
         }
 
+#ifndef USE_FILL_ATTACKS
   init_sliding_attacks();
+#endif
 
   for (Square s1 = 0; s1 < 64; s1++) {
     PseudoAttacks[QUEEN][s1] = PseudoAttacks[BISHOP][s1] = attacks_bb_bishop(s1, 0);
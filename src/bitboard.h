@@ -2,11 +2,16 @@
 #define BITBOARD_H_INCLUDED
 
 #include <assert.h>
+#ifdef USE_AVX2
+#include <immintrin.h>
+#endif
 
+#include "stats.h"
 #include "types.h"
 
 void bitboards_init();
 void bitboards_pretty(Bitboard b);
+bool sliders_select(const char *name);
 
 #define AllSquares   0xFFFFFFFFFFFFFFFFULL
 #define DarkSquares  0xAA55AA55AA55AA55ULL
@@ -59,11 +64,116 @@ extern uint8_t  BishopShifts[64];
 extern Bitboard *RookAttacks[64];
 extern Bitboard *BishopAttacks[64];
 
+// Slider attacks come either from the magic tables below or from the
+// table-free occluded fills. A USE_FILL_ATTACKS build always uses the
+// fills and does not allocate the tables; otherwise SliderFills selects
+// the backend at run time (see sliders_select()).
+
+#ifdef USE_FILL_ATTACKS
+#define SliderFills 1
+#else
+extern bool SliderFills;
+#endif
+
+// rook_attacks_bb() and bishop_attacks_bb() return the squares attacked
+// by a whole set of rooks or bishops. Each ray is grown through the empty
+// squares with a Kogge-Stone fill in three doubling steps and pushed one
+// more step onto the blocker; the wrap mask of a direction drops the
+// squares that a shift carries around the board edge.
+
+#ifdef USE_AVX2
+
+// With AVX2 the four directions fill side by side in the lanes of one
+// vector. Each lane shifts left and right by its own counts, and a count
+// of 64 or more clears the lane, so the positive and the negative
+// directions share the same instructions.
+
+INLINE __m256i fill_shift(__m256i b, __m256i left, __m256i right)
+{
+  return _mm256_or_si256(_mm256_sllv_epi64(b, left), _mm256_srlv_epi64(b, right));
+}
+
+INLINE Bitboard fill_attacks(Bitboard sliders, Bitboard occupied,
+                             __m256i left, __m256i right, __m256i wrap)
+{
+  __m256i gen = _mm256_set1_epi64x(sliders);
+  __m256i pro = _mm256_andnot_si256(_mm256_set1_epi64x(occupied), wrap);
+  __m256i l = left, r = right;
+
+  for (int i = 0; i < 2; i++) {
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, fill_shift(gen, l, r)));
+    pro = _mm256_and_si256(pro, fill_shift(pro, l, r));
+    l = _mm256_slli_epi64(l, 1);
+    r = _mm256_slli_epi64(r, 1);
+  }
+  gen = _mm256_or_si256(gen, _mm256_and_si256(pro, fill_shift(gen, l, r)));
+  gen = _mm256_and_si256(fill_shift(gen, left, right), wrap);
+
+  __m128i x = _mm_or_si128(_mm256_castsi256_si128(gen), _mm256_extracti128_si256(gen, 1));
+  return (Bitboard)_mm_cvtsi128_si64(_mm_or_si128(x, _mm_unpackhi_epi64(x, x)));
+}
+
+INLINE Bitboard rook_attacks_bb(Bitboard rooks, Bitboard occupied)
+{
+  return fill_attacks(rooks, occupied,
+                      _mm256_setr_epi64x(8, 1, 64, 64),
+                      _mm256_setr_epi64x(64, 64, 8, 1),
+                      _mm256_setr_epi64x(AllSquares, ~FileABB, AllSquares, ~FileHBB));
+}
+
+INLINE Bitboard bishop_attacks_bb(Bitboard bishops, Bitboard occupied)
+{
+  return fill_attacks(bishops, occupied,
+                      _mm256_setr_epi64x(9, 7, 64, 64),
+                      _mm256_setr_epi64x(64, 64, 7, 9),
+                      _mm256_setr_epi64x(~FileABB, ~FileHBB, ~FileABB, ~FileHBB));
+}
+
+#else
+
+INLINE Bitboard fill_step(Bitboard b, int d)
+{
+  return d > 0 ? b << d : b >> -d;
+}
+
+INLINE Bitboard fill_ray(Bitboard gen, Bitboard occupied, int d, Bitboard wrap)
+{
+  Bitboard pro = ~occupied & wrap;
+
+  gen |= pro & fill_step(gen, d);
+  pro &= fill_step(pro, d);
+  gen |= pro & fill_step(gen, 2 * d);
+  pro &= fill_step(pro, 2 * d);
+  gen |= pro & fill_step(gen, 4 * d);
+  return fill_step(gen, d) & wrap;
+}
+
+INLINE Bitboard rook_attacks_bb(Bitboard rooks, Bitboard occupied)
+{
+  return  fill_ray(rooks, occupied,  8, AllSquares)
+        | fill_ray(rooks, occupied,  1, ~FileABB)
+        | fill_ray(rooks, occupied, -8, AllSquares)
+        | fill_ray(rooks, occupied, -1, ~FileHBB);
+}
+
+INLINE Bitboard bishop_attacks_bb(Bitboard bishops, Bitboard occupied)
+{
+  return  fill_ray(bishops, occupied,  9, ~FileABB)
+        | fill_ray(bishops, occupied,  7, ~FileHBB)
+        | fill_ray(bishops, occupied, -7, ~FileABB)
+        | fill_ray(bishops, occupied, -9, ~FileHBB);
+}
+
+#endif
+
 // attacks_bb() returns a bitboard representing all the squares attacked
 // by a // piece of type Pt (bishop or rook) placed on 's'. The helper magic_index() looks up the index using the 'magic bitboards' approach.
 
 INLINE unsigned magic_index_bishop(Square s, Bitboard occupied)
 {
+  if (HasPext)
+      return (unsigned)pext(occupied, BishopMasks[s]);
+
   if (Is64Bit)
       return (unsigned)(((occupied & BishopMasks[s]) * BishopMagics[s])
                            >> BishopShifts[s]);
@@ -75,6 +185,9 @@ INLINE unsigned magic_index_bishop(Square s, Bitboard occupied)
 
 INLINE unsigned magic_index_rook(Square s, Bitboard occupied)
 {
+  if (HasPext)
+      return (unsigned)pext(occupied, RookMasks[s]);
+
   if (Is64Bit)
       return (unsigned)(((occupied & RookMasks[s]) * RookMagics[s])
                            >> RookShifts[s]);
@@ -86,11 +199,17 @@ INLINE unsigned magic_index_rook(Square s, Bitboard occupied)
 
 INLINE Bitboard attacks_bb_bishop(int s, Bitboard occupied)
 {
+  stats_inc(STAT_MAGIC_LOOKUP);
+  if (SliderFills)
+    return bishop_attacks_bb(SquareBB[s], occupied);
   return BishopAttacks[s][magic_index_bishop(s, occupied)];
 }
 
 INLINE Bitboard attacks_bb_rook(int s, Bitboard occupied)
 {
+  stats_inc(STAT_MAGIC_LOOKUP);
+  if (SliderFills)
+    return rook_attacks_bb(SquareBB[s], occupied);
   return RookAttacks[s][magic_index_rook(s, occupied)];
 }
 
@@ -159,6 +278,32 @@ INLINE Bitboard shift_bb(int Direction, Bitboard b)
 }
 
 
+// north_fill() and south_fill() smear the bits of a bitboard towards the
+// 8th and the 1st rank respectively.
+
+INLINE Bitboard north_fill(Bitboard b)
+{
+  b |= b << 8;
+  b |= b << 16;
+  return b | b << 32;
+}
+
+INLINE Bitboard south_fill(Bitboard b)
+{
+  b |= b >> 8;
+  b |= b >> 16;
+  return b | b >> 32;
+}
+
+
+// flip_bb() mirrors a bitboard vertically, mapping square s to s ^ 56.
+
+INLINE Bitboard flip_bb(Bitboard b)
+{
+  return __builtin_bswap64(b);
+}
+
+
 // pawn_attacks_bb() returns the squares attacked by pawns of the given color
 // from the squares in the given bitboard.
 
@@ -0,0 +1,305 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+
+// The file starts with a page holding the header, followed by the buckets,
+// so that the table is page aligned in the mapping.
+
+enum { CACHE_HEADER_SIZE = 4096, CACHE_VERSION = 1 };
+
+static const char CacheMagic[8] = "CATACCH";
+
+// mix() is the splitmix64 finalizer, used for the entry checksum and the
+// key signature.
+
+INLINE uint64_t mix(uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+INLINE uint64_t slot_check(uint64_t key, uint64_t data, uint64_t nodes) {
+  return mix(key ^ mix(data ^ mix(nodes + 0x9E3779B97F4A7C15ULL)));
+}
+
+INLINE uint64_t pack_data(const CacheEntry *e) {
+  return (uint16_t)e->move | (uint64_t)(uint16_t)e->score << 16
+       | (uint64_t)(uint8_t)e->depth << 32;
+}
+
+INLINE int data_depth(uint64_t data) { return (data >> 32) & 0xFF; }
+
+// key_signature() folds all Zobrist keys into one number. A file written
+// by a build with other keys has another signature and is rejected.
+
+static uint64_t key_signature(void) {
+  uint64_t sig = mix(SideKey);
+  for (int pc = 0; pc < 16; ++pc)
+    for (int s = 0; s < 64; ++s)
+      sig = mix(sig ^ PieceKeys[pc][s]);
+  for (int i = 0; i < 16; ++i)
+    sig = mix(sig ^ CastleKeys[i]);
+  for (int s = 0; s < 64; ++s)
+    sig = mix(sig ^ PassantKeys[s]);
+  return sig;
+}
+
+INLINE CacheBucket *cache_bucket(AnalysisCache *c, Key key) {
+  return &c->table[((uint32_t)key * (uint64_t)c->bucketCount) >> 32];
+}
+
+// read_slot() copies a slot and returns false if it is empty or fails the
+// checksum, i.e. if it was torn by a concurrent or interrupted store.
+
+static bool read_slot(CacheSlot *s, uint64_t *key, uint64_t *data, uint64_t *nodes) {
+  uint64_t check = atomic_load_explicit(&s->check, memory_order_acquire);
+  *key = atomic_load_explicit(&s->key, memory_order_relaxed);
+  *data = atomic_load_explicit(&s->data, memory_order_relaxed);
+  *nodes = atomic_load_explicit(&s->nodes, memory_order_relaxed);
+  return data_depth(*data) && check == slot_check(*key, *data, *nodes);
+}
+
+// create_file() builds an empty cache under a temporary name and links it
+// into place. If another process created the file meanwhile, its file wins
+// and ours is discarded.
+
+static bool create_file(const char *path, size_t mbSize) {
+  char tmp[4096];
+  CacheHeader h;
+
+  if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp))
+    return false;
+  int fd = mkstemp(tmp);
+  if (fd < 0)
+    return false;
+  fchmod(fd, 0644);
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, CacheMagic, sizeof(h.magic));
+  h.version = CACHE_VERSION;
+  h.entrySize = sizeof(CacheSlot);
+  h.bucketCount = mbSize * 1024 * 1024 / sizeof(CacheBucket);
+  h.keySignature = key_signature();
+  if (!h.bucketCount)
+    h.bucketCount = 1;
+
+  bool ok = !ftruncate(fd, CACHE_HEADER_SIZE + h.bucketCount * sizeof(CacheBucket))
+         && pwrite(fd, &h, sizeof(h), 0) == sizeof(h)
+         && !fsync(fd)
+         && (!link(tmp, path) || errno == EEXIST);
+  close(fd);
+  unlink(tmp);
+  return ok;
+}
+
+// cache_open() maps the cache at path, creating it with mbSize megabytes
+// if it does not exist; an existing file keeps its size. A file that can
+// only be read is mapped read-only and stores to it are ignored.
+
+bool cache_open(AnalysisCache *c, const char *path, size_t mbSize) {
+  struct stat st;
+  CacheHeader h;
+
+  memset(c, 0, sizeof(*c));
+  int fd = open(path, O_RDWR);
+  if (fd < 0 && errno == ENOENT && create_file(path, mbSize))
+    fd = open(path, O_RDWR);
+  if (fd < 0 && (errno == EACCES || errno == EROFS)) {
+    fd = open(path, O_RDONLY);
+    c->readOnly = true;
+  }
+  if (fd < 0) {
+    fprintf(stderr, "cache: cannot open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  if (   fstat(fd, &st)
+      || pread(fd, &h, sizeof(h), 0) != sizeof(h)
+      || memcmp(h.magic, CacheMagic, sizeof(h.magic))
+      || h.version != CACHE_VERSION
+      || h.entrySize != sizeof(CacheSlot)
+      || !h.bucketCount
+      || (uint64_t)st.st_size != CACHE_HEADER_SIZE + h.bucketCount * sizeof(CacheBucket)) {
+    fprintf(stderr, "cache: %s is not an analysis cache\n", path);
+    close(fd);
+    return false;
+  }
+  if (h.keySignature != key_signature()) {
+    fprintf(stderr, "cache: %s was written with other position keys\n", path);
+    close(fd);
+    return false;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ | (c->readOnly ? 0 : PROT_WRITE),
+                   MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "cache: cannot map %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  madvise(map, st.st_size, MADV_RANDOM);
+  c->table = (CacheBucket *)((char *)map + CACHE_HEADER_SIZE);
+  c->bucketCount = h.bucketCount;
+  c->mapSize = st.st_size;
+  return true;
+}
+
+// cache_close() flushes the stores to disk and unmaps the file. The data
+// is in the page cache as soon as it is stored, so a crashed process loses
+// nothing; the flush guards against a crash of the machine.
+
+void cache_close(AnalysisCache *c) {
+  if (!c->table)
+    return;
+  void *map = (char *)c->table - CACHE_HEADER_SIZE;
+  if (!c->readOnly)
+    msync(map, c->mapSize, MS_SYNC);
+  munmap(map, c->mapSize);
+  c->table = NULL;
+}
+
+bool cache_probe(AnalysisCache *c, Key key, CacheEntry *e) {
+  CacheBucket *b = cache_bucket(c, key);
+  uint64_t k, data, nodes;
+
+  for (int i = 0; i < CACHE_BUCKET_SIZE; ++i)
+    if (read_slot(&b->slot[i], &k, &data, &nodes) && k == key) {
+      e->move = (Move)(uint16_t)data;
+      e->score = (int16_t)(data >> 16);
+      e->depth = data_depth(data);
+      e->nodes = nodes;
+      return true;
+    }
+  return false;
+}
+
+// cache_store() saves an entry unless the slot of the key holds a deeper
+// result already. Otherwise a torn or empty slot is taken first, then the
+// shallowest one.
+
+void cache_store(AnalysisCache *c, Key key, const CacheEntry *e) {
+  CacheBucket *b = cache_bucket(c, key);
+  CacheSlot *replace = NULL;
+  int replaceDepth = 256;
+  uint64_t k, data, nodes;
+
+  if (c->readOnly || e->depth < 1)
+    return;
+  for (int i = 0; i < CACHE_BUCKET_SIZE; ++i) {
+    CacheSlot *s = &b->slot[i];
+    if (!read_slot(s, &k, &data, &nodes)) {
+      if (replaceDepth > 0)
+        replace = s, replaceDepth = 0;
+      continue;
+    }
+    if (k == key) {
+      if (data_depth(data) > e->depth || (data_depth(data) == e->depth && nodes >= e->nodes))
+        return;
+      replace = s;
+      break;
+    }
+    if (data_depth(data) < replaceDepth)
+      replace = s, replaceDepth = data_depth(data);
+  }
+
+  data = pack_data(e);
+  atomic_store_explicit(&replace->key, key, memory_order_relaxed);
+  atomic_store_explicit(&replace->data, data, memory_order_relaxed);
+  atomic_store_explicit(&replace->nodes, e->nodes, memory_order_relaxed);
+  atomic_store_explicit(&replace->check, slot_check(key, data, e->nodes), memory_order_release);
+  atomic_fetch_add_explicit(&c->stores, 1, memory_order_relaxed);
+}
+
+// cache_lookup() answers a root search from the cache if the cached result
+// satisfies the limits: it is at least as deep as a depth limit, or, for a
+// search limited by nodes only, it took at least as many nodes. Time
+// limited and MultiPV searches always search. On a hit si holds the result
+// as if search_start() had found it, with the best move as the PV.
+
+bool cache_lookup(AnalysisCache *c, Position *pos, const SearchLimits *limits, SearchInfo *si) {
+  ExtMove list[MAX_MOVES], *m = list;
+  CacheEntry e;
+
+  if (!c || limits->multiPV > 1)
+    return false;
+  atomic_fetch_add_explicit(&c->probes, 1, memory_order_relaxed);
+  if (!cache_probe(c, pos->key, &e))
+    return false;
+  if (limits->depth ? e.depth < limits->depth : !limits->nodes || e.nodes < limits->nodes)
+    return false;
+
+  // A different position with the same key would come with a move that is
+  // most likely illegal here
+  ExtMove *end = generate_moves(pos, list);
+  while (m < end && m->move != e.move)
+    ++m;
+  if (m == end)
+    return false;
+
+  si->depth = e.depth;
+  si->score = e.score;
+  si->nodes = e.nodes;
+  si->pvlen = 1;
+  si->pv[0] = e.move;
+  si->lineCount = 0;
+  atomic_fetch_add_explicit(&c->hits, 1, memory_order_relaxed);
+  return true;
+}
+
+// cache_save() stores the result of a finished root search.
+
+void cache_save(AnalysisCache *c, Position *pos, const SearchInfo *si) {
+  if (!c || !si->pvlen || si->depth < 1)
+    return;
+  CacheEntry e = { si->pv[0], si->score, si->depth < 255 ? si->depth : 255, si->nodes };
+  cache_store(c, pos->key, &e);
+}
+
+// cache_cmd() parses "cache <file> [size MB]" and prints the statistics of
+// the cache, creating it if it does not exist.
+
+void cache_cmd(int argc, char **argv) {
+  AnalysisCache c;
+  size_t mbSize = 64;
+  uint64_t used = 0, torn = 0, nodes = 0, depths[256] = { 0 };
+
+  for (int i = 1; i + 1 < argc; i += 2)
+    if (!strcmp(argv[i], "size"))
+      mbSize = atoi(argv[i + 1]);
+  if (argc < 1) {
+    fprintf(stderr, "Usage: cache <file> [size MB]\n");
+    exit(EXIT_FAILURE);
+  }
+  if (!cache_open(&c, argv[0], mbSize))
+    exit(EXIT_FAILURE);
+
+  for (size_t i = 0; i < c.bucketCount; ++i)
+    for (int j = 0; j < CACHE_BUCKET_SIZE; ++j) {
+      CacheSlot *s = &c.table[i].slot[j];
+      uint64_t k, data, n;
+      if (read_slot(s, &k, &data, &n)) {
+        used++;
+        nodes += n;
+        depths[data_depth(data)]++;
+      }
+      else if (atomic_load_explicit(&s->check, memory_order_relaxed))
+        torn++;
+    }
+
+  printf("entries %llu used %llu torn %llu size %zu MB%s\n",
+         (unsigned long long)(c.bucketCount * CACHE_BUCKET_SIZE),
+         (unsigned long long)used, (unsigned long long)torn,
+         c.mapSize / (1024 * 1024), c.readOnly ? " (read-only)" : "");
+  if (used)
+    printf("average nodes %llu\n", (unsigned long long)(nodes / used));
+  for (int d = 1; d < 256; ++d)
+    if (depths[d])
+      printf("depth %3d: %llu\n", d, (unsigned long long)depths[d]);
+  cache_close(&c);
+}
@@ -0,0 +1,71 @@
+#ifndef CACHE_H_INCLUDED
+#define CACHE_H_INCLUDED
+
+#include <stdatomic.h>
+
+#include "search.h"
+
+// The analysis cache keeps finished root searches in a file that outlives
+// the process: a memory-mapped table of 32 byte entries in buckets of two,
+// addressed by the Zobrist key. Batch runs and the server look a position
+// up before searching it and store a result when it is deeper than the
+// one already there.
+//
+// Any number of processes may map the same file. Entries are written
+// without locks as four 64-bit words, the last of which is a checksum of
+// the other three; a reader recomputes it and treats a mismatch as a miss.
+// Concurrent writers, a reader racing a writer and a process killed in the
+// middle of a store all leave at worst an entry that fails the check, and
+// the next store overwrites it. A new file is built under a temporary
+// name and renamed into place, so a half-initialized file is never seen.
+//
+// The key ignores the game history, so a cached result is the analysis of
+// the position as if it had no history.
+
+enum { CACHE_BUCKET_SIZE = 2 };
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t entrySize;
+  uint64_t bucketCount;
+  uint64_t keySignature;   // Detects files written with other Zobrist keys
+} CacheHeader;
+
+typedef struct {
+  _Atomic uint64_t key;
+  _Atomic uint64_t data;   // move 16, score 16, depth 8 bits
+  _Atomic uint64_t nodes;
+  _Atomic uint64_t check;
+} CacheSlot;
+
+typedef struct {
+  CacheSlot slot[CACHE_BUCKET_SIZE];
+} CacheBucket;
+
+_Static_assert(sizeof(CacheBucket) == 64, "CacheBucket must be 64 bytes");
+
+typedef struct {
+  Move move;
+  Value score;
+  int depth;
+  uint64_t nodes;
+} CacheEntry;
+
+typedef struct {
+  CacheBucket *table;
+  size_t bucketCount;
+  size_t mapSize;
+  bool readOnly;
+  _Atomic uint64_t probes, hits, stores;
+} AnalysisCache;
+
+bool cache_open(AnalysisCache *c, const char *path, size_t mbSize);
+void cache_close(AnalysisCache *c);
+bool cache_probe(AnalysisCache *c, Key key, CacheEntry *e);
+void cache_store(AnalysisCache *c, Key key, const CacheEntry *e);
+bool cache_lookup(AnalysisCache *c, Position *pos, const SearchLimits *limits, SearchInfo *si);
+void cache_save(AnalysisCache *c, Position *pos, const SearchInfo *si);
+void cache_cmd(int argc, char **argv);
+
+#endif
@@ -0,0 +1,636 @@
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "cluster.h"
+#include "evaluate.h"
+#include "misc.h"
+#include "search.h"
+#include "tt.h"
+
+// The processes form a star around rank 0 and exchange binary messages,
+// each a header and a payload of the given length:
+//
+//   START  rank 0 -> worker  position, rank and root moves to search
+//   STOP   rank 0 -> worker  end the search, answered by DONE
+//   DONE   worker -> rank 0  nodes searched
+//   TT     any -> any        a batch of transposition table results
+//   INFO   worker -> rank 0  best line of a completed iteration
+//   QUIT   rank 0 -> worker  exit
+//
+// Rank 0 relays the TT batches of every worker to the others. A process
+// only ever writes to a socket from its message thread, without blocking:
+// messages queue in the output buffer of the link, and TT batches are
+// dropped while it is full, so that two processes that send to each other
+// at once cannot block each other.
+
+enum { MSG_START, MSG_STOP, MSG_DONE, MSG_TT, MSG_INFO, MSG_QUIT };
+
+enum {
+  MAX_WORKERS = 64, SHARE_BATCH = 128, DEFAULT_SHARE_DEPTH = 4,
+  INPUT_SIZE = 1 << 16, OUTPUT_LIMIT = 1 << 20
+};
+
+typedef struct {
+  uint32_t type, length;
+} MsgHeader;
+
+typedef struct {
+  uint64_t key;
+  int16_t value;
+  uint16_t move;
+  int16_t depth;
+  uint8_t bound;
+  uint8_t pad;
+} SharedEntry;
+
+_Static_assert(sizeof(SharedEntry) == 16, "SharedEntry must be 16 bytes");
+
+typedef struct {
+  char fen[128];
+  int32_t rank;
+  int32_t count;         // Root moves to search, all if 0
+  uint16_t moves[MAX_MOVES];
+} StartMsg;
+
+typedef struct {
+  int32_t rank, depth, score, pvlen;
+  uint64_t nodes;
+  uint16_t pv[MAX_PLY + 1];
+} InfoMsg;
+
+typedef struct {
+  uint64_t nodes;
+} DoneMsg;
+
+typedef struct {
+  int fd;
+  pthread_mutex_t mutex;
+  char *out;             // Queued output, written as the socket takes it
+  size_t outLength, outSize;
+  char in[INPUT_SIZE];   // Input up to the last complete message
+  size_t inLength;
+} Link;
+
+// ClusterState is the state of the process. The search thread fills the share
+// batch and quit is atomic; everything else that is shared is under the
+// mutex.
+
+typedef struct {
+  int rank;
+  Link *links[MAX_WORKERS];   // Of the workers on rank 0, of rank 0 on a worker
+  int linkCount;
+  bool quit, lost;
+  pthread_mutex_t mutex;
+  pthread_cond_t doneCond;
+
+  SearchInfo *si;
+  Key rootKey;
+  pthread_t searchThread;
+  bool searching;
+
+  SharedEntry batch[SHARE_BATCH];
+  int batchCount;
+  TimePoint batchTime;
+
+  int done;              // Workers that answered STOP
+  uint64_t workerNodes;
+  InfoMsg hint;          // Deepest best line of a worker, depth 0 if none
+  uint64_t sent, received, dropped;
+} ClusterState;
+
+static ClusterState State;
+
+static Link *link_new(int fd) {
+  Link *l = calloc(1, sizeof(Link));
+  l->fd = fd;
+  pthread_mutex_init(&l->mutex, NULL);
+  return l;
+}
+
+// link_queue() appends a message to the output of a link. A droppable
+// message is dropped if the output is over its limit; it returns false
+// then.
+
+static bool link_queue(Link *l, int type, const void *data, size_t length, bool droppable) {
+  MsgHeader h = { type, length };
+
+  pthread_mutex_lock(&l->mutex);
+  if (droppable && l->outLength + sizeof(h) + length > OUTPUT_LIMIT) {
+    __atomic_fetch_add(&State.dropped, length / sizeof(SharedEntry), __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&l->mutex);
+    return false;
+  }
+  if (l->outLength + sizeof(h) + length > l->outSize) {
+    l->outSize = 2 * (l->outLength + sizeof(h) + length);
+    l->out = realloc(l->out, l->outSize);
+  }
+  memcpy(l->out + l->outLength, &h, sizeof(h));
+  memcpy(l->out + l->outLength + sizeof(h), data, length);
+  l->outLength += sizeof(h) + length;
+  pthread_mutex_unlock(&l->mutex);
+  return true;
+}
+
+// link_pending() returns the length of the queued output.
+
+static size_t link_pending(Link *l) {
+  pthread_mutex_lock(&l->mutex);
+  size_t n = l->outLength;
+  pthread_mutex_unlock(&l->mutex);
+  return n;
+}
+
+// link_flush() writes as much of the output as the socket takes and
+// returns false if the connection is broken.
+
+static bool link_flush(Link *l) {
+  bool ok = true;
+
+  pthread_mutex_lock(&l->mutex);
+  if (l->outLength) {
+    ssize_t n = send(l->fd, l->out, l->outLength, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n > 0) {
+      memmove(l->out, l->out + n, l->outLength - n);
+      l->outLength -= n;
+    }
+    ok = n >= 0 || errno == EAGAIN || errno == EWOULDBLOCK;
+  }
+  pthread_mutex_unlock(&l->mutex);
+  return ok;
+}
+
+static void handle_message(Link *from, MsgHeader *h, char *payload);
+
+// link_receive() reads what the socket has and handles every complete
+// message. It returns false if the connection is closed or broken.
+
+static bool link_receive(Link *l) {
+  ssize_t n = recv(l->fd, l->in + l->inLength, INPUT_SIZE - l->inLength, 0);
+  size_t used = 0;
+  MsgHeader h;
+
+  if (n <= 0)
+    return false;
+  l->inLength += n;
+  while (l->inLength - used >= sizeof(h)) {
+    memcpy(&h, l->in + used, sizeof(h));
+    if (h.length > INPUT_SIZE - sizeof(h))
+      return false;
+    if (l->inLength - used < sizeof(h) + h.length)
+      break;
+    handle_message(l, &h, l->in + used + sizeof(h));
+    used += sizeof(h) + h.length;
+  }
+  memmove(l->in, l->in + used, l->inLength - used);
+  l->inLength -= used;
+  return true;
+}
+
+// share_entry() is the TT share hook: results go out in batches, at least
+// every 2 ms. The root is left out, since workers search only some of its
+// moves. Entries count as sent once for every link that queued them.
+
+static void flush_batch(void) {
+  for (int i = 0; i < State.linkCount && State.batchCount; ++i)
+    if (link_queue(State.links[i], MSG_TT, State.batch, State.batchCount * sizeof(SharedEntry), true))
+      State.sent += State.batchCount;
+  State.batchCount = 0;
+  State.batchTime = now();
+}
+
+static void share_entry(Key key, Value v, int bound, Depth d, Move m) {
+  if (key == State.rootKey)
+    return;
+  State.batch[State.batchCount++] = (SharedEntry){ key, v, m, d, bound, 0 };
+  if (State.batchCount == SHARE_BATCH || now() - State.batchTime >= 2)
+    flush_batch();
+}
+
+// report_worker() sends the best line of every iteration of a worker to
+// rank 0.
+
+static void report_worker(SearchInfo *si, void *data) {
+  (void)data;
+  InfoMsg info = { State.rank, si->depth, si->score, si->pvlen, si->nodes, { 0 } };
+  for (int i = 0; i < si->pvlen; ++i)
+    info.pv[i] = si->pv[i];
+  link_queue(State.links[0], MSG_INFO, &info, sizeof(info), false);
+}
+
+static void *search_thread(void *arg) {
+  (void)arg;
+  search_start(State.si);
+  return NULL;
+}
+
+// start_worker() starts the search of a worker on its share of the root
+// moves, or all of them if none of its share is legal.
+
+static void start_worker(StartMsg *msg) {
+  Position pos;
+  SearchLimits limits = { 0 };
+  SearchInfo *si = State.si;
+
+  if (!parse_fen(&pos, msg->fen))
+    return;
+  State.rank = msg->rank;
+  State.rootKey = pos.key;
+  search_init(si, &pos, &limits);
+  int count = 0;
+  for (int i = 0; i < si->rootCount; ++i)
+    for (int j = 0; j < msg->count; ++j)
+      if (si->rootMoves[i].move == msg->moves[j])
+        si->rootMoves[count++] = si->rootMoves[i];
+  if (count)
+    si->rootCount = count;
+  si->report = report_worker;
+  State.searching = true;
+  pthread_create(&State.searchThread, NULL, search_thread, NULL);
+}
+
+static void stop_worker(void) {
+  DoneMsg done = { 0 };
+
+  if (State.searching) {
+    search_stop(State.si);
+    pthread_join(State.searchThread, NULL);
+    State.searching = false;
+    flush_batch();
+    done.nodes = State.si->nodes;
+  }
+  link_queue(State.links[0], MSG_DONE, &done, sizeof(done), false);
+}
+
+static void handle_message(Link *from, MsgHeader *h, char *payload) {
+  if (h->type == MSG_TT) {
+    SharedEntry *e = (SharedEntry *)payload;
+    int count = h->length / sizeof(SharedEntry);
+    for (int i = 0; i < count; ++i)
+      if (e[i].key != State.rootKey)
+        tt_import(e[i].key, e[i].value, e[i].bound, e[i].depth, e[i].move);
+    State.received += count;
+    // Rank 0 passes the results of a worker on to the other workers
+    for (int i = 0; State.rank == 0 && i < State.linkCount; ++i)
+      if (State.links[i] != from)
+        link_queue(State.links[i], MSG_TT, payload, h->length, true);
+  }
+  else if (h->type == MSG_START && h->length == sizeof(StartMsg))
+    start_worker((StartMsg *)payload);
+  else if (h->type == MSG_STOP)
+    stop_worker();
+  else if (h->type == MSG_QUIT)
+    __atomic_store_n(&State.quit, true, __ATOMIC_RELAXED);
+  else if (h->type == MSG_INFO && h->length == sizeof(InfoMsg)) {
+    InfoMsg *info = (InfoMsg *)payload;
+    pthread_mutex_lock(&State.mutex);
+    if (info->depth > State.hint.depth || (info->depth == State.hint.depth && info->score > State.hint.score))
+      State.hint = *info;
+    pthread_mutex_unlock(&State.mutex);
+  }
+  else if (h->type == MSG_DONE && h->length == sizeof(DoneMsg)) {
+    pthread_mutex_lock(&State.mutex);
+    State.done++;
+    State.workerNodes += ((DoneMsg *)payload)->nodes;
+    pthread_cond_signal(&State.doneCond);
+    pthread_mutex_unlock(&State.mutex);
+  }
+}
+
+// message_loop() moves the messages of all links until QUIT, or until a
+// link breaks. Queued output is written within a millisecond.
+
+static void *message_loop(void *arg) {
+  struct pollfd fds[MAX_WORKERS];
+  bool lost = false;
+
+  (void)arg;
+  while (!__atomic_load_n(&State.quit, __ATOMIC_RELAXED)) {
+    for (int i = 0; i < State.linkCount; ++i) {
+      fds[i].fd = State.links[i]->fd;
+      fds[i].events = POLLIN | (link_pending(State.links[i]) ? POLLOUT : 0);
+    }
+    poll(fds, State.linkCount, 1);
+    for (int i = 0; i < State.linkCount; ++i)
+      if (   ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) && !link_receive(State.links[i]))
+          || !link_flush(State.links[i])) {
+        pthread_mutex_lock(&State.mutex);
+        State.lost = lost = true;
+        __atomic_store_n(&State.quit, true, __ATOMIC_RELAXED);
+        pthread_cond_signal(&State.doneCond);
+        pthread_mutex_unlock(&State.mutex);
+      }
+  }
+  // What is still queued, such as QUIT, goes out before the links close
+  for (int i = 0; i < State.linkCount && !lost; ++i)
+    for (int tries = 0; link_pending(State.links[i]) && tries < 1000 && link_flush(State.links[i]); ++tries)
+      usleep(1000);
+  return NULL;
+}
+
+// open_socket() listens on, or connects to, an address: "host:port" for
+// TCP, or else the path of a Unix socket.
+
+static int open_socket(const char *address, bool listening) {
+  const char *colon = strrchr(address, ':');
+  int fd = -1, one = 1;
+
+  if (!colon) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(address) >= sizeof(addr.sun_path) || (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+      return -1;
+    strcpy(addr.sun_path, address);
+    if (listening)
+      unlink(address);
+    if (listening ? bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, MAX_WORKERS) < 0
+                  : connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM,
+                            .ai_flags = listening ? AI_PASSIVE : 0 }, *res, *ai;
+  char host[256];
+  snprintf(host, sizeof(host), "%.*s", (int)(colon - address), address);
+  if (getaddrinfo(host[0] ? host : NULL, colon + 1, &hints, &res))
+    return -1;
+  for (ai = res; ai; ai = ai->ai_next) {
+    if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0)
+      continue;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (listening ? !bind(fd, ai->ai_addr, ai->ai_addrlen) && !listen(fd, MAX_WORKERS)
+                  : !connect(fd, ai->ai_addr, ai->ai_addrlen))
+      break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  return fd;
+}
+
+static void cluster_init(int shareDepth) {
+  pthread_mutex_init(&State.mutex, NULL);
+  pthread_cond_init(&State.doneCond, NULL);
+  State.si = search_new();
+  State.batchTime = now();
+  TT.shareDepth = shareDepth;
+  TT.share = share_entry;
+}
+
+// run_worker() connects to rank 0, retrying for 10 seconds, and serves it
+// until QUIT.
+
+static void run_worker(const char *address, int shareDepth) {
+  int fd = -1;
+
+  for (int i = 0; i < 100 && (fd = open_socket(address, false)) < 0; ++i)
+    usleep(100000);
+  if (fd < 0) {
+    fprintf(stderr, "cluster: cannot connect to %s\n", address);
+    exit(EXIT_FAILURE);
+  }
+  cluster_init(shareDepth);
+  State.links[State.linkCount++] = link_new(fd);
+  message_loop(NULL);
+  if (State.searching) {
+    search_stop(State.si);
+    pthread_join(State.searchThread, NULL);
+  }
+  close(fd);
+  search_delete(State.si);
+}
+
+// report_root() prints the progress of rank 0 and takes the hint of the
+// workers: a move of theirs that scores better at the same depth or deeper
+// is searched first in the next iteration.
+
+static void report_root(SearchInfo *si, void *data) {
+  TimePoint *start = data;
+  InfoMsg hint;
+
+  pthread_mutex_lock(&State.mutex);
+  hint = State.hint;
+  pthread_mutex_unlock(&State.mutex);
+  fprintf(stderr, "info depth %d time %lld nodes %llu hint depth %d\n", si->depth,
+          (long long)(now() - *start), (unsigned long long)si->nodes, hint.depth);
+
+  if (hint.pvlen && hint.depth >= si->depth && hint.score > si->score)
+    for (int i = 1; i < si->rootCount; ++i)
+      if (si->rootMoves[i].move == hint.pv[0]) {
+        RootMove rm = si->rootMoves[i];
+        memmove(si->rootMoves + 1, si->rootMoves, i * sizeof(RootMove));
+        si->rootMoves[0] = rm;
+        break;
+      }
+}
+
+// search_cluster() searches a position on rank 0 while the workers search
+// their share of the root moves, round robin in the order of generation.
+// A single worker searches all of them.
+
+static void search_cluster(Position *pos, SearchLimits *limits) {
+  SearchInfo *si = State.si;
+  StartMsg msg;
+  TimePoint start = now();
+  int workers = State.linkCount;
+
+  search_init(si, pos, limits);
+  State.rootKey = pos->key;
+  memset(&State.hint, 0, sizeof(State.hint));
+  State.done = 0;
+  State.workerNodes = 0;
+  pos_fen(pos, msg.fen);
+  for (int w = 0; w < workers; ++w) {
+    msg.rank = w + 1;
+    msg.count = 0;
+    for (int i = w; workers > 1 && i < si->rootCount; i += workers)
+      msg.moves[msg.count++] = si->rootMoves[i].move;
+    link_queue(State.links[w], MSG_START, &msg, sizeof(msg), false);
+  }
+
+  si->report = report_root;
+  si->reportData = &start;
+  search_start(si);
+  flush_batch();
+
+  for (int w = 0; w < workers; ++w)
+    link_queue(State.links[w], MSG_STOP, NULL, 0, false);
+  pthread_mutex_lock(&State.mutex);
+  while (State.done < workers && !State.lost)
+    pthread_cond_wait(&State.doneCond, &State.mutex);
+  bool lost = State.lost;
+  pthread_mutex_unlock(&State.mutex);
+  if (lost) {
+    fprintf(stderr, "cluster: lost the connection to a worker\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+// cluster_cmd() parses "cluster [procs N] [listen ADDR] [remote] [depth N]
+// [movetime MS] [nodes N] [hash MB] [share D] [output FILE] [FILE|-]" for
+// rank 0, or "cluster connect ADDR [hash MB] [share D]" for a worker. Rank
+// 0 starts procs - 1 workers itself, or with "remote" waits for them to
+// connect from elsewhere. It searches every FEN or EPD line of the input
+// and writes it back with the EPD opcodes of the result, replacing those
+// the line already had. Results of depth
+// D (4 by default) or more are shared.
+
+void cluster_cmd(int argc, char **argv) {
+  const char *input = "-", *output = "-", *address = NULL, *connectTo = NULL;
+  SearchLimits limits = { 0 };
+  int procs = 1, shareDepth = DEFAULT_SHARE_DEPTH;
+  bool remote = false;
+  char defaultAddress[64];
+
+  for (int i = 0; i < argc; ++i) {
+    if (!strcmp(argv[i], "procs") && i + 1 < argc)
+      procs = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "listen") && i + 1 < argc)
+      address = argv[++i];
+    else if (!strcmp(argv[i], "connect") && i + 1 < argc)
+      connectTo = argv[++i];
+    else if (!strcmp(argv[i], "remote"))
+      remote = true;
+    else if (!strcmp(argv[i], "depth") && i + 1 < argc)
+      limits.depth = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "movetime") && i + 1 < argc)
+      limits.movetime = atoll(argv[++i]);
+    else if (!strcmp(argv[i], "nodes") && i + 1 < argc)
+      limits.nodes = strtoull(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "hash") && i + 1 < argc)
+      tt_resize(atoi(argv[++i]));
+    else if (!strcmp(argv[i], "share") && i + 1 < argc)
+      shareDepth = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "output") && i + 1 < argc)
+      output = argv[++i];
+    else
+      input = argv[i];
+  }
+  if (connectTo) {
+    run_worker(connectTo, shareDepth);
+    return;
+  }
+  if (procs < 1 || procs > MAX_WORKERS + 1) {
+    fprintf(stderr, "Usage: cluster [procs 1-%d] [listen ADDR] [remote] [depth N] [movetime MS]"
+            " [nodes N] [hash MB] [share D] [output FILE] [FILE|-]\n", MAX_WORKERS + 1);
+    exit(EXIT_FAILURE);
+  }
+  if (!limits.depth && !limits.nodes && !limits.movetime)
+    limits.depth = 8;
+  if (!address) {
+    snprintf(defaultAddress, sizeof(defaultAddress), "/tmp/catacomb-cluster-%d.sock", (int)getpid());
+    address = defaultAddress;
+  }
+
+  FILE *in = strcmp(input, "-") ? fopen(input, "r") : stdin;
+  FILE *out = strcmp(output, "-") ? fopen(output, "w") : stdout;
+  int listenFd = procs > 1 ? open_socket(address, true) : -1;
+  if (!in || !out || (procs > 1 && listenFd < 0)) {
+    fprintf(stderr, "cluster: cannot open %s\n", !in ? input : !out ? output : address);
+    exit(EXIT_FAILURE);
+  }
+
+  // The workers are forked before any thread exists
+  pid_t children[MAX_WORKERS];
+  int childCount = 0;
+  for (int i = 1; i < procs && !remote; ++i)
+    if ((children[childCount++] = fork()) == 0) {
+      close(listenFd);
+      run_worker(address, shareDepth);
+      _exit(EXIT_SUCCESS);
+    }
+  for (int i = 1; i < procs; ++i) {
+    int fd = accept(listenFd, NULL, NULL);
+    if (fd < 0) {
+      fprintf(stderr, "cluster: accept failed\n");
+      exit(EXIT_FAILURE);
+    }
+    State.links[State.linkCount++] = link_new(fd);
+  }
+  if (listenFd >= 0) {
+    close(listenFd);
+    if (!strchr(address, ':'))
+      unlink(address);
+  }
+
+  cluster_init(shareDepth);
+  pthread_t messages;
+  pthread_create(&messages, NULL, message_loop, NULL);
+
+  uint64_t positions = 0, nodes = 0, workerNodes = 0;
+  char line[512], move[6];
+  Position pos;
+  TimePoint start = now();
+
+  while (fgets(line, sizeof(line), in)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (!line[0] || line[0] == '#')
+      continue;
+    const char *ops = parse_fen(&pos, line);
+    if (!ops) {
+      fprintf(out, "# invalid: %s\n", line);
+      continue;
+    }
+    epd_strip(line, ops, "acd acn ce dm pm pv c0");
+
+    TimePoint t = now();
+    search_cluster(&pos, &limits);
+    SearchInfo *si = State.si;
+    positions++;
+    nodes += si->nodes;
+    workerNodes += State.workerNodes;
+
+    fprintf(out, "%s%s acd %d; acn %llu;", line, strchr(line, ';') ? "" : " ;", si->depth,
+            (unsigned long long)(si->nodes + State.workerNodes));
+    if (abs(si->score) >= VALUE_MATE_IN_MAX_PLY)
+      fprintf(out, " dm %d;", si->score > 0 ? (VALUE_MATE - si->score + 1) / 2
+                                            : -(VALUE_MATE + si->score) / 2);
+    else
+      fprintf(out, " ce %d;", to_cp(si->score));
+    if (si->pvlen) {
+      fprintf(out, " pm %s; pv", move_str(si->pv[0], move));
+      for (int i = 0; i < si->pvlen; ++i)
+        fprintf(out, " %s", move_str(si->pv[i], move));
+      fprintf(out, ";");
+    }
+    fprintf(out, " c0 \"%d procs, %lld ms\";\n", procs, (long long)(now() - t));
+    fflush(out);
+  }
+
+  for (int i = 0; i < State.linkCount; ++i)
+    link_queue(State.links[i], MSG_QUIT, NULL, 0, false);
+  __atomic_store_n(&State.quit, true, __ATOMIC_RELAXED);
+  pthread_join(messages, NULL);
+  for (int i = 0; i < childCount; ++i)
+    waitpid(children[i], NULL, 0);
+
+  TimePoint elapsed = now() - start + 1;
+  fprintf(stderr, "positions %llu procs %d time %lld ms nodes %llu rank 0 %llu workers %llu"
+          " nps %llu tt sent %llu received %llu dropped %llu\n",
+          (unsigned long long)positions, procs, (long long)elapsed,
+          (unsigned long long)(nodes + workerNodes), (unsigned long long)nodes,
+          (unsigned long long)workerNodes,
+          (unsigned long long)((nodes + workerNodes) * 1000 / elapsed),
+          (unsigned long long)State.sent, (unsigned long long)State.received,
+          (unsigned long long)State.dropped);
+
+  if (in != stdin)
+    fclose(in);
+  if (out != stdout)
+    fclose(out);
+  search_delete(State.si);
+}
@@ -0,0 +1,13 @@
+#ifndef CLUSTER_H_INCLUDED
+#define CLUSTER_H_INCLUDED
+
+// The cluster mode spreads the search of a position over several engine
+// processes, on one machine or many. Rank 0 reads the positions, hands
+// every worker process a share of the root moves and searches all of them
+// itself; the workers search their share until rank 0 is done. All ranks
+// send their deep transposition table results to the others, through
+// rank 0, and the workers report their best lines to it.
+
+void cluster_cmd(int argc, char **argv);
+
+#endif
@@ -0,0 +1,481 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef USE_AVX2
+#include <immintrin.h>
+#endif
+
+#include "evalbatch.h"
+#include "evaluate.h"
+#include "misc.h"
+
+#ifdef USE_AVX2
+
+// EvalBlock holds the bitboards of EVAL_LANES positions, lane i of every
+// array belonging to position i: pieces[c][0] are all the pieces of color
+// c, pieces[c][pt] those of type pt. Unused lanes are empty boards.
+
+typedef struct {
+  Bitboard pieces[2][8][EVAL_LANES] __attribute__((aligned(32)));
+  int side[EVAL_LANES];
+  bool valid[EVAL_LANES];
+} EvalBlock;
+
+// Vec holds one bitboard or counter per lane in an __m256i. The
+// operations below are all the evaluator needs; shift counts are
+// compile-time constants once inlined.
+
+typedef __m256i Vec;
+
+INLINE Vec v_load(const Bitboard *p) { return _mm256_load_si256((const __m256i *)p); }
+INLINE void v_store(int64_t *p, Vec a) { _mm256_storeu_si256((__m256i *)p, a); }
+INLINE Vec v_set1(uint64_t x) { return _mm256_set1_epi64x(x); }
+INLINE Vec v_and(Vec a, Vec b) { return _mm256_and_si256(a, b); }
+INLINE Vec v_or(Vec a, Vec b) { return _mm256_or_si256(a, b); }
+INLINE Vec v_andnot(Vec a, Vec b) { return _mm256_andnot_si256(a, b); }
+INLINE Vec v_add(Vec a, Vec b) { return _mm256_add_epi64(a, b); }
+INLINE Vec v_sub(Vec a, Vec b) { return _mm256_sub_epi64(a, b); }
+INLINE Vec v_shl(Vec a, int n) { return _mm256_slli_epi64(a, n); }
+INLINE Vec v_shr(Vec a, int n) { return _mm256_srli_epi64(a, n); }
+INLINE bool v_any(Vec a) { return !_mm256_testz_si256(a, a); }
+INLINE Vec v_gather(const uint64_t *table, Vec idx) {
+  return _mm256_i64gather_epi64((const long long *)table, idx, 8);
+}
+
+// v_mul() multiplies small non-negative counters by a signed weight.
+
+INLINE Vec v_mul(Vec a, int w) { return _mm256_mul_epi32(a, _mm256_set1_epi64x(w)); }
+
+INLINE Vec v_flip(Vec a) {
+  return _mm256_shuffle_epi8(a, _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                                 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8));
+}
+
+// v_bytecount() counts the bits of every byte, looking up each nibble in a
+// 16 entry table; v_sum_bytes() adds up the bytes of each lane. Byte
+// counts of up to 31 bitboards can be added before the sum.
+
+INLINE Vec v_bytecount(Vec a) {
+  const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low = _mm256_set1_epi8(0x0f);
+  __m256i lo = _mm256_and_si256(a, low);
+  __m256i hi = _mm256_and_si256(_mm256_srli_epi16(a, 4), low);
+  return _mm256_add_epi8(_mm256_shuffle_epi8(table, lo), _mm256_shuffle_epi8(table, hi));
+}
+
+INLINE Vec v_sum_bytes(Vec a) { return _mm256_sad_epu8(a, _mm256_setzero_si256()); }
+INLINE Vec v_add_bytes(Vec a, Vec b) { return _mm256_add_epi8(a, b); }
+
+INLINE Vec v_popcount(Vec a) { return v_sum_bytes(v_bytecount(a)); }
+
+#define NotFileA  (~FileABB)
+#define NotFileH  (~FileHBB)
+#define NotFileAB (~(FileABB | FileBBB))
+#define NotFileGH (~(FileGBB | FileHBB))
+
+INLINE Vec v_shift(Vec a, int d) { return d > 0 ? v_shl(a, d) : v_shr(a, -d); }
+
+// v_step() moves every bit d squares, dropping the bits that would cross
+// the board edge: 'wrap' holds the squares that can be reached legally.
+
+INLINE Vec v_step(Vec a, int d, Bitboard wrap) { return v_and(v_shift(a, d), v_set1(wrap)); }
+
+// Sliders use a Kogge-Stone occluded fill through the empty squares. The
+// propagators of a direction, the empty squares from which a ray goes on
+// for 1, 2 and 4 more steps, depend only on the occupancy, so a Slide is
+// set up once per block and direction. Rays of different sliders in one
+// direction never overlap, so the popcount of a fill is the sum of the
+// attacks of every slider.
+
+typedef struct {
+  Vec pro[3];
+} Slide;
+
+INLINE void v_slide_init(Slide *s, Vec empty, int d, Bitboard wrap) {
+  s->pro[0] = v_and(empty, v_set1(wrap));
+  s->pro[1] = v_and(s->pro[0], v_shift(s->pro[0], d));
+  s->pro[2] = v_and(s->pro[1], v_shift(s->pro[1], 2 * d));
+}
+
+// v_slide() returns the squares attacked by the sliders in gen along
+// direction d, s having been set up for it.
+
+INLINE Vec v_slide(Vec gen, const Slide *s, int d, Bitboard wrap) {
+  gen = v_or(gen, v_and(s->pro[0], v_shift(gen, d)));
+  gen = v_or(gen, v_and(s->pro[1], v_shift(gen, 2 * d)));
+  gen = v_or(gen, v_and(s->pro[2], v_shift(gen, 4 * d)));
+  return v_step(gen, d, wrap);
+}
+
+// The eight directions: SLIDE(k, f) expands f(slide, d, wrap) for the
+// k-th, diagonals first.
+
+#define SLIDE_DIRS(f) \
+  f(0, NORTH_EAST, NotFileA) f(1, SOUTH_EAST, NotFileA) \
+  f(2, NORTH_WEST, NotFileH) f(3, SOUTH_WEST, NotFileH) \
+  f(4, NORTH, AllSquares)    f(5, SOUTH, AllSquares)    \
+  f(6, EAST, NotFileA)       f(7, WEST, NotFileH)
+
+INLINE Vec v_north_fill(Vec a) {
+  a = v_or(a, v_shl(a, 8));
+  a = v_or(a, v_shl(a, 16));
+  return v_or(a, v_shl(a, 32));
+}
+
+INLINE Vec v_south_fill(Vec a) {
+  a = v_or(a, v_shr(a, 8));
+  a = v_or(a, v_shr(a, 16));
+  return v_or(a, v_shr(a, 32));
+}
+
+// PsqEntry[piece][s] holds the material and PSQT Score of a piece on a
+// square, as evaluate() sums it, with the non-pawn material of the piece
+// from bit 40 up for the game phase. Summing entries in 64-bit lanes
+// leaves the exact uint32 Score sum of the scalar code in the low 32 bits;
+// its carries stay in bits 32-39. Entry 64 is zero and absorbs the lanes
+// that have run out of pieces.
+
+static uint64_t PsqEntry[16][65];
+
+// evalbatch_init() builds PsqEntry from PSQT and PieceValue, so it must
+// run after psqt_init().
+
+void evalbatch_init(void) {
+  for (int c = WHITE; c <= BLACK; ++c)
+    for (int pt = PAWN; pt <= KING; ++pt) {
+      int piece = make_piece(c, pt);
+      Score material = make_score(PieceValue[MG][piece], PieceValue[EG][piece]);
+      uint64_t npm = pt != PAWN ? (uint64_t)PieceValue[MG][piece] << 40 : 0;
+      for (Square s = 0; s < 64; ++s)
+        PsqEntry[piece][s] = npm | (Score)((c == WHITE ? material : -material) + PSQT[piece][s]);
+      PsqEntry[piece][64] = 0;
+    }
+}
+
+// pawn_terms() adds the pawn structure terms of the pawns 'us', moving
+// north, against the pawns 'them'; it mirrors pawn_structure().
+
+INLINE void pawn_terms(Vec us, Vec them, Vec *mg, Vec *eg) {
+  Vec files = v_or(v_north_fill(us), v_south_fill(us));
+  Vec span = v_south_fill(v_shr(them, 8));
+  span = v_or(span, v_or(v_step(span, EAST, NotFileA), v_step(span, WEST, NotFileH)));
+
+  Vec isolated = v_popcount(v_andnot(v_or(v_step(files, EAST, NotFileA),
+                                          v_step(files, WEST, NotFileH)), us));
+  Vec doubled = v_popcount(v_and(us, v_shl(us, 8)));
+  *mg = v_sub(*mg, v_add(v_mul(isolated, mg_value(Isolated)), v_mul(doubled, mg_value(Doubled))));
+  *eg = v_sub(*eg, v_add(v_mul(isolated, eg_value(Isolated)), v_mul(doubled, eg_value(Doubled))));
+
+  // Byte r of the byte counts is the number of passed pawns on rank r
+  Vec passed = v_bytecount(v_andnot(span, us));
+  for (int r = RANK_2; r <= RANK_7; ++r) {
+    Vec n = v_and(v_shr(passed, 8 * r), v_set1(0xFF));
+    *mg = v_add(*mg, v_mul(n, mg_value(PassedRank[r])));
+    *eg = v_add(*eg, v_mul(n, eg_value(PassedRank[r])));
+  }
+}
+
+// evaluate_block() evaluates the positions of a block; it mirrors
+// evaluate() term by term.
+
+static void evaluate_block(EvalBlock *blk, Value *out) {
+  Vec mg[2], eg[2], psq = v_set1(0);
+  Vec occupied = v_or(v_load(blk->pieces[WHITE][0]), v_load(blk->pieces[BLACK][0]));
+  Vec empty = v_andnot(occupied, v_set1(AllSquares));
+  Slide slides[8];
+
+#define INIT(k, d, wrap) v_slide_init(&slides[k], empty, d, wrap);
+  SLIDE_DIRS(INIT)
+#undef INIT
+
+  for (int c = WHITE; c <= BLACK; ++c) {
+    mg[c] = eg[c] = v_set1(0);
+
+    // Material and piece-square tables: all lanes take their lowest piece
+    // of the type at once, its square being the popcount of the bits
+    // below it, until every lane is done.
+    for (int pt = PAWN; pt <= KING; ++pt) {
+      const uint64_t *table = PsqEntry[make_piece(c, pt)];
+      for (Vec b = v_load(blk->pieces[c][pt]); v_any(b); ) {
+        Vec low = v_and(b, v_sub(v_set1(0), b));
+        psq = v_add(psq, v_gather(table, v_popcount(v_sub(low, v_set1(1)))));
+        b = v_andnot(low, b);
+      }
+    }
+
+    // Mobility
+    Vec theirPawns = v_load(blk->pieces[!c][PAWN]);
+    Vec pawnAttacks = c == WHITE
+                    ? v_or(v_step(theirPawns, SOUTH_EAST, NotFileA), v_step(theirPawns, SOUTH_WEST, NotFileH))
+                    : v_or(v_step(theirPawns, NORTH_EAST, NotFileA), v_step(theirPawns, NORTH_WEST, NotFileH));
+    Vec area = v_andnot(v_or(v_load(blk->pieces[c][0]), pawnAttacks), v_set1(AllSquares));
+
+    // Byte counts of the attacks in every direction are added up before
+    // summing the bytes; a piece type missing from all lanes is skipped.
+    Vec knights = v_load(blk->pieces[c][KNIGHT]);
+    if (v_any(knights)) {
+      Vec n = v_bytecount(v_and(area, v_step(knights, 17, NotFileA)));
+      n = v_add_bytes(n, v_bytecount(v_and(area, v_step(knights,  15, NotFileH))));
+      n = v_add_bytes(n, v_bytecount(v_and(area, v_step(knights,  10, NotFileAB))));
+      n = v_add_bytes(n, v_bytecount(v_and(area, v_step(knights,   6, NotFileGH))));
+      n = v_add_bytes(n, v_bytecount(v_and(area, v_step(knights,  -6, NotFileAB))));
+      n = v_add_bytes(n, v_bytecount(v_and(area, v_step(knights, -10, NotFileGH))));
+      n = v_add_bytes(n, v_bytecount(v_and(area, v_step(knights, -15, NotFileA))));
+      n = v_add_bytes(n, v_bytecount(v_and(area, v_step(knights, -17, NotFileH))));
+      n = v_sum_bytes(n);
+      mg[c] = v_add(mg[c], v_mul(n, mg_value(MobilityBonus[KNIGHT])));
+      eg[c] = v_add(eg[c], v_mul(n, eg_value(MobilityBonus[KNIGHT])));
+    }
+
+    for (int pt = BISHOP; pt <= QUEEN; ++pt) {
+      Vec gen = v_load(blk->pieces[c][pt]), n = v_set1(0);
+      if (!v_any(gen))
+        continue;
+#define COUNT(k, d, wrap) \
+      if ((k < 4 && pt != ROOK) || (k >= 4 && pt != BISHOP)) \
+        n = v_add_bytes(n, v_bytecount(v_and(area, v_slide(gen, &slides[k], d, wrap))));
+      SLIDE_DIRS(COUNT)
+#undef COUNT
+      n = v_sum_bytes(n);
+      mg[c] = v_add(mg[c], v_mul(n, mg_value(MobilityBonus[pt])));
+      eg[c] = v_add(eg[c], v_mul(n, eg_value(MobilityBonus[pt])));
+    }
+  }
+
+  // Pawn structure, black on the flipped board
+  Vec wp = v_load(blk->pieces[WHITE][PAWN]), bp = v_load(blk->pieces[BLACK][PAWN]);
+  pawn_terms(wp, bp, &mg[WHITE], &eg[WHITE]);
+  pawn_terms(v_flip(bp), v_flip(wp), &mg[BLACK], &eg[BLACK]);
+
+  int64_t mgs[EVAL_LANES], egs[EVAL_LANES], psqs[EVAL_LANES];
+  v_store(mgs, v_sub(mg[WHITE], mg[BLACK]));
+  v_store(egs, v_sub(eg[WHITE], eg[BLACK]));
+  v_store(psqs, psq);
+  for (int i = 0; i < EVAL_LANES; ++i)
+    if (blk->valid[i]) {
+      Bitboard white = blk->pieces[WHITE][0][i], black = blk->pieces[BLACK][0][i];
+      Bitboard pawns = blk->pieces[WHITE][PAWN][i] | blk->pieces[BLACK][PAWN][i];
+      Score score = (Score)psqs[i] + make_score((Value)mgs[i], (Value)egs[i]);
+      out[i] = is_kpk(white | black, pawns) ? evaluate_kpk(white, black, pawns, blk->side[i])
+             : taper(score, (Value)((uint64_t)psqs[i] >> 40), blk->side[i]);
+    }
+}
+
+#else
+
+// Without AVX2 the batch evaluator calls evaluate(), which needs no tables
+
+void evalbatch_init(void) {}
+
+#endif
+
+// evaluate_batch() evaluates n positions into out[]. The results equal
+// those of evaluate() on every position. Without AVX2 it just calls
+// evaluate().
+
+void evaluate_batch(Position *pos, int n, Value *out) {
+#ifdef USE_AVX2
+  EvalBlock blk;
+  Value result[EVAL_LANES];
+
+  for (int first = 0; first < n; first += EVAL_LANES) {
+    memset(&blk, 0, sizeof(blk));
+    for (int i = 0; i < EVAL_LANES && first + i < n; ++i) {
+      Position *p = &pos[first + i];
+      for (int c = WHITE; c <= BLACK; ++c) {
+        blk.pieces[c][0][i] = p->occupied[c];
+        for (int pt = PAWN; pt <= KING; ++pt)
+          blk.pieces[c][pt][i] = p->occupied[c] & p->types[pt];
+      }
+      blk.side[i] = p->side;
+      blk.valid[i] = true;
+    }
+    evaluate_block(&blk, result);
+    for (int i = 0; i < EVAL_LANES && first + i < n; ++i)
+      out[first + i] = result[i];
+  }
+#else
+  for (int i = 0; i < n; ++i)
+    out[i] = evaluate(&pos[i]);
+#endif
+}
+
+// evaluate_packed() evaluates n packed records into out[], building the
+// bitboards straight from the records. Records that unpack_position()
+// would reject get VALUE_NONE. Without AVX2 the records are unpacked and
+// passed to evaluate().
+
+void evaluate_packed(const PackedPos *pp, int n, Value *out) {
+#ifdef USE_AVX2
+  EvalBlock blk;
+  Value result[EVAL_LANES];
+
+  for (int first = 0; first < n; first += EVAL_LANES) {
+    memset(&blk, 0, sizeof(blk));
+    for (int i = 0; i < EVAL_LANES && first + i < n; ++i) {
+      const PackedPos *p = &pp[first + i];
+      Bitboard bb[16] = { 0 }, b = p->occupied;
+      if (popcount(b) > 32) {
+        out[first + i] = VALUE_NONE;
+        continue;
+      }
+      for (int j = 0; b; ++j)
+        bb[(p->pieces[j / 2] >> (4 * (j & 1))) & 15] |= sq_bb(pop_lsb(&b));
+      // Codes 0, 7, 8 and 15 are not pieces
+      if (   (bb[0] | bb[7] | bb[8] | bb[15])
+          || popcount(bb[W_KING]) != 1 || popcount(bb[B_KING]) != 1) {
+        out[first + i] = VALUE_NONE;
+        continue;
+      }
+      for (int c = WHITE; c <= BLACK; ++c)
+        for (int pt = PAWN; pt <= KING; ++pt) {
+          blk.pieces[c][pt][i] = bb[make_piece(c, pt)];
+          blk.pieces[c][0][i] |= bb[make_piece(c, pt)];
+        }
+      blk.side[i] = p->flags & 1;
+      blk.valid[i] = true;
+    }
+    evaluate_block(&blk, result);
+    for (int i = 0; i < EVAL_LANES && first + i < n; ++i)
+      if (blk.valid[i])
+        out[first + i] = result[i];
+  }
+#else
+  Position pos;
+  for (int i = 0; i < n; ++i)
+    out[i] = unpack_position(&pp[i], &pos) ? evaluate(&pos) : VALUE_NONE;
+#endif
+}
+
+// evalbatch_cmd() parses "evalbatch <file|-|x.bin> [scalar] [verify]
+// [output FILE]" and prints the static evaluation of every record as an
+// EPD ce opcode, replacing any ce of the input. Records are evaluated in
+// chunks; 'scalar' uses evaluate() instead of the batch evaluator and
+// 'verify' checks the batch results against evaluate(). The evaluation
+// time alone is reported on stderr; for packed input it includes
+// unpacking the records in either mode.
+
+enum { EVAL_CHUNK = 4096, EVAL_LINE = 512 };
+
+void evalbatch_cmd(int argc, char **argv) {
+  const char *input = "-", *output = "-";
+  bool scalar = false, verify = false;
+
+  for (int i = 0; i < argc; ++i) {
+    if (!strcmp(argv[i], "scalar"))
+      scalar = true;
+    else if (!strcmp(argv[i], "verify"))
+      verify = true;
+    else if (!strcmp(argv[i], "output") && i + 1 < argc)
+      output = argv[++i];
+    else
+      input = argv[i];
+  }
+
+  size_t len = strlen(input);
+  bool packed = len > 4 && !strcmp(input + len - 4, ".bin");
+  PackedReader reader;
+  FILE *in = packed ? NULL : strcmp(input, "-") ? fopen(input, "r") : stdin;
+  FILE *out = strcmp(output, "-") ? fopen(output, "w") : stdout;
+  if ((packed ? !packed_reader_open(&reader, input) : !in) || !out) {
+    fprintf(stderr, "evalbatch: cannot open %s\n", out ? input : output);
+    exit(EXIT_FAILURE);
+  }
+
+  Position *pos = malloc(EVAL_CHUNK * sizeof(Position));
+  char (*lines)[EVAL_LINE] = malloc(EVAL_CHUNK * EVAL_LINE);
+  bool *valid = malloc(EVAL_CHUNK * sizeof(bool));
+  Value *values = malloc(EVAL_CHUNK * sizeof(Value));
+  uint64_t count = 0, mismatches = 0;
+  uint64_t nanos = 0;
+  size_t next = 0;
+
+  while (true) {
+    // Read a chunk: packed records are evaluated in place
+    int n = 0;
+    const PackedPos *chunk = NULL;
+    if (packed) {
+      chunk = reader.data + next;
+      n = reader.count - next < EVAL_CHUNK ? reader.count - next : EVAL_CHUNK;
+      next += n;
+    }
+    else
+      while (n < EVAL_CHUNK && fgets(lines[n], EVAL_LINE, in)) {
+        lines[n][strcspn(lines[n], "\r\n")] = '\0';
+        if (!lines[n][0] || lines[n][0] == '#')
+          continue;
+        const char *ops = parse_fen(&pos[n], lines[n]);
+        if ((valid[n] = ops))
+          epd_strip(lines[n], ops, "ce");
+        ++n;
+      }
+    if (!n)
+      break;
+
+    // Batch input must hold valid positions only: compact them
+    int m = 0;
+    Position *batch = pos;
+    if (!packed)
+      for (int i = 0; i < n; ++i)
+        if (valid[i])
+          pos[m++] = pos[i];
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (scalar && packed)
+      for (int i = 0; i < n; ++i) {
+        valid[i] = unpack_position(&chunk[i], &pos[i]);
+        values[i] = valid[i] ? evaluate(&pos[i]) : VALUE_NONE;
+      }
+    else if (scalar)
+      for (int i = 0; i < m; ++i)
+        values[i] = evaluate(&batch[i]);
+    else if (packed)
+      evaluate_packed(chunk, n, values);
+    else
+      evaluate_batch(batch, m, values);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    nanos += (t1.tv_sec - t0.tv_sec) * 1000000000ULL + t1.tv_nsec - t0.tv_nsec;
+
+    // The batch evaluator reads the records directly; unpack them for output
+    if (!scalar && packed)
+      for (int i = 0; i < n; ++i)
+        valid[i] = unpack_position(&chunk[i], &pos[i]);
+
+    for (int i = 0, j = 0; i < n; ++i) {
+      char fen[128];
+      const char *line = packed ? valid[i] ? pos_fen(&pos[i], fen) : "corrupt packed record"
+                                : lines[i];
+      if (!valid[i]) {
+        fprintf(out, "# invalid: %s\n", line);
+        continue;
+      }
+      Value v = values[packed ? i : j];
+      if (verify && v != evaluate(&batch[packed ? i : j]))
+        ++mismatches;
+      ++j;
+      ++count;
+      fprintf(out, "%s%s ce %d;\n", line, strchr(line, ';') ? "" : " ;", to_cp(v));
+    }
+  }
+
+  fprintf(stderr, "evalbatch: %llu positions, %.1f ns/position (%s)\n",
+          (unsigned long long)count, count ? (double)nanos / count : 0.0,
+          scalar || !HasAvx2 ? "scalar" : "avx2");
+  if (verify)
+    fprintf(stderr, "evalbatch: %llu mismatches against evaluate()\n",
+            (unsigned long long)mismatches);
+
+  if (packed)
+    packed_reader_close(&reader);
+  else if (in != stdin)
+    fclose(in);
+  if (out != stdout)
+    fclose(out);
+  free(pos);
+  free(lines);
+  free(valid);
+  free(values);
+}
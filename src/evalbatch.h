@@ -0,0 +1,20 @@
+#ifndef EVALBATCH_H_INCLUDED
+#define EVALBATCH_H_INCLUDED
+
+#include "packed.h"
+#include "position.h"
+
+// The batch evaluator computes evaluate() for many positions at once. The
+// bitboards of EVAL_LANES positions are transposed into structure-of-arrays
+// form, one 64-bit lane per position, and every term is computed set-wise
+// with shifts, fills and popcounts on whole __m256i vectors. The vector
+// code needs USE_AVX2; other builds evaluate the positions one by one.
+
+enum { EVAL_LANES = 4 };
+
+void evalbatch_init(void);
+void evaluate_batch(Position *pos, int n, Value *out);
+void evaluate_packed(const PackedPos *pp, int n, Value *out);
+void evalbatch_cmd(int argc, char **argv);
+
+#endif
@@ -0,0 +1,289 @@
+#include <string.h>
+
+#include "bitbase.h"
+#include "evaluate.h"
+
+#define S(mg, eg) make_score(mg, eg)
+
+Value PieceValue[2][16] = {
+  { 0, PawnValueMg, KnightValueMg, BishopValueMg, RookValueMg, QueenValueMg, 0, 0,
+    0, PawnValueMg, KnightValueMg, BishopValueMg, RookValueMg, QueenValueMg, 0, 0 },
+  { 0, PawnValueEg, KnightValueEg, BishopValueEg, RookValueEg, QueenValueEg, 0, 0,
+    0, PawnValueEg, KnightValueEg, BishopValueEg, RookValueEg, QueenValueEg, 0, 0 }
+};
+
+// Bonus[PieceType][Rank][File/2] contains the piece-square bonuses for
+// pieces other than pawns. Tables are defined for files A..D and white
+// side: they are symmetric for the other files and mirrored for black.
+
+static const Score Bonus[][8][4] = {
+  { },
+  { },
+  { // Knight
+   { S(-169,-105), S(-96,-74), S(-80,-46), S(-79,-18) },
+   { S( -79, -70), S(-39,-56), S(-24,-15), S( -9,  6) },
+   { S( -64, -38), S(-20,-33), S(  4, -5), S( 19, 27) },
+   { S( -28, -36), S(  5,  0), S( 41, 13), S( 47, 34) },
+   { S( -29, -41), S( 13,-20), S( 42,  4), S( 52, 35) },
+   { S( -11, -51), S( 28,-38), S( 63,-17), S( 55, 19) },
+   { S( -67, -64), S(-21,-45), S(  6,-37), S( 37, 16) },
+   { S(-200, -98), S(-80,-89), S(-53,-53), S(-32,-16) }
+  },
+  { // Bishop
+   { S(-44,-63), S( -4,-30), S(-11,-35), S(-28, -8) },
+   { S(-18,-38), S(  7,-13), S( 14,-14), S(  3,  0) },
+   { S( -8,-18), S( 24,  0), S( -3, -7), S( 15, 13) },
+   { S(  1,-26), S(  8, -3), S( 26,  1), S( 37, 16) },
+   { S( -7,-24), S( 30, -6), S( 23,-10), S( 28, 17) },
+   { S(-17,-26), S(  4,  2), S( -1,  1), S(  8, 16) },
+   { S(-21,-34), S(-19,-18), S( 10, -7), S( -6,  9) },
+   { S(-48,-51), S( -3,-40), S(-12,-39), S(-25,-20) }
+  },
+  { // Rook
+   { S(-24, -2), S(-13,-6), S(-7, -3), S( 2,-2) },
+   { S(-18,-10), S(-10,-7), S(-5,  1), S( 9, 0) },
+   { S(-21, 10), S( -7,-4), S( 3,  2), S(-1,-2) },
+   { S(-13, -5), S( -5, 2), S(-4, -8), S(-6, 8) },
+   { S(-24, -8), S(-12, 5), S(-1,  4), S( 6,-9) },
+   { S(-24,  3), S( -4,-2), S( 4,-10), S(10, 7) },
+   { S( -8,  1), S(  6, 2), S(10, 17), S(12,-8) },
+   { S(-22, 12), S(-24,-6), S(-6, 13), S( 4, 7) }
+  },
+  { // Queen
+   { S( 3,-69), S(-5,-57), S(-5,-47), S( 4,-26) },
+   { S(-3,-55), S( 5,-31), S( 8,-22), S(12, -4) },
+   { S(-3,-39), S( 6,-18), S(13, -9), S( 7,  3) },
+   { S( 4,-23), S( 5, -3), S( 9, 13), S( 8, 24) },
+   { S( 0,-29), S(14, -6), S(12,  9), S( 5, 21) },
+   { S(-4,-38), S(10,-18), S( 6,-12), S( 8,  1) },
+   { S(-5,-50), S( 6,-27), S(10,-24), S( 8, -8) },
+   { S(-2,-75), S(-2,-52), S( 1,-43), S(-2,-36) }
+  },
+  { // King
+   { S(272,  0), S(325, 41), S(273, 80), S(190, 93) },
+   { S(277, 57), S(305, 98), S(241,138), S(183,131) },
+   { S(198, 86), S(253,138), S(168,165), S(120,173) },
+   { S(169,103), S(191,152), S(136,168), S(108,169) },
+   { S(145, 98), S(176,166), S(112,197), S( 69,194) },
+   { S(122, 87), S(159,164), S( 85,174), S( 36,189) },
+   { S( 87, 40), S(120, 99), S( 64,128), S( 25,141) },
+   { S( 64,  5), S( 87, 60), S( 49, 75), S(  0, 75) }
+  }
+};
+
+// PBonus[Rank][File] contains the pawn bonuses, which are not symmetric.
+
+static const Score PBonus[8][8] = {
+  { },
+  { S(  0,-10), S( -5,-3), S( 10, 7), S( 13,-1), S( 21,  7), S( 17,  6), S(  6, 1), S( -3,-20) },
+  { S(-11, -6), S(-10,-6), S( 15,-1), S( 22,-1), S( 26, -1), S( 28,  2), S(  4,-2), S(-24, -5) },
+  { S( -9,  4), S(-18,-5), S(  8,-4), S( 22,-5), S( 33, -6), S( 25,-13), S( -4,-3), S(-16, -7) },
+  { S(  6, 18), S( -3, 2), S(-10, 2), S(  1,-9), S( 12,-13), S(  6, -8), S(-12,11), S(  1,  9) },
+  { S( -6, 25), S( -8,17), S(  5,19), S( 11,29), S(-14, 29), S(  0,  8), S(-12, 4), S(-14, 12) },
+  { S(-10, -1), S(  6,-6), S( -5,18), S(-11,22), S( -2, 22), S(-14, 17), S( 12, 2), S( -1,  9) }
+};
+
+// MobilityBonus[PieceType] is the bonus per square a piece attacks in the
+// mobility area. Mobility is linear in the number of squares, so that the
+// total over all pieces of a type can be counted set-wise.
+
+const Score MobilityBonus[8] = {
+  0, 0, S(8, 8), S(10, 10), S(6, 12), S(4, 7)
+};
+
+// Pawn structure terms: penalties for isolated pawns and for pawns with a
+// pawn of the same color directly behind, and a bonus for passed pawns by
+// rank.
+
+const Score Isolated = S(5, 15);
+const Score Doubled  = S(11, 56);
+
+const Score PassedRank[8] = {
+  0, S(5, 18), S(12, 23), S(10, 31), S(57, 62), S(163, 167), S(271, 250)
+};
+
+#undef S
+
+Score PSQT[16][64];
+
+// psqt_init() expands the half-board tables into PSQT[piece][square], from
+// white's point of view: black entries are negated.
+
+void psqt_init(void) {
+  for (int pt = PAWN; pt <= KING; ++pt)
+    for (Square s = 0; s < 64; ++s) {
+      int f = file_of(s) < FILE_E ? file_of(s) : FILE_H - file_of(s);
+      Score score = pt == PAWN ? PBonus[rank_of(s)][file_of(s)] : Bonus[pt][rank_of(s)][f];
+      PSQT[make_piece(WHITE, pt)][s] = score;
+      PSQT[make_piece(BLACK, pt)][s ^ 0x38] = -score;
+    }
+}
+
+// eval_param() returns the current value of tuned parameter i.
+
+Score eval_param(int i) {
+  if (i < TUNE_PAWNS)
+    return Bonus[KNIGHT + (i - TUNE_PSQT) / 32][(i - TUNE_PSQT) / 4 % 8][(i - TUNE_PSQT) % 4];
+  if (i < TUNE_MOBILITY)
+    return PBonus[RANK_2 + (i - TUNE_PAWNS) / 8][(i - TUNE_PAWNS) % 8];
+  if (i < TUNE_ISOLATED)
+    return MobilityBonus[KNIGHT + i - TUNE_MOBILITY];
+  if (i == TUNE_ISOLATED)
+    return -Isolated;
+  if (i == TUNE_DOUBLED)
+    return -Doubled;
+  return PassedRank[RANK_2 + i - TUNE_PASSED];
+}
+
+// psqt_index() returns the parameter of the piece-square bonus of a white
+// piece on square s.
+
+INLINE int psqt_index(int pt, Square s) {
+  if (pt == PAWN)
+    return TUNE_PAWNS + (rank_of(s) - RANK_2) * 8 + file_of(s);
+  int f = file_of(s) < FILE_E ? file_of(s) : FILE_H - file_of(s);
+  return TUNE_PSQT + (pt - KNIGHT) * 32 + rank_of(s) * 4 + f;
+}
+
+// pawn_structure() scores the pawns 'us', moving north, against the enemy
+// pawns 'them'. Black pawns are scored on the flipped board. With a trace
+// the count of every term is added to coeff with the given sign.
+
+INLINE Score pawn_structure(Bitboard us, Bitboard them, int16_t *coeff, int sign) {
+  Score score = SCORE_ZERO;
+  Bitboard files = north_fill(us) | south_fill(us);
+  Bitboard span = south_fill(them >> 8);
+  span |= shift_bb(EAST, span) | shift_bb(WEST, span);
+  int isolated = popcount(us & ~(shift_bb(EAST, files) | shift_bb(WEST, files)));
+  int doubled = popcount(us & (us << 8));
+
+  score -= Isolated * isolated;
+  score -= Doubled * doubled;
+  if (coeff) {
+    coeff[TUNE_ISOLATED] += sign * isolated;
+    coeff[TUNE_DOUBLED] += sign * doubled;
+  }
+  for (Bitboard b = us & ~span; b; b &= b - 1) {
+    score += PassedRank[rank_of(lsb(b))];
+    if (coeff)
+      coeff[TUNE_PASSED + rank_of(lsb(b)) - RANK_2] += sign;
+  }
+  return score;
+}
+
+// mobility() scores the squares attacked by the pieces of color c in the
+// mobility area: squares not occupied by own pieces nor attacked by enemy
+// pawns. attack_info() counts them.
+
+static Score mobility(AttackInfo *ai, int c) {
+  Score score = SCORE_ZERO;
+  for (int pt = KNIGHT; pt <= QUEEN; ++pt)
+    score += MobilityBonus[pt] * ai->mobility[c][pt];
+  return score;
+}
+
+// taper() blends the middlegame and endgame values of a score from white's
+// point of view by the non-pawn material, and returns the result from the
+// point of view of the side to move. The batch evaluator shares it.
+
+Value taper(Score score, Value npm, int side) {
+  npm = npm < EndgameLimit ? EndgameLimit : npm > MidgameLimit ? MidgameLimit : npm;
+  int phase = ((npm - EndgameLimit) * PHASE_MIDGAME) / (MidgameLimit - EndgameLimit);
+  Value mg = mg_value(score), eg = eg_value(score);
+  Value v = (mg * phase + eg * (PHASE_MIDGAME - phase)) / PHASE_MIDGAME;
+
+  return (side == WHITE ? v : -v) + Tempo;
+}
+
+// evaluate_kpk() returns the value of a KPK position, given the pieces of
+// both sides and the pawn, for the side to move: a draw, or a known win
+// that grows as the pawn advances, so that the search makes progress.
+
+Value evaluate_kpk(Bitboard white, Bitboard black, Bitboard pawns, int side) {
+  int strong = pawns & white ? WHITE : BLACK;
+  Bitboard strongBB = strong == WHITE ? white : black;
+  Square strongKsq = lsb(strongBB & ~pawns), psq = lsb(pawns);
+  Square weakKsq = lsb(strong == WHITE ? black : white);
+
+  // Normalize to white with the pawn on files A-D
+  if (strong == BLACK)
+    strongKsq ^= 56, psq ^= 56, weakKsq ^= 56;
+  if (file_of(psq) > FILE_D)
+    strongKsq ^= 7, psq ^= 7, weakKsq ^= 7;
+
+  if (!kpk_probe(strongKsq, psq, weakKsq, strong == side ? WHITE : BLACK))
+    return VALUE_DRAW;
+
+  Value v = VALUE_KNOWN_WIN + PawnValueEg + rank_of(psq);
+  return strong == side ? v : -v;
+}
+
+// evaluate_terms() is the evaluation of a position that is not KPK. With a
+// trace it also records the evaluation as a linear function of the tuned
+// parameters; evaluate_ai() passes none, and the compiler drops the trace.
+
+INLINE Value evaluate_terms(Position *pos, AttackInfo *ai, EvalTrace *t) {
+  Score material = SCORE_ZERO, score = SCORE_ZERO;
+  Value npm = 0;
+
+  for (int c = WHITE; c <= BLACK; ++c)
+    for (int pt = PAWN; pt <= KING; ++pt) {
+      int piece = make_piece(c, pt);
+      int n = pos->count[piece];
+      Score m = make_score(PieceValue[MG][piece], PieceValue[EG][piece]);
+      material += c == WHITE ? n * m : -n * m;
+      if (pt != PAWN)
+        npm += n * PieceValue[MG][piece];
+      for (int i = 0; i < n; ++i) {
+        score += PSQT[piece][pos->lists[piece][i]];
+        if (t)
+          t->coeff[psqt_index(pt, pos->lists[piece][i] ^ (c == WHITE ? 0 : 0x38))] += c == WHITE ? 1 : -1;
+      }
+    }
+
+  score += mobility(ai, WHITE) - mobility(ai, BLACK);
+  score +=  pawn_structure(pos->pawns[WHITE], pos->pawns[BLACK], t ? t->coeff : NULL, 1)
+          - pawn_structure(flip_bb(pos->pawns[BLACK]), flip_bb(pos->pawns[WHITE]), t ? t->coeff : NULL, -1);
+
+  if (t) {
+    for (int pt = KNIGHT; pt <= QUEEN; ++pt)
+      t->coeff[TUNE_MOBILITY + pt - KNIGHT] = ai->mobility[WHITE][pt] - ai->mobility[BLACK][pt];
+    t->base = material;
+    t->npm = npm;
+    t->side = pos->side;
+  }
+  return taper(material + score, npm, pos->side);
+}
+
+// evaluate_ai() returns a static, tapered evaluation of the position from
+// the point of view of the side to move, given the attack info of the
+// node. evaluate() computes the attack info first. It is the reference for
+// the batch evaluator in evalbatch.c, which must return the same values.
+
+Value evaluate_ai(Position *pos, AttackInfo *ai) {
+  stats_inc(STAT_EVALUATE);
+  if (is_kpk(pieces(pos), pos->types[PAWN]))
+    return evaluate_kpk(pos->occupied[WHITE], pos->occupied[BLACK], pos->types[PAWN], pos->side);
+
+  return evaluate_terms(pos, ai, NULL);
+}
+
+Value evaluate(Position *pos) {
+  AttackInfo ai;
+  attack_info(pos, &ai);
+  return evaluate_ai(pos, &ai);
+}
+
+// evaluate_trace() returns the evaluation of the position like evaluate()
+// and fills the trace of it for the tuner.
+
+Value evaluate_trace(Position *pos, EvalTrace *t) {
+  AttackInfo ai;
+
+  memset(t, 0, sizeof(*t));
+  t->linear = !is_kpk(pieces(pos), pos->types[PAWN]);
+  if (!t->linear)
+    return evaluate(pos);
+  attack_info(pos, &ai);
+  return evaluate_terms(pos, &ai, t);
+}
@@ -0,0 +1,70 @@
+#ifndef EVALUATE_H_INCLUDED
+#define EVALUATE_H_INCLUDED
+
+#include "position.h"
+
+enum {
+  PawnValueMg   = 136,   PawnValueEg   = 208,
+  KnightValueMg = 782,   KnightValueEg = 865,
+  BishopValueMg = 830,   BishopValueEg = 918,
+  RookValueMg   = 1289,  RookValueEg   = 1378,
+  QueenValueMg  = 2529,  QueenValueEg  = 2687,
+
+  MidgameLimit  = 15258, EndgameLimit  = 3915
+};
+
+enum { Tempo = 20 };
+
+extern Value PieceValue[2][16];
+extern Score PSQT[16][64];
+extern const Score MobilityBonus[8];
+extern const Score Isolated, Doubled;
+extern const Score PassedRank[8];
+
+// The tuned evaluation parameters, indexed in this order: the piece-square
+// bonuses of knights to kings by piece, rank and file A-D, those of pawns
+// by rank 2-7 and file, the mobility bonuses of knights to queens, the
+// isolated and doubled pawn penalties and the passed pawn bonuses by rank
+// 2-7. The material values are not tuned.
+
+enum {
+  TUNE_PSQT = 0, TUNE_PAWNS = TUNE_PSQT + 5 * 32, TUNE_MOBILITY = TUNE_PAWNS + 6 * 8,
+  TUNE_ISOLATED = TUNE_MOBILITY + 4, TUNE_DOUBLED, TUNE_PASSED,
+  TUNE_NB = TUNE_PASSED + 6
+};
+
+// EvalTrace holds the evaluation as a linear function of the parameters:
+// the score from white's point of view is base plus the sum of coeff[i]
+// times parameter i, tapered by npm. A KPK position is not linear.
+
+typedef struct {
+  Score base;
+  Value npm;
+  int side;
+  bool linear;
+  int16_t coeff[TUNE_NB];
+} EvalTrace;
+
+void psqt_init(void);
+Score eval_param(int i);
+Value evaluate_trace(Position *pos, EvalTrace *t);
+Value taper(Score score, Value npm, int side);
+Value evaluate_kpk(Bitboard white, Bitboard black, Bitboard pawns, int side);
+Value evaluate_ai(Position *pos, AttackInfo *ai);
+Value evaluate(Position *pos);
+
+// is_kpk() tells whether the men on the board are two kings and one pawn.
+
+INLINE bool is_kpk(Bitboard occupied, Bitboard pawns)
+{
+  return popcount(occupied) == 3 && popcount(pawns) == 1;
+}
+
+// to_cp() converts an internal value to centipawns.
+
+INLINE int to_cp(Value v)
+{
+  return v * 100 / PawnValueEg;
+}
+
+#endif
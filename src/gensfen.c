@@ -0,0 +1,229 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "evaluate.h"
+#include "gensfen.h"
+#include "movegen.h"
+#include "packed.h"
+#include "search.h"
+#include "tt.h"
+
+// gensfen plays self-play games on all threads and records the positions
+// reached, with the search score and the final game result, as packed
+// records. Games start from the initial position followed by a number of
+// random plies. Positions in check and positions whose best move is a
+// capture or a promotion are not recorded: they are not quiet, so their
+// static evaluation is a poor training target.
+
+enum { MAX_GAME_PLY = 1024 };
+
+typedef struct {
+  SearchLimits limits;
+  int randomPlies;
+  int maxPly;
+  Value evalLimit;
+  uint64_t target;
+  uint64_t seed;
+
+  PackedWriter writer;
+  uint64_t positions, games;  // Under the mutex
+  bool stop;
+  pthread_mutex_t mutex;
+} Gensfen;
+
+typedef struct {
+  Gensfen *g;
+  int idx;
+} GensfenWorker;
+
+// insufficient_material() detects bare kings, and a lone minor piece
+// against a bare king.
+
+static bool insufficient_material(Position *pos) {
+  if (pos->pawns[WHITE] | pos->pawns[BLACK])
+    return false;
+  int minors = 0;
+  for (int c = WHITE; c <= BLACK; ++c) {
+    if (pos->count[make_piece(c, ROOK)] || pos->count[make_piece(c, QUEEN)])
+      return false;
+    minors += pos->count[make_piece(c, KNIGHT)] + pos->count[make_piece(c, BISHOP)];
+  }
+  return minors <= 1;
+}
+
+// random_opening() plays random legal moves from the start position. It
+// returns false if the game ended during the opening.
+
+static bool random_opening(Position *pos, int plies, uint64_t *rng) {
+  Movelist list;
+
+  parse_fen(pos, START_FEN);
+  for (int i = 0; i < plies; ++i) {
+    generate_all_moves(pos, &list);
+    if (!list.count)
+      return false;
+    do_move(pos, list.moves[prng_rand(rng) % list.count].move);
+  }
+  generate_all_moves(pos, &list);
+  return list.count > 0;
+}
+
+// play_game() plays one game and returns the number of recorded positions.
+// The result, from white's point of view, is stored into every record.
+
+static int play_game(Gensfen *g, SearchInfo *si, uint64_t *rng, PackedPos *records) {
+  Position pos;
+  Movelist list;
+  Key keys[MAX_GAME_PLY];
+  int n = 0, result;
+
+  while (!random_opening(&pos, g->randomPlies, rng)) {}
+  pos.history = keys;
+  pos.historyLen = 0;
+  search_clear(si);
+
+  for (int ply = 0; ; ++ply) {
+    generate_all_moves(&pos, &list);
+    if (!list.count) {
+      result = !in_check(&pos) ? RESULT_DRAW
+             : pos.side == WHITE ? RESULT_BLACK_WIN : RESULT_WHITE_WIN;
+      break;
+    }
+    if (is_draw(&pos, 0) || insufficient_material(&pos) || ply >= g->maxPly || ply == MAX_GAME_PLY) {
+      result = RESULT_DRAW;
+      break;
+    }
+
+    search_init(si, &pos, &g->limits);
+    search_start(si);
+    Move best = si->pv[0];
+
+    if (abs(si->score) >= g->evalLimit) {
+      result = (si->score > 0) == (pos.side == WHITE) ? RESULT_WHITE_WIN : RESULT_BLACK_WIN;
+      break;
+    }
+
+    if (   !in_check(&pos)
+        && !pos.board[to_sq(best)]
+        && type_of_m(best) != ENPASSANT
+        && type_of_m(best) != PROMOTION) {
+      pack_position(&pos, &records[n]);
+      records[n++].score = si->score;
+    }
+    do_move(&pos, best);
+  }
+
+  for (int i = 0; i < n; ++i)
+    records[i].result = result;
+  return n;
+}
+
+static void *gensfen_worker(void *arg) {
+  GensfenWorker *w = arg;
+  Gensfen *g = w->g;
+  SearchInfo *si = search_new();
+  PackedPos *records = malloc(MAX_GAME_PLY * sizeof(PackedPos));
+  uint64_t rng;
+
+  prng_init(&rng, g->seed + 0x9E3779B97F4A7C15ULL * (w->idx + 1));
+
+  while (!__atomic_load_n(&g->stop, __ATOMIC_RELAXED)) {
+    int n = play_game(g, si, &rng, records);
+
+    pthread_mutex_lock(&g->mutex);
+    for (int i = 0; i < n && g->positions < g->target; ++i, ++g->positions)
+      packed_write(&g->writer, &records[i]);
+    ++g->games;
+    if (g->positions >= g->target)
+      __atomic_store_n(&g->stop, true, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&g->mutex);
+  }
+
+  free(records);
+  search_delete(si);
+  return NULL;
+}
+
+// gensfen_cmd() parses "gensfen [depth N] [nodes N] [count N] [threads N]
+// [random N] [maxply N] [evallimit CP] [seed N] [hash MB] [output FILE]" and runs the
+// generator, reporting progress on stderr every few seconds.
+
+void gensfen_cmd(int argc, char **argv) {
+  const char *output = "gensfen.bin";
+  int threads = cpu_count();
+  Gensfen g;
+
+  memset(&g, 0, sizeof(g));
+  g.randomPlies = 8;
+  g.maxPly = 400;
+  g.evalLimit = 3000 * PawnValueEg / 100;
+  g.target = 1000000;
+  g.seed = now();
+
+  for (int i = 0; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "depth"))
+      g.limits.depth = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "nodes"))
+      g.limits.nodes = strtoull(argv[i + 1], NULL, 10);
+    else if (!strcmp(argv[i], "count"))
+      g.target = strtoull(argv[i + 1], NULL, 10);
+    else if (!strcmp(argv[i], "threads"))
+      threads = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "random"))
+      g.randomPlies = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "maxply"))
+      g.maxPly = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "evallimit"))
+      g.evalLimit = atoi(argv[i + 1]) * PawnValueEg / 100;
+    else if (!strcmp(argv[i], "seed"))
+      g.seed = strtoull(argv[i + 1], NULL, 10);
+    else if (!strcmp(argv[i], "hash"))
+      tt_resize(atoi(argv[i + 1]));
+    else if (!strcmp(argv[i], "output"))
+      output = argv[i + 1];
+  }
+  if (!g.limits.depth && !g.limits.nodes)
+    g.limits.depth = 6;
+  if (threads < 1)
+    threads = 1;
+
+  if (!packed_writer_open(&g.writer, output, true)) {
+    fprintf(stderr, "gensfen: cannot open %s\n", output);
+    exit(EXIT_FAILURE);
+  }
+  pthread_mutex_init(&g.mutex, NULL);
+
+  pthread_t *handles = malloc(threads * sizeof(pthread_t));
+  GensfenWorker *workers = malloc(threads * sizeof(GensfenWorker));
+  TimePoint start = now(), last = start;
+  for (int i = 0; i < threads; ++i) {
+    workers[i] = (GensfenWorker){ &g, i };
+    pthread_create(&handles[i], NULL, gensfen_worker, &workers[i]);
+  }
+
+  for (bool stop = false; !stop; ) {
+    usleep(100000);
+    stop = __atomic_load_n(&g.stop, __ATOMIC_RELAXED);
+    if (now() - last >= 5000 || stop) {
+      pthread_mutex_lock(&g.mutex);
+      uint64_t games = g.games, positions = g.positions;
+      pthread_mutex_unlock(&g.mutex);
+      last = now();
+      TimePoint elapsed = last - start + 1;
+      fprintf(stderr, "games %llu positions %llu positions/hour %.0f\n",
+              (unsigned long long)games, (unsigned long long)positions,
+              positions * 3600000.0 / elapsed);
+    }
+  }
+  for (int i = 0; i < threads; ++i)
+    pthread_join(handles[i], NULL);
+
+  packed_writer_close(&g.writer);
+  fprintf(stderr, "gensfen: wrote %llu positions from %llu games to %s in %lld ms\n",
+          (unsigned long long)g.positions, (unsigned long long)g.games, output,
+          (long long)(now() - start));
+  free(workers);
+  free(handles);
+}
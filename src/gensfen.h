@@ -0,0 +1,6 @@
+#ifndef GENSFEN_H_INCLUDED
+#define GENSFEN_H_INCLUDED
+
+void gensfen_cmd(int argc, char **argv);
+
+#endif
@@ -1,10 +1,89 @@
 #include <stdio.h>
+#include <string.h>
 
+#include "batch.h"
+#include "benchmark.h"
+#include "bitbase.h"
 #include "bitboard.h"
+#include "cache.h"
+#include "cluster.h"
+#include "evalbatch.h"
+#include "evaluate.h"
+#include "gensfen.h"
+#include "mate.h"
+#include "mcts.h"
+#include "packed.h"
+#include "pgn.h"
 #include "position.h"
+#include "server.h"
+#include "stats.h"
+#include "tbgen.h"
+#include "trace.h"
+#include "tt.h"
+#include "tune.h"
 
-int main() {
+int main(int argc, char **argv) {
   bitboards_init();
   position_init();
+  bitbase_init();
+  psqt_init();
+  evalbatch_init();
+  tt_resize(16);
+
+  // "sliders magic|fill" in front of a command selects the slider attack
+  // backend for that run.
+  if (argc > 2 && !strcmp(argv[1], "sliders")) {
+    if (!sliders_select(argv[2])) {
+      fprintf(stderr, "Unsupported slider backend: %s\n", argv[2]);
+      return EXIT_FAILURE;
+    }
+    argc -= 2;
+    argv += 2;
+  }
+
+  if (argc > 1 && !strcmp(argv[1], "batch"))
+    batch_cmd(argc - 2, argv + 2);
+  else if (argc > 1 && !strcmp(argv[1], "gensfen"))
+    gensfen_cmd(argc - 2, argv + 2);
+  else if (argc > 1 && !strcmp(argv[1], "bench"))
+    bench_cmd(argc - 2, argv + 2);
+  else if (argc > 1 && !strcmp(argv[1], "microbench"))
+    microbench_cmd(argc - 2, argv + 2);
+  else if (argc > 1 && !strcmp(argv[1], "stats"))
+    stats_cmd(argc - 2, argv + 2);
+  else if (argc > 1 && !strcmp(argv[1], "evalbatch"))
+    evalbatch_cmd(argc - 2, argv + 2);
+  else if (argc > 1 && !strcmp(argv[1], "mate"))
+    mate_cmd(argc - 2, argv + 2);
+  else if (argc > 1 && !strcmp(argv[1], "mcts"))
+    mcts_cmd(argc - 2, argv + 2);
+  else if (argc > 1 && !strcmp(argv[1], "cluster"))
+    cluster_cmd(argc - 2, argv + 2);
+  else if (argc > 1 && !strcmp(argv[1], "server"))
+    server_cmd(argc - 2, argv + 2);
+  else if (argc > 1 && !strcmp(argv[1], "client"))
+    client_cmd(argc - 2, argv + 2);
+  else if (argc > 1 && !strcmp(argv[1], "loadgen"))
+    loadgen_cmd(argc - 2, argv + 2);
+  else if (argc > 1 && !strcmp(argv[1], "traceview"))
+    traceview_cmd(argc - 2, argv + 2);
+  else if (argc > 1 && !strcmp(argv[1], "cache"))
+    cache_cmd(argc - 2, argv + 2);
+  else if (argc > 1 && !strcmp(argv[1], "pack"))
+    pack_cmd(argc - 2, argv + 2);
+  else if (argc > 1 && !strcmp(argv[1], "unpack"))
+    unpack_cmd(argc - 2, argv + 2);
+  else if (argc > 1 && !strcmp(argv[1], "annotate"))
+    annotate_cmd(argc - 2, argv + 2);
+  else if (argc > 1 && !strcmp(argv[1], "tune"))
+    tune_cmd(argc - 2, argv + 2);
+  else if (argc > 1 && !strcmp(argv[1], "tbgen"))
+    tbgen_cmd(argc - 2, argv + 2);
+  else if (argc > 1 && !strcmp(argv[1], "tbprobe"))
+    tbprobe_cmd(argc - 2, argv + 2);
+  else if (argc > 1) {
+    fprintf(stderr, "Unknown command: %s\n", argv[1]);
+    return EXIT_FAILURE;
+  }
   return 0;
-}
\ No newline at end of file
+}
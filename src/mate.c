@@ -0,0 +1,480 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "mate.h"
+#include "misc.h"
+#include "movegen.h"
+
+// The solver works in the phi/delta form of df-pn: phi is the proof number
+// of the side to move at a node (the number of leaves that must still be
+// proven for it to succeed) and delta its disproof number. The attacker
+// succeeds by mating within the ply budget, the defender by escaping, so
+// that phi(n) = min delta(child) and delta(n) = sum phi(child).
+//
+// The remaining ply budget is part of a node, as a node that is lost with
+// 3 plies to go can be won with 5. Attacker nodes have an odd budget and
+// defender nodes an even one. A defender node with no budget left is won
+// by the defender unless it is mate.
+
+enum { PN_INFINITE = 1 << 30, MAX_PROOF_SIZE = 10000000 };
+
+// MateEntry is one 16 byte entry of the proof table:
+//
+//  key32   32 bits  upper bits of the position key
+//  phi     32 bits  proof number of the side to move
+//  delta   32 bits  disproof number of the side to move
+//  move    16 bits  child with the smallest delta, the proving move once
+//                   phi is 0
+//  depth    8 bits  remaining plies
+//  work     8 bits  log2 of the nodes searched below the entry
+//
+// phi and delta are never both 0, which marks an empty entry. The entry
+// with the least work is replaced first; solved entries are kept longer,
+// as the mate is read back from them.
+
+typedef struct {
+  uint32_t key32;
+  uint32_t phi, delta;
+  uint16_t move;
+  uint8_t depth;
+  uint8_t work;
+} MateEntry;
+
+enum { MATE_CLUSTER_SIZE = 4 };
+
+typedef struct {
+  MateEntry entry[MATE_CLUSTER_SIZE];
+} MateCluster;
+
+_Static_assert(sizeof(MateCluster) == 64, "MateCluster must be 64 bytes");
+
+static MateCluster *MateTable;
+static size_t MateClusterCount;
+
+typedef struct {
+  MateLimits limits;
+  uint64_t nodes;
+  bool stop;
+} Solver;
+
+// mate_tt_resize() sets the size of the proof table in megabytes and
+// clears it.
+
+void mate_tt_resize(size_t mbSize) {
+  size_t clusterCount = mbSize * 1024 * 1024 / sizeof(MateCluster);
+  if (clusterCount != MateClusterCount) {
+    free(MateTable);
+    MateTable = aligned_alloc(64, clusterCount * sizeof(MateCluster));
+    if (!MateTable) {
+      fprintf(stderr, "Failed to allocate %zuMB for the proof table\n", mbSize);
+      exit(EXIT_FAILURE);
+    }
+    MateClusterCount = clusterCount;
+  }
+  memset(MateTable, 0, MateClusterCount * sizeof(MateCluster));
+}
+
+void mate_tt_free(void) {
+  free(MateTable);
+  MateTable = NULL;
+  MateClusterCount = 0;
+}
+
+INLINE MateCluster *mate_cluster(Key key) {
+  return &MateTable[((uint32_t)key * (uint64_t)MateClusterCount) >> 32];
+}
+
+static MateEntry *mate_probe(Key key, int depth) {
+  MateCluster *c = mate_cluster(key);
+  for (int i = 0; i < MATE_CLUSTER_SIZE; ++i)
+    if (   c->entry[i].key32 == (uint32_t)(key >> 32) && c->entry[i].depth == depth
+        && (c->entry[i].phi | c->entry[i].delta))
+      return &c->entry[i];
+  return NULL;
+}
+
+static void mate_store(Key key, int depth, uint32_t phi, uint32_t delta, Move m, uint64_t nodes) {
+  MateEntry *e = mate_probe(key, depth);
+  if (!e) {
+    MateCluster *c = mate_cluster(key);
+    int worth = INT_MAX;
+    for (int i = 0; i < MATE_CLUSTER_SIZE; ++i) {
+      MateEntry *r = &c->entry[i];
+      int w = !(r->phi | r->delta) ? -1 : r->work + (!r->phi || !r->delta) * 16;
+      if (w < worth) {
+        worth = w;
+        e = r;
+      }
+    }
+  }
+  int work = 0;
+  while (nodes >>= 1)
+    ++work;
+  e->key32 = key >> 32;
+  e->phi = phi;
+  e->delta = delta;
+  e->move = m;
+  e->depth = depth;
+  e->work = work;
+}
+
+// lookup() returns the numbers of a node from the table, or 1 and 1 for a
+// node not searched yet.
+
+INLINE void lookup(Key key, int depth, uint32_t *phi, uint32_t *delta) {
+  MateEntry *e = mate_probe(key, depth);
+  *phi = e ? e->phi : 1;
+  *delta = e ? e->delta : 1;
+}
+
+// mid() searches the node until its phi reaches thPhi or its delta reaches
+// thDelta, always descending into the child with the smallest delta. The
+// child gets just enough of the thresholds to overtake the second best,
+// so that the search moves on once another child looks more promising.
+// The result is left in the table.
+
+static void mid(Solver *s, Position *pos, int depth, uint32_t thPhi, uint32_t thDelta) {
+  ExtMove moves[MAX_MOVES];
+  Key keys[MAX_MOVES];
+  bool attacker = depth & 1;
+  uint64_t start = s->nodes++;
+  int n = 0;
+
+  if (s->limits.nodes && s->nodes >= s->limits.nodes)
+    s->stop = true;
+
+  // Only the checks of the attacker are made, found from the attack maps
+  AttackInfo ai;
+  bool checksOnly = attacker && s->limits.checksOnly;
+  if (checksOnly)
+    attack_info(pos, &ai);
+
+  ExtMove *end = generate_moves(pos, moves);
+  for (ExtMove *m = moves; m < end; ++m) {
+    if (checksOnly && !gives_check(pos, &ai, m->move))
+      continue;
+    Position child = *pos;
+    do_move(&child, m->move);
+    moves[n].move = m->move;
+    keys[n++] = child.key;
+  }
+
+  // Mate, stalemate, an attacker without checks and a defender who has
+  // survived the budget end the search at the node.
+  if (end == moves || !n || !depth) {
+    bool lost = end == moves ? in_check(pos) || attacker : attacker;
+    mate_store(pos->key, depth, lost ? PN_INFINITE : 0, lost ? 0 : PN_INFINITE,
+               MOVE_NONE, 1);
+    return;
+  }
+
+  while (true) {
+    uint32_t phi = PN_INFINITE, delta = 0, delta2 = PN_INFINITE, bestPhi = 1;
+    int best = 0;
+
+    for (int i = 0; i < n; ++i) {
+      uint32_t cPhi, cDelta;
+      lookup(keys[i], depth - 1, &cPhi, &cDelta);
+      delta = delta + cPhi < PN_INFINITE ? delta + cPhi : PN_INFINITE;
+      if (cDelta < phi) {
+        delta2 = phi;
+        phi = cDelta;
+        bestPhi = cPhi;
+        best = i;
+      }
+      else if (cDelta < delta2)
+        delta2 = cDelta;
+    }
+
+    if (phi >= thPhi || delta >= thDelta || s->stop) {
+      mate_store(pos->key, depth, phi, delta, moves[best].move, s->nodes - start);
+      return;
+    }
+
+    Position child = *pos;
+    do_move(&child, moves[best].move);
+    uint32_t childPhi = thDelta - delta + bestPhi;
+    uint32_t childDelta = delta2 < thPhi - 1 ? delta2 + 1 : thPhi;
+    mid(s, &child, depth - 1, childPhi < PN_INFINITE ? childPhi : PN_INFINITE, childDelta);
+  }
+}
+
+// proven() returns the table entry of an attacker node if it is proven,
+// searching the node again if the entry has been replaced.
+
+static MateEntry *proven(Solver *s, Position *pos, int depth) {
+  MateEntry *e = mate_probe(pos->key, depth);
+  if (!e || (e->phi && e->delta)) {
+    mid(s, pos, depth, PN_INFINITE, PN_INFINITE);
+    e = mate_probe(pos->key, depth);
+  }
+  return e && !e->phi && e->move ? e : NULL;
+}
+
+// The proof tree is a graph: transpositions reach the same attacker node
+// along several lines. walk() remembers the mate length of the attacker
+// nodes it has read back in a ProofMap, so that each is walked only once.
+
+enum { PROOF_MAP_SIZE = 1 << 18 };
+
+typedef struct {
+  Key key;
+  int len;
+} ProofNode;
+
+typedef struct {
+  ProofNode *nodes;
+  uint64_t size;
+} ProofMap;
+
+INLINE Key proof_key(Position *pos, int depth) {
+  return pos->key ^ (depth * 0x9E3779B97F4A7C15ULL);
+}
+
+static ProofNode *proof_slot(ProofMap *map, Key key) {
+  for (size_t i = key & (PROOF_MAP_SIZE - 1), n = 0; n < 16; ++n, i = (i + 1) & (PROOF_MAP_SIZE - 1))
+    if (!map->nodes[i].len || map->nodes[i].key == key)
+      return &map->nodes[i];
+  return NULL;
+}
+
+// walk() follows the proof tree below a proven node: the proving move at
+// attacker nodes and every reply at defender nodes. It returns the length
+// of the mate in plies, or -1 if the proof could not be read back within
+// the node budget. map->size counts the nodes of the proof tree.
+
+static int walk(Solver *s, ProofMap *map, Position *pos, int depth) {
+  if (++map->size > MAX_PROOF_SIZE || s->stop)
+    return -1;
+
+  if (depth & 1) {
+    ProofNode *slot = proof_slot(map, proof_key(pos, depth));
+    if (slot && slot->len) {
+      --map->size;
+      return slot->len - 1;
+    }
+    MateEntry *e = proven(s, pos, depth);
+    if (!e)
+      return -1;
+    Position child = *pos;
+    do_move(&child, e->move);
+    int len = walk(s, map, &child, depth - 1);
+    if (len < 0)
+      return -1;
+    if (slot) {
+      slot->key = proof_key(pos, depth);
+      slot->len = len + 2;
+    }
+    return len + 1;
+  }
+
+  ExtMove moves[MAX_MOVES];
+  ExtMove *end = generate_moves(pos, moves);
+  int len = -1;
+  if (end == moves)
+    return in_check(pos) ? 0 : -1;
+  if (!depth)
+    return -1;
+  for (ExtMove *m = moves; m < end; ++m) {
+    Position child = *pos;
+    do_move(&child, m->move);
+    int l = walk(s, map, &child, depth - 1);
+    if (l < 0)
+      return -1;
+    if (l + 1 > len)
+      len = l + 1;
+  }
+  return len;
+}
+
+// proof_pv() writes the main line of a walked proof: the proving moves of
+// the attacker against the longest defence. It returns its length.
+
+static int proof_pv(Solver *s, ProofMap *map, Position *pos, int depth, Move *pv) {
+  Position child;
+  Move best = MOVE_NONE;
+
+  if (depth & 1) {
+    MateEntry *e = proven(s, pos, depth);
+    if (!e)
+      return 0;
+    best = e->move;
+  }
+  else {
+    ExtMove moves[MAX_MOVES];
+    ExtMove *end = generate_moves(pos, moves);
+    int len = -1;
+    for (ExtMove *m = moves; m < end; ++m) {
+      child = *pos;
+      do_move(&child, m->move);
+      ProofNode *slot = proof_slot(map, proof_key(&child, depth - 1));
+      int l = slot && slot->len ? slot->len - 1 : walk(s, map, &child, depth - 1);
+      if (l > len) {
+        len = l;
+        best = m->move;
+      }
+    }
+    if (!best)
+      return 0;
+  }
+  child = *pos;
+  do_move(&child, best);
+  pv[0] = best;
+  return 1 + proof_pv(s, map, &child, depth - 1, pv + 1);
+}
+
+// mate_solve() looks for a mate in at most limits->moves moves for the side
+// to move. Once a mate is proven, shorter budgets are tried until one is
+// disproven, so that the mate reported is the shortest. If the node budget
+// runs out first, the mate found is only an upper bound and info->shortest
+// stays false. The proof table is shared and not locked: only one solver
+// may run at a time.
+
+void mate_solve(Position *pos, MateLimits *limits, MateInfo *info) {
+  Solver s = { .limits = *limits };
+  ProofMap map = { .nodes = malloc(PROOF_MAP_SIZE * sizeof(ProofNode)) };
+  Position root = *pos;
+  int moves = limits->moves < MAX_PLY / 2 ? limits->moves : MAX_PLY / 2;
+
+  if (!map.nodes) {
+    fprintf(stderr, "Failed to allocate %zu bytes for proof map\n",
+            PROOF_MAP_SIZE * sizeof(ProofNode));
+    exit(EXIT_FAILURE);
+  }
+  root.history = NULL;
+  info->result = MATE_UNKNOWN;
+  info->shortest = false;
+  info->score = VALUE_NONE;
+  info->pvlen = 0;
+  info->proofSize = 0;
+
+  while (moves > 0) {
+    int depth = 2 * moves - 1;
+    mid(&s, &root, depth, PN_INFINITE, PN_INFINITE);
+    MateEntry *e = mate_probe(root.key, depth);
+    if (s.stop || !e)
+      break;
+    if (e->phi) {
+      if (info->result == MATE_UNKNOWN)
+        info->result = MATE_DISPROVEN;
+      else
+        info->shortest = true;
+      break;
+    }
+
+    memset(map.nodes, 0, PROOF_MAP_SIZE * sizeof(ProofNode));
+    map.size = 0;
+    int len = walk(&s, &map, &root, depth);
+    if (len < 0)
+      break;
+    info->result = MATE_PROVEN;
+    info->score = mate_in(len);
+    info->pvlen = proof_pv(&s, &map, &root, depth, info->pv);
+    info->proofSize = map.size;
+    moves = (len + 1) / 2 - 1;
+  }
+  if (info->result == MATE_PROVEN && !moves)
+    info->shortest = true;
+  info->nodes = s.nodes;
+  free(map.nodes);
+}
+
+// mate_cmd() parses "mate <n> [hash MB] [nodes N] [allmoves] [output FILE]
+// [FILE|-]" and solves every FEN/EPD record of the input. Without
+// 'allmoves' the attacker is restricted to checks. The result is appended
+// as EPD opcodes: dm (moves to mate) and pv for a proven mate, acn (nodes)
+// and a comment with the proof tree size or why no mate was found. A mate
+// that the node budget kept from being proven shortest gets no dm; its
+// comment says "mate in at most N". These opcodes are removed from the
+// input line first.
+
+void mate_cmd(int argc, char **argv) {
+  MateLimits limits = { .moves = argc > 0 ? atoi(argv[0]) : 0, .checksOnly = true };
+  const char *input = "-", *output = "-";
+  size_t hash = 16;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "hash") && i + 1 < argc)
+      hash = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "nodes") && i + 1 < argc)
+      limits.nodes = strtoull(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "allmoves"))
+      limits.checksOnly = false;
+    else if (!strcmp(argv[i], "output") && i + 1 < argc)
+      output = argv[++i];
+    else
+      input = argv[i];
+  }
+  if (limits.moves < 1 || !hash) {
+    fprintf(stderr, "Usage: mate <n> [hash MB] [nodes N] [allmoves] [output FILE] [FILE|-]\n");
+    exit(EXIT_FAILURE);
+  }
+
+  FILE *in = strcmp(input, "-") ? fopen(input, "r") : stdin;
+  FILE *out = strcmp(output, "-") ? fopen(output, "w") : stdout;
+  if (!in || !out) {
+    fprintf(stderr, "mate: cannot open %s\n", in ? output : input);
+    exit(EXIT_FAILURE);
+  }
+  mate_tt_resize(hash);
+
+  uint64_t counts[3] = { 0 }, bounds = 0, invalid = 0, nodes = 0, proofNodes = 0;
+  char line[512], move[6];
+  MateInfo info;
+  Position pos;
+  TimePoint start = now();
+
+  while (fgets(line, sizeof(line), in)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (!line[0] || line[0] == '#')
+      continue;
+    const char *ops = parse_fen(&pos, line);
+    if (!ops) {
+      fprintf(out, "# invalid: %s\n", line);
+      ++invalid;
+      continue;
+    }
+    epd_strip(line, ops, "dm pv acn c0");
+
+    mate_tt_resize(hash);
+    mate_solve(&pos, &limits, &info);
+    counts[info.result]++;
+    nodes += info.nodes;
+    proofNodes += info.proofSize;
+
+    fprintf(out, "%s%s", line, strchr(line, ';') ? "" : " ;");
+    if (info.result == MATE_PROVEN) {
+      int dm = (VALUE_MATE - info.score + 1) / 2;
+      bounds += !info.shortest;
+      if (info.shortest)
+        fprintf(out, " dm %d;", dm);
+      fprintf(out, " pv");
+      for (int i = 0; i < info.pvlen; ++i)
+        fprintf(out, " %s", move_str(info.pv[i], move));
+      fprintf(out, "; acn %llu; c0 \"", (unsigned long long)info.nodes);
+      if (!info.shortest)
+        fprintf(out, "mate in at most %d, ", dm);
+      fprintf(out, "proof tree %llu nodes\";\n", (unsigned long long)info.proofSize);
+    }
+    else
+      fprintf(out, " acn %llu; c0 \"%s\";\n", (unsigned long long)info.nodes,
+              info.result == MATE_DISPROVEN ? "no mate" : "unknown");
+  }
+
+  TimePoint elapsed = now() - start + 1;
+  fflush(out);
+  fprintf(stderr, "positions %llu proven %llu (not shortest %llu) disproven %llu unknown %llu"
+          " invalid %llu time %lld ms nodes %llu nps %llu proof nodes %llu\n",
+          (unsigned long long)(counts[0] + counts[1] + counts[2]),
+          (unsigned long long)counts[MATE_PROVEN], (unsigned long long)bounds,
+          (unsigned long long)counts[MATE_DISPROVEN],
+          (unsigned long long)counts[MATE_UNKNOWN], (unsigned long long)invalid,
+          (long long)elapsed, (unsigned long long)nodes,
+          (unsigned long long)(nodes * 1000 / elapsed), (unsigned long long)proofNodes);
+
+  if (in != stdin)
+    fclose(in);
+  if (out != stdout)
+    fclose(out);
+  mate_tt_free();
+}
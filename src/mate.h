@@ -0,0 +1,33 @@
+#ifndef MATE_H_INCLUDED
+#define MATE_H_INCLUDED
+
+#include "position.h"
+
+// The mate solver proves or disproves a forced mate of bounded length with
+// depth-first proof-number search (df-pn). Proof and disproof numbers are
+// kept in a dedicated table of bounded size, separate from the search TT.
+
+typedef struct {
+  int moves;          // longest mate to look for, in moves of the attacker
+  bool checksOnly;    // the attacker only plays checking moves
+  uint64_t nodes;     // node budget, 0 for none
+} MateLimits;
+
+typedef enum { MATE_UNKNOWN, MATE_PROVEN, MATE_DISPROVEN } MateResult;
+
+typedef struct {
+  MateResult result;
+  bool shortest;      // a proven mate is known to be the shortest
+  Value score;        // mate_in() of the mate found, VALUE_NONE otherwise
+  int pvlen;
+  Move pv[MAX_PLY];
+  uint64_t nodes;
+  uint64_t proofSize; // nodes of the proof tree walked to extract the mate
+} MateInfo;
+
+void mate_tt_resize(size_t mbSize);
+void mate_tt_free(void);
+void mate_solve(Position *pos, MateLimits *limits, MateInfo *info);
+void mate_cmd(int argc, char **argv);
+
+#endif
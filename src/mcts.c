@@ -0,0 +1,606 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "evaluate.h"
+#include "mcts.h"
+#include "misc.h"
+#include "movegen.h"
+
+// A node holds the statistics of the move that leads to it, from the view
+// of the side that made the move: the sum of the results of the playouts
+// through it, each in [-1, 1], and their number. Playouts still on their
+// way down count as losses (virtual losses), so that the next thread to
+// select at the same node prefers another child. Every playout ends at a
+// leaf, which is expanded on its first visit and valued by the evaluation.
+//
+// The pool never frees single nodes. A child array is taken from its end,
+// and compact() slides the arrays that are still in use down over the
+// free space, in order, updating the index of each array in its parent.
+
+enum { NODE_LEAF, NODE_BUSY, NODE_EXPANDED, NODE_TERMINAL };
+
+typedef struct {
+  uint32_t children;     // Pool index of the first child, 0 if none
+  uint16_t move;         // Move that leads to the node
+  uint8_t childCount;
+  uint8_t state;
+  int32_t visits;        // Completed playouts
+  int32_t virtualLoss;   // Playouts below the node that are not back yet
+  float prior;
+  float valueSum;
+} MctsNode;
+
+_Static_assert(sizeof(MctsNode) == 24, "MctsNode must be 24 bytes");
+
+static const float DefaultCpuct = 1.5f;
+static const float FpuReduction = 0.3f;
+
+// The value of an evaluation v is tanh(v / ValueScale), about 0.46 for a
+// pawn up in the endgame.
+
+static const float ValueScale = 2 * PawnValueEg;
+
+struct MctsTree {
+  MctsNode *pool;        // Child arrays; index 0 is never used
+  uint64_t capacity;
+  uint64_t used;         // Next free index, past capacity once full
+  MctsNode root;
+  Position pos;
+  Key keys[MAX_HISTORY + MAX_PLY];
+  float cpuct;
+  uint64_t reused;
+
+  SearchLimits limits;
+  TimePoint start;
+  uint64_t playouts;
+  bool stop, full;
+};
+
+INLINE float load_float(float *p) {
+  float v;
+  __atomic_load(p, &v, __ATOMIC_RELAXED);
+  return v;
+}
+
+INLINE void add_float(float *p, float x) {
+  float cur = load_float(p), next;
+  do
+    next = cur + x;
+  while (!__atomic_compare_exchange(p, &cur, &next, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+// mcts_new() allocates a tree whose pool fills the given megabytes.
+
+MctsTree *mcts_new(size_t mbSize) {
+  MctsTree *t = calloc(1, sizeof(MctsTree));
+  uint64_t capacity = mbSize * 1024 * 1024 / sizeof(MctsNode);
+
+  if (capacity > UINT32_MAX - MAX_MOVES * 1024)
+    capacity = UINT32_MAX - MAX_MOVES * 1024;
+  t->pool = aligned_alloc(64, (capacity * sizeof(MctsNode) + 63) / 64 * 64);
+  if (!t->pool || capacity < 2 * MAX_MOVES) {
+    fprintf(stderr, "Failed to allocate %zuMB for the MCTS tree\n", mbSize);
+    exit(EXIT_FAILURE);
+  }
+  t->capacity = capacity;
+  t->cpuct = DefaultCpuct;
+  reset_pos(&t->pos);
+  mcts_set_position(t, &t->pos);
+  return t;
+}
+
+void mcts_delete(MctsTree *t) {
+  free(t->pool);
+  free(t);
+}
+
+// mcts_set_position() empties the tree and sets its root. As in
+// search_init(), the last keys of the game are kept for repetitions.
+
+void mcts_set_position(MctsTree *t, Position *pos) {
+  int n = pos->history ? pos->historyLen : 0;
+  if (n > pos->rule)
+    n = pos->rule;
+  if (n > MAX_HISTORY)
+    n = MAX_HISTORY;
+  if (n)
+    memmove(t->keys, pos->history + pos->historyLen - n, n * sizeof(Key));
+
+  t->pos = *pos;
+  t->pos.history = t->keys;
+  t->pos.historyLen = n;
+  memset(&t->root, 0, sizeof(t->root));
+  t->used = 1;
+  t->reused = 0;
+}
+
+// Compaction keeps the child arrays of the expanded nodes reached from the
+// root whose visits reach a threshold; the other nodes become leaves again.
+
+typedef struct {
+  uint32_t start, count;
+  uint32_t newStart;
+  MctsNode *parent;
+} Block;
+
+static uint64_t count_kept(MctsTree *t, MctsNode *node, int threshold, uint64_t *blocks) {
+  if (node->state != NODE_EXPANDED || (node != &t->root && node->visits < threshold))
+    return 0;
+
+  MctsNode *child = t->pool + node->children;
+  uint64_t n = node->childCount;
+  ++*blocks;
+  for (int i = 0; i < node->childCount; ++i)
+    n += count_kept(t, child + i, threshold, blocks);
+  return n;
+}
+
+static void collect_blocks(MctsTree *t, MctsNode *node, int threshold, Block *blocks, uint64_t *n) {
+  if (node->state != NODE_EXPANDED)
+    return;
+  if (node != &t->root && node->visits < threshold) {
+    node->children = 0;
+    node->childCount = 0;
+    node->state = NODE_LEAF;
+    return;
+  }
+
+  MctsNode *child = t->pool + node->children;
+  blocks[(*n)++] = (Block){ node->children, node->childCount, 0, node };
+  for (int i = 0; i < node->childCount; ++i)
+    collect_blocks(t, child + i, threshold, blocks, n);
+}
+
+static int compare_blocks(const void *a, const void *b) {
+  const Block *x = a, *y = b;
+  return (x->start > y->start) - (x->start < y->start);
+}
+
+static void compact(MctsTree *t, int threshold) {
+  uint64_t count = 0, n = 0, next = 1;
+
+  count_kept(t, &t->root, threshold, &count);
+  Block *blocks = malloc((count + 1) * sizeof(Block));
+  collect_blocks(t, &t->root, threshold, blocks, &n);
+  qsort(blocks, n, sizeof(Block), compare_blocks);
+
+  // New places are assigned in the old order, so no array moves up and
+  // none overwrites an array that has not moved yet
+  for (uint64_t i = 0; i < n; ++i) {
+    blocks[i].newStart = next;
+    blocks[i].parent->children = next;
+    next += blocks[i].count;
+  }
+  for (uint64_t i = 0; i < n; ++i)
+    memmove(t->pool + blocks[i].newStart, t->pool + blocks[i].start,
+            blocks[i].count * sizeof(MctsNode));
+  t->used = next;
+  free(blocks);
+}
+
+// prune() frees at least half of the pool, keeping the subtrees of the
+// nodes visited most.
+
+static void prune(MctsTree *t) {
+  uint64_t blocks = 0;
+  int threshold = 2;
+
+  while (   threshold <= t->root.visits
+         && count_kept(t, &t->root, threshold, &blocks) > t->capacity / 2)
+    threshold *= 2;
+  compact(t, threshold);
+}
+
+// mcts_advance() plays a move at the root and keeps its subtree, and
+// returns false if the move had no subtree to keep.
+
+bool mcts_advance(MctsTree *t, Move move) {
+  MctsNode *child = NULL;
+
+  if (t->root.state == NODE_EXPANDED)
+    for (int i = 0; i < t->root.childCount; ++i)
+      if (t->pool[t->root.children + i].move == move)
+        child = t->pool + t->root.children + i;
+
+  if (t->pos.historyLen == MAX_HISTORY) {
+    memmove(t->keys, t->keys + 1, (MAX_HISTORY - 1) * sizeof(Key));
+    t->pos.historyLen--;
+  }
+  do_move(&t->pos, move);
+  if (!child) {
+    memset(&t->root, 0, sizeof(t->root));
+    t->used = 1;
+    t->reused = 0;
+    return false;
+  }
+  t->root = *child;
+  compact(t, 0);
+  t->reused = t->used;
+  return true;
+}
+
+// set_priors() spreads the prior of the children by a softmax over move
+// features: good captures and checks up, queen promotions up and other
+// promotions down, moves that lose material down.
+
+static void set_priors(Position *pos, MctsNode *child, Movelist *list) {
+  float logit[MAX_MOVES], maxLogit = -1e9f, sum = 0;
+  AttackInfo ai;
+
+  attack_info(pos, &ai);
+  for (int i = 0; i < list->count; ++i) {
+    Move m = list->moves[i].move;
+    float l = 0;
+    if (type_of_m(m) == PROMOTION)
+      l += promotion_type(m) == QUEEN ? 2.0f : -2.0f;
+    if (pos->board[to_sq(m)] || type_of_m(m) == ENPASSANT)
+      l += see_ge(pos, m, VALUE_ZERO) ? 1.0f + PieceValue[MG][pos->board[to_sq(m)]] / 1000.0f : -0.5f;
+    else if (!see_ge(pos, m, VALUE_ZERO))
+      l -= 1.0f;
+    if (gives_check(pos, &ai, m))
+      l += 1.0f;
+    logit[i] = l;
+    if (l > maxLogit)
+      maxLogit = l;
+  }
+  for (int i = 0; i < list->count; ++i)
+    sum += logit[i] = expf(logit[i] - maxLogit);
+  for (int i = 0; i < list->count; ++i) {
+    memset(&child[i], 0, sizeof(MctsNode));
+    child[i].move = list->moves[i].move;
+    child[i].prior = logit[i] / sum;
+  }
+}
+
+// expand() gives a leaf its children, or marks it terminal if it has no
+// legal moves. It returns false if the pool is full.
+
+static bool expand(MctsTree *t, MctsNode *node, Position *pos) {
+  Movelist list;
+
+  generate_all_moves(pos, &list);
+  if (!list.count) {
+    __atomic_store_n(&node->state, NODE_TERMINAL, __ATOMIC_RELEASE);
+    return true;
+  }
+  uint64_t first = __atomic_fetch_add(&t->used, list.count, __ATOMIC_RELAXED);
+  if (first + list.count > t->capacity) {
+    __atomic_store_n(&t->full, true, __ATOMIC_RELAXED);
+    return false;
+  }
+  set_priors(pos, t->pool + first, &list);
+  node->children = first;
+  node->childCount = list.count;
+  __atomic_store_n(&node->state, NODE_EXPANDED, __ATOMIC_RELEASE);
+  return true;
+}
+
+// select_child() returns the child with the highest PUCT score. A child
+// without visits is valued as its parent, less a reduction.
+
+static MctsNode *select_child(MctsTree *t, MctsNode *node) {
+  MctsNode *child = t->pool + node->children, *best = child;
+  int visits = __atomic_load_n(&node->visits, __ATOMIC_RELAXED);
+  int parentVisits = visits + __atomic_load_n(&node->virtualLoss, __ATOMIC_RELAXED);
+  float fpu = visits ? -load_float(&node->valueSum) / visits - FpuReduction : -FpuReduction;
+  float explore = t->cpuct * sqrtf(parentVisits > 1 ? parentVisits : 1);
+  float bestScore = -1e9f;
+
+  for (int i = 0; i < node->childCount; ++i) {
+    int vl = __atomic_load_n(&child[i].virtualLoss, __ATOMIC_RELAXED);
+    int n = __atomic_load_n(&child[i].visits, __ATOMIC_RELAXED) + vl;
+    float q = n ? (load_float(&child[i].valueSum) - vl) / n : fpu;
+    float score = q + explore * child[i].prior / (1 + n);
+    if (score > bestScore) {
+      bestScore = score;
+      best = child + i;
+    }
+  }
+  return best;
+}
+
+// playout() descends from the root to a leaf, values it and adds the value
+// to the nodes of the path, for the side that moved to each.
+
+static void playout(MctsTree *t, Key *keys) {
+  MctsNode *path[MAX_PLY], *node = &t->root;
+  Position pos = t->pos;
+  int len = 0;
+  float value;
+
+  memcpy(keys, t->keys, pos.historyLen * sizeof(Key));
+  pos.history = keys;
+  while (true) {
+    path[len++] = node;
+    __atomic_fetch_add(&node->virtualLoss, 1, __ATOMIC_RELAXED);
+    if (len > 1 && is_draw(&pos, len - 1)) {
+      value = 0;
+      break;
+    }
+    // A leaf is expanded by the first thread to reach it and valued by
+    // every thread that does
+    uint8_t state = __atomic_load_n(&node->state, __ATOMIC_ACQUIRE);
+    if (state == NODE_LEAF && len < MAX_PLY) {
+      if (   __atomic_compare_exchange_n(&node->state, &state, NODE_BUSY, false,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)
+          && !expand(t, node, &pos))
+        __atomic_store_n(&node->state, NODE_LEAF, __ATOMIC_RELEASE);
+      state = __atomic_load_n(&node->state, __ATOMIC_ACQUIRE);
+      if (state == NODE_EXPANDED)
+        state = NODE_LEAF;
+    }
+    if (state != NODE_EXPANDED || len == MAX_PLY) {
+      value = state == NODE_TERMINAL ? (in_check(&pos) ? -1 : 0)
+                                     : tanhf(evaluate(&pos) / ValueScale);
+      break;
+    }
+    node = select_child(t, node);
+    do_move(&pos, node->move);
+  }
+
+  while (len--) {
+    value = -value;
+    add_float(&path[len]->valueSum, value);
+    __atomic_fetch_add(&path[len]->visits, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&path[len]->virtualLoss, 1, __ATOMIC_RELAXED);
+  }
+}
+
+static bool limits_reached(MctsTree *t) {
+  return   (t->limits.nodes && __atomic_load_n(&t->playouts, __ATOMIC_RELAXED) >= t->limits.nodes)
+        || (t->limits.movetime && now() - t->start >= t->limits.movetime);
+}
+
+static void *mcts_worker(void *arg) {
+  MctsTree *t = arg;
+  Key keys[MAX_HISTORY + MAX_PLY];
+
+  while (!__atomic_load_n(&t->stop, __ATOMIC_RELAXED)) {
+    playout(t, keys);
+    uint64_t n = __atomic_add_fetch(&t->playouts, 1, __ATOMIC_RELAXED);
+    if (   __atomic_load_n(&t->full, __ATOMIC_RELAXED)
+        || (t->limits.nodes && n >= t->limits.nodes)
+        || ((n & 255) == 0 && limits_reached(t)))
+      __atomic_store_n(&t->stop, true, __ATOMIC_RELAXED);
+  }
+  return NULL;
+}
+
+// most_visited() returns the most visited child of an expanded node.
+
+static MctsNode *most_visited(MctsTree *t, MctsNode *node) {
+  MctsNode *child = t->pool + node->children, *best = child;
+  for (int i = 1; i < node->childCount; ++i)
+    if (child[i].visits > best->visits)
+      best = child + i;
+  return best;
+}
+
+// proven_plies() returns the plies to a mate that is certain within the
+// tree, for the side that made the move to the node: positive if that side
+// mates, negative if it is mated, 0 if the tree does not prove a mate. A
+// side is mated if one of its moves is, or mates if all of its replies are.
+
+static int proven_plies(MctsTree *t, MctsNode *node) {
+  if (node->state == NODE_TERMINAL)
+    return node->valueSum > 0;
+  if (node->state != NODE_EXPANDED)
+    return 0;
+
+  MctsNode *child = t->pool + node->children;
+  int fastest = 0, slowest = 0;
+  bool all = true;
+  for (int i = 0; i < node->childCount; ++i) {
+    int p = proven_plies(t, child + i);
+    if (p > 0 && (!fastest || p < fastest))
+      fastest = p;
+    if (p >= 0)
+      all = false;
+    else if (-p > slowest)
+      slowest = -p;
+  }
+  return fastest ? -(fastest + 1) : all ? slowest + 1 : 0;
+}
+
+// best_child() returns the child of an expanded node that mates fastest,
+// else the one that is mated slowest if all are, else the most visited,
+// and stores the proven_plies() of the child returned.
+
+static MctsNode *best_child(MctsTree *t, MctsNode *node, int *plies) {
+  MctsNode *child = t->pool + node->children;
+  int proven[MAX_MOVES], best = most_visited(t, node) - child, fastest = -1, slowest = -1;
+  bool all = true;
+
+  for (int i = 0; i < node->childCount; ++i) {
+    proven[i] = proven_plies(t, child + i);
+    if (proven[i] > 0 && (fastest < 0 || proven[i] < proven[fastest]))
+      fastest = i;
+    if (proven[i] >= 0)
+      all = false;
+    else if (slowest < 0 || proven[i] < proven[slowest])
+      slowest = i;
+  }
+  if (fastest >= 0)
+    best = fastest;
+  else if (all)
+    best = slowest;
+  *plies = proven[best];
+  return child + best;
+}
+
+// mcts_search() runs playouts on all threads until the node (playout) or
+// time limit; without limits it runs 100000 playouts. If the pool fills
+// up, the threads stop while it is pruned, then go on.
+
+void mcts_search(MctsTree *t, SearchLimits *limits, int threads, MctsInfo *info) {
+  pthread_t *workers = malloc(threads * sizeof(pthread_t));
+  Movelist list;
+
+  memset(info, 0, sizeof(*info));
+  t->limits = *limits;
+  if (!t->limits.nodes && !t->limits.movetime)
+    t->limits.nodes = 100000;
+  t->start = now();
+  t->playouts = 0;
+  t->full = false;
+  info->reused = t->reused;
+
+  generate_all_moves(&t->pos, &list);
+  if (!list.count) {
+    info->score = in_check(&t->pos) ? mated_in(0) : VALUE_DRAW;
+    free(workers);
+    return;
+  }
+
+  do {
+    if (t->full) {
+      info->nodes = t->capacity;
+      prune(t);
+      info->prunes++;
+    }
+    t->stop = t->full = false;
+    for (int i = 0; i < threads; ++i)
+      pthread_create(&workers[i], NULL, mcts_worker, t);
+    for (int i = 0; i < threads; ++i)
+      pthread_join(workers[i], NULL);
+  } while (t->full && !limits_reached(t));
+  free(workers);
+
+  info->playouts = t->playouts;
+  if (!info->prunes)
+    info->nodes = t->used < t->capacity ? t->used : t->capacity;
+  info->capacity = t->capacity;
+  info->time = now() - t->start;
+
+  // Once a move is proven, the line follows the proof
+  MctsNode *best = &t->root;
+  int plies = 0;
+  if (t->root.state == NODE_EXPANDED)
+    best = best_child(t, &t->root, &plies);
+  for (MctsNode *node = best; node != &t->root && info->pvlen < MAX_PLY; ) {
+    if (!node->visits)
+      break;
+    info->pv[info->pvlen++] = node->move;
+    if (node->state != NODE_EXPANDED)
+      break;
+    int p;
+    node = plies ? best_child(t, node, &p) : most_visited(t, node);
+  }
+  info->pv[info->pvlen] = MOVE_NONE;
+
+  // The value of the best move back to a score, for the side to move
+  float q = best != &t->root && best->visits ? best->valueSum / best->visits : 0;
+  q = q > 0.999f ? 0.999f : q < -0.999f ? -0.999f : q;
+  info->score = plies > 0 ? mate_in(plies) : plies < 0 ? mated_in(1 - plies)
+                          : atanhf(q) * ValueScale;
+}
+
+// mcts_cmd() parses "mcts [nodes N] [movetime MS] [threads N] [memory MB]
+// [cpuct X] [play N] [output FILE] [FILE|-]" and searches every FEN or
+// EPD line of the input, writing it back with the EPD operations of the
+// result. With "play N" it then plays the best move N times, keeping the
+// subtree of each move for the next search.
+
+void mcts_cmd(int argc, char **argv) {
+  const char *input = "-", *output = "-";
+  SearchLimits limits = { 0 };
+  int threads = cpu_count(), plays = 0;
+  size_t memory = 256;
+  float cpuct = DefaultCpuct;
+
+  for (int i = 0; i < argc; ++i) {
+    if (!strcmp(argv[i], "nodes") && i + 1 < argc)
+      limits.nodes = strtoull(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "movetime") && i + 1 < argc)
+      limits.movetime = atoll(argv[++i]);
+    else if (!strcmp(argv[i], "threads") && i + 1 < argc)
+      threads = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "memory") && i + 1 < argc)
+      memory = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "cpuct") && i + 1 < argc)
+      cpuct = atof(argv[++i]);
+    else if (!strcmp(argv[i], "play") && i + 1 < argc)
+      plays = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "output") && i + 1 < argc)
+      output = argv[++i];
+    else
+      input = argv[i];
+  }
+  if (threads < 1)
+    threads = 1;
+
+  FILE *in = strcmp(input, "-") ? fopen(input, "r") : stdin;
+  FILE *out = strcmp(output, "-") ? fopen(output, "w") : stdout;
+  if (!in || !out) {
+    fprintf(stderr, "mcts: cannot open %s\n", in ? output : input);
+    exit(EXIT_FAILURE);
+  }
+
+  MctsTree *t = mcts_new(memory);
+  uint64_t searches = 0, playouts = 0, reused = 0, peak = 0, invalid = 0;
+  int prunes = 0;
+  char line[512], fen[128], move[8];
+  MctsInfo info;
+  Position pos;
+  TimePoint start = now();
+
+  t->cpuct = cpuct;
+  while (fgets(line, sizeof(line), in)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (!line[0] || line[0] == '#')
+      continue;
+    if (!parse_fen(&pos, line)) {
+      fprintf(out, "# invalid: %s\n", line);
+      ++invalid;
+      continue;
+    }
+
+    mcts_set_position(t, &pos);
+    for (int ply = 0; ply <= plays; ++ply) {
+      mcts_search(t, &limits, threads, &info);
+      searches++;
+      playouts += info.playouts;
+      reused += info.reused;
+      prunes += info.prunes;
+      if (info.nodes > peak)
+        peak = info.nodes;
+
+      if (!info.pvlen) {
+        fprintf(out, "%s ; c0 \"%s\";\n", pos_fen(&t->pos, fen),
+                in_check(&t->pos) ? "checkmate" : "stalemate");
+        break;
+      }
+      fprintf(out, "%s ; bm %s;", pos_fen(&t->pos, fen), move_san(&t->pos, info.pv[0], move));
+      if (abs(info.score) >= VALUE_MATE_IN_MAX_PLY)
+        fprintf(out, " dm %d;", info.score > 0 ? (VALUE_MATE - info.score + 1) / 2
+                                               : -(VALUE_MATE + info.score) / 2);
+      else
+        fprintf(out, " ce %d;", to_cp(info.score));
+      fprintf(out, " acn %llu; pv", (unsigned long long)info.playouts);
+      for (int i = 0; i < info.pvlen && i < 8; ++i)
+        fprintf(out, " %s", move_str(info.pv[i], move));
+      fprintf(out, "; c0 \"tree %llu nodes, %llu reused, %d prunes\";\n",
+              (unsigned long long)info.nodes, (unsigned long long)info.reused, info.prunes);
+      if (ply < plays)
+        mcts_advance(t, info.pv[0]);
+    }
+  }
+
+  TimePoint elapsed = now() - start + 1;
+  fflush(out);
+  fprintf(stderr, "searches %llu invalid %llu time %lld ms playouts %llu nodes/sec %llu"
+          " reused %llu prunes %d peak nodes %llu of %llu node bytes %zu threads %d\n",
+          (unsigned long long)searches, (unsigned long long)invalid, (long long)elapsed,
+          (unsigned long long)playouts, (unsigned long long)(playouts * 1000 / elapsed),
+          (unsigned long long)reused, prunes, (unsigned long long)peak,
+          (unsigned long long)t->capacity, sizeof(MctsNode), threads);
+
+  if (in != stdin)
+    fclose(in);
+  if (out != stdout)
+    fclose(out);
+  mcts_delete(t);
+}
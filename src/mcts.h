@@ -0,0 +1,35 @@
+#ifndef MCTS_H_INCLUDED
+#define MCTS_H_INCLUDED
+
+#include "search.h"
+
+// The MCTS mode grows a tree of visit counts and mean values from the root,
+// selecting moves by PUCT with priors from cheap move features and the
+// evaluation as the value of a leaf. The nodes live in a pool of fixed
+// size: the children of a node are one contiguous array of it. Threads
+// descend concurrently, steered apart by virtual losses. When the pool
+// fills up, the least visited subtrees are pruned; mcts_advance() keeps
+// the subtree of the move played for the next search.
+
+typedef struct MctsTree MctsTree;
+
+typedef struct {
+  uint64_t playouts;     // Descents of this search
+  uint64_t reused;       // Nodes kept from the previous search
+  uint64_t nodes;        // Most nodes in the pool during the search
+  uint64_t capacity;     // Nodes the pool holds
+  int prunes;            // Times the pool filled up and was pruned
+  TimePoint time;
+  Value score;           // Of the best move, for the side to move
+  int pvlen;
+  Move pv[MAX_PLY + 1];  // Best move, then the most visited line
+} MctsInfo;
+
+MctsTree *mcts_new(size_t mbSize);
+void mcts_delete(MctsTree *t);
+void mcts_set_position(MctsTree *t, Position *pos);
+bool mcts_advance(MctsTree *t, Move move);
+void mcts_search(MctsTree *t, SearchLimits *limits, int threads, MctsInfo *info);
+void mcts_cmd(int argc, char **argv);
+
+#endif
@@ -0,0 +1,42 @@
+#include <time.h>
+#include <unistd.h>
+
+#include "misc.h"
+
+// now() returns a monotonic time stamp in milliseconds.
+
+TimePoint now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (TimePoint)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// cpu_count() returns the number of online logical processors, used as the
+// default number of worker threads.
+
+int cpu_count(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+}
+
+void prng_init(uint64_t *rng, uint64_t seed) {
+  *rng = seed;
+}
+
+uint64_t prng_rand(uint64_t *rng) {
+  uint64_t s = *rng;
+
+  s ^= s >> 12;
+  s ^= s << 25;
+  s ^= s >> 27;
+  *rng = s;
+
+  return s * 2685821657736338717LL;
+}
+
+uint64_t prng_sparse_rand(uint64_t *rng) {
+  uint64_t r1 = prng_rand(rng);
+  uint64_t r2 = prng_rand(rng);
+  uint64_t r3 = prng_rand(rng);
+  return r1 & r2 & r3;
+}
@@ -0,0 +1,18 @@
+#ifndef MISC_H_INCLUDED
+#define MISC_H_INCLUDED
+
+#include "types.h"
+
+typedef int64_t TimePoint; // A value in milliseconds
+
+TimePoint now(void);
+
+// xorshift64star pseudo random number generator. It is used wherever
+// reproducible random numbers are needed, starting with the magic search.
+
+void prng_init(uint64_t *rng, uint64_t seed);
+uint64_t prng_rand(uint64_t *rng);
+uint64_t prng_sparse_rand(uint64_t *rng);
+int cpu_count(void);
+
+#endif
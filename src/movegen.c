@@ -1,157 +1,288 @@
 #include <stdio.h>
+#include <string.h>
 
 #include "movegen.h"
 #include "position.h"
 
-void add_move(Position *pos, Movelist *list, bool check, int move) {
-  if (sq_pinned(pos, from_sq(move), pos->side) == SQ_NONE) {
-    if (check) {
-      if (!move_attacked(pos, from_sq(move), to_sq(move), ~pos->side & 1)) {
-        list->moves[list->count] = move;
-        list->scores[list->count] = 0;
-        ++list->count;
-      }
-    }
-    else {
-      list->moves[list->count] = move;
-      list->scores[list->count] = 0;
-      ++list->count;
+// The generator is specialized for the side to move: every function below
+// takes the color as a constant, so that pawn directions, promotion and
+// castling ranks and the enemy piece codes fold into the code of each
+// variant. generate_moves_ai() picks the variant once per call.
+
+// add_move() appends a pseudo-legal move if it does not leave the king in
+// check, which the attack info of the node decides: the king must stay out
+// of the danger squares, evasions must capture or block the single checker
+// and pinned pieces must stay on the line of their king. En passant, which
+// can uncover a check along the rank, still pays for the full test.
+
+INLINE ExtMove *add_move(Position *pos, AttackInfo *ai, ExtMove *list, int move, const Color Us) {
+  int from = from_sq(move), to = to_sq(move);
+  int ksq = king_sq(pos, Us);
+  stats_inc(STAT_ADD_MOVE);
+  if (type_of_m(move) == ENPASSANT || from == ksq) {
+    stats_inc(STAT_KING_EP_TEST);
+    if (  from == ksq ? (ai->kingDanger & SquareBB[to])
+        : move_attacked(pos, from, to, !Us)) {
+      stats_inc(STAT_KING_EP_REJECT);
+      return list;
     }
   }
-  else if (sq_pinned(pos, from_sq(move), pos->side) == move_pinned(pos, from_sq(move), to_sq(move), pos->side)) {
-    if (check) {
-      if (!move_attacked(pos, from_sq(move), to_sq(move), ~pos->side & 1)) {
-        list->moves[list->count] = move;
-        list->scores[list->count] = 0;
-        ++list->count;
+  else {
+    if (ai->checkers) {
+      stats_inc(STAT_EVASION_TEST);
+      if (   more_than_one(ai->checkers)
+          || !((between_bb(ksq, lsb(ai->checkers)) | ai->checkers) & SquareBB[to])) {
+        stats_inc(STAT_EVASION_REJECT);
+        return list;
       }
     }
-    else {
-      list->moves[list->count] = move;
-      list->scores[list->count] = 0;
-      ++list->count;
-    }
-  }
-  else if (sq_pinned(pos, from_sq(move), pos->side) == to_sq(move)) {
-    if (check) {
-      if (!move_attacked(pos, from_sq(move), to_sq(move), ~pos->side & 1)) {
-        list->moves[list->count] = move;
-        list->scores[list->count] = 0;
-        ++list->count;
+    if (ai->pinned[Us] & SquareBB[from]) {
+      stats_inc(STAT_PINNED_TEST);
+      if (!aligned(move, ksq)) {
+        stats_inc(STAT_PINNED_REJECT);
+        return list;
       }
     }
-    else {
-      list->moves[list->count] = move;
-      list->scores[list->count] = 0;
-      ++list->count;
-    }
   }
+  (list++)->move = move;
+  return list;
 }
 
-void add_castling(Position *pos, Movelist *list, bool check, int move) {
-  if (!check)
-    list->moves[list->count] = move;
-    list->scores[list->count] = 0;
-    ++list->count;
+INLINE ExtMove *add_castling(AttackInfo *ai, ExtMove *list, int move) {
+  if (!ai->checkers)
+    (list++)->move = move;
+  return list;
 }
 
-void add_pawn_move(Position *pos, Movelist *list, bool check, int from, int to) {
-  if (pos->side == WHITE && rank_of(from) == RANK_7) {
-    add_move(pos, list, check, make_promotion(from, to, KNIGHT));
-    add_move(pos, list, check, make_promotion(from, to, BISHOP));
-    add_move(pos, list, check, make_promotion(from, to, ROOK));
-    add_move(pos, list, check, make_promotion(from, to, QUEEN));
-  }
-  else if (pos->side == BLACK && rank_of(from) == RANK_2) {
-    add_move(pos, list, check, make_promotion(from, to, KNIGHT));
-    add_move(pos, list, check, make_promotion(from, to, BISHOP));
-    add_move(pos, list, check, make_promotion(from, to, ROOK));
-    add_move(pos, list, check, make_promotion(from, to, QUEEN));
+INLINE ExtMove *add_pawn_move(Position *pos, AttackInfo *ai, ExtMove *list, int from, int to,
+                              const Color Us) {
+  if (rank_of(from) == relative_rank(Us, RANK_7)) {
+    list = add_move(pos, ai, list, make_promotion(from, to, KNIGHT), Us);
+    list = add_move(pos, ai, list, make_promotion(from, to, BISHOP), Us);
+    list = add_move(pos, ai, list, make_promotion(from, to, ROOK), Us);
+    list = add_move(pos, ai, list, make_promotion(from, to, QUEEN), Us);
   }
   else
-    add_move(pos, list, check, make_move(from, to));
+    list = add_move(pos, ai, list, make_move(from, to), Us);
+  return list;
 }
 
-void generate_all_moves(Position *pos, Movelist *list) {
+INLINE ExtMove *generate(Position *pos, AttackInfo *ai, ExtMove *list, const Color Us) {
+  const Color Them = !Us;
+  const int Up = pawn_push(Us);
+  const int BackRank = relative_rank(Us, RANK_1);
   int from;
   int to;
-  int pin;
-  int enemy = ~pos->side & 1;
-  int castled = pos->side * RANK_8;
-  bool check = sq_attacked(pos, pos->lists[make_piece(pos->side, KING)][0], enemy);
   Bitboard moves;
-  Bitboard occupied;
-  list->count = 0;
-  for (int pt = PAWN; pt <= KING; ++pt)
-    for (int c = 0; c < pos->count[make_piece(pos->side, pt)]; ++c) {
-      from = pos->lists[make_piece(pos->side, pt)][c];
-      occupied = pos->occupied[WHITE] | pos->occupied[BLACK];
-      if (pt == PAWN)
-        occupied = pos->occupied[enemy];
-      moves = attacks_bb(make_piece(pos->side, pt), from, occupied);
+  Bitboard occupied = pos->occupied[WHITE] | pos->occupied[BLACK];
+  Bitboard attacked = ai->attackedBy[Them][0];
+
+  for (int c = 0; c < pos->count[make_piece(Us, PAWN)]; ++c) {
+    from = pos->lists[make_piece(Us, PAWN)][c];
+    moves = ai->pieceAttacks[make_piece(Us, PAWN)][c];
+    while (moves) {
+      to = pop_lsb(&moves);
+      if (SquareBB[to] & pos->occupied[Them])
+        list = add_pawn_move(pos, ai, list, from, to, Us);
+      else if (to == pos->passant)
+        list = add_move(pos, ai, list, make_enpassant(from, to), Us);
+    }
+    to = from + Up;
+    if (SquareBB[to] & ~occupied) {
+      list = add_pawn_move(pos, ai, list, from, to, Us);
+      if (rank_of(from) == relative_rank(Us, RANK_2) && (SquareBB[to + Up] & ~occupied))
+        list = add_pawn_move(pos, ai, list, from, to + Up, Us);
+    }
+  }
+  for (int pt = KNIGHT; pt <= KING; ++pt)
+    for (int c = 0; c < pos->count[make_piece(Us, pt)]; ++c) {
+      from = pos->lists[make_piece(Us, pt)][c];
+      moves = ai->pieceAttacks[make_piece(Us, pt)][c] & ~pos->occupied[Us];
       while (moves) {
         to = pop_lsb(&moves);
-        if (pt == PAWN) {
-          if (SquareBB[to] & occupied)
-            add_pawn_move(pos, list, check, from, to);
-          else if (to == pos->passant)
-            add_move(pos, list, check, make_enpassant(from, to));
-        }
-        else if (pt == KING) {
-          if (!sq_attacked(pos, to, enemy) && SquareBB[to] & ~pos->occupied[pos->side])
-            add_move(pos, list, check, make_move(from, to));
-        }
-        else if (SquareBB[to] & ~pos->occupied[pos->side])
-          add_move(pos, list, check, make_move(from, to));
+        list = add_move(pos, ai, list, make_move(from, to), Us);
       }
-      if (pt == PAWN) {
-        to = from + (pos->side == WHITE ? 8 : -8);
-        occupied = pos->occupied[WHITE] | pos->occupied[BLACK];
-        if (SquareBB[to] & ~occupied) {
-          add_pawn_move(pos, list, check, from, to);
-          to += (pos->side == WHITE ? 8 : -8);
-          if ((SquareBB[to] & ~occupied) && pos->side == WHITE && (rank_of(from) == RANK_2) )
-            add_pawn_move(pos, list, check, from, to);
-          if ((SquareBB[to] & ~occupied) && pos->side == BLACK && (rank_of(from) == RANK_7))
-            add_pawn_move(pos, list, check, from, to);
+    }
+  if (pos->count[make_piece(Us, KING)]) {
+    if (pos->castling & make_castling_right(Us, KING_SIDE))
+      if (!(attacked & (SquareBB[make_square(FILE_F, BackRank)] | SquareBB[make_square(FILE_G, BackRank)])))
+        if (!(SquareBB[make_square(FILE_F, BackRank)] & occupied))
+          if (!(SquareBB[make_square(FILE_G, BackRank)] & occupied))
+            list = add_castling(ai, list, make_castling(make_square(FILE_E, BackRank), make_square(FILE_G, BackRank)));
+    if (pos->castling & make_castling_right(Us, QUEEN_SIDE))
+      if (!(attacked & (SquareBB[make_square(FILE_D, BackRank)] | SquareBB[make_square(FILE_C, BackRank)])))
+        if (!(SquareBB[make_square(FILE_D, BackRank)] & occupied))
+          if (!(SquareBB[make_square(FILE_C, BackRank)] & occupied))
+            if (!(SquareBB[make_square(FILE_B, BackRank)] & occupied))
+              list = add_castling(ai, list, make_castling(make_square(FILE_E, BackRank), make_square(FILE_C, BackRank)));
+  }
+  return list;
+}
+
+// generate_moves_ai() writes all legal moves to the list and returns a
+// pointer past the last one. The destinations of every piece come from
+// the attack info of the node. generate_moves() computes it first.
+
+ExtMove *generate_moves_ai(Position *pos, AttackInfo *ai, ExtMove *list) {
+  STATS_TIMER(timer);
+  stats_inc(STAT_GENERATE_CALLS);
+  list = pos->side == WHITE ? generate(pos, ai, list, WHITE)
+                            : generate(pos, ai, list, BLACK);
+  stats_time(STAT_GENERATE_CYCLES, timer);
+  return list;
+}
+
+ExtMove *generate_moves(Position *pos, ExtMove *list) {
+  AttackInfo ai;
+  attack_info(pos, &ai);
+  return generate_moves_ai(pos, &ai, list);
+}
+
+void generate_all_moves(Position *pos, Movelist *list) {
+  list->count = generate_moves(pos, list->moves) - list->moves;
+}
+
+// move_str() writes the move in coordinate notation ("e2e4", "e7e8q") and
+// returns the string.
+
+char *move_str(int move, char *str) {
+  str[0] = 'a' + file_of(from_sq(move));
+  str[1] = '1' + rank_of(from_sq(move));
+  str[2] = 'a' + file_of(to_sq(move));
+  str[3] = '1' + rank_of(to_sq(move));
+  str[4] = type_of_m(move) == PROMOTION ? " pnbrqk"[promotion_type(move)] : '\0';
+  str[5] = '\0';
+  return str;
+}
+
+void movelist_pretty(Movelist *list) {
+  char str[6];
+  for (int i = 0; i < list->count; ++i)
+    printf("%s\n", move_str(list->moves[i].move, str));
+}
+
+// move_san() writes the legal move in standard algebraic notation ("Nbd2",
+// "exd6", "e8=Q+", "O-O-O#") and returns the string, which must have room
+// for 8 characters. Like movelist_pretty() it is for callers outside the
+// search: the disambiguation and the check suffix generate moves.
+
+char *move_san(Position *pos, int move, char *str) {
+  static const char PieceChars[] = "  NBRQK";
+  int from = from_sq(move), to = to_sq(move);
+  int pt = type_of_p(pos->board[from]);
+  char *s = str;
+  Movelist list;
+
+  if (type_of_m(move) == CASTLING)
+    s = stpcpy(s, to > from ? "O-O" : "O-O-O");
+  else {
+    if (pt == PAWN) {
+      if (file_of(from) != file_of(to))
+        *s++ = 'a' + file_of(from);
+    }
+    else {
+      // Name the file of the piece if that tells it apart from the others
+      // of its type that reach the square, else its rank, else both
+      bool others = false, sameFile = false, sameRank = false;
+      *s++ = PieceChars[pt];
+      generate_all_moves(pos, &list);
+      for (int i = 0; i < list.count; ++i) {
+        int m = list.moves[i].move, f = from_sq(m);
+        if (to_sq(m) == to && f != from && pos->board[f] == pos->board[from]) {
+          others = true;
+          sameFile |= file_of(f) == file_of(from);
+          sameRank |= rank_of(f) == rank_of(from);
         }
       }
-      if (pt == KING) {
-        if (pos->castling & make_castling_right(pos->side, KING_SIDE))
-          if (!sq_attacked(pos, make_square(FILE_F, castled), enemy))
-            if (!sq_attacked(pos, make_square(FILE_G, castled), enemy))
-              if (!(SquareBB[make_square(FILE_F, castled)] & (pos->occupied[WHITE] | pos->occupied[BLACK])))
-                if (!(SquareBB[make_square(FILE_G, castled)] & (pos->occupied[WHITE] | pos->occupied[BLACK])))
-                  add_castling(pos, list, check, make_castling(make_square(FILE_E, castled), make_square(FILE_G, castled)));
-        if (pos->castling & make_castling_right(pos->side, QUEEN_SIDE))
-          if (!sq_attacked(pos, make_square(FILE_D, castled), enemy))
-            if (!sq_attacked(pos, make_square(FILE_C, castled), enemy))
-              if (!(SquareBB[make_square(FILE_D, castled)] & (pos->occupied[WHITE] | pos->occupied[BLACK])))
-                if (!(SquareBB[make_square(FILE_C, castled)] & (pos->occupied[WHITE] | pos->occupied[BLACK])))
-                  if (!(SquareBB[make_square(FILE_B, castled)] & (pos->occupied[WHITE] | pos->occupied[BLACK])))
-                    add_castling(pos, list, check, make_castling(make_square(FILE_E, castled), make_square(FILE_C, castled)));
-      }
+      if (others && (!sameFile || sameRank))
+        *s++ = 'a' + file_of(from);
+      if (others && sameFile)
+        *s++ = '1' + rank_of(from);
     }
+    if (pos->board[to] || type_of_m(move) == ENPASSANT)
+      *s++ = 'x';
+    *s++ = 'a' + file_of(to);
+    *s++ = '1' + rank_of(to);
+    if (type_of_m(move) == PROMOTION) {
+      *s++ = '=';
+      *s++ = PieceChars[promotion_type(move)];
+    }
+  }
+
+  Position child = *pos;
+  child.history = NULL;
+  do_move(&child, move);
+  if (in_check(&child)) {
+    generate_all_moves(&child, &list);
+    *s++ = list.count ? '+' : '#';
+  }
+  *s = '\0';
+  return str;
 }
 
-void movelist_pretty(Movelist *list) {
-  char charmove[5];
-  for (int i = 0; i < list->count; ++i) {
-    charmove[0] = 'a' + file_of(from_sq(list->moves[i]));
-    charmove[1] = '1' + rank_of(from_sq(list->moves[i]));
-    charmove[2] = 'a' + file_of(to_sq(list->moves[i]));
-    charmove[3] = '1' + rank_of(to_sq(list->moves[i]));
-    if (type_of_m(list->moves[i]) == PROMOTION) {
-      if (promotion_type(list->moves[i]) == KNIGHT)
-        printf("%sn\n",charmove);
-      if (promotion_type(list->moves[i]) == BISHOP)
-        printf("%sb\n",charmove);
-      if (promotion_type(list->moves[i]) == ROOK)
-        printf("%sr\n",charmove);
-      if (promotion_type(list->moves[i]) == QUEEN)
-        printf("%sq\n",charmove);
+// parse_san() returns the legal move written in standard algebraic notation,
+// or MOVE_NONE if the text names no move or more than one. It accepts the
+// usual variants: a missing "=" or a lowercase piece of a promotion, "0-0"
+// for castling, surplus disambiguation, and any check or annotation suffix.
+
+int parse_san(Position *pos, const char *san) {
+  int pt = PAWN, promotion = 0, file = -1, rank = -1, to = -1, castling = 0;
+  int found = MOVE_NONE;
+  const char *p = san;
+  Movelist list;
+
+  if (!strncmp(p, "O-O-O", 5) || !strncmp(p, "0-0-0", 5))
+    castling = -1, p += 5;
+  else if (!strncmp(p, "O-O", 3) || !strncmp(p, "0-0", 3))
+    castling = 1, p += 3;
+  else {
+    const char *q = strchr("NBRQK", *p);
+    if (*p && q)
+      pt = KNIGHT + (q - "NBRQK"), ++p;
+
+    // The destination is the last square named; a square or a file or
+    // rank before it disambiguates.
+    for (; *p; ++p) {
+      if (*p >= 'a' && *p <= 'h' && p[1] >= '1' && p[1] <= '8') {
+        if (to >= 0)
+          file = file_of(to), rank = rank_of(to);
+        to = make_square(*p - 'a', p[1] - '1');
+        ++p;
+      }
+      else if (*p >= 'a' && *p <= 'h' && to < 0)
+        file = *p - 'a';
+      else if (*p >= '1' && *p <= '8' && to < 0)
+        rank = *p - '1';
+      else if (*p != 'x' && *p != ':' && *p != '-')
+        break;
+    }
+    if (to < 0)
+      return MOVE_NONE;
+    if (pt == PAWN && *p == '=')
+      ++p;
+    if (pt == PAWN && *p && strchr("NBRQnbrq", *p))
+      promotion = KNIGHT + (strchr("NBRQ", *p & ~0x20) - "NBRQ"), ++p;
+  }
+  if (*p && !strchr("+#!?", *p))
+    return MOVE_NONE;
+
+  generate_all_moves(pos, &list);
+  for (int i = 0; i < list.count; ++i) {
+    int m = list.moves[i].move, from = from_sq(m);
+    if (castling) {
+      if (type_of_m(m) != CASTLING || (to_sq(m) > from) != (castling > 0))
+        continue;
     }
-    else
-      printf("%s\n",charmove);
+    else if (   type_of_m(m) == CASTLING
+             || to_sq(m) != to
+             || type_of_p(pos->board[from]) != pt
+             || (file >= 0 && file_of(from) != file)
+             || (rank >= 0 && rank_of(from) != rank)
+             || (type_of_m(m) == PROMOTION ? promotion_type(m) != promotion : promotion != 0))
+      continue;
+    if (found)
+      return MOVE_NONE;
+    found = m;
   }
-}
\ No newline at end of file
+  return found;
+}
@@ -3,16 +3,29 @@
 
 #include "position.h"
 
+// ExtMove packs a 16-bit move with its ordering score, so that a move and
+// its score share a cache line while the picker sorts them. The score is
+// written by the picker; generation leaves it undefined.
+
+typedef struct {
+  uint16_t move;
+  int16_t score;
+} ExtMove;
+
+// Movelist is a self-contained list for callers outside the search, which
+// generates into slices of a per-thread arena instead (see search.h).
+
 typedef struct {
-  int moves[MAX_MOVES];
-  int scores[MAX_MOVES];
+  ExtMove moves[MAX_MOVES];
   int count;
 } Movelist;
 
-void add_move(Position *pos, Movelist *list, bool check, int move);
-void add_castling(Position *pos, Movelist *list, bool check, int move);
-void add_pawn_move(Position *pos, Movelist *list, bool check, int from, int to);
+ExtMove *generate_moves_ai(Position *pos, AttackInfo *ai, ExtMove *list);
+ExtMove *generate_moves(Position *pos, ExtMove *list);
 void generate_all_moves(Position *pos, Movelist *list);
+char *move_str(int move, char *str);
 void movelist_pretty(Movelist *movelist);
+char *move_san(Position *pos, int move, char *str);
+int parse_san(Position *pos, const char *san);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include "evaluate.h"
+#include "movepick.h"
+
+// mp_init() sets up a picker over the legal moves [ss->moves, end). The
+// first move is tried before any other; refutations are the killers of
+// the ply and the counter move to the previous move. With capturesOnly the
+// picker stops after the captures that do not lose material (quiescence
+// search outside of check).
+
+void mp_init(MovePicker *mp, Position *pos, Stack *ss, ExtMove *end, Move first,
+             Move counter, ButterflyHistory *history, bool capturesOnly) {
+  mp->pos = pos;
+  mp->history = history;
+  mp->contHist[0] = (ss - 1)->contHist;
+  mp->contHist[1] = (ss - 2)->contHist;
+  mp->cur = mp->badCaptures = mp->badCapturesEnd = ss->moves;
+  mp->end = end;
+  mp->first = first;
+  mp->refutations[0] = ss->killers[0];
+  mp->refutations[1] = ss->killers[1];
+  mp->refutations[2] = counter;
+  mp->refutation = 0;
+  mp->capturesOnly = capturesOnly;
+  mp->stage = first ? STAGE_FIRST : STAGE_CAPTURES_INIT;
+}
+
+// find_move() swaps move m, if it is in [cur, end), to *cur. It returns
+// false if the move is not in the list.
+
+static bool find_move(ExtMove *cur, ExtMove *end, Move m) {
+  for (ExtMove *e = cur; e < end; ++e)
+    if (e->move == m) {
+      ExtMove tmp = *e;
+      *e = *cur;
+      *cur = tmp;
+      return true;
+    }
+  return false;
+}
+
+// pick_best() swaps the best scored move in [cur, end) to *cur.
+
+static Move pick_best(ExtMove *cur, ExtMove *end) {
+  ExtMove *best = cur;
+  for (ExtMove *e = cur + 1; e < end; ++e)
+    if (e->score > best->score)
+      best = e;
+  ExtMove tmp = *best;
+  *best = *cur;
+  *cur = tmp;
+  return cur->move;
+}
+
+Move next_move(MovePicker *mp) {
+  Position *pos = mp->pos;
+
+  switch (mp->stage) {
+  case STAGE_FIRST:
+    ++mp->stage;
+    if (find_move(mp->cur, mp->end, mp->first))
+      return (mp->cur++)->move;
+    /* fallthrough */
+
+  case STAGE_CAPTURES_INIT: {
+    // Partition captures to the front and score them by MVV-LVA
+    ExtMove *split = mp->cur;
+    for (ExtMove *e = mp->cur; e < mp->end; ++e) {
+      Move m = e->move;
+      bool queenPromotion = type_of_m(m) == PROMOTION && promotion_type(m) == QUEEN;
+      int captured = type_of_m(m) == ENPASSANT ? PAWN : type_of_p(pos->board[to_sq(m)]);
+      if (!captured && !queenPromotion)
+        continue;
+      ExtMove tmp = *e;
+      *e = *split;
+      *split = tmp;
+      split->score = PieceValue[MG][captured] * 8 - type_of_p(pos->board[from_sq(m)])
+                   + (queenPromotion ? PieceValue[MG][QUEEN] : 0);
+      ++split;
+    }
+    mp->capturesEnd = split;
+    mp->stage = STAGE_CAPTURES;
+  }
+    /* fallthrough */
+
+  case STAGE_CAPTURES:
+    // Losing captures are moved to the front of the list, over moves that
+    // have already been returned, and tried after the quiets.
+    while (mp->cur < mp->capturesEnd) {
+      Move m = pick_best(mp->cur, mp->capturesEnd);
+      if (see_ge(pos, m, VALUE_ZERO))
+        return (mp->cur++)->move;
+      *mp->badCapturesEnd++ = *mp->cur++;
+    }
+    if (mp->capturesOnly) {
+      mp->stage = STAGE_END;
+      return MOVE_NONE;
+    }
+    mp->stage = STAGE_REFUTATIONS;
+    /* fallthrough */
+
+  case STAGE_REFUTATIONS:
+    while (mp->refutation < 3) {
+      Move m = mp->refutations[mp->refutation++];
+      if (m && find_move(mp->cur, mp->end, m))
+        return (mp->cur++)->move;
+    }
+    ++mp->stage;
+    /* fallthrough */
+
+  case STAGE_QUIETS_INIT: {
+    Color us = pos->side;
+    for (ExtMove *e = mp->cur; e < mp->end; ++e) {
+      Move m = e->move;
+      int piece = pos->board[from_sq(m)], to = to_sq(m);
+      e->score = (*mp->history)[us][from_to(m)]
+               + (*mp->contHist[0])[piece][to]
+               + (*mp->contHist[1])[piece][to];
+    }
+    ++mp->stage;
+  }
+    /* fallthrough */
+
+  case STAGE_QUIETS:
+    if (mp->cur < mp->end) {
+      pick_best(mp->cur, mp->end);
+      return (mp->cur++)->move;
+    }
+    ++mp->stage;
+    /* fallthrough */
+
+  case STAGE_BAD_CAPTURES:
+    if (mp->badCaptures < mp->badCapturesEnd)
+      return (mp->badCaptures++)->move;
+    ++mp->stage;
+    /* fallthrough */
+
+  case STAGE_END:
+  default:
+    return MOVE_NONE;
+  }
+}
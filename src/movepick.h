@@ -0,0 +1,71 @@
+#ifndef MOVEPICK_H_INCLUDED
+#define MOVEPICK_H_INCLUDED
+
+#include "movegen.h"
+#include "position.h"
+
+// Move ordering statistics. All entries are bounded by gravity updates
+// (see update_stat()): the three history terms of a quiet move add up to
+// less than 3 * HISTORY_MAX, which fits the 16-bit ExtMove score.
+
+enum { HISTORY_MAX = 8192 };
+
+typedef int16_t ButterflyHistory[2][4096];    // [color][from_to]
+typedef int16_t PieceToHistory[16][64];       // [piece][to]
+typedef PieceToHistory ContinuationHistory[16][64];
+typedef uint16_t CounterMoveTable[16][64];    // [piece][to] of previous move
+
+// update_stat() applies a saturating "gravity" update: the closer the entry
+// is to the bound, the less a bonus of the same sign moves it.
+
+INLINE void update_stat(int16_t *entry, int bonus)
+{
+  *entry += bonus - *entry * abs(bonus) / HISTORY_MAX;
+}
+
+// Stack holds the per-ply search state. Each ply generates its moves into
+// the arena right after those of its parent, so the lists of the current
+// line are contiguous and the arena never needs more than MAX_MOVES per ply.
+
+typedef struct {
+  ExtMove *moves;
+  PieceToHistory *contHist;   // Continuation history of currentMove
+  int ply;
+  int movedPiece;
+  Move currentMove;
+  Move killers[2];
+} Stack;
+
+// MovePicker returns the legal moves of a node one at a time in stages:
+// the hash/PV move, winning and even captures and queen promotions by
+// MVV-LVA, the killers and the counter move, the remaining quiets by
+// history and finally the captures that lose material by SEE. Each stage
+// sorts lazily, so a cutoff early in the list leaves the rest unscored.
+
+enum {
+  STAGE_FIRST, STAGE_CAPTURES_INIT, STAGE_CAPTURES, STAGE_REFUTATIONS,
+  STAGE_QUIETS_INIT, STAGE_QUIETS, STAGE_BAD_CAPTURES, STAGE_END
+};
+
+typedef struct {
+  Position *pos;
+  ButterflyHistory *history;
+  PieceToHistory *contHist[2];
+  ExtMove *cur, *end, *capturesEnd, *badCaptures, *badCapturesEnd;
+  Move first;
+  Move refutations[3];
+  int refutation;
+  int stage;
+  bool capturesOnly;
+} MovePicker;
+
+void mp_init(MovePicker *mp, Position *pos, Stack *ss, ExtMove *end, Move first,
+             Move counter, ButterflyHistory *history, bool capturesOnly);
+Move next_move(MovePicker *mp);
+
+INLINE bool is_capture_or_promotion(Position *pos, Move m)
+{
+  return pos->board[to_sq(m)] || type_of_m(m) == ENPASSANT || type_of_m(m) == PROMOTION;
+}
+
+#endif
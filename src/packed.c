@@ -0,0 +1,188 @@
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "evaluate.h"
+#include "misc.h"
+#include "packed.h"
+
+// pack_position() encodes the position into a record. The score and
+// result fields are left for the caller to fill in.
+
+void pack_position(Position *pos, PackedPos *pp) {
+  Bitboard b = pieces(pos);
+  int i = 0;
+
+  memset(pp, 0, sizeof(*pp));
+  pp->occupied = b;
+  while (b) {
+    int sq = pop_lsb(&b);
+    pp->pieces[i / 2] |= pos->board[sq] << (4 * (i & 1));
+    ++i;
+  }
+  pp->flags = pos->side | pos->castling << 1;
+  pp->passant = pos->passant;
+  pp->rule = pos->rule < 255 ? pos->rule : 255;
+  pp->result = RESULT_NONE;
+  pp->ply = pos->ply;
+  pp->score = VALUE_NONE;
+}
+
+// unpack_position() decodes a record. It does only the checks needed to
+// keep the Position structure consistent (piece codes, list capacity and
+// one king per side) and returns false if they fail.
+
+bool unpack_position(const PackedPos *pp, Position *pos) {
+  Bitboard b = pp->occupied;
+  int i = 0;
+
+  if (popcount(b) > 32)
+    return false;
+  reset_pos(pos);
+  while (b) {
+    int sq = pop_lsb(&b);
+    int piece = (pp->pieces[i / 2] >> (4 * (i & 1))) & 15;
+    ++i;
+    if (!type_of_p(piece) || type_of_p(piece) > KING || pos->count[piece] == 10)
+      return false;
+    put_piece(pos, piece, sq);
+  }
+  if (pos->count[W_KING] != 1 || pos->count[B_KING] != 1)
+    return false;
+  pos->side = pp->flags & 1;
+  pos->castling = (pp->flags >> 1) & ANY_CASTLING;
+  pos->passant = pp->passant < 64 ? pp->passant : SQ_NONE;
+  pos->rule = pp->rule;
+  pos->ply = pp->ply;
+  update_key(pos);
+  return true;
+}
+
+bool packed_reader_open(PackedReader *r, const char *path) {
+  struct stat st;
+  int fd = open(path, O_RDONLY);
+
+  memset(r, 0, sizeof(*r));
+  if (fd < 0)
+    return false;
+  if (fstat(fd, &st) || st.st_size % sizeof(PackedPos)) {
+    close(fd);
+    return false;
+  }
+  r->size = st.st_size;
+  r->count = r->size / sizeof(PackedPos);
+  if (r->size) {
+    void *data = mmap(NULL, r->size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      return false;
+    }
+    madvise(data, r->size, MADV_SEQUENTIAL);
+    r->data = data;
+  }
+  close(fd);
+  return true;
+}
+
+void packed_reader_close(PackedReader *r) {
+  if (r->data)
+    munmap((void *)r->data, r->size);
+  memset(r, 0, sizeof(*r));
+}
+
+bool packed_writer_open(PackedWriter *w, const char *path, bool append) {
+  memset(w, 0, sizeof(*w));
+  w->file = fopen(path, append ? "ab" : "wb");
+  if (!w->file)
+    return false;
+  setvbuf(w->file, NULL, _IONBF, 0);
+  w->buffer = malloc(PACKED_BUFFER * sizeof(PackedPos));
+  return true;
+}
+
+void packed_writer_flush(PackedWriter *w) {
+  if (w->pending && fwrite(w->buffer, sizeof(PackedPos), w->pending, w->file) != w->pending) {
+    perror("packed_writer_flush");
+    exit(EXIT_FAILURE);
+  }
+  w->written += w->pending;
+  w->pending = 0;
+}
+
+bool packed_writer_close(PackedWriter *w) {
+  packed_writer_flush(w);
+  bool ok = !fclose(w->file);
+  free(w->buffer);
+  memset(w, 0, sizeof(*w));
+  return ok;
+}
+
+// pack_cmd() converts a FEN/EPD file into packed records: "pack <in> <out>".
+
+void pack_cmd(int argc, char **argv) {
+  char line[512];
+  uint64_t invalid = 0;
+  Position pos;
+  PackedPos pp;
+  PackedWriter w;
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: pack <input.epd> <output.bin>\n");
+    exit(EXIT_FAILURE);
+  }
+  FILE *in = strcmp(argv[0], "-") ? fopen(argv[0], "r") : stdin;
+  if (!in || !packed_writer_open(&w, argv[1], false)) {
+    fprintf(stderr, "pack: cannot open %s\n", !in ? argv[0] : argv[1]);
+    exit(EXIT_FAILURE);
+  }
+
+  TimePoint start = now();
+  while (fgets(line, sizeof(line), in)) {
+    if (line[0] == '\n' || line[0] == '#')
+      continue;
+    if (!parse_fen(&pos, line)) {
+      ++invalid;
+      continue;
+    }
+    pack_position(&pos, &pp);
+    packed_write(&w, &pp);
+  }
+  uint64_t written = w.written + w.pending;
+  packed_writer_close(&w);
+  if (in != stdin)
+    fclose(in);
+  fprintf(stderr, "packed %llu positions (%llu invalid) in %lld ms\n",
+          (unsigned long long)written, (unsigned long long)invalid,
+          (long long)(now() - start));
+}
+
+// unpack_cmd() prints packed records as FEN: "unpack <in>". Scores and
+// results, when present, are appended as EPD-style "ce" and "c9" fields.
+
+void unpack_cmd(int argc, char **argv) {
+  static const char *Results[] = { "0-1", "1/2-1/2", "1-0" };
+  char fen[128];
+  PackedReader r;
+  Position pos;
+
+  if (argc < 1 || !packed_reader_open(&r, argv[0])) {
+    fprintf(stderr, "Usage: unpack <input.bin>\n");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < r.count; ++i) {
+    const PackedPos *pp = &r.data[i];
+    if (!unpack_position(pp, &pos)) {
+      printf("# invalid record %zu\n", i);
+      continue;
+    }
+    printf("%s", pos_fen(&pos, fen));
+    if (pp->score != VALUE_NONE)
+      printf(" ; ce %d;", to_cp(pp->score));
+    if (pp->result >= RESULT_BLACK_WIN && pp->result <= RESULT_WHITE_WIN)
+      printf(" c9 \"%s\";", Results[pp->result + 1]);
+    printf("\n");
+  }
+  packed_reader_close(&r);
+}
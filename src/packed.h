@@ -0,0 +1,72 @@
+#ifndef PACKED_H_INCLUDED
+#define PACKED_H_INCLUDED
+
+#include <stdio.h>
+
+#include "position.h"
+
+// PackedPos is a fixed-size 32 byte position record. The occupied squares
+// are stored as a bitboard and the pieces on them, in square order, as
+// 4-bit piece codes, which is enough for the 32 men of any legal position.
+// The last bytes carry an optional search score and game result so that
+// the same record serves as analysis input and as training data.
+//
+// Records are stored in host (little-endian) byte order. Files are plain
+// arrays of records with no header, so they can be concatenated and split
+// with ordinary tools.
+
+enum { RESULT_BLACK_WIN = -1, RESULT_DRAW = 0, RESULT_WHITE_WIN = 1, RESULT_NONE = -128 };
+
+typedef struct {
+  uint64_t occupied;
+  uint8_t pieces[16];
+  uint8_t flags;         // bit 0: side to move, bits 1-4: castling rights
+  uint8_t passant;       // En passant square or SQ_NONE
+  uint8_t rule;          // Fifty-move counter, saturated at 255
+  int8_t result;         // Game result from white's point of view
+  uint16_t ply;
+  int16_t score;         // Search score for the side to move or VALUE_NONE
+} PackedPos;
+
+_Static_assert(sizeof(PackedPos) == 32, "PackedPos must be 32 bytes");
+
+void pack_position(Position *pos, PackedPos *pp);
+bool unpack_position(const PackedPos *pp, Position *pos);
+
+// PackedReader maps a whole file read-only; records are accessed in place.
+
+typedef struct {
+  const PackedPos *data;
+  size_t count;
+  size_t size;
+} PackedReader;
+
+bool packed_reader_open(PackedReader *r, const char *path);
+void packed_reader_close(PackedReader *r);
+
+// PackedWriter buffers records and writes them out in large blocks.
+
+enum { PACKED_BUFFER = 4096 };
+
+typedef struct {
+  FILE *file;
+  PackedPos *buffer;
+  size_t pending;
+  uint64_t written;
+} PackedWriter;
+
+bool packed_writer_open(PackedWriter *w, const char *path, bool append);
+void packed_writer_flush(PackedWriter *w);
+bool packed_writer_close(PackedWriter *w);
+
+INLINE void packed_write(PackedWriter *w, const PackedPos *pp)
+{
+  w->buffer[w->pending++] = *pp;
+  if (w->pending == PACKED_BUFFER)
+    packed_writer_flush(w);
+}
+
+void pack_cmd(int argc, char **argv);
+void unpack_cmd(int argc, char **argv);
+
+#endif
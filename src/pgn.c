@@ -0,0 +1,201 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "movegen.h"
+#include "pgn.h"
+
+void pgn_reader_init(PgnReader *r, FILE *in) {
+  memset(r, 0, sizeof(*r));
+  r->in = in;
+}
+
+// append() adds text to the game. A game that would outgrow the limit is
+// marked overlong and keeps the text read so far.
+
+static void append(PgnGame *g, const char *s, size_t n) {
+  if (g->overlong || g->len + n + 1 > PGN_GAME_LIMIT) {
+    g->overlong = true;
+    return;
+  }
+  if (g->len + n + 1 > g->cap) {
+    size_t cap = g->cap ? 2 * g->cap : 4096;
+    while (cap < g->len + n + 1)
+      cap *= 2;
+    g->text = realloc(g->text, cap);
+    g->cap = cap;
+  }
+  memcpy(g->text + g->len, s, n);
+  g->len += n;
+  g->text[g->len] = '\0';
+}
+
+INLINE bool is_blank(const char *s) {
+  return !s[strspn(s, " \t\r\n")];
+}
+
+INLINE bool is_tag_line(const char *s) {
+  return s[0] == '[' && isalpha((unsigned char)s[1]);
+}
+
+// pgn_read_game() reads the next game and returns false at the end of the
+// file. The tag pairs of a game run up to its movetext, which in turn ends
+// at a blank line or at the tag pairs of the next game. Lines longer than
+// the line buffer are read in pieces; only the first piece of a line can
+// be a tag pair or an escape ("%") line.
+
+bool pgn_read_game(PgnReader *r, PgnGame *g) {
+  bool movetext = false, any = false, lineStart = true;
+
+  g->len = g->tagsLen = 0;
+  g->overlong = false;
+  while (r->pending || fgets(r->line, PGN_LINE_LENGTH, r->in)) {
+    const char *s = r->line;
+    size_t n = strlen(s);
+    bool start = lineStart || r->pending;
+
+    if (!r->pending)
+      r->bytes += n;
+    r->pending = false;
+    lineStart = n && s[n - 1] == '\n';
+    if (!start) {
+      append(g, s, n);
+      continue;
+    }
+    if (is_blank(s) || s[0] == '%') {
+      if (movetext && s[0] != '%')
+        break;
+      continue;
+    }
+    if (is_tag_line(s)) {
+      if (movetext) {
+        r->pending = true;
+        break;
+      }
+      append(g, s, n);
+      g->tagsLen = g->len;
+      any = true;
+      continue;
+    }
+    append(g, s, n);
+    movetext = any = true;
+  }
+  return any;
+}
+
+void pgn_game_free(PgnGame *g) {
+  free(g->text);
+  memset(g, 0, sizeof(*g));
+}
+
+// pgn_tag() copies the value of the tag pair with the given name, without
+// its quotes and escapes, and returns false if the game has no such tag.
+
+bool pgn_tag(const PgnGame *g, const char *name, char *value, size_t size) {
+  size_t len = strlen(name);
+  const char *p = g->text, *end = g->text + g->tagsLen;
+
+  for (; p < end; p = strchr(p, '\n') + 1) {
+    if (p[0] == '[' && !strncmp(p + 1, name, len) && p[len + 1] == ' ') {
+      const char *q = strchr(p, '"');
+      size_t n = 0;
+      if (!q)
+        return false;
+      for (++q; *q && *q != '"' && *q != '\n' && n + 1 < size; ++q)
+        value[n++] = *q == '\\' && q[1] ? *++q : *q;
+      value[n] = '\0';
+      return true;
+    }
+    if (!strchr(p, '\n'))
+      break;
+  }
+  return false;
+}
+
+bool pgn_start(const PgnGame *g, Position *pos, PgnCursor *c) {
+  char fen[128];
+
+  c->p = g->text + g->tagsLen;
+  c->end = g->text + g->len;
+  c->error = c->commentary = false;
+  c->token[0] = '\0';
+  strcpy(c->result, "*");
+  return parse_fen(pos, pgn_tag(g, "FEN", fen, sizeof(fen)) ? fen : START_FEN) != NULL;
+}
+
+// skip_variation() returns the end of the variation that starts at p,
+// which may hold comments and other variations.
+
+static const char *skip_variation(const char *p, const char *end) {
+  int depth = 0;
+
+  for (; p < end; ++p) {
+    if (*p == '(')
+      ++depth;
+    else if (*p == ')' && !--depth)
+      return p + 1;
+    else if (*p == '{' && !(p = memchr(p, '}', end - p)))
+      return end;
+    else if (*p == ';' && !(p = memchr(p, '\n', end - p)))
+      return end;
+  }
+  return end;
+}
+
+int pgn_next_move(PgnCursor *c, Position *pos) {
+  static const char *Results[] = { "1-0", "0-1", "1/2-1/2", "*" };
+  const char *p = c->p, *end = c->end;
+  int move;
+
+  while (p < end) {
+    if (isspace((unsigned char)*p) || *p == ')')
+      ++p;
+    else if (*p == '{' || *p == ';' || *p == '(' || *p == '$') {
+      c->commentary = true;
+      if (*p == '{')
+        p = (p = memchr(p, '}', end - p)) ? p + 1 : end;
+      else if (*p == ';')
+        p = (p = memchr(p, '\n', end - p)) ? p + 1 : end;
+      else if (*p == '(')
+        p = skip_variation(p, end);
+      else
+        for (++p; p < end && isdigit((unsigned char)*p); ++p) {}
+    }
+    else {
+      size_t len = 0;
+      while (p + len < end && !isspace((unsigned char)p[len]) && !strchr("{}();", p[len]))
+        ++len;
+      snprintf(c->token, sizeof(c->token), "%.*s", (int)len, p);
+
+      for (int i = 0; i < 4; ++i)
+        if (!strcmp(c->token, Results[i])) {
+          strcpy(c->result, Results[i]);
+          c->p = end;
+          return MOVE_NONE;
+        }
+
+      // A move number, possibly run together with the move ("12.e4")
+      if (isdigit((unsigned char)*p) && strncmp(p, "0-0", 3)) {
+        while (p < end && isdigit((unsigned char)*p))
+          ++p;
+        while (p < end && *p == '.')
+          ++p;
+        continue;
+      }
+      // Dots after a move number, or a suffix annotation standing apart
+      if (strspn(p, ".!?") >= len) {
+        c->commentary |= p[0] != '.';
+        p += len;
+        continue;
+      }
+
+      c->p = p + len;
+      c->commentary |= strpbrk(c->token, "!?") != NULL;
+      if (!(move = parse_san(pos, c->token)))
+        c->error = true;
+      return move;
+    }
+  }
+  c->p = end;
+  return MOVE_NONE;
+}
@@ -0,0 +1,55 @@
+#ifndef PGN_H_INCLUDED
+#define PGN_H_INCLUDED
+
+#include <stdio.h>
+
+#include "position.h"
+
+// PgnReader streams games out of a PGN file of any size. A game is read
+// into a PgnGame buffer as raw text, its tag pairs first, so that callers
+// can echo it unchanged; the buffer grows with the game but no further
+// than PGN_GAME_LIMIT, so the memory in use does not depend on the file.
+
+enum { PGN_LINE_LENGTH = 4096, PGN_GAME_LIMIT = 1 << 20, MAX_GAME_PLIES = 2048 };
+
+typedef struct {
+  FILE *in;
+  char line[PGN_LINE_LENGTH];
+  bool pending;          // line holds the first line of the next game
+  uint64_t bytes;        // Bytes read so far
+} PgnReader;
+
+typedef struct {
+  char *text;
+  size_t len, cap;
+  size_t tagsLen;        // The tag pairs are text[0, tagsLen)
+  bool overlong;         // Cut at PGN_GAME_LIMIT
+} PgnGame;
+
+void pgn_reader_init(PgnReader *r, FILE *in);
+bool pgn_read_game(PgnReader *r, PgnGame *g);
+void pgn_game_free(PgnGame *g);
+bool pgn_tag(const PgnGame *g, const char *name, char *value, size_t size);
+
+// PgnCursor walks the movetext of a game. pgn_start() sets up the initial
+// position, from the FEN tag if there is one, then every pgn_next_move()
+// returns the next move of the main line for the caller to make. Comments,
+// variations, NAGs, move suffixes ("!", "?") and move numbers are skipped;
+// commentary tells whether any but the move numbers were met. At the end of
+// the game it returns MOVE_NONE with error unset and the result, "*" if
+// none is given.
+
+typedef struct {
+  const char *p, *end;
+  char result[8];
+  bool error;            // A move is illegal or ambiguous
+  bool commentary;       // Comments, variations, NAGs or suffixes skipped
+  char token[16];        // The text of the move, or of the offending token
+} PgnCursor;
+
+bool pgn_start(const PgnGame *g, Position *pos, PgnCursor *c);
+int pgn_next_move(PgnCursor *c, Position *pos);
+
+void annotate_cmd(int argc, char **argv);
+
+#endif
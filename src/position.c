@@ -1,23 +1,90 @@
 #include <stdio.h>
+#include <string.h>
 
+#include "evaluate.h"
+#include "misc.h"
 #include "position.h"
 
-#define RAND_64 ((Key)rand() | (Key)rand() << 15 | (Key)rand() << 30 | (Key)rand() << 45 | ((Key)rand() & 0xf) << 60 )
-
 Key PieceKeys[16][64];
 Key SideKey;
 Key CastleKeys[16];
 Key PassantKeys[64];
 
+// CastlingRightsMask[] holds the castling rights that survive a move from
+// or to the given square.
+
+static int CastlingRightsMask[64];
+
+static void init_castling_mask(void) {
+  for (int s = 0; s < 64; ++s)
+    CastlingRightsMask[s] = ANY_CASTLING;
+  CastlingRightsMask[SQ_E1] &= ~(WHITE_OO | WHITE_OOO);
+  CastlingRightsMask[SQ_H1] &= ~WHITE_OO;
+  CastlingRightsMask[SQ_A1] &= ~WHITE_OOO;
+  CastlingRightsMask[SQ_E8] &= ~(BLACK_OO | BLACK_OOO);
+  CastlingRightsMask[SQ_H8] &= ~BLACK_OO;
+  CastlingRightsMask[SQ_A8] &= ~BLACK_OOO;
+}
+
+// Cuckoo tables with Zobrist hashes of valid reversible moves, and the moves
+// themselves. A move and its reverse share an entry.
+
+static Key Cuckoo[8192];
+static uint16_t CuckooMove[8192];
+
+INLINE int H1(Key h) { return h & 0x1fff; }
+INLINE int H2(Key h) { return (h >> 16) & 0x1fff; }
+
+// init_cuckoo() inserts every move of a non-pawn piece between two squares
+// it attacks on an empty board. Its hash is the difference between the
+// keys of the positions before and after the move.
+
+static void init_cuckoo(void) {
+  for (int i = 0; i < 8192; ++i) {
+    Cuckoo[i] = 0;
+    CuckooMove[i] = MOVE_NONE;
+  }
+  for (int c = WHITE; c <= BLACK; ++c)
+    for (int pt = KNIGHT; pt <= KING; ++pt) {
+      int piece = make_piece(c, pt);
+      for (int s1 = 0; s1 < 64; ++s1)
+        for (int s2 = s1 + 1; s2 < 64; ++s2)
+          if (PseudoAttacks[pt][s1] & SquareBB[s2]) {
+            uint16_t move = make_move(s1, s2);
+            Key key = PieceKeys[piece][s1] ^ PieceKeys[piece][s2] ^ SideKey;
+            int i = H1(key);
+            while (true) {
+              Key k = Cuckoo[i];
+              uint16_t m = CuckooMove[i];
+              Cuckoo[i] = key;
+              CuckooMove[i] = move;
+              if (m == MOVE_NONE)
+                break;
+              key = k;
+              move = m;
+              i = i == H1(key) ? H2(key) : H1(key);
+            }
+          }
+    }
+}
+
+// position_init() fills the Zobrist tables from a fixed seed, so that keys
+// are the same in every build and every run. The persistent analysis cache
+// relies on this to find positions stored by earlier processes.
+
 void position_init() {
-	for (int a = 0; a < 16; ++a)
-		for (int b = 0; b < 64; ++b)
-			PieceKeys[a][b] = RAND_64;
-	for (int c = 0; c < 16; ++c)
-		CastleKeys[c] = RAND_64;
-	for (int d = 0; d < 64; ++d)
-		PassantKeys[d] = RAND_64;
-	SideKey = RAND_64;
+  Key rng;
+  prng_init(&rng, 1070372);
+  for (int a = 0; a < 16; ++a)
+    for (int b = 0; b < 64; ++b)
+      PieceKeys[a][b] = prng_rand(&rng);
+  for (int c = 0; c < 16; ++c)
+    CastleKeys[c] = prng_rand(&rng);
+  for (int d = 0; d < 64; ++d)
+    PassantKeys[d] = prng_rand(&rng);
+  SideKey = prng_rand(&rng);
+  init_castling_mask();
+  init_cuckoo();
 }
 
 void update_key(Position *pos) {
@@ -85,7 +152,7 @@ void pos_pretty(Position *pos) {
     puts("No En Passant Square");
   printf("Castling: %s", strings[pos->castling]);
   printf("\nFifty Move Rule: %d\n", pos->rule);
-  printf("Move Number: %d\n\n",pos->ply);
+  printf("Move Number: %d\n\n", 1 + pos->ply / 2);
 }
 
 void reset_pos(Position *pos) {
@@ -98,6 +165,12 @@ void reset_pos(Position *pos) {
   pos->ply = 0;
   pos->pawns[0] = 0x0ULL;
   pos->pawns[1] = 0x0ULL;
+  pos->history = NULL;
+  pos->historyLen = 0;
+  for (int s = 0; s < 64; ++s)
+    pos->board[s] = 0;
+  for (int pt = 0; pt < 8; ++pt)
+    pos->types[pt] = 0x0ULL;
   for (int a = 0; a < 16; ++a) {
     pos->count[a] = 0;
     for (int b = 0; b < 10; ++b)
@@ -106,190 +179,296 @@ void reset_pos(Position *pos) {
   update_key(pos);
 }
 
-void parse_fen(Position *pos, char *fen) {
+// parse_fen() sets up the position described by the FEN or EPD string and
+// returns a pointer just past the parsed fields (the EPD opcodes, if any),
+// or NULL if the string is not a valid position. The halfmove clock and
+// fullmove number are optional so that plain EPD records are accepted.
+
+static const char *skip_spaces(const char *str) {
+  while (*str == ' ' || *str == '\t')
+    ++str;
+  return str;
+}
+
+static const char *parse_number(const char *str, int *value) {
+  if (*str < '0' || *str > '9')
+    return NULL;
+  int n = 0;
+  while (*str >= '0' && *str <= '9') {
+    if (n > 100000)
+      return NULL;
+    n = n * 10 + *str++ - '0';
+  }
+  *value = n;
+  return str;
+}
+
+static bool is_field_end(char c) {
+  return c == ' ' || c == '\t' || c == '\0' || c == '\n' || c == '\r' || c == ';';
+}
+
+const char *parse_fen(Position *pos, const char *fen) {
+  static const char PieceChars[] = " PNBRQK  pnbrqk";
+  int file = FILE_A, rank = RANK_8;
   reset_pos(pos);
-  int file = FILE_A;
-  int rank = RANK_8;
-  int piece;
-  int count;
-  while (rank >= RANK_1) {
-    count = 1;
-    switch (*fen) {
-      case 'p': piece = B_PAWN; break;
-      case 'r': piece = B_ROOK; break;
-      case 'n': piece = B_KNIGHT; break;
-      case 'b': piece = B_BISHOP; break;
-      case 'k': piece = B_KING; break;
-      case 'q': piece = B_QUEEN; break;
-      case 'P': piece = W_PAWN; break;
-      case 'R': piece = W_ROOK; break;
-      case 'N': piece = W_KNIGHT; break;
-      case 'B': piece = W_BISHOP; break;
-      case 'K': piece = W_KING; break;
-      case 'Q': piece = W_QUEEN; break;
-      case '1':
-      case '2':
-      case '3':
-      case '4':
-      case '5':
-      case '6':
-      case '7':
-      case '8':
-        piece = -1;
-        count = *fen - '0';
-        break;
-      case '/':
-      case ' ':
-        rank--;
-        file = FILE_A;
-        ++fen;
-        continue;
+  fen = skip_spaces(fen);
+
+  // 1. Piece placement
+  for (; !is_field_end(*fen); ++fen) {
+    if (*fen == '/') {
+      if (file != 8 || rank == RANK_1)
+        return NULL;
+      file = FILE_A;
+      --rank;
     }
-		for (int i = 0; i < count; i++) {			
-      int sq = make_square(file, rank);
-      if (piece != -1) {
-        pos->lists[piece][pos->count[piece]] = sq;
-        pos->occupied[color_of(piece)] |= SquareBB[sq];
-        ++pos->count[piece];
-        if (type_of_p(piece) == PAWN) {
-          pos->pawns[color_of(piece)] |= SquareBB[sq];
-        }
-      }
-			file++;
+    else if (*fen >= '1' && *fen <= '8') {
+      file += *fen - '0';
+      if (file > 8)
+        return NULL;
     }
-		++fen;
-  }
-  pos->side = (*fen == 'w') ? WHITE : BLACK;
-	fen += 2;
-	for (int i = 0; i < 4; i++) {
-    if (*fen == ' ') {
-      break;
-    }		
-		switch (*fen) {
-			case 'K': pos->castling |= WHITE_OO; break;
-			case 'Q': pos->castling |= WHITE_OOO; break;
-			case 'k': pos->castling |= BLACK_OO; break;
-			case 'q': pos->castling |= BLACK_OOO; break;
+    else {
+      const char *p = strchr(PieceChars, *fen);
+      int piece = p ? (int)(p - PieceChars) : 0;
+      if (!piece || *fen == ' ' || file > FILE_H || pos->count[piece] == 10)
+        return NULL;
+      put_piece(pos, piece, make_square(file, rank));
+      ++file;
     }
-		++fen;
-	}
-	++fen;
-	if (*fen != '-') {        
-		file = *fen - 'a';
-    ++fen;
-		rank = *fen - '1';
-    ++fen;
-		pos->passant = make_square(file, rank);
-    --fen;
   }
-  fen += 2;
-  pos->rule = *fen - '0';
-  ++fen;
-  if (*fen != ' ') {
-    pos->rule *= 10;
-    pos->rule += *fen - '0';
+  if (file != 8 || rank != RANK_1)
+    return NULL;
+
+  // 2. Active color
+  fen = skip_spaces(fen);
+  if (*fen != 'w' && *fen != 'b')
+    return NULL;
+  pos->side = *fen++ == 'w' ? WHITE : BLACK;
+  if (!is_field_end(*fen))
+    return NULL;
+
+  // 3. Castling availability. Rights not backed by a king and rook on
+  // their original squares are dropped rather than rejected.
+  fen = skip_spaces(fen);
+  if (*fen == '-')
     ++fen;
-  }
-  ++fen;
-  pos->ply = *fen - '0';
-  ++fen;
-  while (*fen) {
-    pos->ply *= 10;
-    pos->ply += *fen - '0';
+  else
+    for (; !is_field_end(*fen); ++fen)
+      switch (*fen) {
+        case 'K': pos->castling |= WHITE_OO; break;
+        case 'Q': pos->castling |= WHITE_OOO; break;
+        case 'k': pos->castling |= BLACK_OO; break;
+        case 'q': pos->castling |= BLACK_OOO; break;
+        default: return NULL;
+      }
+  if (pos->board[SQ_E1] != W_KING || pos->board[SQ_H1] != W_ROOK)
+    pos->castling &= ~WHITE_OO;
+  if (pos->board[SQ_E1] != W_KING || pos->board[SQ_A1] != W_ROOK)
+    pos->castling &= ~WHITE_OOO;
+  if (pos->board[SQ_E8] != B_KING || pos->board[SQ_H8] != B_ROOK)
+    pos->castling &= ~BLACK_OO;
+  if (pos->board[SQ_E8] != B_KING || pos->board[SQ_A8] != B_ROOK)
+    pos->castling &= ~BLACK_OOO;
+
+  // 4. En passant square. It is kept only if a pawn can actually capture,
+  // matching what do_move() does, so that equal positions get equal keys.
+  fen = skip_spaces(fen);
+  if (*fen == '-')
     ++fen;
+  else {
+    if (fen[0] < 'a' || fen[0] > 'h' || fen[1] != (pos->side == WHITE ? '6' : '3'))
+      return NULL;
+    int sq = make_square(fen[0] - 'a', fen[1] - '1');
+    fen += 2;
+    if (   (pos->pawns[!pos->side] & SquareBB[sq - pawn_push(pos->side)])
+        && (PawnAttacks[!pos->side][sq] & pos->pawns[pos->side]))
+      pos->passant = sq;
   }
-  pos->ply *= 2;
-  pos->ply -= 2;
-  pos->ply += pos->side;
+  if (!is_field_end(*fen))
+    return NULL;
+
+  // 5-6. Halfmove clock and fullmove number (optional in EPD)
+  int rule = 0, fullmove = 1;
+  const char *next = parse_number(skip_spaces(fen), &rule);
+  if (next && is_field_end(*next)) {
+    fen = next;
+    next = parse_number(skip_spaces(fen), &fullmove);
+    if (next && is_field_end(*next))
+      fen = next;
+  }
+  pos->rule = rule;
+  pos->ply = 2 * (fullmove > 0 ? fullmove - 1 : 0) + pos->side;
+
+  // Sanity checks: one king each, no pawns on the first or last rank and
+  // the side that has just moved must not be left in check.
+  if (   pos->count[W_KING] != 1 || pos->count[B_KING] != 1
+      || pos->count[W_PAWN] > 8 || pos->count[B_PAWN] > 8
+      || ((pos->pawns[WHITE] | pos->pawns[BLACK]) & (Rank1BB | Rank8BB))
+      || sq_attacked(pos, king_sq(pos, !pos->side), pos->side))
+    return NULL;
+
   update_key(pos);
+  return skip_spaces(fen);
 }
 
-void do_move(Position *pos, int move) {
-  int to = to_sq(move);
+// epd_strip() removes from line the EPD operations whose opcode is one of
+// the space separated names, ops pointing into line at the opcodes that
+// parse_fen() returned. A name ending in '#' stands for the opcodes that
+// continue it with digits, "mpv#" for mpv1, mpv2 and so on. Tools strip the opcodes they write, so that analyzing
+// their own output again does not duplicate them.
+
+static bool opcode_listed(const char *op, size_t len, const char *names) {
+  while (*(names = skip_spaces(names))) {
+    size_t n = strcspn(names, " ");
+    if (names[n - 1] == '#' ? len >= n && !strncmp(op, names, n - 1)
+                              && strspn(op + n - 1, "0123456789") == len - n + 1
+                            : len == n && !strncmp(op, names, n))
+      return true;
+    names += n;
+  }
+  return false;
+}
+
+void epd_strip(char *line, const char *ops, const char *names) {
+  char *out = line + (ops - line), *in;
+
+  // Every operation is removed with the blanks in front of it
+  while (out > line && (out[-1] == ' ' || out[-1] == '\t'))
+    --out;
+  for (in = out; *in; ) {
+    // An operation runs from its opcode to a semicolon outside quotes
+    char *start = in, *op = (char *)skip_spaces(in), *end = op;
+    bool quoted = false;
+    while (*end && (*end != ';' || quoted))
+      quoted ^= *end++ == '"';
+    end += *end == ';';
+    if (opcode_listed(op, strcspn(op, " \t;"), names))
+      start = end;
+    memmove(out, start, end - start);
+    out += end - start;
+    in = end;
+  }
+  *out = '\0';
+}
+
+// pos_fen() writes the FEN string of the position into fen[], which must
+// hold at least 92 characters, and returns it.
+
+char *pos_fen(Position *pos, char *fen) {
+  static const char PieceChars[] = " PNBRQK  pnbrqk";
+  char *str = fen;
+
+  for (int r = RANK_8; r >= RANK_1; --r) {
+    for (int f = FILE_A; f <= FILE_H; ++f) {
+      int empty = 0;
+      for (; f <= FILE_H && !pos->board[make_square(f, r)]; ++f)
+        ++empty;
+      if (empty)
+        *str++ = '0' + empty;
+      if (f <= FILE_H)
+        *str++ = PieceChars[pos->board[make_square(f, r)]];
+    }
+    if (r > RANK_1)
+      *str++ = '/';
+  }
+  *str++ = ' ';
+  *str++ = pos->side == WHITE ? 'w' : 'b';
+  *str++ = ' ';
+  if (pos->castling & WHITE_OO) *str++ = 'K';
+  if (pos->castling & WHITE_OOO) *str++ = 'Q';
+  if (pos->castling & BLACK_OO) *str++ = 'k';
+  if (pos->castling & BLACK_OOO) *str++ = 'q';
+  if (!pos->castling) *str++ = '-';
+  *str++ = ' ';
+  if (pos->passant != SQ_NONE) {
+    *str++ = 'a' + file_of(pos->passant);
+    *str++ = '1' + rank_of(pos->passant);
+  }
+  else
+    *str++ = '-';
+  sprintf(str, " %d %d", pos->rule, 1 + pos->ply / 2);
+  return fen;
+}
+
+// do_move() makes a legal move on the board. There is no undo: the search
+// copies the position before each move instead. The body is specialized
+// for the side to move, like the move generator.
+
+INLINE void make_move_c(Position *pos, int move, const Color Us) {
+  const Color Them = !Us;
+  const int Up = pawn_push(Us);
   int from = from_sq(move);
+  int to = to_sq(move);
   int type = type_of_m(move);
-  int promote = make_piece(pos->side, promotion_type(move));
-  for (int t = PAWN; t <= KING; ++t) {
-    int piece = make_piece(pos->side, t);
-    int enemy = make_piece(pos->side == WHITE ? BLACK : WHITE, t);
-    for (int c = 0; c < pos->count[piece]; ++c) {
-      if (pos->lists[piece][c] == from) {
-        pos->lists[piece][c] = to;
-        if (t == PAWN)
-          pos->rule = -1;
-        for (int p = PAWN; p <= KING; ++p) {
-          for (int i = 0; i < pos->count[make_piece(pos->side == WHITE ? BLACK : WHITE, p)]; ++i) {
-            int sq = pos->lists[make_piece((pos->side == WHITE ? BLACK : WHITE), p)][i];
-            if (sq == to) {
-              pos->lists[make_piece((pos->side == WHITE ? BLACK : WHITE), p)][i] = pos->count[make_piece(pos->side == WHITE ? BLACK : WHITE, p)];
-              pos->rule = -1;
-            }
-          }
-        }
-        if (type == ENPASSANT && to == pos->passant) {
-          for (int c = 0; c < pos->count[piece]; ++c)
-            if (pos->lists[enemy][c] == (pos->side == WHITE ? pos->passant - 8 : pos->passant + 8)) {
-              pos->lists[enemy][c] = pos->lists[enemy][pos->count[enemy]-1];
-              pos->lists[enemy][c] = SQ_NONE;
-              break;
-            }
-        }
-        if (type == PROMOTION) {
-          pos->lists[piece][c] = pos->lists[piece][pos->count[piece]-1];
-          pos->lists[piece][pos->count[piece]-1] = SQ_NONE;
-          --pos->count[piece];
-          pos->lists[promote][pos->count[promote]] = to;
-          ++pos->count[promote];
-        }
-        if (t == PAWN && to - from == 16)
-          pos->passant = from + 8;
-        else if (t == PAWN && from - to == 16)
-          pos->passant = to + 8;
-        else
-          pos->passant = SQ_NONE;
-        if (t == KING && from == SQ_E1 && to == SQ_G1 && type == CASTLING)
-          for (int c = 0; c < pos->count[W_ROOK]; ++c)
-            if (pos->lists[W_ROOK][c] == SQ_H1)
-              pos->lists[W_ROOK][c] = SQ_F1;
-        if (t == KING && from == SQ_E1 && to == SQ_C1 && type == CASTLING)
-          for (int c = 0; c < pos->count[W_ROOK]; ++c)
-            if (pos->lists[W_ROOK][c] == SQ_A1)
-              pos->lists[W_ROOK][c] = SQ_D1;
-        if (t == KING && from == SQ_E8 && to == SQ_G8 && type == CASTLING)
-          for (int c = 0; c < pos->count[B_ROOK]; ++c)
-            if (pos->lists[B_ROOK][c] == SQ_H8)
-              pos->lists[B_ROOK][c] = SQ_F8;
-        if (t == KING && from == SQ_E8 && to == SQ_C8 && type == CASTLING)
-          for (int c = 0; c < pos->count[W_ROOK]; ++c)
-            if (pos->lists[B_ROOK][c] == SQ_A8)
-              pos->lists[B_ROOK][c] = SQ_D8;
-        if (t == KING) {
-          pos->castling &= pos->side == WHITE ? BLACK_OO | BLACK_OOO : WHITE_OO | WHITE_OOO;
-        }
-        if (t == ROOK && from == SQ_A1) {
-          pos->castling &= pos->side == WHITE ? ~WHITE_OOO : ~BLACK_OOO;
-        }
-        if (t == ROOK && from == SQ_H1) {
-          pos->castling &= pos->side == WHITE ? ~WHITE_OO : ~BLACK_OO;
-        }
-        pos->side = pos->side == WHITE ? BLACK : WHITE;
-        ++pos->ply;
-        ++pos->rule;
-        return;
-      }
+  int piece = pos->board[from];
+  int capsq = type == ENPASSANT ? to - Up : to;
+  int captured = pos->board[capsq];
+
+  ++pos->ply;
+  ++pos->rule;
+
+  if (type == CASTLING) {
+    int rfrom = to > from ? to + 1 : to - 2;
+    int rto = to > from ? to - 1 : to + 1;
+    move_piece(pos, make_piece(Us, ROOK), rfrom, rto);
+    captured = 0;
+  }
+
+  if (captured) {
+    remove_piece(pos, captured, capsq);
+    pos->rule = 0;
+  }
+
+  move_piece(pos, piece, from, to);
+  pos->passant = SQ_NONE;
+
+  if (piece == make_piece(Us, PAWN)) {
+    pos->rule = 0;
+    if (type == PROMOTION) {
+      remove_piece(pos, piece, to);
+      put_piece(pos, make_piece(Us, promotion_type(move)), to);
     }
+    else if ((to ^ from) == 16 && (PawnAttacks[Us][from + Up] & pos->pawns[Them]))
+      pos->passant = from + Up;
   }
+
+  pos->castling &= CastlingRightsMask[from] & CastlingRightsMask[to];
+  pos->side = Them;
 }
 
+void do_move(Position *pos, int move) {
+  stats_inc(STAT_DO_MOVE);
+  if (pos->history)
+    pos->history[pos->historyLen++] = pos->key;
+  if (pos->side == WHITE)
+    make_move_c(pos, move, WHITE);
+  else
+    make_move_c(pos, move, BLACK);
+  update_key(pos);
+}
+
+// move_attacked() returns true if the king of the side to move would be
+// attacked by 'color' after the piece on 'from' moves to 'to'. A piece
+// captured on 'to', or by en passant, no longer gives check.
+
 bool move_attacked(Position *pos, int from, int to, int color) {
+  Bitboard occupied = (pieces(pos) & ~SquareBB[from]) | SquareBB[to];
+  Bitboard captured = SquareBB[to];
+  int ksq = type_of_p(pos->board[from]) == KING ? to : king_sq(pos, pos->side);
+  if (to == pos->passant && type_of_p(pos->board[from]) == PAWN) {
+    captured |= SquareBB[to - pawn_push(pos->side)];
+    occupied &= ~captured | SquareBB[to];
+  }
   for (int p = PAWN; p <= KING; ++p)
-    for (int c = 0; c < pos->count[make_piece(color, p)]; ++c)
-      if (attacks_bb(make_piece(color, p), pos->lists[make_piece(color, p)][c], ((pos->occupied[WHITE] | pos->occupied[BLACK] | SquareBB[to]) & ~SquareBB[from])) & SquareBB[pos->lists[make_piece(pos->side, KING)][0]])
+    for (int c = 0; c < pos->count[make_piece(color, p)]; ++c) {
+      int sq = pos->lists[make_piece(color, p)][c];
+      if (!(SquareBB[sq] & captured) && (attacks_bb(make_piece(color, p), sq, occupied) & SquareBB[ksq]))
         return true;
+    }
   return false;
 }
 
 bool sq_attacked(Position *pos, int sq, int color) {
+  stats_inc(STAT_SQ_ATTACKED);
   for (int p = PAWN; p <= KING; ++p)
     for (int c = 0; c < pos->count[make_piece(color, p)]; ++c)
       if (attacks_bb(make_piece(color, p), pos->lists[make_piece(color, p)][c], (pos->occupied[WHITE] | pos->occupied[BLACK])) & SquareBB[sq])
@@ -316,6 +495,7 @@ int move_pinned(Position *pos, int from, int to, int color) {
 }
 
 int sq_pinned(Position *pos, int sq, int color) {
+  stats_inc(STAT_SQ_PINNED);
   if (!pos->count[W_KING] || !pos->count[B_KING])
     return SQ_NONE;
   for (int c = 0; c < pos->count[make_piece(~color & 1, BISHOP)]; ++c)
@@ -328,4 +508,287 @@ int sq_pinned(Position *pos, int sq, int color) {
     if ((attacks_bb(make_piece(~color & 1, QUEEN), pos->lists[make_piece(~color & 1, QUEEN)][c], ((pos->occupied[WHITE] | pos->occupied[BLACK]) & ~SquareBB[sq]))) & SquareBB[pos->lists[make_piece(color, KING)][0]])
       return pos->lists[make_piece(~color & 1, QUEEN)][c];
   return SQ_NONE;
-}
\ No newline at end of file
+}
+
+// attackers_to() returns the pieces of both colors that attack the square,
+// given the occupancy.
+
+Bitboard attackers_to(Position *pos, int sq, Bitboard occupied) {
+  return  (PawnAttacks[BLACK][sq] & pieces_cpt(pos, WHITE, PAWN))
+        | (PawnAttacks[WHITE][sq] & pieces_cpt(pos, BLACK, PAWN))
+        | (PseudoAttacks[KNIGHT][sq] & pieces_pt(pos, KNIGHT))
+        | (attacks_bb_rook(sq, occupied) & (pieces_pt(pos, ROOK) | pieces_pt(pos, QUEEN)))
+        | (attacks_bb_bishop(sq, occupied) & (pieces_pt(pos, BISHOP) | pieces_pt(pos, QUEEN)))
+        | (PseudoAttacks[KING][sq] & pieces_pt(pos, KING));
+}
+
+// attack_info() fills the attack maps of the position. The mobility area
+// of a side excludes its own pieces and the squares attacked by enemy
+// pawns, so pawn attacks go first. A slider that checks the king also
+// covers the squares behind it along the line, which the king must not
+// step back to.
+
+void attack_info(Position *pos, AttackInfo *ai) {
+  Bitboard occupied = pieces(pos);
+  int us = pos->side;
+
+  for (int c = WHITE; c <= BLACK; ++c) {
+    ai->attackedBy[c][PAWN] = pawn_attacks_bb(pos->pawns[c], c);
+    ai->attackedBy2[c] = pawn_double_attacks_bb(pos->pawns[c], c);
+    ai->kingRing[c] = PseudoAttacks[KING][king_sq(pos, c)] | SquareBB[king_sq(pos, c)];
+  }
+
+  ai->checkers = 0;
+  for (int c = WHITE; c <= BLACK; ++c) {
+    Bitboard area = ~(pos->occupied[c] | ai->attackedBy[!c][PAWN]);
+    Bitboard all = ai->attackedBy[c][PAWN];
+    Bitboard enemyKing = SquareBB[king_sq(pos, !c)];
+    ai->kingAttackers[c] = 0;
+
+    for (int i = 0; i < pos->count[make_piece(c, PAWN)]; ++i) {
+      int sq = pos->lists[make_piece(c, PAWN)][i];
+      ai->pieceAttacks[make_piece(c, PAWN)][i] = PawnAttacks[c][sq];
+      if (PawnAttacks[c][sq] & enemyKing)
+        ai->checkers |= SquareBB[sq];
+    }
+
+    for (int pt = KNIGHT; pt <= KING; ++pt) {
+      int piece = make_piece(c, pt);
+      Bitboard byType = 0;
+      int n = 0;
+      for (int i = 0; i < pos->count[piece]; ++i) {
+        int sq = pos->lists[piece][i];
+        Bitboard b = attacks_bb(piece, sq, occupied);
+        ai->pieceAttacks[piece][i] = b;
+        ai->attackedBy2[c] |= all & b;
+        all |= b;
+        byType |= b;
+        n += popcount(b & area);
+        if (b & ai->kingRing[!c])
+          ai->kingAttackers[c]++;
+        if (b & enemyKing)
+          ai->checkers |= SquareBB[sq];
+      }
+      ai->attackedBy[c][pt] = byType;
+      ai->mobility[c][pt] = n;
+    }
+    ai->attackedBy[c][0] = all;
+  }
+  ai->checkers &= pos->occupied[!us];
+
+  // Pins and the lines of slider checks come from the sliders that see the
+  // king through at most one piece. A piece of ours between one of our
+  // sliders and the enemy king is a candidate for a discovered check.
+  ai->kingDanger = ai->attackedBy[!us][0];
+  ai->dcCandidates = 0;
+  for (int c = WHITE; c <= BLACK; ++c) {
+    int ksq = king_sq(pos, c);
+    Bitboard snipers =  (PseudoAttacks[ROOK][ksq] & (pieces_cpt(pos, !c, ROOK) | pieces_cpt(pos, !c, QUEEN)))
+                      | (PseudoAttacks[BISHOP][ksq] & (pieces_cpt(pos, !c, BISHOP) | pieces_cpt(pos, !c, QUEEN)));
+    ai->pinned[c] = 0;
+    while (snipers) {
+      int s = pop_lsb(&snipers);
+      Bitboard b = between_bb(ksq, s) & occupied;
+      if (!b && c == us)
+        ai->kingDanger |= LineBB[s][ksq] & ~SquareBB[s];
+      else if (!more_than_one(b)) {
+        ai->pinned[c] |= b & pos->occupied[c];
+        if (c != us)
+          ai->dcCandidates |= b & pos->occupied[us];
+      }
+    }
+  }
+
+  // The squares from which each piece type of ours would check the enemy
+  // king, for gives_check()
+  int ksq = king_sq(pos, !us);
+  ai->checkSquares[PAWN] = PawnAttacks[!us][ksq];
+  ai->checkSquares[KNIGHT] = PseudoAttacks[KNIGHT][ksq];
+  ai->checkSquares[BISHOP] = attacks_bb_bishop(ksq, occupied);
+  ai->checkSquares[ROOK] = attacks_bb_rook(ksq, occupied);
+  ai->checkSquares[QUEEN] = ai->checkSquares[BISHOP] | ai->checkSquares[ROOK];
+  ai->checkSquares[KING] = 0;
+}
+
+// gives_check() returns true if the legal move checks the enemy king. It
+// needs the check squares and discovered check candidates of attack_info(),
+// so that a normal move costs two bitmask tests. Promotions, en passant
+// and castling, which move or remove a second piece, look at the board.
+
+bool gives_check(Position *pos, AttackInfo *ai, int move) {
+  int us = pos->side;
+  int from = from_sq(move), to = to_sq(move);
+  int ksq = king_sq(pos, !us);
+
+  // Direct check
+  if (ai->checkSquares[type_of_p(pos->board[from])] & SquareBB[to])
+    return true;
+
+  // Discovered check, unless the piece stays on the line to the king
+  if ((ai->dcCandidates & SquareBB[from]) && !aligned(move, ksq))
+    return true;
+
+  switch (type_of_m(move)) {
+  case NORMAL:
+    return false;
+
+  case PROMOTION:
+    return attacks_bb(make_piece(us, promotion_type(move)), to, pieces(pos) ^ SquareBB[from])
+         & SquareBB[ksq];
+
+  // The captured pawn may uncover a slider on the king, even along a rank
+  case ENPASSANT: {
+    int capsq = make_square(file_of(to), rank_of(from));
+    Bitboard b = (pieces(pos) ^ SquareBB[from] ^ SquareBB[capsq]) | SquareBB[to];
+    return  (attacks_bb_rook(ksq, b) & (pieces_cpt(pos, us, ROOK) | pieces_cpt(pos, us, QUEEN)))
+          | (attacks_bb_bishop(ksq, b) & (pieces_cpt(pos, us, BISHOP) | pieces_cpt(pos, us, QUEEN)));
+  }
+
+  // Only the rook can check, from its square next to the king
+  default: {
+    int rfrom = to > from ? to + 1 : to - 2;
+    int rto = to > from ? to - 1 : to + 1;
+    Bitboard b = (pieces(pos) ^ SquareBB[from] ^ SquareBB[rfrom]) | SquareBB[to] | SquareBB[rto];
+    return attacks_bb_rook(rto, b) & SquareBB[ksq];
+  }
+  }
+}
+
+// see_ge() tests whether the static exchange evaluation of the move is
+// greater than or equal to the threshold. The exchange on the destination
+// square is resolved with the least valuable attacker first; whenever a
+// piece is taken off the occupancy, sliders behind it along the same line
+// (x-rays) are added back through a fresh magic lookup. Castling, en
+// passant and promotions are scored as an even exchange.
+
+bool see_ge(Position *pos, int move, Value threshold) {
+  if (type_of_m(move) != NORMAL)
+    return VALUE_ZERO >= threshold;
+
+  int from = from_sq(move), to = to_sq(move);
+
+  int swap = PieceValue[MG][pos->board[to]] - threshold;
+  if (swap < 0)
+    return false;
+
+  swap = PieceValue[MG][pos->board[from]] - swap;
+  if (swap <= 0)
+    return true;
+
+  Bitboard occupied = pieces(pos) ^ SquareBB[from] ^ SquareBB[to];
+  Bitboard attackers = attackers_to(pos, to, occupied);
+  Bitboard diagonal = pieces_pt(pos, BISHOP) | pieces_pt(pos, QUEEN);
+  Bitboard straight = pieces_pt(pos, ROOK) | pieces_pt(pos, QUEEN);
+  Bitboard stmAttackers, bb;
+  int stm = color_of(pos->board[from]);
+  int res = 1;
+
+  while (true) {
+    stm = !stm;
+    attackers &= occupied;
+    if (!(stmAttackers = attackers & pos->occupied[stm]))
+      break;
+    res ^= 1;
+
+    if ((bb = stmAttackers & pieces_pt(pos, PAWN))) {
+      if ((swap = PawnValueMg - swap) < res)
+        break;
+      occupied ^= bb & -bb;
+      attackers |= attacks_bb_bishop(to, occupied) & diagonal;
+    }
+    else if ((bb = stmAttackers & pieces_pt(pos, KNIGHT))) {
+      if ((swap = KnightValueMg - swap) < res)
+        break;
+      occupied ^= bb & -bb;
+    }
+    else if ((bb = stmAttackers & pieces_pt(pos, BISHOP))) {
+      if ((swap = BishopValueMg - swap) < res)
+        break;
+      occupied ^= bb & -bb;
+      attackers |= attacks_bb_bishop(to, occupied) & diagonal;
+    }
+    else if ((bb = stmAttackers & pieces_pt(pos, ROOK))) {
+      if ((swap = RookValueMg - swap) < res)
+        break;
+      occupied ^= bb & -bb;
+      attackers |= attacks_bb_rook(to, occupied) & straight;
+    }
+    else if ((bb = stmAttackers & pieces_pt(pos, QUEEN))) {
+      if ((swap = QueenValueMg - swap) < res)
+        break;
+      occupied ^= bb & -bb;
+      attackers |=  (attacks_bb_bishop(to, occupied) & diagonal)
+                  | (attacks_bb_rook(to, occupied) & straight);
+    }
+    else // King: it can capture only if the opponent has no attackers left
+      return (attackers & ~pos->occupied[stm]) ? res ^ 1 : res;
+  }
+
+  return res;
+}
+
+// repetitions() counts the earlier occurrences of the key of the position
+// 'back' plies before the current one, within 'end' plies of the current
+// position (the fifty-move window).
+
+static int repetitions(Position *pos, int back, int end) {
+  Key key = back ? pos->history[pos->historyLen - back] : pos->key;
+  int count = 0;
+  for (int i = back + 4; i <= end; i += 2)
+    count += pos->history[pos->historyLen - i] == key;
+  return count;
+}
+
+// is_draw() tests for a draw by the fifty-move rule or by repetition. Only
+// the last 'rule' plies can hold a repetition, so the scan is bounded by
+// the fifty-move counter and steps back two plies at a time. A position
+// repeated strictly after the root (less than 'ply' plies back) counts as
+// a draw at once; a repetition of the root or of an earlier position needs
+// to have occurred three times, as in has_game_cycle().
+
+bool is_draw(Position *pos, int ply) {
+  if (pos->rule >= 100)
+    return true;
+  if (!pos->history)
+    return false;
+
+  int end = pos->rule < pos->historyLen ? pos->rule : pos->historyLen;
+  for (int i = 4; i <= end; i += 2)
+    if (pos->history[pos->historyLen - i] == pos->key)
+      return i < ply || repetitions(pos, i, end) > 0;
+  return false;
+}
+
+// has_game_cycle() tests whether the side to move has a move that reaches
+// a position already in the history (an "upcoming repetition"). The key
+// difference to each earlier position an odd number of plies back is
+// looked up in the cuckoo tables; a hit is a single reversible move whose
+// path must be clear. As in is_draw(), a cycle before the root needs an
+// extra repetition.
+
+bool has_game_cycle(Position *pos, int ply) {
+  if (!pos->history)
+    return false;
+  int end = pos->rule < pos->historyLen ? pos->rule : pos->historyLen;
+  if (end < 3)
+    return false;
+
+  for (int i = 3; i <= end; i += 2) {
+    Key moveKey = pos->key ^ pos->history[pos->historyLen - i];
+    int j;
+    if (   (j = H1(moveKey), Cuckoo[j] == moveKey)
+        || (j = H2(moveKey), Cuckoo[j] == moveKey)) {
+      int s1 = from_sq(CuckooMove[j]), s2 = to_sq(CuckooMove[j]);
+      if (BetweenBB[s1][s2] & pieces(pos))
+        continue;
+      if (ply > i)
+        return true;
+      // Both Rc1c5 and Rc5c1 share an entry: the piece must be ours
+      if (color_of(pos->board[pos->board[s1] ? s1 : s2]) != pos->side)
+        continue;
+      if (repetitions(pos, i, end))
+        return true;
+    }
+  }
+  return false;
+}
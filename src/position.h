@@ -18,20 +18,123 @@ typedef struct {
   int side;
   int passant;
   int lists[16][10];
+  int board[64];
   Bitboard occupied[2];
   Bitboard pawns[2];
+  Bitboard types[8];
   Key key;
+
+  // Keys of the positions before this one, oldest first, or NULL if the
+  // history is not tracked. do_move() appends to it, so the buffer must
+  // have room for every move that will be made from this position.
+  Key *history;
+  int historyLen;
 } Position;
 
+// AttackInfo holds the attacks of both sides in a position. attack_info()
+// computes it once per node, so that the move generator and the evaluator
+// share one pass of attack lookups instead of each making its own.
+
+typedef struct {
+  Bitboard pieceAttacks[16][10];  // attacks of the piece on lists[p][i]
+  Bitboard attackedBy[2][8];      // by piece type; index 0 is all pieces
+  Bitboard attackedBy2[2];        // squares attacked at least twice
+  Bitboard kingRing[2];           // king square and its neighbours
+  int kingAttackers[2];           // pieces attacking the enemy king ring
+  int mobility[2][8];             // attacked squares in the mobility area
+  Bitboard pinned[2];             // pieces pinned to their own king
+  Bitboard checkers;              // pieces giving check to the side to move
+  Bitboard kingDanger;            // squares the king to move must not enter
+  Bitboard checkSquares[8];       // squares where a piece type checks the enemy king
+  Bitboard dcCandidates;          // pieces whose move may uncover a check
+} AttackInfo;
+
 void position_init();
 void update_key(Position *pos);
 void pos_pretty(Position *pos);
 void reset_pos(Position *pos);
-void parse_fen(Position *pos, char *fen);
+const char *parse_fen(Position *pos, const char *fen);
+void epd_strip(char *line, const char *ops, const char *names);
+char *pos_fen(Position *pos, char *fen);
 void do_move(Position *pos, int move);
 bool move_attacked(Position *pos, int from, int to, int color);
 bool sq_attacked(Position *pos, int sq, int color);
 int move_pinned(Position *pos, int from, int to, int color);
 int sq_pinned(Position *pos, int sq, int color);
+Bitboard attackers_to(Position *pos, int sq, Bitboard occupied);
+void attack_info(Position *pos, AttackInfo *ai);
+bool is_draw(Position *pos, int ply);
+bool has_game_cycle(Position *pos, int ply);
+bool see_ge(Position *pos, int move, Value threshold);
+bool gives_check(Position *pos, AttackInfo *ai, int move);
+
+// put_piece(), remove_piece() and move_piece() keep the piece lists, the
+// board array and the occupancy bitboards in sync. They do not touch the
+// key; callers recompute it with update_key() once the move is complete.
+
+INLINE void put_piece(Position *pos, int piece, int sq)
+{
+  pos->lists[piece][pos->count[piece]++] = sq;
+  pos->board[sq] = piece;
+  pos->occupied[color_of(piece)] |= SquareBB[sq];
+  pos->types[type_of_p(piece)] |= SquareBB[sq];
+  if (type_of_p(piece) == PAWN)
+    pos->pawns[color_of(piece)] |= SquareBB[sq];
+}
+
+INLINE void remove_piece(Position *pos, int piece, int sq)
+{
+  int last = --pos->count[piece];
+  for (int c = 0; c < last; ++c)
+    if (pos->lists[piece][c] == sq) {
+      pos->lists[piece][c] = pos->lists[piece][last];
+      break;
+    }
+  pos->lists[piece][last] = SQ_NONE;
+  pos->board[sq] = 0;
+  pos->occupied[color_of(piece)] &= ~SquareBB[sq];
+  pos->types[type_of_p(piece)] &= ~SquareBB[sq];
+  pos->pawns[color_of(piece)] &= ~SquareBB[sq];
+}
+
+INLINE void move_piece(Position *pos, int piece, int from, int to)
+{
+  for (int c = 0; c < pos->count[piece]; ++c)
+    if (pos->lists[piece][c] == from) {
+      pos->lists[piece][c] = to;
+      break;
+    }
+  pos->board[from] = 0;
+  pos->board[to] = piece;
+  pos->occupied[color_of(piece)] ^= SquareBB[from] | SquareBB[to];
+  pos->types[type_of_p(piece)] ^= SquareBB[from] | SquareBB[to];
+  if (type_of_p(piece) == PAWN)
+    pos->pawns[color_of(piece)] ^= SquareBB[from] | SquareBB[to];
+}
+
+INLINE int king_sq(Position *pos, int color)
+{
+  return pos->lists[make_piece(color, KING)][0];
+}
+
+INLINE Bitboard pieces(Position *pos)
+{
+  return pos->occupied[WHITE] | pos->occupied[BLACK];
+}
+
+INLINE Bitboard pieces_pt(Position *pos, int pt)
+{
+  return pos->types[pt];
+}
+
+INLINE Bitboard pieces_cpt(Position *pos, int c, int pt)
+{
+  return pos->occupied[c] & pos->types[pt];
+}
+
+INLINE bool in_check(Position *pos)
+{
+  return sq_attacked(pos, king_sq(pos, pos->side), !pos->side);
+}
 
 #endif
\ No newline at end of file
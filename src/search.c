@@ -0,0 +1,496 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "evaluate.h"
+#include "movegen.h"
+#include "search.h"
+#include "stats.h"
+#include "trace.h"
+#include "tt.h"
+
+// check_limits() raises the stop flag once the node or time budget is
+// spent. The first iteration always completes so that a move is available.
+
+static void check_limits(SearchInfo *si) {
+  if (!si->depth)
+    return;
+  if (   (si->limits.nodes && si->nodes >= si->limits.nodes)
+      || (si->limits.movetime && now() - si->start >= si->limits.movetime))
+    search_stop(si);
+}
+
+// update_quiet_history() applies a bonus (or malus) to the three history
+// tables for a quiet move.
+
+static void update_quiet_history(SearchInfo *si, Stack *ss, Position *pos, Move m, int bonus) {
+  int piece = pos->board[from_sq(m)], to = to_sq(m);
+  update_stat(&si->history[pos->side][from_to(m)], bonus);
+  update_stat(&(*(ss - 1)->contHist)[piece][to], bonus);
+  update_stat(&(*(ss - 2)->contHist)[piece][to], bonus);
+}
+
+// update_quiet_stats() is called when a quiet move fails high: it becomes
+// a killer and the counter move to the previous move, its history goes up
+// and that of the quiets searched before it goes down.
+
+static void update_quiet_stats(SearchInfo *si, Stack *ss, Position *pos, Move m,
+                               Move *quiets, int quietCount, Depth depth) {
+  int bonus = depth > 8 ? 2048 : 32 * depth * depth;
+  Move prev = (ss - 1)->currentMove;
+
+  if (ss->killers[0] != m) {
+    ss->killers[1] = ss->killers[0];
+    ss->killers[0] = m;
+  }
+  if (prev)
+    si->counterMoves[(ss - 1)->movedPiece][to_sq(prev)] = m;
+
+  update_quiet_history(si, ss, pos, m, bonus);
+  for (int i = 0; i < quietCount; ++i)
+    update_quiet_history(si, ss, pos, quiets[i], -bonus);
+}
+
+// set_current_move() records the move about to be searched at this ply, for
+// the counter move and continuation history lookups of the child.
+
+INLINE void set_current_move(SearchInfo *si, Stack *ss, Position *pos, Move m) {
+  ss->currentMove = m;
+  ss->movedPiece = pos->board[from_sq(m)];
+  ss->contHist = &si->contHist[ss->movedPiece][to_sq(m)];
+}
+
+// value_to_tt() converts a mate score relative to the root into one
+// relative to the node, as stored in the TT; value_from_tt() converts back.
+
+INLINE Value value_to_tt(Value v, int ply) {
+  return  v >= VALUE_MATE_IN_MAX_PLY  ? v + ply
+        : v <= VALUE_MATED_IN_MAX_PLY ? v - ply : v;
+}
+
+INLINE Value value_from_tt(Value v, int ply) {
+  return  v == VALUE_NONE             ? VALUE_NONE
+        : v >= VALUE_MATE_IN_MAX_PLY  ? v - ply
+        : v <= VALUE_MATED_IN_MAX_PLY ? v + ply : v;
+}
+
+// tt_cutoff() tests whether a TT entry of at least the given depth proves
+// that the node fails high or low.
+
+INLINE bool tt_cutoff(TTEntry *tte, Value ttValue, Depth depth, Value beta) {
+  return   tte_depth(tte) >= depth
+        && ttValue != VALUE_NONE
+        && (tte_bound(tte) & (ttValue >= beta ? BOUND_LOWER : BOUND_UPPER));
+}
+
+// find_root_move() returns the root move m among those not yet reported in
+// this iteration, or NULL.
+
+static RootMove *find_root_move(SearchInfo *si, Move m) {
+  for (int i = si->pvIdx; i < si->rootCount; ++i)
+    if (si->rootMoves[i].move == m)
+      return &si->rootMoves[i];
+  return NULL;
+}
+
+// exit_reason() classifies the result of a node that searched its moves,
+// for the tracer.
+
+INLINE int exit_reason(Value best, Value beta, Move bestMove) {
+  return best >= beta ? TRACE_FAIL_HIGH : bestMove ? TRACE_EXACT : TRACE_FAIL_LOW;
+}
+
+static Value qsearch(SearchInfo *si, Position *pos, Stack *ss, Value alpha, Value beta) {
+  stats_inc(STAT_QNODES);
+  trace_node_enter(ss->ply, 0, (ss - 1)->currentMove, alpha, beta);
+  if ((++si->nodes & 1023) == 0)
+    check_limits(si);
+  if (search_stopped(si)) {
+    trace_node_exit(ss->ply, 0, MOVE_NONE, VALUE_ZERO, TRACE_STOP, false);
+    return VALUE_ZERO;
+  }
+  if (is_draw(pos, ss->ply)) {
+    trace_node_exit(ss->ply, 0, MOVE_NONE, VALUE_DRAW, TRACE_DRAW, false);
+    return VALUE_DRAW;
+  }
+  if (ss->ply >= MAX_PLY - 1) {
+    Value v = evaluate(pos);
+    trace_node_exit(ss->ply, 0, MOVE_NONE, v, TRACE_MAX_PLY, false);
+    return v;
+  }
+
+  bool pvNode = beta - alpha > 1;
+  Value oldAlpha = alpha;
+  TTEntry tte;
+  bool ttHit = tt_probe(pos->key, &tte);
+  Value ttValue = ttHit ? value_from_tt(tte.value, ss->ply) : VALUE_NONE;
+  if (!pvNode && ttHit && tt_cutoff(&tte, ttValue, DEPTH_QS_NO_CHECKS, beta)) {
+    stats_inc(STAT_TT_CUTOFF);
+    trace_node_exit(ss->ply, 0, tte.move, ttValue, TRACE_TT_CUTOFF, true);
+    return ttValue;
+  }
+
+  AttackInfo ai;
+  attack_info(pos, &ai);
+  bool check = ai.checkers;
+  Move ttMove = ttHit && (check || is_capture_or_promotion(pos, tte.move)) ? tte.move : MOVE_NONE;
+  Move bestMove = MOVE_NONE;
+  Value best = -VALUE_INFINITE;
+  if (!check) {
+    best = evaluate_ai(pos, &ai);
+    if (best >= beta) {
+      if (!ttHit)
+        tt_save(pos->key, value_to_tt(best, ss->ply), BOUND_LOWER, DEPTH_NONE, MOVE_NONE);
+      trace_node_exit(ss->ply, 0, MOVE_NONE, best, TRACE_STAND_PAT, ttHit);
+      return best;
+    }
+    if (best > alpha)
+      alpha = best;
+  }
+
+  ExtMove *end = generate_moves_ai(pos, &ai, ss->moves);
+  if (check && end == ss->moves) {
+    trace_node_exit(ss->ply, 0, MOVE_NONE, mated_in(ss->ply), TRACE_NO_MOVES, ttHit);
+    return mated_in(ss->ply);
+  }
+  (ss + 1)->moves = end;
+  (ss + 1)->ply = ss->ply + 1;
+
+  MovePicker mp;
+  Move m;
+  mp_init(&mp, pos, ss, end, ttMove, MOVE_NONE, &si->history, !check);
+
+  while ((m = next_move(&mp))) {
+    set_current_move(si, ss, pos, m);
+    Position child = *pos;
+    do_move(&child, m);
+    Value v = -qsearch(si, &child, ss + 1, -beta, -alpha);
+    if (search_stopped(si)) {
+      trace_node_exit(ss->ply, 0, MOVE_NONE, VALUE_ZERO, TRACE_STOP, ttHit);
+      return VALUE_ZERO;
+    }
+    if (v > best) {
+      best = v;
+      if (v > alpha) {
+        bestMove = m;
+        if (v >= beta)
+          break;
+        alpha = v;
+      }
+    }
+  }
+
+  tt_save(pos->key, value_to_tt(best, ss->ply),
+          best >= beta ? BOUND_LOWER : pvNode && best > oldAlpha ? BOUND_EXACT : BOUND_UPPER,
+          DEPTH_QS_NO_CHECKS, bestMove);
+  trace_node_exit(ss->ply, 0, bestMove, best, exit_reason(best, beta, bestMove), ttHit);
+  return best;
+}
+
+// search() is the principal variation search. The PV of the node is
+// written to pv[], terminated by MOVE_NONE.
+
+static Value search(SearchInfo *si, Position *pos, Stack *ss, Value alpha, Value beta, Depth depth, Move *pv) {
+  Move childPv[MAX_PLY + 1];
+  pv[0] = MOVE_NONE;
+
+  if (depth <= 0)
+    return qsearch(si, pos, ss, alpha, beta);
+  stats_inc(STAT_NODES);
+  trace_node_enter(ss->ply, depth, (ss - 1)->currentMove, alpha, beta);
+  if ((++si->nodes & 1023) == 0)
+    check_limits(si);
+  if (search_stopped(si)) {
+    trace_node_exit(ss->ply, depth, MOVE_NONE, VALUE_ZERO, TRACE_STOP, false);
+    return VALUE_ZERO;
+  }
+  if (ss->ply) {
+    if (is_draw(pos, ss->ply)) {
+      trace_node_exit(ss->ply, depth, MOVE_NONE, VALUE_DRAW, TRACE_DRAW, false);
+      return VALUE_DRAW;
+    }
+    // A drawn KPK needs no search
+    if (   is_kpk(pieces(pos), pos->types[PAWN])
+        && evaluate_kpk(pos->occupied[WHITE], pos->occupied[BLACK], pos->types[PAWN], pos->side)
+           == VALUE_DRAW) {
+      trace_node_exit(ss->ply, depth, MOVE_NONE, VALUE_DRAW, TRACE_DRAW, false);
+      return VALUE_DRAW;
+    }
+    // A move back into an earlier position can always reach a draw
+    if (alpha < VALUE_DRAW && has_game_cycle(pos, ss->ply)) {
+      alpha = VALUE_DRAW;
+      if (alpha >= beta) {
+        trace_node_exit(ss->ply, depth, MOVE_NONE, alpha, TRACE_CYCLE, false);
+        return alpha;
+      }
+    }
+  }
+  if (ss->ply >= MAX_PLY - 1) {
+    Value v = evaluate(pos);
+    trace_node_exit(ss->ply, depth, MOVE_NONE, v, TRACE_MAX_PLY, false);
+    return v;
+  }
+
+  bool rootNode = !ss->ply, pvNode = beta - alpha > 1;
+  TTEntry tte;
+  bool ttHit = tt_probe(pos->key, &tte);
+  Value ttValue = ttHit ? value_from_tt(tte.value, ss->ply) : VALUE_NONE;
+  Move ttMove = rootNode ? si->rootMoves[si->pvIdx].move : ttHit ? tte.move : MOVE_NONE;
+  if (!pvNode && ttHit && tt_cutoff(&tte, ttValue, depth, beta)) {
+    stats_inc(STAT_TT_CUTOFF);
+    trace_node_exit(ss->ply, depth, tte.move, ttValue, TRACE_TT_CUTOFF, true);
+    return ttValue;
+  }
+
+  AttackInfo ai;
+  attack_info(pos, &ai);
+  bool check = ai.checkers;
+  ExtMove *end = generate_moves_ai(pos, &ai, ss->moves);
+  if (end == ss->moves) {
+    Value v = check ? mated_in(ss->ply) : VALUE_DRAW;
+    trace_node_exit(ss->ply, depth, MOVE_NONE, v, TRACE_NO_MOVES, ttHit);
+    return v;
+  }
+  (ss + 1)->moves = end;
+  (ss + 1)->ply = ss->ply + 1;
+  (ss + 2)->killers[0] = (ss + 2)->killers[1] = MOVE_NONE;
+
+  Move prev = (ss - 1)->currentMove;
+  Move counter = prev ? si->counterMoves[(ss - 1)->movedPiece][to_sq(prev)] : MOVE_NONE;
+  Move quiets[64];
+  int quietCount = 0, moveCount = 0;
+  MovePicker mp;
+  Move m;
+  mp_init(&mp, pos, ss, end, ttMove, counter, &si->history, false);
+
+  Move bestMove = MOVE_NONE;
+  Value best = -VALUE_INFINITE;
+  while ((m = next_move(&mp))) {
+    // At the root only the moves of the lines not yet reported are searched
+    RootMove *rm = NULL;
+    if (rootNode && !(rm = find_root_move(si, m)))
+      continue;
+
+    bool capture = is_capture_or_promotion(pos, m);
+
+    // Prune moves that lose material by SEE at low depth, once a move has
+    // been searched and no mate is at stake.
+    if (   ss->ply
+        && !check
+        && depth <= 6
+        && moveCount
+        && best > VALUE_MATED_IN_MAX_PLY
+        && !see_ge(pos, m, capture ? -PawnValueEg * depth : -40 * depth * depth))
+      continue;
+
+    ++moveCount;
+    set_current_move(si, ss, pos, m);
+    Position child = *pos;
+    do_move(&child, m);
+    Depth newDepth = depth - 1 + gives_check(pos, &ai, m);
+    Value v;
+    if (moveCount == 1)
+      v = -search(si, &child, ss + 1, -beta, -alpha, newDepth, childPv);
+    else {
+      v = -search(si, &child, ss + 1, -alpha - 1, -alpha, newDepth, childPv);
+      if (v > alpha && v < beta)
+        v = -search(si, &child, ss + 1, -beta, -alpha, newDepth, childPv);
+    }
+    if (search_stopped(si)) {
+      trace_node_exit(ss->ply, depth, MOVE_NONE, VALUE_ZERO, TRACE_STOP, ttHit);
+      return VALUE_ZERO;
+    }
+
+    if (rootNode) {
+      if (moveCount == 1 || v > alpha) {
+        rm->score = v;
+        rm->pv[0] = m;
+        for (rm->pvlen = 1; (rm->pv[rm->pvlen] = childPv[rm->pvlen - 1]) != MOVE_NONE; ++rm->pvlen) {}
+      }
+      else
+        rm->score = -VALUE_INFINITE;
+    }
+
+    if (v > best) {
+      best = v;
+      if (v > alpha) {
+        bestMove = m;
+        pv[0] = m;
+        for (int j = 0; (pv[j + 1] = childPv[j]) != MOVE_NONE; ++j) {}
+        if (v >= beta) {
+          if (!capture)
+            update_quiet_stats(si, ss, pos, m, quiets, quietCount, depth);
+          break;
+        }
+        alpha = v;
+      }
+    }
+    if (!capture && quietCount < 64)
+      quiets[quietCount++] = m;
+  }
+
+  // Later MultiPV lines exclude the best move, so their result does not
+  // belong to the root position
+  if (!rootNode || !si->pvIdx)
+    tt_save(pos->key, value_to_tt(best, ss->ply),
+            best >= beta ? BOUND_LOWER : pvNode && bestMove ? BOUND_EXACT : BOUND_UPPER,
+            depth, bestMove);
+  trace_node_exit(ss->ply, depth, bestMove, best, exit_reason(best, beta, bestMove), ttHit);
+  return best;
+}
+
+SearchInfo *search_new(void) {
+  SearchInfo *si = aligned_alloc(64, sizeof(SearchInfo));
+  if (!si) {
+    fprintf(stderr, "Failed to allocate %zu bytes for search\n", sizeof(SearchInfo));
+    exit(EXIT_FAILURE);
+  }
+  search_clear(si);
+  si->report = NULL;
+  return si;
+}
+
+void search_delete(SearchInfo *si) {
+  free(si);
+}
+
+// search_clear() resets the ordering tables, so that the next search does
+// not depend on what was searched before. They take 2MB, so it is meant to
+// be called once per game or test run, not before every position.
+
+void search_clear(SearchInfo *si) {
+  memset(si->history, 0, sizeof(si->history));
+  memset(si->contHist, 0, sizeof(si->contHist));
+  memset(si->counterMoves, 0, sizeof(si->counterMoves));
+}
+
+// search_init() prepares a search of pos. Only the keys of the last
+// 'rule' plies of the game can repeat, so at most MAX_HISTORY of them are
+// copied; the search path is appended behind them.
+
+void search_init(SearchInfo *si, Position *pos, SearchLimits *limits) {
+  int n = pos->history ? pos->historyLen : 0;
+  if (n > pos->rule)
+    n = pos->rule;
+  if (n > MAX_HISTORY)
+    n = MAX_HISTORY;
+  if (n)
+    memcpy(si->keys, pos->history + pos->historyLen - n, n * sizeof(Key));
+
+  si->root = *pos;
+  si->root.history = si->keys;
+  si->root.historyLen = n;
+  si->limits = *limits;
+  si->nodes = 0;
+  si->stop = false;
+  si->depth = 0;
+  si->score = -VALUE_INFINITE;
+  si->pvlen = 0;
+  si->pv[0] = MOVE_NONE;
+  si->lineCount = 0;
+
+  Movelist list;
+  generate_all_moves(&si->root, &list);
+  si->rootCount = list.count;
+  si->rootMoves[0].move = MOVE_NONE;
+  for (int i = 0; i < list.count; ++i) {
+    RootMove *rm = &si->rootMoves[i];
+    rm->move = list.moves[i].move;
+    rm->score = rm->previousScore = -VALUE_INFINITE;
+    rm->pvlen = 0;
+  }
+  si->multiPV = limits->multiPV > 1 ? limits->multiPV : 1;
+  if (si->multiPV > MAX_MULTIPV)
+    si->multiPV = MAX_MULTIPV;
+  if (si->multiPV > si->rootCount)
+    si->multiPV = si->rootCount;
+}
+
+// sort_root_moves() stable sorts root moves [first, last) by score, then
+// by the score of the previous iteration.
+
+static void sort_root_moves(RootMove *first, RootMove *last) {
+  for (RootMove *p = first + 1; p < last; ++p)
+    for (RootMove *q = p; q > first; --q) {
+      if (   q->score < (q - 1)->score
+          || (q->score == (q - 1)->score && q->previousScore <= (q - 1)->previousScore))
+        break;
+      RootMove tmp = *q;
+      *q = *(q - 1);
+      *(q - 1) = tmp;
+    }
+}
+
+// search_start() runs the iterative deepening loop until the limits are
+// reached. Each iteration searches the MultiPV lines one after the other:
+// line i is the best of the root moves not among the first i, which are
+// kept sorted by score. From depth 5 on, every line is searched with an
+// aspiration window. The TT and ordering tables filled by the earlier
+// lines make the later ones cheap. The results of the last completed
+// iteration are kept in si.
+
+void search_start(SearchInfo *si) {
+  Move pv[MAX_PLY + 1];
+  int maxDepth = si->limits.depth ? si->limits.depth : MAX_PLY - 1;
+
+  Stack *ss = si->stack + 2;
+
+  si->start = now();
+  tt_new_search();
+  if (!si->rootCount) {
+    si->depth = 1;
+    si->score = in_check(&si->root) ? mated_in(0) : VALUE_DRAW;
+    return;
+  }
+
+  memset(si->stack, 0, sizeof(si->stack));
+  si->stack[0].contHist = si->stack[1].contHist = &si->contHist[0][0];
+  ss->moves = si->moveArena;
+  for (int d = 1; d <= maxDepth && !search_stopped(si); ++d) {
+    trace_iteration(d, si->nodes);
+    for (int i = 0; i < si->rootCount; ++i)
+      si->rootMoves[i].previousScore = si->rootMoves[i].score;
+
+    for (si->pvIdx = 0; si->pvIdx < si->multiPV && !search_stopped(si); ++si->pvIdx) {
+      // Aspiration window around the score of the line in the previous
+      // iteration, widened on every fail
+      Value prev = si->rootMoves[si->pvIdx].previousScore, delta = 18;
+      Value alpha = -VALUE_INFINITE, beta = VALUE_INFINITE;
+      if (d >= 5 && prev != -VALUE_INFINITE) {
+        alpha = prev - delta > -VALUE_INFINITE ? prev - delta : -VALUE_INFINITE;
+        beta  = prev + delta <  VALUE_INFINITE ? prev + delta :  VALUE_INFINITE;
+      }
+      while (true) {
+        Value v = search(si, &si->root, ss, alpha, beta, d, pv);
+        if (search_stopped(si))
+          break;
+        sort_root_moves(si->rootMoves + si->pvIdx, si->rootMoves + si->rootCount);
+        if (v <= alpha) {
+          beta = (alpha + beta) / 2;
+          alpha = v - delta > -VALUE_INFINITE ? v - delta : -VALUE_INFINITE;
+        }
+        else if (v >= beta)
+          beta = v + delta < VALUE_INFINITE ? v + delta : VALUE_INFINITE;
+        else
+          break;
+        delta += delta / 4 + 5;
+      }
+    }
+    if (search_stopped(si))
+      break;
+    sort_root_moves(si->rootMoves, si->rootMoves + si->multiPV);
+
+    si->depth = d;
+    si->lineCount = si->multiPV;
+    memcpy(si->lines, si->rootMoves, si->multiPV * sizeof(RootMove));
+    RootMove *best = &si->rootMoves[0];
+    si->score = best->score;
+    si->pvlen = best->pvlen;
+    memcpy(si->pv, best->pv, (best->pvlen + 1) * sizeof(Move));
+    if (si->report)
+      si->report(si, si->reportData);
+    if (si->multiPV == 1 && (si->score >= mate_in(d) || si->score <= mated_in(d)))
+      break;
+    check_limits(si);
+  }
+  trace_iteration(0, si->nodes);
+}
@@ -0,0 +1,89 @@
+#ifndef SEARCH_H_INCLUDED
+#define SEARCH_H_INCLUDED
+
+#include "misc.h"
+#include "movegen.h"
+#include "movepick.h"
+#include "position.h"
+
+// SearchLimits holds the budget of a search. A zero field means "no limit";
+// if all fields are zero the search runs to MAX_PLY.
+
+typedef struct {
+  int depth;
+  uint64_t nodes;
+  TimePoint movetime;
+  int multiPV;           // Number of lines to report, 0 or 1 for one
+} SearchLimits;
+
+// RootMove is a legal move of the root with its score and PV from the
+// latest search of it. Moves outside the PV window score -VALUE_INFINITE.
+
+typedef struct {
+  Move move;
+  Value score, previousScore;
+  int pvlen;
+  Move pv[MAX_PLY + 1];
+} RootMove;
+
+enum { MAX_HISTORY = 256, MAX_MULTIPV = 64 };
+
+// SearchInfo holds the state of one search thread. Searches share only the
+// transposition table, so each worker thread can run its own SearchInfo
+// concurrently. The ordering tables survive from one search to the next
+// until search_clear() is called; allocate with search_new() for
+// alignment.
+
+typedef struct SearchInfo SearchInfo;
+
+struct SearchInfo {
+  ButterflyHistory history;
+  ContinuationHistory contHist;
+  CounterMoveTable counterMoves;
+
+  Position root;
+  Key keys[MAX_HISTORY + MAX_PLY];   // Game history of the root, then the search path
+  SearchLimits limits;
+  TimePoint start;
+  uint64_t nodes;
+  bool stop;
+
+  RootMove rootMoves[MAX_MOVES];
+  int rootCount;
+  int multiPV;
+  int pvIdx;             // Line being searched in the current iteration
+
+  int depth;             // Last completed iteration
+  Value score;           // Best line of the last completed iteration
+  int pvlen;
+  Move pv[MAX_PLY + 1];
+  int lineCount;         // All lines of the last completed iteration
+  RootMove lines[MAX_MULTIPV];
+
+  // Called after every completed iteration if set, e.g. to stream the
+  // progress of a long search.
+  void (*report)(SearchInfo *si, void *data);
+  void *reportData;
+
+  Stack stack[MAX_PLY + 5];   // Two sentinels before the root, two after
+  ExtMove moveArena[MAX_PLY * MAX_MOVES];
+} __attribute__((aligned(64)));
+
+SearchInfo *search_new(void);
+void search_delete(SearchInfo *si);
+void search_clear(SearchInfo *si);
+void search_init(SearchInfo *si, Position *pos, SearchLimits *limits);
+void search_start(SearchInfo *si);
+
+// search_stop() asks a running search to stop at the next node; it may be
+// called from any thread. search_stopped() is the check of the search.
+
+INLINE void search_stop(SearchInfo *si) {
+  __atomic_store_n(&si->stop, true, __ATOMIC_RELAXED);
+}
+
+INLINE bool search_stopped(SearchInfo *si) {
+  return __atomic_load_n(&si->stop, __ATOMIC_RELAXED);
+}
+
+#endif
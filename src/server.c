@@ -0,0 +1,844 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "evaluate.h"
+#include "search.h"
+#include "server.h"
+#include "trace.h"
+#include "tt.h"
+
+// The server keeps one process, its tables and a fixed pool of search
+// threads alive across analysis requests. Clients connect to a Unix socket
+// and send one request per line:
+//
+//   go <id> [depth N] [nodes N] [movetime MS] [multipv N] fen <FEN>
+//   stats
+//   trace
+//   shutdown
+//
+// and get back, for every completed iteration and at the end:
+//
+//   info <id> depth D score cp|mate X nodes N time MS [multipv K] pv ...
+//   result <id> depth D score cp|mate X nodes N time MS bestmove M pv ...
+//
+// or "error <id> <reason>". A client may have up to MAX_QUEUED requests
+// waiting; each queues on its own connection, and idle workers serve the
+// connections round robin, so that one busy client cannot starve the
+// others. Replies go to a per-client output buffer that only the main
+// thread writes to the socket, without blocking, so a client that does not
+// read its replies cannot stall the others: its info lines are dropped
+// past PROGRESS_LIMIT bytes, and it is disconnected if its final replies
+// exceed OUTPUT_LIMIT. The searches of a client that disconnects are
+// stopped. All searches share the transposition table, which ages its
+// entries by search generation, and the persistent analysis cache if one
+// is given.
+
+enum { MAX_LINE = 1024, OUTPUT_LENGTH = 8192, MAX_CLIENTS = 256, MAX_LATENCIES = 1 << 20 };
+enum { MAX_QUEUED = 64, PROGRESS_LIMIT = 64 * 1024, OUTPUT_LIMIT = 1024 * 1024 };
+
+typedef struct Client Client;
+typedef struct Request Request;
+typedef struct Worker Worker;
+
+struct Request {
+  Request *next;
+  Client *client;
+  char id[32];
+  Position pos;
+  SearchLimits limits;
+  uint64_t received;     // microseconds
+};
+
+// The server mutex guards the queue, the reference count and closed;
+// writeMutex guards closed and the output buffer. closed is set with both
+// held, so either is enough to read it.
+
+struct Client {
+  int fd;
+  int wakeup;            // Write end of the server's wakeup pipe
+  int refs;              // The connection plus the requests in flight
+  int queued;
+  bool closed;
+  Request *head, *tail;
+  pthread_mutex_t writeMutex;
+  char *out;             // Replies not yet written to the socket
+  size_t outLength, outCapacity;
+  char buffer[MAX_LINE];
+  size_t length;
+};
+
+typedef struct {
+  Client *clients[MAX_CLIENTS];
+  int clientCount;
+  int cursor;            // Round robin position among the clients
+  bool stopping;
+  pthread_mutex_t mutex;
+  pthread_cond_t workCond;
+  Worker *workers;
+  int workerCount;
+  int wakeup[2];         // Pipe that wakes the main thread for output
+
+  AnalysisCache *cache;
+  const char *tracePath;
+  uint64_t served;
+  uint64_t *latencies;   // Microseconds from receipt to result
+  uint64_t start;
+} Server;
+
+struct Worker {
+  Server *server;
+  SearchInfo *si;
+  Client *client;        // Whose request is being searched, or NULL
+  pthread_t thread;
+};
+
+static volatile sig_atomic_t Interrupted;
+
+static void on_signal(int sig) {
+  (void)sig;
+  Interrupted = 1;
+}
+
+// now_us() returns a monotonic time stamp in microseconds.
+
+static uint64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+// format_latencies() sorts the latencies and writes the request count,
+// the throughput and the latency percentiles in milliseconds.
+
+static void format_latencies(char *out, size_t size, uint64_t *lat, uint64_t n, uint64_t elapsed) {
+  if (!n) {
+    snprintf(out, size, "requests 0");
+    return;
+  }
+  qsort(lat, n, sizeof(uint64_t), compare_u64);
+  snprintf(out, size, "requests %llu time %.0f ms throughput %.2f/s latency ms"
+           " p50 %.2f p90 %.2f p99 %.2f max %.2f",
+           (unsigned long long)n, elapsed / 1000.0, n * 1e6 / (elapsed + 1),
+           lat[n / 2] / 1000.0, lat[n * 9 / 10] / 1000.0, lat[n * 99 / 100] / 1000.0,
+           lat[n - 1] / 1000.0);
+}
+
+// send_line() appends a line to the output of a client, unless the client
+// is gone, and wakes the main thread to write it. Progress lines are
+// dropped while the client is behind; if it falls behind on its final
+// replies too, it is shut down and then dropped by the main thread.
+
+static void send_line(Client *c, const char *line, bool progress) {
+  size_t len = strlen(line);
+
+  pthread_mutex_lock(&c->writeMutex);
+  if (c->closed || (progress && c->outLength + len > PROGRESS_LIMIT)) {}
+  else if (c->outLength + len > OUTPUT_LIMIT)
+    shutdown(c->fd, SHUT_RDWR);
+  else {
+    if (c->outLength + len > c->outCapacity) {
+      size_t capacity = c->outCapacity ? c->outCapacity : 4096;
+      while (capacity < c->outLength + len)
+        capacity *= 2;
+      c->outCapacity = capacity < OUTPUT_LIMIT ? capacity : OUTPUT_LIMIT;
+      c->out = realloc(c->out, c->outCapacity);
+    }
+    memcpy(c->out + c->outLength, line, len);
+    if (!c->outLength && write(c->wakeup, "", 1) < 0) {}
+    c->outLength += len;
+  }
+  pthread_mutex_unlock(&c->writeMutex);
+}
+
+// pending_output() tells whether a client has output to write;
+// flush_output() writes as much of it as the socket takes without
+// blocking and returns false on a write error.
+
+static bool pending_output(Client *c) {
+  pthread_mutex_lock(&c->writeMutex);
+  bool pending = c->outLength > 0;
+  pthread_mutex_unlock(&c->writeMutex);
+  return pending;
+}
+
+static bool flush_output(Client *c) {
+  pthread_mutex_lock(&c->writeMutex);
+  ssize_t n = c->outLength ? send(c->fd, c->out, c->outLength, MSG_DONTWAIT | MSG_NOSIGNAL) : 0;
+  bool ok = n >= 0 || errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+  if (n > 0) {
+    c->outLength -= n;
+    memmove(c->out, c->out + n, c->outLength);
+  }
+  pthread_mutex_unlock(&c->writeMutex);
+  return ok;
+}
+
+static void free_client(Client *c) {
+  close(c->fd);
+  pthread_mutex_destroy(&c->writeMutex);
+  free(c->out);
+  free(c);
+}
+
+static void release_client(Server *s, Client *c) {
+  pthread_mutex_lock(&s->mutex);
+  bool last = !--c->refs;
+  pthread_mutex_unlock(&s->mutex);
+  if (last)
+    free_client(c);
+}
+
+// format_line() writes the info or result line of a search.
+
+static void format_line(char *out, size_t size, const char *kind, const char *id,
+                        SearchInfo *si, RootMove *line, int multiPV, bool final) {
+  char move[6];
+  Value v = line ? line->score : si->score;
+  int n = snprintf(out, size, "%s %s depth %d score", kind, id, si->depth);
+
+  if (abs(v) >= VALUE_MATE_IN_MAX_PLY)
+    n += snprintf(out + n, size - n, " mate %d",
+                  v > 0 ? (VALUE_MATE - v + 1) / 2 : -(VALUE_MATE + v) / 2);
+  else
+    n += snprintf(out + n, size - n, " cp %d", to_cp(v));
+  n += snprintf(out + n, size - n, " nodes %llu time %lld",
+                (unsigned long long)si->nodes, (long long)(now() - si->start));
+  if (multiPV)
+    n += snprintf(out + n, size - n, " multipv %d", multiPV);
+  if (final)
+    n += snprintf(out + n, size - n, " bestmove %s",
+                  si->pvlen ? move_str(si->pv[0], move) : "none");
+
+  int pvlen = line ? line->pvlen : si->pvlen;
+  Move *pv = line ? line->pv : si->pv;
+  n += snprintf(out + n, size - n, " pv");
+  for (int i = 0; i < pvlen && n < (int)size - 8; ++i)
+    n += snprintf(out + n, size - n, " %s", move_str(pv[i], move));
+  snprintf(out + n, size - n, "\n");
+}
+
+// report_iteration() streams the lines of every completed iteration.
+
+static void report_iteration(SearchInfo *si, void *data) {
+  Request *r = data;
+  char out[OUTPUT_LENGTH];
+
+  for (int i = 0; i < si->lineCount; ++i) {
+    format_line(out, sizeof(out), "info", r->id, si, &si->lines[i],
+                si->lineCount > 1 ? i + 1 : 0, false);
+    send_line(r->client, out, true);
+  }
+}
+
+// next_request() takes the first request of the next client with work,
+// round robin. It waits for work and returns NULL once the server stops.
+
+static Request *next_request(Server *s) {
+  pthread_mutex_lock(&s->mutex);
+  while (true) {
+    for (int i = 0; i < s->clientCount; ++i) {
+      int k = (s->cursor + i) % s->clientCount;
+      Client *c = s->clients[k];
+      if (c->head) {
+        Request *r = c->head;
+        if (!(c->head = r->next))
+          c->tail = NULL;
+        c->queued--;
+        s->cursor = k + 1;
+        pthread_mutex_unlock(&s->mutex);
+        return r;
+      }
+    }
+    if (s->stopping)
+      break;
+    pthread_cond_wait(&s->workCond, &s->mutex);
+  }
+  pthread_mutex_unlock(&s->mutex);
+  return NULL;
+}
+
+static void *server_worker(void *arg) {
+  Worker *w = arg;
+  Server *s = w->server;
+  SearchInfo *si = w->si;
+  char out[OUTPUT_LENGTH];
+  Request *r;
+
+  si->report = report_iteration;
+  while ((r = next_request(s))) {
+    si->reportData = r;
+    if (!cache_lookup(s->cache, &r->pos, &r->limits, si)) {
+      search_init(si, &r->pos, &r->limits);
+      // From here on drop_client() stops the search
+      pthread_mutex_lock(&s->mutex);
+      w->client = r->client;
+      if (r->client->closed)
+        search_stop(si);
+      pthread_mutex_unlock(&s->mutex);
+      search_start(si);
+      cache_save(s->cache, &r->pos, si);
+    }
+    format_line(out, sizeof(out), "result", r->id, si, NULL, 0, true);
+    send_line(r->client, out, false);
+
+    pthread_mutex_lock(&s->mutex);
+    w->client = NULL;
+    if (s->served < MAX_LATENCIES)
+      s->latencies[s->served] = now_us() - r->received;
+    s->served++;
+    pthread_mutex_unlock(&s->mutex);
+    release_client(s, r->client);
+    free(r);
+  }
+  return NULL;
+}
+
+// parse_request() reads the limits and the position of a "go" line.
+// Without a limit the search stops at depth 8.
+
+static bool parse_request(Request *r, char *line, char **error) {
+  char *save, *tok = strtok_r(line, " \t", &save);
+
+  if (!tok || strlen(tok) >= sizeof(r->id)) {
+    *error = "missing id";
+    return false;
+  }
+  strcpy(r->id, tok);
+  memset(&r->limits, 0, sizeof(r->limits));
+  while ((tok = strtok_r(NULL, " \t", &save))) {
+    char *arg = strcmp(tok, "fen") ? strtok_r(NULL, " \t", &save) : NULL;
+    if (!strcmp(tok, "fen"))
+      break;
+    if (!arg) {
+      *error = "missing value";
+      return false;
+    }
+    if (!strcmp(tok, "depth"))
+      r->limits.depth = atoi(arg);
+    else if (!strcmp(tok, "nodes"))
+      r->limits.nodes = strtoull(arg, NULL, 10);
+    else if (!strcmp(tok, "movetime"))
+      r->limits.movetime = atoll(arg);
+    else if (!strcmp(tok, "multipv"))
+      r->limits.multiPV = atoi(arg);
+    else {
+      *error = "unknown limit";
+      return false;
+    }
+  }
+  if (!tok || !save || !parse_fen(&r->pos, save)) {
+    *error = "invalid fen";
+    return false;
+  }
+  if (!r->limits.depth && !r->limits.nodes && !r->limits.movetime)
+    r->limits.depth = 8;
+  return true;
+}
+
+// handle_line() serves one line of a client. Called with the server mutex
+// held. A "trace" line is left to the caller, which writes the trace
+// without the mutex: handle_line() returns true for it.
+
+static bool handle_line(Server *s, Client *c, char *line) {
+  char out[512];
+
+  if (!strncmp(line, "go ", 3)) {
+    Request *r = malloc(sizeof(Request));
+    char *error = NULL;
+    r->id[0] = '\0';
+    if (c->queued == MAX_QUEUED && (error = "queue full"))
+      snprintf(r->id, sizeof(r->id), "%.*s", (int)strcspn(line + 3, " \t"), line + 3);
+    if (error || !parse_request(r, line + 3, &error)) {
+      snprintf(out, sizeof(out), "error %s %s\n", r->id[0] ? r->id : "-", error);
+      send_line(c, out, false);
+      free(r);
+      return false;
+    }
+    r->client = c;
+    r->next = NULL;
+    r->received = now_us();
+    c->refs++;
+    c->queued++;
+    if (c->tail)
+      c->tail->next = r;
+    else
+      c->head = r;
+    c->tail = r;
+    pthread_cond_signal(&s->workCond);
+  }
+  else if (!strcmp(line, "stats")) {
+    uint64_t n = s->served < MAX_LATENCIES ? s->served : MAX_LATENCIES;
+    uint64_t *lat = malloc((n + 1) * sizeof(uint64_t));
+    memcpy(lat, s->latencies, n * sizeof(uint64_t));
+    int len = snprintf(out, sizeof(out), "stats hashfull %d ", tt_hashfull());
+    format_latencies(out + len, sizeof(out) - len - 1, lat, n, now_us() - s->start);
+    strcat(out, "\n");
+    send_line(c, out, false);
+    free(lat);
+  }
+  else if (!strcmp(line, "trace"))
+    return true;
+  else if (!strcmp(line, "shutdown"))
+    s->stopping = true;
+  else if (line[strspn(line, " \t")]) {
+    snprintf(out, sizeof(out), "error - unknown command\n");
+    send_line(c, out, false);
+  }
+  return false;
+}
+
+// drop_client() removes a closed connection from the round robin,
+// discards its queued requests and stops its searches. Called with the
+// server mutex held.
+
+static void drop_client(Server *s, int k) {
+  Client *c = s->clients[k];
+  while (c->head) {
+    Request *r = c->head;
+    c->head = r->next;
+    c->refs--;
+    free(r);
+  }
+  c->tail = NULL;
+  c->queued = 0;
+  pthread_mutex_lock(&c->writeMutex);
+  c->closed = true;
+  pthread_mutex_unlock(&c->writeMutex);
+  for (int i = 0; i < s->workerCount; ++i)
+    if (s->workers[i].client == c)
+      search_stop(s->workers[i].si);
+  s->clients[k] = s->clients[--s->clientCount];
+  if (!--c->refs)
+    free_client(c);
+}
+
+// drop_polled() drops a client polled by the main thread, unless it has
+// been dropped already.
+
+static void drop_polled(Server *s, Client *c) {
+  pthread_mutex_lock(&s->mutex);
+  for (int k = 0; k < s->clientCount; ++k)
+    if (s->clients[k] == c)
+      drop_client(s, k);
+  pthread_mutex_unlock(&s->mutex);
+}
+
+static int listen_socket(const char *path) {
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if (fd < 0 || strlen(path) >= sizeof(addr.sun_path))
+    return -1;
+  strcpy(addr.sun_path, path);
+  unlink(path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// server_cmd() parses "server [socket PATH] [threads N] [hash MB] [cache
+// FILE] [cachesize MB] [trace FILE]" and serves requests until a client
+// sends "shutdown" or the process gets SIGINT or SIGTERM. With "trace" the
+// searches are traced, and the trace is written to FILE on every "trace"
+// request and at the end. Requests already queued are finished first. The
+// request statistics are written to stderr at the end.
+
+void server_cmd(int argc, char **argv) {
+  const char *path = DEFAULT_SOCKET, *cachePath = NULL;
+  int threads = cpu_count(), cacheSize = 64;
+  AnalysisCache cache;
+  Server s;
+
+  memset(&s, 0, sizeof(s));
+  for (int i = 0; i + 1 < argc; i += 2)
+    if (!strcmp(argv[i], "socket"))
+      path = argv[i + 1];
+    else if (!strcmp(argv[i], "threads"))
+      threads = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "hash"))
+      tt_resize(atoi(argv[i + 1]));
+    else if (!strcmp(argv[i], "cache"))
+      cachePath = argv[i + 1];
+    else if (!strcmp(argv[i], "cachesize"))
+      cacheSize = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "trace"))
+      s.tracePath = argv[i + 1];
+  if (threads < 1)
+    threads = 1;
+  if (cachePath) {
+    if (!cache_open(&cache, cachePath, cacheSize))
+      exit(EXIT_FAILURE);
+    s.cache = &cache;
+  }
+
+  int lfd = listen_socket(path);
+  if (lfd < 0) {
+    fprintf(stderr, "server: cannot listen on %s: %s\n", path, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  signal(SIGPIPE, SIG_IGN);
+
+  if (s.tracePath)
+    trace_start();
+  if (pipe(s.wakeup) < 0) {
+    fprintf(stderr, "server: cannot create pipe: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  fcntl(s.wakeup[0], F_SETFL, O_NONBLOCK);
+  fcntl(s.wakeup[1], F_SETFL, O_NONBLOCK);
+  s.latencies = malloc(MAX_LATENCIES * sizeof(uint64_t));
+  s.start = now_us();
+  pthread_mutex_init(&s.mutex, NULL);
+  pthread_cond_init(&s.workCond, NULL);
+  s.workers = calloc(threads, sizeof(Worker));
+  s.workerCount = threads;
+  for (int i = 0; i < threads; ++i) {
+    s.workers[i].server = &s;
+    s.workers[i].si = search_new();
+    pthread_create(&s.workers[i].thread, NULL, server_worker, &s.workers[i]);
+  }
+  fprintf(stderr, "server: listening on %s with %d threads\n", path, threads);
+
+  struct pollfd fds[MAX_CLIENTS + 2];
+  Client *polled[MAX_CLIENTS];
+  while (!Interrupted) {
+    pthread_mutex_lock(&s.mutex);
+    bool stopping = s.stopping;
+    int n = s.clientCount;
+    for (int i = 0; i < n; ++i) {
+      polled[i] = s.clients[i];
+      fds[i + 2] = (struct pollfd){ .fd = polled[i]->fd,
+                                    .events = POLLIN | (pending_output(polled[i]) ? POLLOUT : 0) };
+    }
+    pthread_mutex_unlock(&s.mutex);
+    if (stopping)
+      break;
+    fds[0] = (struct pollfd){ .fd = lfd, .events = POLLIN };
+    fds[1] = (struct pollfd){ .fd = s.wakeup[0], .events = POLLIN };
+
+    if (poll(fds, n + 2, 200) <= 0)
+      continue;
+
+    if (fds[1].revents & POLLIN) {
+      char drain[64];
+      while (read(s.wakeup[0], drain, sizeof(drain)) > 0) {}
+    }
+    if (fds[0].revents & POLLIN) {
+      int cfd = accept(lfd, NULL, NULL);
+      pthread_mutex_lock(&s.mutex);
+      if (cfd >= 0 && s.clientCount < MAX_CLIENTS) {
+        Client *c = calloc(1, sizeof(Client));
+        c->fd = cfd;
+        c->wakeup = s.wakeup[1];
+        c->refs = 1;
+        pthread_mutex_init(&c->writeMutex, NULL);
+        s.clients[s.clientCount++] = c;
+      }
+      else if (cfd >= 0)
+        close(cfd);
+      pthread_mutex_unlock(&s.mutex);
+    }
+
+    // Only the main thread reads, writes, adds and drops clients, so the
+    // polled clients are still valid here.
+    for (int i = 0; i < n; ++i) {
+      Client *c = polled[i];
+      if ((fds[i + 2].revents & POLLOUT) && !flush_output(c)) {
+        drop_polled(&s, c);
+        continue;
+      }
+      if (!(fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)))
+        continue;
+      ssize_t got = read(c->fd, c->buffer + c->length, MAX_LINE - 1 - c->length);
+      if (got <= 0) {
+        drop_polled(&s, c);
+        continue;
+      }
+      pthread_mutex_lock(&s.mutex);
+      char *line = c->buffer, *eol;
+      int traces = 0;
+      c->length += got;
+      c->buffer[c->length] = '\0';
+      while ((eol = strchr(line, '\n'))) {
+        *eol = '\0';
+        if (eol > line && eol[-1] == '\r')
+          eol[-1] = '\0';
+        traces += handle_line(&s, c, line);
+        line = eol + 1;
+      }
+      c->length -= line - c->buffer;
+      memmove(c->buffer, line, c->length);
+      // An overlong line is dropped
+      if (c->length == MAX_LINE - 1)
+        c->length = 0;
+      pthread_mutex_unlock(&s.mutex);
+
+      // The rings are copied while the searches go on, and the workers
+      // keep taking requests while the file is written
+      if (traces) {
+        char out[512];
+        if (s.tracePath && trace_dump(s.tracePath))
+          snprintf(out, sizeof(out), "trace %s\n", s.tracePath);
+        else
+          snprintf(out, sizeof(out), "error - trace not recorded\n");
+        while (traces--)
+          send_line(c, out, false);
+      }
+    }
+  }
+
+  pthread_mutex_lock(&s.mutex);
+  s.stopping = true;
+  pthread_cond_broadcast(&s.workCond);
+  pthread_mutex_unlock(&s.mutex);
+  for (int i = 0; i < threads; ++i) {
+    pthread_join(s.workers[i].thread, NULL);
+    search_delete(s.workers[i].si);
+  }
+
+  // Deliver the replies still buffered, waiting a second at most
+  uint64_t deadline = now_us() + 1000000;
+  for (int i = 0; i < s.clientCount; ++i) {
+    struct pollfd pfd = { .fd = s.clients[i]->fd, .events = POLLOUT };
+    while (   pending_output(s.clients[i]) && now_us() < deadline
+           && poll(&pfd, 1, (deadline - now_us()) / 1000 + 1) > 0
+           && flush_output(s.clients[i])) {}
+  }
+
+  char stats[256];
+  uint64_t n = s.served < MAX_LATENCIES ? s.served : MAX_LATENCIES;
+  format_latencies(stats, sizeof(stats), s.latencies, n, now_us() - s.start);
+  fprintf(stderr, "server: %s\n", stats);
+  if (s.cache) {
+    fprintf(stderr, "server: cache hits %llu of %llu stores %llu\n",
+            (unsigned long long)cache.hits, (unsigned long long)cache.probes,
+            (unsigned long long)cache.stores);
+    cache_close(&cache);
+  }
+  if (s.tracePath)
+    trace_dump(s.tracePath);
+
+  while (s.clientCount)
+    drop_client(&s, 0);
+  close(lfd);
+  close(s.wakeup[0]);
+  close(s.wakeup[1]);
+  unlink(path);
+  free(s.workers);
+  free(s.latencies);
+}
+
+// LineReader reads a socket line by line.
+
+typedef struct {
+  int fd;
+  char buffer[OUTPUT_LENGTH];
+  size_t start, length;
+} LineReader;
+
+static char *read_line(LineReader *lr) {
+  while (true) {
+    char *eol = memchr(lr->buffer + lr->start, '\n', lr->length - lr->start);
+    if (eol) {
+      char *line = lr->buffer + lr->start;
+      *eol = '\0';
+      lr->start = eol + 1 - lr->buffer;
+      return line;
+    }
+    memmove(lr->buffer, lr->buffer + lr->start, lr->length - lr->start);
+    lr->length -= lr->start;
+    lr->start = 0;
+    if (lr->length == sizeof(lr->buffer))
+      lr->length = 0;
+    ssize_t n = read(lr->fd, lr->buffer + lr->length, sizeof(lr->buffer) - lr->length);
+    if (n <= 0)
+      return NULL;
+    lr->length += n;
+  }
+}
+
+static int connect_socket(const char *path) {
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if (fd < 0 || strlen(path) >= sizeof(addr.sun_path))
+    return -1;
+  strcpy(addr.sun_path, path);
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void write_all(int fd, const char *buf, size_t len) {
+  while (len) {
+    ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+    if (n <= 0)
+      return;
+    buf += n;
+    len -= n;
+  }
+}
+
+// client_cmd() parses "client [socket PATH]", sends the request lines of
+// stdin to the server and prints the replies. Every line but "shutdown"
+// gets one final reply (result, error, stats or trace); once stdin ends the
+// client waits for all of them.
+
+void client_cmd(int argc, char **argv) {
+  const char *path = argc > 1 && !strcmp(argv[0], "socket") ? argv[1] : DEFAULT_SOCKET;
+  LineReader lr = { .fd = connect_socket(path) };
+  char line[MAX_LINE], *reply;
+  int pending = 0;
+
+  if (lr.fd < 0) {
+    fprintf(stderr, "client: cannot connect to %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  while (fgets(line, sizeof(line), stdin)) {
+    pending += line[strspn(line, " \t\r\n")] && strncmp(line, "shutdown", 8);
+    write_all(lr.fd, line, strlen(line));
+  }
+  while (pending > 0 && (reply = read_line(&lr))) {
+    printf("%s\n", reply);
+    pending -= !strncmp(reply, "result ", 7) || !strncmp(reply, "error ", 6)
+              || !strncmp(reply, "stats ", 6) || !strncmp(reply, "trace ", 6);
+  }
+  close(lr.fd);
+}
+
+// The load generator opens a number of connections, each sending requests
+// for the positions of a file one at a time, and measures the latency from
+// sending a request to its result.
+
+typedef struct {
+  const char *path;
+  char (*fens)[MAX_LINE];
+  int fenCount;
+  int index, requests;
+  const char *limits;
+  uint64_t *latencies;
+  int done;
+} LoadConnection;
+
+static void *loadgen_worker(void *arg) {
+  LoadConnection *lc = arg;
+  LineReader lr = { .fd = connect_socket(lc->path) };
+  char line[2 * MAX_LINE], *reply;
+
+  if (lr.fd < 0)
+    return NULL;
+  for (int i = 0; i < lc->requests; ++i) {
+    snprintf(line, sizeof(line), "go %d-%d %s fen %s\n", lc->index, i, lc->limits,
+             lc->fens[(lc->index + i * 7) % lc->fenCount]);
+    uint64_t start = now_us();
+    write_all(lr.fd, line, strlen(line));
+    while ((reply = read_line(&lr)) && strncmp(reply, "result ", 7) && strncmp(reply, "error ", 6)) {}
+    if (!reply)
+      break;
+    if (reply[0] == 'e') {
+      fprintf(stderr, "loadgen: %s\n", reply);
+      continue;
+    }
+    lc->latencies[lc->done++] = now_us() - start;
+  }
+  close(lr.fd);
+  return NULL;
+}
+
+// loadgen_cmd() parses "loadgen [socket PATH] [connections N] [requests N]
+// [depth N] [nodes N] FILE" and reports the throughput and the latency
+// percentiles of all requests.
+
+void loadgen_cmd(int argc, char **argv) {
+  const char *path = DEFAULT_SOCKET, *input = NULL;
+  int connections = 4, requests = 100;
+  char limits[64] = "", *p = limits;
+
+  for (int i = 0; i < argc; ++i) {
+    if (!strcmp(argv[i], "socket") && i + 1 < argc)
+      path = argv[++i];
+    else if (!strcmp(argv[i], "connections") && i + 1 < argc)
+      connections = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "requests") && i + 1 < argc)
+      requests = atoi(argv[++i]);
+    else if ((!strcmp(argv[i], "depth") || !strcmp(argv[i], "nodes")) && i + 1 < argc) {
+      p += snprintf(p, limits + sizeof(limits) - p, "%s%s %s", p > limits ? " " : "",
+                    argv[i], argv[i + 1]);
+      ++i;
+    }
+    else
+      input = argv[i];
+  }
+  if (!limits[0])
+    strcpy(limits, "depth 6");
+
+  FILE *in = input ? fopen(input, "r") : NULL;
+  if (!in || connections < 1 || requests < 1) {
+    fprintf(stderr, "Usage: loadgen [socket PATH] [connections N] [requests N] [depth N] [nodes N] FILE\n");
+    exit(EXIT_FAILURE);
+  }
+  int fenCount = 0, capacity = 64;
+  char (*fens)[MAX_LINE] = malloc(capacity * sizeof(*fens));
+  while (fgets(fens[fenCount], MAX_LINE, in)) {
+    fens[fenCount][strcspn(fens[fenCount], ";\r\n")] = '\0';
+    if (!fens[fenCount][0] || fens[fenCount][0] == '#')
+      continue;
+    if (++fenCount == capacity)
+      fens = realloc(fens, (capacity *= 2) * sizeof(*fens));
+  }
+  fclose(in);
+  if (!fenCount) {
+    fprintf(stderr, "loadgen: no positions in %s\n", input);
+    exit(EXIT_FAILURE);
+  }
+
+  LoadConnection *lcs = calloc(connections, sizeof(LoadConnection));
+  pthread_t *threads = malloc(connections * sizeof(pthread_t));
+  uint64_t *latencies = malloc((uint64_t)connections * requests * sizeof(uint64_t));
+  uint64_t start = now_us();
+  for (int i = 0; i < connections; ++i) {
+    lcs[i] = (LoadConnection){ .path = path, .fens = fens, .fenCount = fenCount, .index = i,
+                               .requests = requests, .limits = limits,
+                               .latencies = latencies + (uint64_t)i * requests };
+    pthread_create(&threads[i], NULL, loadgen_worker, &lcs[i]);
+  }
+
+  uint64_t n = 0;
+  for (int i = 0; i < connections; ++i) {
+    pthread_join(threads[i], NULL);
+    memmove(latencies + n, lcs[i].latencies, lcs[i].done * sizeof(uint64_t));
+    n += lcs[i].done;
+  }
+  char stats[256];
+  format_latencies(stats, sizeof(stats), latencies, n, now_us() - start);
+  printf("loadgen: connections %d %s\n", connections, stats);
+  if (n < (uint64_t)connections * requests)
+    fprintf(stderr, "loadgen: %llu requests failed\n",
+            (unsigned long long)((uint64_t)connections * requests - n));
+
+  free(fens);
+  free(lcs);
+  free(threads);
+  free(latencies);
+}
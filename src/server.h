@@ -0,0 +1,10 @@
+#ifndef SERVER_H_INCLUDED
+#define SERVER_H_INCLUDED
+
+#define DEFAULT_SOCKET "/tmp/catacomb.sock"
+
+void server_cmd(int argc, char **argv);
+void client_cmd(int argc, char **argv);
+void loadgen_cmd(int argc, char **argv);
+
+#endif
@@ -0,0 +1,125 @@
+#include <stdatomic.h>
+#include <string.h>
+
+#include "benchmark.h"
+#include "search.h"
+#include "tt.h"
+#include "stats.h"
+
+static const char *StatNames[STAT_NB] = {
+  "nodes", "qnodes", "evaluate",
+  "generate_all_moves.calls", "generate_all_moves.cycles",
+  "add_move.calls", "add_move.evasion_tests", "add_move.evasion_rejects",
+  "add_move.king_ep_tests", "add_move.king_ep_rejects",
+  "add_move.pinned_tests", "add_move.pinned_rejects",
+  "sq_attacked.calls", "sq_pinned.calls", "do_move.calls", "magic.lookups",
+  "tt.probes", "tt.hits", "tt.cutoffs"
+};
+
+#ifdef STATS
+
+enum { MAX_STATS_THREADS = 512 };
+
+static Stats StatsTable[MAX_STATS_THREADS];
+static Stats Untracked;
+static atomic_int StatsThreads;
+
+_Thread_local Stats *LocalStats;
+
+// stats_register() hands out a block on a thread's first count. Blocks are
+// never released, so counts of finished threads are still reported. Threads
+// past the limit count into a block that is never merged, rather than mix
+// their counts into another thread's; the first of them prints a warning.
+
+Stats *stats_register(void) {
+  int idx = atomic_fetch_add(&StatsThreads, 1);
+  if (idx == MAX_STATS_THREADS)
+    fprintf(stderr, "stats: more than %d threads, counts of the others are dropped\n",
+            MAX_STATS_THREADS);
+  return LocalStats = idx < MAX_STATS_THREADS ? &StatsTable[idx] : &Untracked;
+}
+
+void stats_merge(uint64_t counters[STAT_NB]) {
+  int n = atomic_load(&StatsThreads);
+  memset(counters, 0, STAT_NB * sizeof(uint64_t));
+  for (int i = 0; i < n && i < MAX_STATS_THREADS; ++i)
+    for (int j = 0; j < STAT_NB; ++j)
+      counters[j] += StatsTable[i].counters[j];
+}
+
+void stats_clear(void) {
+  memset(StatsTable, 0, sizeof(StatsTable));
+}
+
+#else
+
+void stats_merge(uint64_t counters[STAT_NB]) {
+  memset(counters, 0, STAT_NB * sizeof(uint64_t));
+}
+
+void stats_clear(void) {}
+
+#endif
+
+static double ratio(uint64_t a, uint64_t b) {
+  return b ? (double)a / b : 0.0;
+}
+
+// stats_report() prints the merged counters either as a readable table with
+// a few derived ratios, or as a single JSON object.
+
+void stats_report(FILE *out, bool json) {
+  uint64_t c[STAT_NB];
+
+  if (!HasStats) {
+    fprintf(out, json ? "{}\n" : "Counters not compiled in, rebuild with -DSTATS\n");
+    return;
+  }
+  stats_merge(c);
+
+  if (json) {
+    fprintf(out, "{");
+    for (int i = 0; i < STAT_NB; ++i)
+      fprintf(out, "%s\"%s\":%llu", i ? "," : "", StatNames[i], (unsigned long long)c[i]);
+    fprintf(out, "}\n");
+    return;
+  }
+
+  for (int i = 0; i < STAT_NB; ++i)
+    fprintf(out, "%-28s %16llu\n", StatNames[i], (unsigned long long)c[i]);
+  fprintf(out, "%-28s %16.1f\n", "qnodes %", 100 * ratio(c[STAT_QNODES], c[STAT_NODES] + c[STAT_QNODES]));
+  fprintf(out, "%-28s %16.1f\n", "cycles/generate", ratio(c[STAT_GENERATE_CYCLES], c[STAT_GENERATE_CALLS]));
+  fprintf(out, "%-28s %16.1f\n", "moves/generate", ratio(c[STAT_ADD_MOVE], c[STAT_GENERATE_CALLS]));
+  fprintf(out, "%-28s %16.1f\n", "evasion reject %", 100 * ratio(c[STAT_EVASION_REJECT], c[STAT_EVASION_TEST]));
+  fprintf(out, "%-28s %16.1f\n", "pinned reject %", 100 * ratio(c[STAT_PINNED_REJECT], c[STAT_PINNED_TEST]));
+  fprintf(out, "%-28s %16.1f\n", "magic lookups/node", ratio(c[STAT_MAGIC_LOOKUP], c[STAT_NODES] + c[STAT_QNODES]));
+  fprintf(out, "%-28s %16.1f\n", "tt hit %", 100 * ratio(c[STAT_TT_HIT], c[STAT_TT_PROBE]));
+}
+
+// stats_cmd() parses "stats [depth N] [format json|text]": it searches the
+// bench positions to the given depth and reports the counters.
+
+void stats_cmd(int argc, char **argv) {
+  SearchLimits limits = { .depth = 6 };
+  SearchInfo *si = search_new();
+  bool json = false;
+  Position pos;
+
+  for (int i = 0; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "depth"))
+      limits.depth = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "format"))
+      json = !strcmp(argv[i + 1], "json");
+  }
+
+  stats_clear();
+  for (int i = 0; i < BenchFenCount; ++i) {
+    parse_fen(&pos, BenchFens[i]);
+    tt_clear();
+    search_clear(si);
+    search_init(si, &pos, &limits);
+    search_start(si);
+  }
+  stats_report(stdout, json);
+  search_delete(si);
+}
@@ -0,0 +1,69 @@
+#ifndef STATS_H_INCLUDED
+#define STATS_H_INCLUDED
+
+#include <stdio.h>
+
+#include "types.h"
+
+// Hot-path counters, compiled in only with -DSTATS. Every thread counts
+// into its own cache-line aligned block, so counting never contends; the
+// blocks are summed when a report is requested. Without STATS the macros
+// expand to nothing and the counted code is unchanged.
+
+enum {
+  STAT_NODES, STAT_QNODES, STAT_EVALUATE,
+  STAT_GENERATE_CALLS, STAT_GENERATE_CYCLES,
+  STAT_ADD_MOVE, STAT_EVASION_TEST, STAT_EVASION_REJECT,
+  STAT_KING_EP_TEST, STAT_KING_EP_REJECT,
+  STAT_PINNED_TEST, STAT_PINNED_REJECT,
+  STAT_SQ_ATTACKED, STAT_SQ_PINNED, STAT_DO_MOVE, STAT_MAGIC_LOOKUP,
+  STAT_TT_PROBE, STAT_TT_HIT, STAT_TT_CUTOFF,
+  STAT_NB
+};
+
+#ifdef STATS
+
+#define HasStats 1
+
+typedef struct {
+  uint64_t counters[STAT_NB];
+} __attribute__((aligned(64))) Stats;
+
+extern _Thread_local Stats *LocalStats;
+Stats *stats_register(void);
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define stats_clock() __rdtsc()
+#else
+#include <time.h>
+INLINE uint64_t stats_clock(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+#define stats_add(n, v) ((LocalStats ? LocalStats : stats_register())->counters[n] += (v))
+#define stats_inc(n) stats_add(n, 1)
+#define STATS_TIMER(t) uint64_t t = stats_clock()
+#define stats_time(n, t) stats_add(n, stats_clock() - (t))
+
+#else
+
+#define HasStats 0
+
+#define stats_add(n, v) ((void)0)
+#define stats_inc(n) ((void)0)
+#define STATS_TIMER(t)
+#define stats_time(n, t) ((void)0)
+
+#endif
+
+void stats_merge(uint64_t counters[STAT_NB]);
+void stats_clear(void);
+void stats_report(FILE *out, bool json);
+void stats_cmd(int argc, char **argv);
+
+#endif
@@ -0,0 +1,1151 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "evaluate.h"
+#include "misc.h"
+#include "movegen.h"
+#include "tbgen.h"
+
+// The generator assigns the values in rounds n = 1, 2, ...: first every
+// position with a move to a position lost in n - 1 is won in n, found by
+// un-moves from the lost ones; then every predecessor of a position won in
+// n whose moves all lead to won positions is lost, which a forward move
+// generation confirms. Captures and promotions lead to smaller tables,
+// which are generated first: a position that wins by one of them is marked
+// with that bound at the start and settles when its round comes, unless a
+// faster win is found. Values are bytes updated with compare-and-swap, and
+// every round is split by index range across the threads.
+//
+// A double push next to an enemy pawn leads to the position of the table
+// with an en passant capture added, which is a conversion. Its value is
+// the better of the table entry and the capture, or the capture alone if
+// it is the only move. Such a position whose capture wins or loses is an
+// EpSource: it is found at the start, and its round makes it a source of
+// the un-move of the double push like the positions of the table.
+
+enum { TB_HEADER_SIZE = 4096, TB_VERSION = 1, MAX_TABLES = 128, MAX_SUBS = 32 };
+
+static const char TbMagic[8] = "CATATB";
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t count;
+  int32_t pieces[TB_MAX_PIECES + 1];
+  uint64_t size;
+  uint64_t wdlOffset, dtmOffset;   // dtmOffset is 0 if the DTM is left out
+  char name[16];
+} TbHeader;
+
+// Only the table being generated is in memory: its values, a byte per
+// position and side to move, and Pending, a bit for each whose value is
+// set and whose round has not come yet, which the rounds scan instead of
+// the values. A table that captures and promotions probe is written with
+// its DTM, to a temporary file unless "all" writes it, and probed from the
+// file mapped into memory, whose pages the system can drop. Probers counts
+// the tables not generated yet whose captures or promotions lead to a
+// table, and the file is unmapped once it drops to 0. The memory is then
+// 2.25 bytes per position of the largest table: 905MB for a 5-men set
+// with a pawn such as KRPvKR, 680MB for KQPvKP among those of KPPvKP.
+
+typedef struct {
+  uint64_t idx;          // Of the position after the double push
+  uint8_t stm, square;   // Side to move there and square of the pawn
+  uint8_t value;         // Of the best en passant capture, for stm
+  bool only;             // The captures are the only moves
+} EpSource;
+
+static Tablebase *Tables[MAX_TABLES];
+static int Subs[MAX_TABLES][MAX_SUBS], SubCount[MAX_TABLES];
+static int Probers[MAX_TABLES];
+static TbFile Files[MAX_TABLES];
+static int TableCount;
+static uint64_t *Pending[2];
+static EpSource *EpSources;
+static uint64_t EpCount;
+static Position EmptyPosition;
+
+// TriangleIndex[s] numbers the 10 squares of a1-d1-d4 for the white king.
+
+static const int TriangleSquares[10] = {
+  SQ_A1, SQ_B1, SQ_C1, SQ_D1, SQ_B2, SQ_C2, SQ_D2, SQ_C3, SQ_D3, SQ_D4
+};
+static int TriangleIndex[64];
+
+static void tb_init(void) {
+  for (int i = 0; i < 10; ++i)
+    TriangleIndex[TriangleSquares[i]] = i;
+  reset_pos(&EmptyPosition);
+}
+
+INLINE bool is_win(int v) { return v > TB_DRAW && v < TB_LOSS; }
+INLINE bool is_loss(int v) { return v >= TB_LOSS && v < TB_ILLEGAL; }
+
+// value_order() ranks the values for the side to move: the fastest win
+// first, then draws, then the slowest loss. better() returns the better of
+// two values.
+
+INLINE int value_order(int v) {
+  return is_win(v) ? 256 - v : is_loss(v) ? v - 2 * TB_LOSS : 0;
+}
+
+INLINE int better(int a, int b) {
+  return value_order(a) >= value_order(b) ? a : b;
+}
+
+// capture_value() returns the value of a capture or promotion for the side
+// that makes it, from the value v of the position it leads to.
+
+INLINE int capture_value(int v) {
+  return is_loss(v) ? v - TB_LOSS + 1 : is_win(v) ? TB_LOSS + v : TB_DRAW;
+}
+
+// tb_material_key() packs the count of every piece into its nibble, so
+// that the key of the colors swapped is the key rotated by 32 bits.
+
+uint64_t tb_material_key(Position *pos) {
+  uint64_t key = 0;
+  for (int p = W_PAWN; p <= B_KING; ++p)
+    key += (uint64_t)pos->count[p] << (4 * p);
+  return key;
+}
+
+INLINE uint64_t swap_key(uint64_t key) {
+  return key >> 32 | key << 32;
+}
+
+static uint64_t pieces_key(const int *pieces, int count) {
+  uint64_t key = 0;
+  for (int i = 0; i < count; ++i)
+    key += 1ULL << (4 * pieces[i]);
+  return key;
+}
+
+// sorted_index() returns the index of the men on the given squares, with
+// men of the same kind sorted by square.
+
+static uint64_t sorted_index(const Tablebase *tb, int *sq) {
+  uint64_t idx;
+
+  for (int i = 2; i < tb->count; ++i)
+    for (int j = i; j > 1 && tb->pieces[j] == tb->pieces[j - 1] && sq[j] < sq[j - 1]; --j) {
+      int s = sq[j];
+      sq[j] = sq[j - 1], sq[j - 1] = s;
+    }
+
+  idx = tb->pawns ? rank_of(sq[0]) * 4 + file_of(sq[0]) : TriangleIndex[sq[0]];
+  for (int i = 1; i < tb->count; ++i)
+    idx = type_of_p(tb->pieces[i]) == PAWN ? idx * 48 + sq[i] - 8 : idx * 64 + sq[i];
+  return idx;
+}
+
+// tb_encode() returns the index of the men on the given squares, in the
+// order of the table. The squares are transformed by the symmetries; with
+// the white king on the diagonal a1-d4, the position and its mirror in the
+// diagonal take the lower of their two indices.
+
+static uint64_t tb_encode(const Tablebase *tb, const int *squares) {
+  int sq[TB_MAX_PIECES], mirror[TB_MAX_PIECES], flip = 0;
+
+  if (file_of(squares[0]) > FILE_D)
+    flip ^= 7;
+  if (!tb->pawns && rank_of(squares[0] ^ flip) > RANK_4)
+    flip ^= 56;
+  for (int i = 0; i < tb->count; ++i) {
+    sq[i] = squares[i] ^ flip;
+    mirror[i] = (sq[i] >> 3) | ((sq[i] & 7) << 3);
+  }
+  if (tb->pawns || rank_of(sq[0]) < file_of(sq[0]))
+    return sorted_index(tb, sq);
+  if (rank_of(sq[0]) > file_of(sq[0]))
+    return sorted_index(tb, mirror);
+
+  uint64_t idx = sorted_index(tb, sq), idxMirror = sorted_index(tb, mirror);
+  return idx < idxMirror ? idx : idxMirror;
+}
+
+// tb_decode() returns the squares of the men of an index, and false if
+// the index is not the one tb_encode() gives them.
+
+static bool tb_decode(const Tablebase *tb, uint64_t index, int *sq) {
+  uint64_t idx = index;
+
+  for (int i = tb->count - 1; i > 0; --i)
+    if (type_of_p(tb->pieces[i]) == PAWN) {
+      sq[i] = idx % 48 + 8;
+      idx /= 48;
+    }
+    else {
+      sq[i] = idx % 64;
+      idx /= 64;
+    }
+  sq[0] = tb->pawns ? make_square((int)(idx % 4), (int)(idx / 4)) : TriangleSquares[idx];
+
+  for (int i = 2; i < tb->count; ++i)
+    if (tb->pieces[i] == tb->pieces[i - 1] && sq[i] <= sq[i - 1])
+      return false;
+  return tb_encode(tb, sq) == index;
+}
+
+// set_position() sets up the men on the given squares and returns false if
+// two share a square or the side not to move is in check.
+
+static bool set_position(Position *pos, const Tablebase *tb, const int *sq, int stm) {
+  Bitboard occupied = 0;
+
+  *pos = EmptyPosition;
+  for (int i = 0; i < tb->count; ++i) {
+    if (occupied & SquareBB[sq[i]])
+      return false;
+    occupied |= SquareBB[sq[i]];
+    put_piece(pos, tb->pieces[i], sq[i]);
+  }
+  pos->side = stm;
+  return !sq_attacked(pos, king_sq(pos, !stm), stm);
+}
+
+// find_table() returns the table of the material of the position, and in
+// swap whether its colors are swapped in the table.
+
+static Tablebase *find_table(Position *pos, bool *swap) {
+  uint64_t key = tb_material_key(pos);
+  for (int i = 0; i < TableCount; ++i)
+    if (Tables[i]->key == key || Tables[i]->key == swap_key(key)) {
+      *swap = Tables[i]->key != key;
+      return Tables[i];
+    }
+  return NULL;
+}
+
+// table_squares() returns the squares of the men of the position in the
+// order of the table, on the board flipped if the colors are swapped.
+
+static void table_squares(const Tablebase *tb, Position *pos, bool swap, int *sq) {
+  for (int i = 0; i < tb->count; ) {
+    int p = tb->pieces[i], real = swap ? p ^ 8 : p;
+    for (int j = 0; j < pos->count[real]; ++j, ++i)
+      sq[i] = swap ? pos->lists[real][j] ^ 56 : pos->lists[real][j];
+  }
+}
+
+// probe_conversion() returns the value of the position after a capture or
+// a promotion, for its side to move, from the smaller table.
+
+static int probe_conversion(Position *pos) {
+  int sq[TB_MAX_PIECES];
+  bool swap = false;
+  Tablebase *tb = find_table(pos, &swap);
+
+  table_squares(tb, pos, swap, sq);
+  return tb->dtm[swap ? !pos->side : pos->side][tb_encode(tb, sq)];
+}
+
+INLINE bool is_conversion(Position *pos, Move m) {
+  return pos->board[to_sq(m)] || type_of_m(m) != NORMAL;
+}
+
+// passant_push() returns true if the move is a double push that an enemy
+// pawn may capture en passant.
+
+INLINE bool passant_push(Position *pos, Move m) {
+  int from = from_sq(m), us = pos->side;
+  return   type_of_p(pos->board[from]) == PAWN && (from ^ to_sq(m)) == 16
+        && (PawnAttacks[us][from + pawn_push(us)] & pos->pawns[!us]);
+}
+
+// passant_value() returns the value of the best en passant capture after
+// the double push m, for the side to move there, or TB_NONE if none is
+// legal. only tells whether the captures are its only moves.
+
+static int passant_value(Position *pos, Move m, bool *only) {
+  Position next = *pos;
+  Movelist list;
+  int best = TB_NONE, captures = 0;
+
+  do_move(&next, m);
+  generate_all_moves(&next, &list);
+  for (int i = 0; i < list.count; ++i)
+    if (type_of_m(list.moves[i].move) == ENPASSANT) {
+      Position after = next;
+      do_move(&after, list.moves[i].move);
+      int v = capture_value(probe_conversion(&after));
+      best = captures++ ? better(best, v) : v;
+    }
+  *only = captures == list.count;
+  return best;
+}
+
+// child_value() returns the value of the position after the move, for the
+// side to move there. sq holds the squares of the men before the move.
+
+static int child_value(const Tablebase *tb, Position *pos, const int *sq, Move m) {
+  int child[TB_MAX_PIECES], v, ep;
+  bool only;
+
+  if (is_conversion(pos, m)) {
+    Position next = *pos;
+    do_move(&next, m);
+    return probe_conversion(&next);
+  }
+  for (int i = 0; i < tb->count; ++i)
+    child[i] = sq[i] == (int)from_sq(m) ? (int)to_sq(m) : sq[i];
+  v = tb->dtm[!pos->side][tb_encode(tb, child)];
+  if (passant_push(pos, m) && (ep = passant_value(pos, m, &only)) != TB_NONE)
+    v = only ? ep : better(v, ep);
+  return v;
+}
+
+// Work is one round of the generation over a range of indices.
+
+enum { PHASE_INIT, PHASE_WIN, PHASE_LOSS };
+
+typedef struct {
+  Tablebase *tb;
+  int phase, n;
+  uint64_t begin, end;
+  uint64_t epBegin, epEnd;   // EpSources of the round
+  uint64_t changes;
+  int maxValue;
+  bool overflow;
+  EpSource *found;           // EpSources found by PHASE_INIT
+  uint64_t foundCount, foundSize;
+} Work;
+
+INLINE void set_pending(int stm, uint64_t idx) {
+  __atomic_fetch_or(&Pending[stm][idx / 64], 1ULL << (idx % 64), __ATOMIC_RELAXED);
+}
+
+// update_value() sets a position to v if its value is still unknown, or,
+// for a win, if it is a slower win.
+
+static bool update_value(uint8_t *entry, int v) {
+  uint8_t cur = __atomic_load_n(entry, __ATOMIC_RELAXED);
+  while (cur == TB_DRAW || (is_win(v) && is_win(cur) && cur > v))
+    if (__atomic_compare_exchange_n(entry, &cur, v, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      return true;
+  return false;
+}
+
+// find_passant() adds the EpSources of a legal position: for each pawn of
+// the side not to move that may have just made a double push beside an
+// enemy pawn, the value of the en passant capture if it is not a draw.
+
+static void find_passant(Work *w, Position *pos, const int *sq, uint64_t idx) {
+  const Tablebase *tb = w->tb;
+  int us = !pos->side, pred[TB_MAX_PIECES];
+  Position prev;
+  bool only;
+
+  for (int i = 0; i < tb->count; ++i) {
+    int to = sq[i], mid = to - pawn_push(us), from = mid - pawn_push(us);
+    if (   tb->pieces[i] != make_piece(us, PAWN) || relative_rank_s(us, to) != RANK_4
+        || (pieces(pos) & (SquareBB[mid] | SquareBB[from]))
+        || !(PawnAttacks[us][mid] & pos->pawns[pos->side]))
+      continue;
+    memcpy(pred, sq, sizeof(pred));
+    pred[i] = from;
+    if (!set_position(&prev, tb, pred, us))
+      continue;
+    int v = passant_value(&prev, make_move(from, to), &only);
+    if (v == TB_NONE || v == TB_DRAW)
+      continue;
+    if (w->foundCount == w->foundSize) {
+      w->foundSize = w->foundSize ? 2 * w->foundSize : 1024;
+      w->found = realloc(w->found, w->foundSize * sizeof(EpSource));
+    }
+    w->found[w->foundCount++] = (EpSource){ idx, pos->side, to, v, only };
+    if ((is_win(v) ? v : v - TB_LOSS) > w->maxValue)
+      w->maxValue = is_win(v) ? v : v - TB_LOSS;
+  }
+}
+
+// init_position() returns the value of a position known without search:
+// illegal, mated, won by a capture or promotion as a bound, or lost if
+// every move is a capture or promotion to a won position.
+
+static int init_position(Work *w, uint64_t idx, int stm) {
+  const Tablebase *tb = w->tb;
+  int sq[TB_MAX_PIECES], best = TB_DRAW, longest = 0;
+  bool forced = true;
+  Position pos;
+  Movelist list;
+
+  if (!tb_decode(tb, idx, sq) || !set_position(&pos, tb, sq, stm))
+    return TB_ILLEGAL;
+  find_passant(w, &pos, sq, idx);
+  generate_all_moves(&pos, &list);
+  if (!list.count)
+    return in_check(&pos) ? TB_LOSS : TB_DRAW;
+  for (int i = 0; i < list.count; ++i) {
+    Move m = list.moves[i].move;
+    int v = is_conversion(&pos, m) ? child_value(tb, &pos, sq, m) : TB_DRAW;
+    if (is_loss(v) && (best == TB_DRAW || v - TB_LOSS + 1 < best))
+      best = v - TB_LOSS + 1;
+    if (is_win(v) && v > longest)
+      longest = v;
+    forced &= is_win(v);
+  }
+  return best != TB_DRAW ? best : forced ? TB_LOSS + longest : TB_DRAW;
+}
+
+// verify_loss() returns the value of a position all of whose moves might
+// lead to won positions, after a child was found won in n: a loss in the
+// longest of the wins, or TB_DRAW if a move leads to a position that is
+// not won, or not won yet.
+
+static int verify_loss(const Tablebase *tb, Position *pos, const int *sq, int n) {
+  Movelist list;
+  int longest = n;
+
+  generate_all_moves(pos, &list);
+  for (int i = 0; i < list.count; ++i) {
+    Move m = list.moves[i].move;
+    int v = child_value(tb, pos, sq, m);
+    if (!is_win(v) || (!is_conversion(pos, m) && v > n))
+      return TB_DRAW;
+    if (v > longest)
+      longest = v;
+  }
+  return TB_LOSS + longest;
+}
+
+// retro() visits the predecessors of a position: the positions from which
+// a non-capturing move of the side that is not to move leads to it. The
+// origins of a move come from the attack tables of the destination. For an
+// EpSource, epSquare is the square of its pawn and only the double push
+// to it is taken back.
+
+static void retro(Work *w, Position *pos, const int *sq, int epSquare) {
+  const Tablebase *tb = w->tb;
+  int us = !pos->side, them = pos->side;
+  int ksq = king_sq(pos, them);
+  int pred[TB_MAX_PIECES];
+  Bitboard occupied = pieces(pos);
+
+  memcpy(pred, sq, sizeof(pred));
+  for (int i = 0; i < tb->count; ++i) {
+    int piece = tb->pieces[i], to = sq[i];
+    Bitboard origins;
+
+    if (color_of(piece) != us)
+      continue;
+    if (type_of_p(piece) == PAWN) {
+      int from = to - pawn_push(us);
+      origins = 0;
+      if (relative_rank_s(us, to) >= RANK_3 && !(occupied & SquareBB[from])) {
+        origins |= SquareBB[from];
+        if (relative_rank_s(us, to) == RANK_4 && !(occupied & SquareBB[from - pawn_push(us)]))
+          origins |= SquareBB[from - pawn_push(us)];
+      }
+    }
+    else
+      origins = attacks_bb(piece, to, occupied) & ~occupied;
+    if (epSquare != SQ_NONE)
+      origins &= to == epSquare ? SquareBB[to - 2 * pawn_push(us)] : 0;
+
+    while (origins) {
+      int from = pop_lsb(&origins);
+      Bitboard occ = occupied ^ SquareBB[from] ^ SquareBB[to];
+
+      // The king of the side to move must not be in check before the move
+      if (   (attackers_to(pos, ksq, occ) & pos->occupied[us] & ~SquareBB[to])
+          || (attacks_bb(piece, from, occ) & SquareBB[ksq]))
+        continue;
+
+      pred[i] = from;
+      uint64_t idx = tb_encode(tb, pred);
+      uint8_t *entry = &tb->dtm[us][idx];
+
+      // After a double push with an en passant capture, the position is
+      // lost in n - 1 only if the capture loses at least as fast, and it
+      // is an EpSource if the capture loses slower
+      if (   w->phase == PHASE_WIN && epSquare == SQ_NONE
+          && type_of_p(piece) == PAWN && (from ^ to) == 16
+          && (PawnAttacks[us][to - pawn_push(us)] & pos->pawns[them])) {
+        Position prev;
+        bool only;
+        set_position(&prev, tb, pred, us);
+        int v = passant_value(&prev, make_move(from, to), &only);
+        if (v != TB_NONE && (only || !is_loss(v) || v > TB_LOSS + w->n - 1))
+          continue;
+      }
+
+      if (w->phase == PHASE_WIN) {
+        if (update_value(entry, w->n)) {
+          set_pending(us, idx);
+          w->changes++;
+        }
+      }
+      else if (__atomic_load_n(entry, __ATOMIC_RELAXED) == TB_DRAW) {
+        Position prev;
+        int v;
+        set_position(&prev, tb, pred, us);
+        if ((v = verify_loss(tb, &prev, pred, w->n)) != TB_DRAW && update_value(entry, v)) {
+          set_pending(us, idx);
+          w->changes++;
+          if (v - TB_LOSS > w->maxValue)
+            w->maxValue = v - TB_LOSS;
+        }
+      }
+    }
+    pred[i] = to;
+  }
+}
+
+static void *tb_worker(void *arg) {
+  Work *w = arg;
+  Tablebase *tb = w->tb;
+  int sq[TB_MAX_PIECES];
+  Position pos;
+
+  for (int stm = WHITE; stm <= BLACK && w->phase == PHASE_INIT; ++stm)
+    for (uint64_t idx = w->begin; idx < w->end; ++idx) {
+      int v = tb->dtm[stm][idx] = init_position(w, idx, stm);
+      int moves = is_win(v) ? v : is_loss(v) ? v - TB_LOSS : 0;
+      if (moves > w->maxValue)
+        w->maxValue = moves;
+      if (is_win(v) || is_loss(v)) {
+        set_pending(stm, idx);
+        w->changes++;
+      }
+    }
+
+  // Every position lost in n - 1 makes its predecessors won in n. The
+  // range shares its first and last words of Pending with its neighbours.
+  for (int stm = WHITE; stm <= BLACK && w->phase != PHASE_INIT; ++stm)
+    for (uint64_t word = w->begin / 64; word * 64 < w->end; ++word) {
+      Bitboard bits = __atomic_load_n(&Pending[stm][word], __ATOMIC_RELAXED);
+      if (word == w->begin / 64)
+        bits &= ~0ULL << (w->begin % 64);
+      if (word == w->end / 64)
+        bits &= (1ULL << (w->end % 64)) - 1;
+      while (bits) {
+        uint64_t idx = word * 64 + pop_lsb(&bits);
+        int v = __atomic_load_n(&tb->dtm[stm][idx], __ATOMIC_RELAXED);
+        if (w->phase == PHASE_WIN ? v != TB_LOSS + w->n - 1 : v != w->n)
+          continue;
+        __atomic_fetch_and(&Pending[stm][word], ~(1ULL << (idx % 64)), __ATOMIC_RELAXED);
+        tb_decode(tb, idx, sq);
+        set_position(&pos, tb, sq, stm);
+        retro(w, &pos, sq, SQ_NONE);
+      }
+    }
+
+  // An EpSource is a source of the round if the table entry does not make
+  // the position better for its side to move than the capture
+  for (uint64_t i = w->epBegin; i < w->epEnd; ++i) {
+    EpSource *e = &EpSources[i];
+    int v = tb->dtm[e->stm][e->idx];
+    if (   e->only
+        || (w->phase == PHASE_WIN ? is_loss(v) && v <= TB_LOSS + w->n - 1
+                                  : !is_win(v) || v >= w->n)) {
+      tb_decode(tb, e->idx, sq);
+      set_position(&pos, tb, sq, e->stm);
+      retro(w, &pos, sq, e->square);
+    }
+  }
+  if (w->maxValue > TB_MAX_DTM)
+    w->overflow = true;
+  return NULL;
+}
+
+// ep_round() returns the phase and round in which an EpSource is a source,
+// as 2 * round + phase - PHASE_WIN.
+
+static int ep_round(const EpSource *e) {
+  return is_win(e->value) ? 2 * e->value + 1 : 2 * (e->value - TB_LOSS + 1);
+}
+
+static int compare_ep(const void *a, const void *b) {
+  return ep_round(a) - ep_round(b);
+}
+
+// run_phase() runs a phase of round n on all threads and returns the number
+// of positions that got a value. maxValue keeps the longest value so far.
+// The EpSources from epBegin to epEnd are those of the round, and the
+// initial phase collects them all.
+
+static uint64_t run_phase(Tablebase *tb, int phase, int n, uint64_t epBegin, uint64_t epEnd,
+                          int threads, int *maxValue, bool *overflow) {
+  Work *work = calloc(threads, sizeof(Work));
+  pthread_t *workers = malloc(threads * sizeof(pthread_t));
+  uint64_t changes = 0, eps = epEnd - epBegin;
+
+  for (int i = 0; i < threads; ++i) {
+    work[i] = (Work){ tb, phase, n, tb->size * i / threads, tb->size * (i + 1) / threads,
+                      epBegin + eps * i / threads, epBegin + eps * (i + 1) / threads,
+                      0, 0, false, NULL, 0, 0 };
+    pthread_create(&workers[i], NULL, tb_worker, &work[i]);
+  }
+  for (int i = 0; i < threads; ++i) {
+    pthread_join(workers[i], NULL);
+    changes += work[i].changes;
+    *overflow |= work[i].overflow;
+    if (work[i].maxValue > *maxValue)
+      *maxValue = work[i].maxValue;
+    if (work[i].foundCount) {
+      EpSources = realloc(EpSources, (EpCount + work[i].foundCount) * sizeof(EpSource));
+      memcpy(EpSources + EpCount, work[i].found, work[i].foundCount * sizeof(EpSource));
+      EpCount += work[i].foundCount;
+    }
+    free(work[i].found);
+  }
+  free(work);
+  free(workers);
+  return changes;
+}
+
+// print_stats() prints the wins, draws and losses of a table by side to
+// move, and a position of its longest mate.
+
+static void print_stats(Tablebase *tb, TimePoint elapsed) {
+  uint64_t wins[2] = { 0 }, draws[2] = { 0 }, losses[2] = { 0 }, longestIdx = 0;
+  int sq[TB_MAX_PIECES], longest = 0, longestSide = WHITE;
+  char fen[128] = "-";
+  Position pos;
+
+  for (int stm = WHITE; stm <= BLACK; ++stm)
+    for (uint64_t idx = 0; idx < tb->size; ++idx) {
+      int v = tb->dtm[stm][idx];
+      wins[stm] += is_win(v), draws[stm] += v == TB_DRAW, losses[stm] += is_loss(v);
+      if (is_win(v) && v > longest)
+        longest = v, longestIdx = idx, longestSide = stm;
+    }
+  if (longest) {
+    tb_decode(tb, longestIdx, sq);
+    set_position(&pos, tb, sq, longestSide);
+    pos_fen(&pos, fen);
+  }
+  printf("%s: %llu positions, white to move %llu/%llu/%llu, black to move"
+         " %llu/%llu/%llu won/drawn/lost, %lld ms\n",
+         tb->name, (unsigned long long)(2 * tb->size),
+         (unsigned long long)wins[WHITE], (unsigned long long)draws[WHITE],
+         (unsigned long long)losses[WHITE], (unsigned long long)wins[BLACK],
+         (unsigned long long)draws[BLACK], (unsigned long long)losses[BLACK],
+         (long long)elapsed);
+  printf("%s: longest mate %d moves, %s\n", tb->name, longest, fen);
+}
+
+// parse_material() reads a material name such as "KRPvKR" into the pieces
+// of a table, and returns false if it is not valid.
+
+static bool parse_material(const char *name, int *pieces, int *count) {
+  static const char Chars[] = " PNBRQK";
+  int c = WHITE;
+
+  *count = 0;
+  for (const char *p = name; *p; ++p) {
+    const char *q = strchr(Chars + 1, *p);
+    if (*p == 'v' && c == WHITE) {
+      c = BLACK;
+      continue;
+    }
+    if (!q || *count == TB_MAX_PIECES)
+      return false;
+    pieces[(*count)++] = make_piece(c, q - Chars);
+  }
+  return c == BLACK;
+}
+
+// canonical() sorts the pieces of a material into the order of the index:
+// each side king first, then from queens down to pawns, with the stronger
+// side as white. It returns false if a side has not exactly one king.
+
+static bool canonical(int *pieces, int count) {
+  int white = 0, black = 0, kings[2] = { 0, 0 };
+
+  for (int i = 0; i < count; ++i) {
+    if (type_of_p(pieces[i]) == KING)
+      kings[color_of(pieces[i])]++;
+    if (color_of(pieces[i]) == WHITE)
+      white += 16 * PieceValue[MG][pieces[i]] + 1;
+    else
+      black += 16 * PieceValue[MG][pieces[i]] + 1;
+  }
+  if (kings[WHITE] != 1 || kings[BLACK] != 1)
+    return false;
+  if (black > white)
+    for (int i = 0; i < count; ++i)
+      pieces[i] ^= 8;
+
+  // Black after white, kings first, then by falling type
+  for (int i = 1; i < count; ++i)
+    for (int j = i; j > 0; --j) {
+      int a = pieces[j - 1], b = pieces[j];
+      int ka = color_of(a) * 16 + (type_of_p(a) == KING ? 0 : 8 - type_of_p(a));
+      int kb = color_of(b) * 16 + (type_of_p(b) == KING ? 0 : 8 - type_of_p(b));
+      if (ka <= kb)
+        break;
+      pieces[j - 1] = b, pieces[j] = a;
+    }
+  return true;
+}
+
+static void material_name(const int *pieces, int count, char *name) {
+  for (int i = 0; i < count; ++i) {
+    if (i && color_of(pieces[i]) != color_of(pieces[i - 1]))
+      *name++ = 'v';
+    *name++ = " PNBRQK"[type_of_p(pieces[i])];
+  }
+  *name = '\0';
+}
+
+static void table_setup(Tablebase *tb, const int *pieces, int count) {
+  memset(tb, 0, sizeof(*tb));
+  memcpy(tb->pieces, pieces, count * sizeof(int));
+  tb->count = count;
+  tb->key = pieces_key(pieces, count);
+  material_name(pieces, count, tb->name);
+  tb->size = 1;
+  for (int i = 0; i < count; ++i) {
+    tb->pawns |= type_of_p(pieces[i]) == PAWN;
+    tb->size *= type_of_p(pieces[i]) == PAWN ? 48 : 64;
+  }
+  tb->size = tb->size / 64 * (tb->pawns ? 32 : 10);
+}
+
+// plan() adds the table of the material to Tables, after the tables of all
+// materials that a capture or a promotion leads to, and records those as
+// its subtables. It returns the index of the table, which gets its memory
+// only when it is generated.
+
+static int plan(const int *material, int count) {
+  int pieces[TB_MAX_PIECES], sub[TB_MAX_PIECES], subs[MAX_SUBS], subCount = 0;
+  Tablebase *tb;
+
+  memcpy(pieces, material, count * sizeof(int));
+  canonical(pieces, count);
+  for (int i = 0; i < TableCount; ++i)
+    if (Tables[i]->key == pieces_key(pieces, count))
+      return i;
+
+  for (int i = 0; i < count; ++i) {
+    if (type_of_p(pieces[i]) == KING)
+      continue;
+    // Captures of the man, then promotions of a pawn, also by capturing a
+    // piece on the last rank
+    memcpy(sub, pieces, sizeof(sub));
+    sub[i] = sub[count - 1];
+    subs[subCount++] = plan(sub, count - 1);
+    for (int pt = KNIGHT; type_of_p(pieces[i]) == PAWN && pt <= QUEEN; ++pt) {
+      memcpy(sub, pieces, sizeof(sub));
+      sub[i] = make_piece(color_of(pieces[i]), pt);
+      subs[subCount++] = plan(sub, count);
+      for (int j = 0; j < count; ++j) {
+        if (   color_of(pieces[j]) == color_of(pieces[i])
+            || type_of_p(pieces[j]) == KING || type_of_p(pieces[j]) == PAWN)
+          continue;
+        memcpy(sub, pieces, sizeof(sub));
+        sub[i] = make_piece(color_of(pieces[i]), pt);
+        sub[j] = sub[count - 1];
+        subs[subCount++] = plan(sub, count - 1);
+      }
+    }
+  }
+
+  tb = malloc(sizeof(Tablebase));
+  table_setup(tb, pieces, count);
+  if (TableCount == MAX_TABLES) {
+    fprintf(stderr, "tbgen: too many tables for %s\n", tb->name);
+    exit(EXIT_FAILURE);
+  }
+  int t = TableCount++;
+  Tables[t] = tb;
+  SubCount[t] = Probers[t] = 0;
+  for (int i = 0; i < subCount; ++i) {
+    int k = 0;
+    while (k < SubCount[t] && Subs[t][k] != subs[i])
+      ++k;
+    if (k == SubCount[t]) {
+      Subs[t][SubCount[t]++] = subs[i];
+      Probers[subs[i]]++;
+    }
+  }
+  return t;
+}
+
+// TbChecks are positions of known value, each checked when the table of
+// its material, in its colors, is generated.
+
+static const struct {
+  const char *fen;
+  int value;
+} TbChecks[] = {
+  // 1...dxe3 e.p. 2.Kxe3 is a draw; without the capture Black is mated
+  { "8/8/8/8/3pP3/3K4/8/7k b - e3 0 1", TB_DRAW },
+  { "8/8/8/8/3pP3/3K4/8/7k b - - 0 1", TB_LOSS + 10 },
+};
+
+// check_table() compares the generated values of the TbChecks of the table
+// with the known ones and exits if one differs. A position with an en
+// passant square is valued as the child of the double push before it.
+
+static void check_table(Tablebase *tb) {
+  int sq[TB_MAX_PIECES], checked = 0;
+  Position pos;
+
+  for (size_t i = 0; i < sizeof(TbChecks) / sizeof(TbChecks[0]); ++i) {
+    if (!parse_fen(&pos, TbChecks[i].fen) || tb_material_key(&pos) != tb->key)
+      continue;
+    int v, them = !pos.side;
+    if (pos.passant == SQ_NONE) {
+      table_squares(tb, &pos, false, sq);
+      v = tb->dtm[pos.side][tb_encode(tb, sq)];
+    }
+    else {
+      int to = pos.passant + pawn_push(them), from = pos.passant - pawn_push(them);
+      Position prev = pos;
+      move_piece(&prev, make_piece(them, PAWN), to, from);
+      prev.side = them;
+      prev.passant = SQ_NONE;
+      table_squares(tb, &prev, false, sq);
+      v = child_value(tb, &prev, sq, make_move(from, to));
+    }
+    if (v != TbChecks[i].value) {
+      fprintf(stderr, "tbgen: %s: %s has value %d, not %d\n", tb->name, TbChecks[i].fen,
+              v, TbChecks[i].value);
+      exit(EXIT_FAILURE);
+    }
+    checked++;
+  }
+  if (checked)
+    printf("%s: %d known positions checked\n", tb->name, checked);
+}
+
+// generate() generates a planned table, whose subtables are generated and
+// mapped, prints its statistics and returns the bytes of memory it used.
+
+static uint64_t generate(Tablebase *tb, int threads) {
+  uint64_t words = (tb->size + 63) / 64;
+  bool overflow = false;
+
+  tb->dtm[WHITE] = malloc(tb->size);
+  tb->dtm[BLACK] = malloc(tb->size);
+  Pending[WHITE] = calloc(words, sizeof(uint64_t));
+  Pending[BLACK] = calloc(words, sizeof(uint64_t));
+  if (!tb->dtm[WHITE] || !tb->dtm[BLACK] || !Pending[WHITE] || !Pending[BLACK]) {
+    fprintf(stderr, "tbgen: cannot allocate %s\n", tb->name);
+    exit(EXIT_FAILURE);
+  }
+
+  TimePoint start = now();
+  int maxValue = 0;
+  uint64_t ep = 0, epWin, epLoss;
+  run_phase(tb, PHASE_INIT, 0, 0, 0, threads, &maxValue, &overflow);
+  qsort(EpSources, EpCount, sizeof(EpSource), compare_ep);
+  for (int n = 1; ; ++n) {
+    for (epWin = ep; ep < EpCount && ep_round(&EpSources[ep]) == 2 * n; ++ep) {}
+    for (epLoss = ep; ep < EpCount && ep_round(&EpSources[ep]) == 2 * n + 1; ++ep) {}
+    uint64_t changes =  run_phase(tb, PHASE_WIN, n, epWin, epLoss, threads, &maxValue, &overflow)
+                      + run_phase(tb, PHASE_LOSS, n, epLoss, ep, threads, &maxValue, &overflow);
+    if (overflow || n > TB_MAX_DTM) {
+      fprintf(stderr, "tbgen: %s has mates longer than %d moves\n", tb->name, TB_MAX_DTM);
+      exit(EXIT_FAILURE);
+    }
+    if (!changes && n > maxValue)
+      break;
+  }
+
+  uint64_t memory = 2 * (tb->size + words * sizeof(uint64_t)) + EpCount * sizeof(EpSource);
+  free(Pending[WHITE]);
+  free(Pending[BLACK]);
+  free(EpSources);
+  EpSources = NULL;
+  EpCount = 0;
+  print_stats(tb, now() - start);
+  check_table(tb);
+  return memory;
+}
+
+// write_table() writes the table with a 2 bit WDL entry per position and,
+// unless left out, the DTM bytes.
+
+static bool write_table(Tablebase *tb, const char *path, bool dtm) {
+  TbHeader h;
+  FILE *f = fopen(path, "wb");
+  uint64_t wdlSize = (2 * tb->size + 3) / 4;
+  uint8_t *wdl = calloc(wdlSize, 1);
+  char pad[TB_HEADER_SIZE] = { 0 };
+
+  if (!f || !wdl)
+    return false;
+  for (uint64_t i = 0; i < 2 * tb->size; ++i) {
+    int v = tb->dtm[i >= tb->size][i % tb->size];
+    int code = v == TB_ILLEGAL ? 3 : is_loss(v) ? 2 : is_win(v) ? 1 : 0;
+    wdl[i / 4] |= code << (2 * (i % 4));
+  }
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, TbMagic, sizeof(h.magic));
+  h.version = TB_VERSION;
+  h.count = tb->count;
+  for (int i = 0; i < tb->count; ++i)
+    h.pieces[i] = tb->pieces[i];
+  h.size = tb->size;
+  h.wdlOffset = TB_HEADER_SIZE;
+  h.dtmOffset = dtm ? (TB_HEADER_SIZE + wdlSize + 63) / 64 * 64 : 0;
+  strcpy(h.name, tb->name);
+  memcpy(pad, &h, sizeof(h));
+
+  bool ok = fwrite(pad, 1, TB_HEADER_SIZE, f) == TB_HEADER_SIZE
+         && fwrite(wdl, 1, wdlSize, f) == wdlSize;
+  if (dtm && ok) {
+    ok =   fwrite(pad + sizeof(h), 1, h.dtmOffset - TB_HEADER_SIZE - wdlSize, f)
+        == h.dtmOffset - TB_HEADER_SIZE - wdlSize
+        && fwrite(tb->dtm[WHITE], 1, tb->size, f) == tb->size
+        && fwrite(tb->dtm[BLACK], 1, tb->size, f) == tb->size;
+  }
+  free(wdl);
+  return !fclose(f) && ok;
+}
+
+bool tb_open(TbFile *f, const char *path) {
+  struct stat st;
+  TbHeader h;
+
+  memset(f, 0, sizeof(*f));
+  const char *slash = strrchr(path, '/');
+  snprintf(f->dir, sizeof(f->dir), "%.*s", slash ? (int)(slash - path) : 1, slash ? path : ".");
+  int fd = open(path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) || pread(fd, &h, sizeof(h), 0) != sizeof(h)) {
+    if (fd >= 0)
+      close(fd);
+    return false;
+  }
+  if (   memcmp(h.magic, TbMagic, sizeof(h.magic)) || h.version != TB_VERSION
+      || h.count < 2 || h.count > TB_MAX_PIECES) {
+    close(fd);
+    return false;
+  }
+  tb_init();
+  table_setup(&f->tb, h.pieces, h.count);
+  uint64_t wdlSize = (2 * f->tb.size + 3) / 4;
+  if (   f->tb.size != h.size || (uint64_t)st.st_size < h.wdlOffset + wdlSize
+      || (h.dtmOffset && (uint64_t)st.st_size < h.dtmOffset + 2 * h.size)) {
+    close(fd);
+    return false;
+  }
+  f->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (f->map == MAP_FAILED)
+    return false;
+  f->mapSize = st.st_size;
+  f->tb.wdl = (uint8_t *)f->map + h.wdlOffset;
+  if (h.dtmOffset) {
+    f->tb.dtm[WHITE] = (uint8_t *)f->map + h.dtmOffset;
+    f->tb.dtm[BLACK] = f->tb.dtm[WHITE] + h.size;
+  }
+  return true;
+}
+
+void tb_close(TbFile *f) {
+  if (f->map)
+    munmap(f->map, f->mapSize);
+  f->map = NULL;
+}
+
+// tb_index() returns the index of the position in the table and sets stm
+// to the side to move in the table, or returns false if the material is
+// not that of the table.
+
+static bool tb_index(Tablebase *tb, Position *pos, uint64_t *idx, int *stm) {
+  int sq[TB_MAX_PIECES];
+  uint64_t key = tb_material_key(pos);
+  bool swap = key != tb->key;
+
+  if (swap && swap_key(key) != tb->key)
+    return false;
+  table_squares(tb, pos, swap, sq);
+  *idx = tb_encode(tb, sq);
+  *stm = swap ? !pos->side : pos->side;
+  return true;
+}
+
+// probe_passant() returns the WDL or DTM value v of a position with an en
+// passant square with its en passant captures taken into account. They are
+// probed in the tables of their material next to the file of the table,
+// and TB_NONE is returned if one of those cannot be opened.
+
+static int probe_passant(TbFile *f, Position *pos, int v, bool dtm) {
+  Movelist list;
+  int best = TB_NONE, captures = 0;
+
+  generate_all_moves(pos, &list);
+  for (int i = 0; i < list.count; ++i) {
+    Move m = list.moves[i].move;
+    if (type_of_m(m) != ENPASSANT)
+      continue;
+
+    Position after = *pos;
+    int pieces[TB_MAX_PIECES], count = 0;
+    char name[16], path[sizeof(f->dir) + 32];
+    TbFile sub;
+    do_move(&after, m);
+    for (int p = W_PAWN; p <= B_KING; ++p)
+      for (int j = 0; j < after.count[p]; ++j)
+        pieces[count++] = p;
+    canonical(pieces, count);
+    material_name(pieces, count, name);
+    snprintf(path, sizeof(path), "%s/%s.ctb", f->dir, name);
+    if (!tb_open(&sub, path))
+      return TB_NONE;
+    int r = dtm ? tb_probe_dtm(&sub, &after) : tb_probe_wdl(&sub, &after);
+    tb_close(&sub);
+    if (r == TB_NONE || r == TB_ILLEGAL)
+      return TB_NONE;
+    r = dtm ? capture_value(r) : -r;
+    best = !captures++ ? r : dtm ? better(best, r) : best > r ? best : r;
+  }
+  if (!captures)
+    return v;
+  if (captures == list.count)
+    return best;
+  return dtm ? better(v, best) : v > best ? v : best;
+}
+
+int tb_probe_wdl(TbFile *f, Position *pos) {
+  uint64_t idx;
+  int stm;
+
+  if (!tb_index(&f->tb, pos, &idx, &stm))
+    return TB_NONE;
+  idx += stm * f->tb.size;
+  int code = (f->tb.wdl[idx / 4] >> (2 * (idx % 4))) & 3;
+  int v = code == 3 ? TB_ILLEGAL : code == 2 ? -1 : code;
+  return v != TB_ILLEGAL && pos->passant != SQ_NONE ? probe_passant(f, pos, v, false) : v;
+}
+
+int tb_probe_dtm(TbFile *f, Position *pos) {
+  uint64_t idx;
+  int stm;
+
+  if (!f->tb.dtm[WHITE] || !tb_index(&f->tb, pos, &idx, &stm))
+    return TB_NONE;
+  int v = f->tb.dtm[stm][idx];
+  return v != TB_ILLEGAL && pos->passant != SQ_NONE ? probe_passant(f, pos, v, true) : v;
+}
+
+// tbgen_cmd() parses "tbgen <material> [threads N] [dir <path>] [all]
+// [nodtm]" and writes the table <material>.ctb, with "all" also the tables
+// of the smaller materials it needs, each as soon as it is generated.
+// Without "all", or with "nodtm", those still go to the directory while
+// they are probed, as temporary files that are already unlinked. It prints
+// the statistics of every table it generates and the peak of its memory.
+
+void tbgen_cmd(int argc, char **argv) {
+  const char *dir = ".";
+  int threads = cpu_count(), pieces[TB_MAX_PIECES], count = 0;
+  bool all = false, dtm = true;
+  char path[4096];
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "threads") && i + 1 < argc)
+      threads = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "dir") && i + 1 < argc)
+      dir = argv[++i];
+    else if (!strcmp(argv[i], "all"))
+      all = true;
+    else if (!strcmp(argv[i], "nodtm"))
+      dtm = false;
+  }
+  if (argc < 1 || !parse_material(argv[0], pieces, &count) || !canonical(pieces, count)) {
+    fprintf(stderr, "Usage: tbgen <material, e.g. KRPvKR> [threads N] [dir <path>] [all] [nodtm]\n");
+    exit(EXIT_FAILURE);
+  }
+  if (threads < 1)
+    threads = 1;
+  tb_init();
+
+  TimePoint start = now();
+  int target = plan(pieces, count);
+  uint64_t peak = 0;
+  for (int t = 0; t <= target; ++t) {
+    Tablebase *tb = Tables[t];
+    uint64_t memory = generate(tb, threads);
+    peak = memory > peak ? memory : peak;
+    snprintf(path, sizeof(path), "%s/%s.ctb", dir, tb->name);
+    if ((all || t == target) && !write_table(tb, path, dtm)) {
+      fprintf(stderr, "tbgen: cannot write %s\n", path);
+      exit(EXIT_FAILURE);
+    }
+
+    // A table that is probed later is mapped from a file with its DTM
+    if (Probers[t]) {
+      bool temporary = !all || !dtm;
+      if (temporary)
+        snprintf(path, sizeof(path), "%s/%s.ctb.tmp", dir, tb->name);
+      if ((temporary && !write_table(tb, path, true)) || !tb_open(&Files[t], path)) {
+        fprintf(stderr, "tbgen: cannot write %s\n", path);
+        exit(EXIT_FAILURE);
+      }
+      if (temporary)
+        unlink(path);
+      free(tb->dtm[WHITE]);
+      free(tb->dtm[BLACK]);
+      tb->dtm[WHITE] = Files[t].tb.dtm[WHITE];
+      tb->dtm[BLACK] = Files[t].tb.dtm[BLACK];
+    }
+
+    // Unmap the subtables that no table left to generate probes
+    for (int i = 0; i < SubCount[t]; ++i) {
+      if (--Probers[Subs[t][i]])
+        continue;
+      tb_close(&Files[Subs[t][i]]);
+      Tables[Subs[t][i]]->dtm[WHITE] = Tables[Subs[t][i]]->dtm[BLACK] = NULL;
+    }
+  }
+  printf("tables %d time %lld ms peak memory %llu MB threads %d\n", TableCount,
+         (long long)(now() - start), (unsigned long long)(peak >> 20), threads);
+
+  for (int i = 0; i < TableCount; ++i) {
+    free(Tables[i]->dtm[WHITE]);
+    free(Tables[i]->dtm[BLACK]);
+    free(Tables[i]);
+  }
+  TableCount = 0;
+}
+
+// tbprobe_cmd() parses "tbprobe <file> <fen>" and prints the value of the
+// position in the table.
+
+void tbprobe_cmd(int argc, char **argv) {
+  char fen[256] = "";
+  Position pos;
+  TbFile f;
+
+  for (int i = 1; i < argc; ++i)
+    snprintf(fen + strlen(fen), sizeof(fen) - strlen(fen), "%s ", argv[i]);
+  if (argc < 2 || !parse_fen(&pos, fen)) {
+    fprintf(stderr, "Usage: tbprobe <file> <fen>\n");
+    exit(EXIT_FAILURE);
+  }
+  if (!tb_open(&f, argv[0])) {
+    fprintf(stderr, "tbprobe: %s is not a tablebase\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  int wdl = tb_probe_wdl(&f, &pos), v = tb_probe_dtm(&f, &pos);
+  uint64_t idx;
+  int stm;
+  if (wdl == TB_NONE && tb_index(&f.tb, &pos, &idx, &stm))
+    printf("%s: no table for the en passant capture in %s\n", f.tb.name, f.dir);
+  else if (wdl == TB_NONE)
+    printf("%s: other material\n", f.tb.name);
+  else if (wdl == TB_ILLEGAL)
+    printf("%s: illegal\n", f.tb.name);
+  else if (v == TB_NONE)
+    printf("%s: %s\n", f.tb.name, wdl > 0 ? "win" : wdl < 0 ? "loss" : "draw");
+  else if (is_win(v))
+    printf("%s: win, mate in %d\n", f.tb.name, v);
+  else if (is_loss(v))
+    printf("%s: loss, mated in %d\n", f.tb.name, v - TB_LOSS);
+  else
+    printf("%s: draw\n", f.tb.name);
+  tb_close(&f);
+}
@@ -0,0 +1,66 @@
+#ifndef TBGEN_H_INCLUDED
+#define TBGEN_H_INCLUDED
+
+#include "position.h"
+
+// Endgame tablebases hold the distance to mate of every position of a set
+// of material, for both sides to move. tbgen generates them by retrograde
+// analysis, together with every smaller set that a capture or promotion
+// leads to, and writes them as files that tb_open() maps into memory.
+//
+// A position is indexed by the squares of its men in the order of the
+// material name ("KQvKR": white king, queen, black king, rook), each a
+// digit of base 64, or 48 for pawns. The white king is brought to a1-d1-d4
+// by the symmetries of the board without pawns, or to files A-D with
+// pawns, and men of the same kind are sorted by square. Castling and en
+// passant rights are not part of a position: en passant captures are
+// conversions to the smaller table, which generation and probing add.
+
+enum { TB_MAX_PIECES = 5, TB_MAX_DTM = 126 };
+
+// Values of a position for the side to move, in moves: TB_DRAW, a win in
+// 1 to 126 moves, TB_LOSS + n for a loss in n moves (TB_LOSS is mate), or
+// TB_ILLEGAL for an index that is not a legal position.
+
+enum { TB_DRAW = 0, TB_LOSS = 128, TB_ILLEGAL = 255 };
+
+typedef struct {
+  char name[16];
+  int count;
+  int pieces[TB_MAX_PIECES];
+  bool pawns;
+  uint64_t key;          // Material key, see tb_material_key()
+  uint64_t size;         // Positions per side to move
+  uint8_t *dtm[2];       // Values by side to move, or NULL if not stored
+  uint8_t *wdl;          // 2 bits per position, side to move 0 first
+} Tablebase;
+
+// TbFile is a table mapped from a file. The file starts with a header page,
+// followed by the WDL table, then the DTM table unless it was left out.
+
+typedef struct {
+  Tablebase tb;
+  void *map;
+  size_t mapSize;
+  char dir[1024];        // Of the file, where the smaller tables are
+} TbFile;
+
+// tb_probe_wdl() returns 1, 0 or -1 if the side to move wins, draws or
+// loses, and tb_probe_dtm() the value of the position, or TB_ILLEGAL if it
+// is not legal. Both return TB_NONE if the table does not have the
+// material of the position, or does not store the DTM. A position with an
+// en passant capture also needs the table of the capture, in the directory
+// of the file, and gets TB_NONE without it.
+
+enum { TB_NONE = -2 };
+
+uint64_t tb_material_key(Position *pos);
+bool tb_open(TbFile *f, const char *path);
+void tb_close(TbFile *f);
+int tb_probe_wdl(TbFile *f, Position *pos);
+int tb_probe_dtm(TbFile *f, Position *pos);
+
+void tbgen_cmd(int argc, char **argv);
+void tbprobe_cmd(int argc, char **argv);
+
+#endif
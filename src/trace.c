@@ -0,0 +1,439 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "misc.h"
+#include "trace.h"
+#include "types.h"
+
+// A trace file holds a header, then for every thread a TraceThread record
+// followed by its events, oldest first. The record carries the node counts
+// of the iterations of the thread, over all of its searches.
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t threads;
+  double ticksPerSecond;
+} TraceHeader;
+
+typedef struct {
+  uint32_t thread;
+  uint32_t reserved;
+  uint64_t count;
+  uint64_t iterationNodes[MAX_PLY + 1];
+} TraceThread;
+
+static const char TraceMagic[8] = "CATTRACE";
+
+enum { TRACE_VERSION = 2, MAX_TRACE_THREADS = 512 };
+
+static const char *ReasonNames[TRACE_REASON_NB] = {
+  "stop", "draw", "max-ply", "tt-cutoff", "stand-pat",
+  "no-moves", "fail-high", "fail-low", "exact", "cycle"
+};
+
+enum { TRACE_RING_SIZE = 1 << 20, TRACE_STAGE_SIZE = 256 };
+
+#ifdef TRACE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define trace_clock() __rdtsc()
+#else
+#include <time.h>
+INLINE uint64_t trace_clock(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+typedef struct {
+  TraceEvent *events;
+  TraceEvent *stage;       // The events of the block being filled
+  _Atomic uint64_t head;   // Number of events ever written
+  uint64_t lastTime;
+  int iteration;           // Depth of the running iteration, 0 if none
+  uint64_t iterationStart; // Nodes of the search when it started
+  uint64_t iterationNodes[MAX_PLY + 1];
+} __attribute__((aligned(64))) TraceRing;
+
+bool TraceEnabled;
+static _Thread_local TraceRing *LocalRing;
+
+static TraceRing Rings[MAX_TRACE_THREADS];
+static TraceRing NoRing;
+static atomic_int RingCount;
+static atomic_uint_fast64_t DroppedEvents;
+static uint64_t StartTicks;
+static TimePoint StartTime;
+
+// trace_register() hands out a ring on a thread's first event. Rings are
+// never released, so the events of finished threads can still be dumped.
+// Threads past the table get NoRing, which records nothing, rather than
+// write into another thread's ring; the first of them prints a warning.
+
+static TraceRing *trace_register(void) {
+  int idx = atomic_fetch_add(&RingCount, 1);
+  if (idx == MAX_TRACE_THREADS)
+    fprintf(stderr, "trace: more than %d threads, events of the others are dropped\n",
+            MAX_TRACE_THREADS);
+  if (idx >= MAX_TRACE_THREADS)
+    return LocalRing = &NoRing;
+  TraceEvent *events = malloc((TRACE_RING_SIZE + TRACE_STAGE_SIZE) * sizeof(TraceEvent));
+  if (!events) {
+    fprintf(stderr, "Failed to allocate the trace ring\n");
+    exit(EXIT_FAILURE);
+  }
+  Rings[idx].events = events;
+  Rings[idx].stage = events + TRACE_RING_SIZE;
+  return LocalRing = &Rings[idx];
+}
+
+// local_ring() returns the ring of the calling thread, or NULL after
+// counting the event as dropped if the thread has none.
+
+INLINE TraceRing *local_ring(void) {
+  TraceRing *r = LocalRing ? LocalRing : trace_register();
+  if (r != &NoRing)
+    return r;
+  atomic_fetch_add_explicit(&DroppedEvents, 1, memory_order_relaxed);
+  return NULL;
+}
+
+// trace_push() appends an event to the ring of the calling thread. Events
+// are staged in a small buffer that stays in the L1 cache and copied to the
+// ring a block at a time: writing the 16MB ring one event at a time evicts
+// the search's own data. The head is published after the event, and after
+// its block was copied, so a dump never copies a slot that is being written
+// unless the writer overtook it meanwhile. Depths above 127 are stored as
+// 127.
+
+INLINE void trace_push(TraceRing *r, int type, int info, int ply, int depth,
+                       int move, int value, int beta) {
+  uint64_t h = atomic_load_explicit(&r->head, memory_order_relaxed), t = r->lastTime;
+  r->stage[h % TRACE_STAGE_SIZE] = (TraceEvent){
+    (uint32_t)t, (uint16_t)(t >> 32), type, info, ply, depth < INT8_MAX ? depth : INT8_MAX,
+    move, value, beta
+  };
+  if (h % TRACE_STAGE_SIZE == TRACE_STAGE_SIZE - 1)
+    memcpy(&r->events[(h + 1 - TRACE_STAGE_SIZE) & (TRACE_RING_SIZE - 1)], r->stage,
+           TRACE_STAGE_SIZE * sizeof(TraceEvent));
+  atomic_store_explicit(&r->head, h + 1, memory_order_release);
+}
+
+// trace_enter_event() and trace_exit_event() record the events of a node.
+// Reading the clock costs about as much as the rest of the event, so only
+// the exits of main search nodes read it. Every other event takes the time
+// of the last exit read: a node is entered right after its previous sibling
+// returned, or after its parent was entered, and quiescence nodes (depth
+// 0), the bulk of the tree, are accounted to the main search node above.
+
+void trace_enter_event(int ply, int depth, int move, int alpha, int beta) {
+  TraceRing *r = local_ring();
+  if (r)
+    trace_push(r, TRACE_ENTER, 0, ply, depth, move, alpha, beta);
+}
+
+void trace_exit_event(int ply, int depth, int move, int value, int info) {
+  TraceRing *r = local_ring();
+  if (!r)
+    return;
+  if (depth > 0)
+    r->lastTime = trace_clock();
+  trace_push(r, TRACE_EXIT, info, ply, depth, move, value, 0);
+}
+
+// trace_iteration_event() starts an iteration of the given depth, or with
+// depth 0 ends the last iteration of a search. The nodes the search has
+// counted so far close the node count of the previous iteration. Only the
+// owning thread writes the counts.
+
+void trace_iteration_event(int depth, uint64_t nodes) {
+  TraceRing *r = local_ring();
+  if (!r)
+    return;
+  if (r->iteration) {
+    uint64_t *n = &r->iterationNodes[r->iteration];
+    __atomic_store_n(n, *n + nodes - r->iterationStart, __ATOMIC_RELAXED);
+  }
+  r->iteration = depth <= MAX_PLY ? depth : 0;
+  r->iterationStart = nodes;
+  r->lastTime = trace_clock();
+  if (depth)
+    trace_push(r, TRACE_ITERATION, 0, 0, depth, 0, 0, 0);
+}
+
+// trace_start() turns recording on. It must be called before the searches
+// to trace are started.
+
+void trace_start(void) {
+  StartTicks = trace_clock();
+  StartTime = now();
+  TraceEnabled = true;
+}
+
+// trace_dump() writes the rings to a file. The staged events are copied
+// first, again if the writer started a new block meanwhile, then the ring
+// up to them. The copy of the ring is checked against the head afterwards:
+// events that the writer may have overwritten during the copy are dropped
+// from the front.
+
+bool trace_dump(const char *path) {
+  FILE *out = fopen(path, "wb");
+  uint64_t events = 0;
+  if (!out) {
+    fprintf(stderr, "trace: cannot open %s\n", path);
+    return false;
+  }
+
+  int n = atomic_load(&RingCount);
+  n = n < MAX_TRACE_THREADS ? n : MAX_TRACE_THREADS;
+  TimePoint elapsed = now() - StartTime;
+  TraceHeader h = { .version = TRACE_VERSION, .threads = n };
+  memcpy(h.magic, TraceMagic, sizeof(h.magic));
+  h.ticksPerSecond = elapsed > 0 ? (trace_clock() - StartTicks) * 1000.0 / elapsed : 1e9;
+  bool ok = fwrite(&h, sizeof(h), 1, out) == 1;
+
+  TraceEvent *copy = malloc((TRACE_RING_SIZE + TRACE_STAGE_SIZE) * sizeof(TraceEvent));
+  for (int i = 0; i < n && ok; ++i) {
+    TraceRing *r = &Rings[i];
+    uint64_t head, block;
+    do {
+      head = atomic_load_explicit(&r->head, memory_order_acquire);
+      block = head - head % TRACE_STAGE_SIZE;
+      memcpy(copy + TRACE_RING_SIZE, r->stage, (head - block) * sizeof(TraceEvent));
+      atomic_thread_fence(memory_order_acquire);
+    } while (atomic_load_explicit(&r->head, memory_order_relaxed) >= block + TRACE_STAGE_SIZE);
+
+    // The ring events go right in front of the staged ones
+    uint64_t first = block > TRACE_RING_SIZE ? block - TRACE_RING_SIZE : 0;
+    TraceEvent *oldest = copy + TRACE_RING_SIZE - (block - first);
+    for (uint64_t j = first; j < block; ++j)
+      oldest[j - first] = r->events[j & (TRACE_RING_SIZE - 1)];
+
+    // If the event being written when the copy ended completes a block, the
+    // block may have been copied to the ring, overwriting its slots and all
+    // slots before
+    uint64_t after = atomic_load_explicit(&r->head, memory_order_acquire);
+    uint64_t end = after + 1 - (after + 1) % TRACE_STAGE_SIZE;
+    uint64_t valid = end > TRACE_RING_SIZE ? end - TRACE_RING_SIZE : 0;
+    uint64_t skip = valid > first ? (valid < block ? valid : block) - first : 0;
+
+    TraceThread t = { .thread = i, .count = head - first - skip };
+    for (int d = 1; d <= MAX_PLY; ++d)
+      t.iterationNodes[d] = __atomic_load_n(&r->iterationNodes[d], __ATOMIC_RELAXED);
+    events += t.count;
+    ok =   fwrite(&t, sizeof(t), 1, out) == 1
+        && fwrite(oldest + skip, sizeof(TraceEvent), t.count, out) == t.count;
+  }
+  free(copy);
+  ok = !fclose(out) && ok;
+  if (ok)
+    fprintf(stderr, "trace: %llu events of %d threads written to %s\n",
+            (unsigned long long)events, n, path);
+  else
+    fprintf(stderr, "trace: cannot write %s\n", path);
+  uint64_t dropped = atomic_load_explicit(&DroppedEvents, memory_order_relaxed);
+  if (ok && dropped)
+    fprintf(stderr, "trace: %llu events of threads past %d dropped\n",
+            (unsigned long long)dropped, MAX_TRACE_THREADS);
+  return ok;
+}
+
+#else
+
+void trace_start(void) {
+  fprintf(stderr, "Tracing not compiled in, rebuild with -DTRACE\n");
+}
+
+bool trace_dump(const char *path) {
+  (void)path;
+  return false;
+}
+
+#endif
+
+// NodeStats sums the nodes of one remaining depth.
+
+typedef struct {
+  uint64_t nodes, interior, children, ttHits;
+  uint64_t reasons[TRACE_REASON_NB];
+  uint64_t firstMoveCutoffs;   // Fail highs on the first child searched
+  uint64_t ticks;              // Inclusive time of the nodes
+} NodeStats;
+
+typedef struct {
+  uint64_t start;
+  int ply, depth, children;
+} OpenNode;
+
+enum { MAX_DEPTH_STATS = 64 };
+
+INLINE uint64_t event_time(const TraceEvent *e) {
+  return e->time | (uint64_t)e->timeHigh << 32;
+}
+
+static void print_move(FILE *out, Move m) {
+  static const char pieces[] = " pnbrqk";
+  if (!m) {
+    fprintf(out, "root");
+    return;
+  }
+  fprintf(out, "%c%c%c%c", 'a' + file_of(from_sq(m)), '1' + rank_of(from_sq(m)),
+          'a' + file_of(to_sq(m)), '1' + rank_of(to_sq(m)));
+  if (type_of_m(m) == PROMOTION)
+    fputc(pieces[promotion_type(m)], out);
+}
+
+// traceview_cmd() parses "traceview <file> [tree PLIES] [thread N]". It
+// rebuilds the search trees of every thread from the enter and exit events
+// and prints per-depth branching factors, cutoff reasons and node times,
+// and the node counts of the iterations. With "tree" the nodes of one
+// thread up to the given ply are printed as an indented tree instead.
+
+void traceview_cmd(int argc, char **argv) {
+  int treePlies = -1, treeThread = 0;
+  TraceHeader h;
+
+  for (int i = 1; i + 1 < argc; i += 2)
+    if (!strcmp(argv[i], "tree"))
+      treePlies = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "thread"))
+      treeThread = atoi(argv[i + 1]);
+
+  FILE *in = argc > 0 ? fopen(argv[0], "rb") : NULL;
+  if (!in) {
+    fprintf(stderr, "Usage: traceview <file> [tree PLIES] [thread N]\n");
+    exit(EXIT_FAILURE);
+  }
+  if (   fread(&h, sizeof(h), 1, in) != 1
+      || memcmp(h.magic, TraceMagic, sizeof(h.magic)) || h.version != TRACE_VERSION) {
+    fprintf(stderr, "traceview: %s is not a trace file\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  static NodeStats stats[MAX_DEPTH_STATS];
+  static OpenNode stack[MAX_PLY + 8];
+  uint64_t iterationNodes[MAX_PLY + 1] = { 0 };
+  uint64_t events = 0, orphans = 0, first = UINT64_MAX, last = 0;
+  TraceEvent *buf = malloc((TRACE_RING_SIZE + TRACE_STAGE_SIZE) * sizeof(TraceEvent));
+
+  memset(stats, 0, sizeof(stats));
+  for (uint32_t t = 0; t < h.threads; ++t) {
+    TraceThread th;
+    if (   fread(&th, sizeof(th), 1, in) != 1 || th.count > TRACE_RING_SIZE + TRACE_STAGE_SIZE
+        || fread(buf, sizeof(TraceEvent), th.count, in) != th.count) {
+      fprintf(stderr, "traceview: %s is truncated\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+    bool print = treePlies >= 0 && th.thread == (uint32_t)treeThread;
+    int sp = 0;
+
+    events += th.count;
+    for (int d = 1; d <= MAX_PLY; ++d)
+      iterationNodes[d] += th.iterationNodes[d];
+    for (uint64_t i = 0; i < th.count; ++i) {
+      TraceEvent *e = &buf[i];
+      uint64_t time = event_time(e);
+      first = time < first ? time : first;
+      last = time > last ? time : last;
+
+      if (e->type == TRACE_ITERATION) {
+        sp = 0;
+        if (print)
+          printf("iteration %d\n", e->depth);
+      }
+      else if (e->type == TRACE_ENTER) {
+        // A node whose entry was overwritten in the ring cannot be closed
+        if (sp && stack[sp - 1].ply + 1 != e->ply)
+          sp = 0;
+        if (sp)
+          stack[sp - 1].children++;
+        if (sp < MAX_PLY + 8)
+          stack[sp++] = (OpenNode){ time, e->ply, e->depth, 0 };
+        if (print && e->ply <= treePlies) {
+          printf("%*s", 2 * e->ply, "");
+          print_move(stdout, e->move);
+          printf(" d%d [%d, %d]\n", e->depth, e->value, e->beta);
+        }
+      }
+      else if (e->type == TRACE_EXIT) {
+        if (!sp || stack[sp - 1].ply != e->ply) {
+          orphans++;
+          sp = 0;
+          continue;
+        }
+        OpenNode *n = &stack[--sp];
+        int reason = e->info & ~TRACE_TT_HIT;
+        NodeStats *s = &stats[n->depth < 0 ? 0 : n->depth < MAX_DEPTH_STATS ? n->depth : MAX_DEPTH_STATS - 1];
+        s->nodes++;
+        s->ttHits += !!(e->info & TRACE_TT_HIT);
+        s->ticks += time - n->start;
+        if (reason < TRACE_REASON_NB)
+          s->reasons[reason]++;
+        if (n->children) {
+          s->interior++;
+          s->children += n->children;
+        }
+        if (reason == TRACE_FAIL_HIGH && n->children == 1)
+          s->firstMoveCutoffs++;
+        if (print && e->ply <= treePlies) {
+          printf("%*s= %d %s%s", 2 * e->ply + 2, "", e->value,
+                 reason < TRACE_REASON_NB ? ReasonNames[reason] : "?",
+                 e->info & TRACE_TT_HIT ? " tt" : "");
+          if (e->move) {
+            printf(" best ");
+            print_move(stdout, e->move);
+          }
+          printf("\n");
+        }
+      }
+    }
+  }
+  fclose(in);
+  free(buf);
+  if (treePlies >= 0)
+    return;
+
+  double seconds = last > first ? (last - first) / h.ticksPerSecond : 0;
+  printf("threads %u events %llu orphan exits %llu span %.3f s\n\n", h.threads,
+         (unsigned long long)events, (unsigned long long)orphans, seconds);
+
+  printf("depth        nodes  tt-hit%%  branch  fail-high%%  first-move%%  tt-cut%%  fail-low%%  exact%%   us/node\n");
+  for (int d = MAX_DEPTH_STATS - 1; d >= 0; --d) {
+    NodeStats *s = &stats[d];
+    if (!s->nodes)
+      continue;
+    double n = s->nodes;
+    uint64_t fh = s->reasons[TRACE_FAIL_HIGH];
+    printf("%5d %12llu %8.1f %7.2f %11.1f %12.1f %8.1f %10.1f %7.1f", d,
+           (unsigned long long)s->nodes, 100 * s->ttHits / n,
+           s->interior ? (double)s->children / s->interior : 0.0,
+           100 * fh / n, fh ? 100.0 * s->firstMoveCutoffs / fh : 0.0,
+           100 * s->reasons[TRACE_TT_CUTOFF] / n, 100 * s->reasons[TRACE_FAIL_LOW] / n,
+           100 * s->reasons[TRACE_EXACT] / n);
+    // Quiescence nodes are not timed on their own
+    if (d)
+      printf(" %9.2f\n", s->ticks * 1e6 / h.ticksPerSecond / n);
+    else
+      printf(" %9s\n", "-");
+  }
+
+  printf("\nreason      ");
+  for (int r = 0; r < TRACE_REASON_NB; ++r) {
+    uint64_t total = 0;
+    for (int d = 0; d < MAX_DEPTH_STATS; ++d)
+      total += stats[d].reasons[r];
+    printf("%s%s %llu", r ? ", " : "", ReasonNames[r], (unsigned long long)total);
+  }
+  printf("\n\niteration        nodes     ebf\n");
+  for (int d = 1; d <= MAX_PLY; ++d)
+    if (iterationNodes[d])
+      printf("%9d %12llu %7.2f\n", d, (unsigned long long)iterationNodes[d],
+             d > 1 && iterationNodes[d - 1]
+             ? (double)iterationNodes[d] / iterationNodes[d - 1] : 0.0);
+}
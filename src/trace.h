@@ -0,0 +1,80 @@
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+#include "types.h"
+
+// The search tracer records every node of the search as a pair of 16 byte
+// events, one on entry with the window and one on exit with the value and
+// the reason the node returned. It is compiled in only with -DTRACE and
+// then records only while enabled with trace_start(). Every thread writes
+// into its own ring buffer without locks, overwriting its oldest events;
+// trace_dump() takes a consistent copy of the rings at any time, even
+// while searches are running, and "traceview" analyzes the file offline.
+// The node counts of the iterations are kept outside the rings, so they
+// survive the rings wrapping around. Without TRACE the macros expand to
+// nothing.
+
+enum { TRACE_ENTER, TRACE_EXIT, TRACE_ITERATION };
+
+// Exit reasons, in bits 0-6 of TraceEvent.info. Bit 7 is set if the node
+// had a TT hit.
+
+enum {
+  TRACE_STOP, TRACE_DRAW, TRACE_MAX_PLY, TRACE_TT_CUTOFF, TRACE_STAND_PAT,
+  TRACE_NO_MOVES, TRACE_FAIL_HIGH, TRACE_FAIL_LOW, TRACE_EXACT, TRACE_CYCLE,
+  TRACE_REASON_NB
+};
+
+enum { TRACE_TT_HIT = 0x80 };
+
+typedef struct {
+  uint32_t time;       // Clock ticks, low 32 of 48 bits
+  uint16_t timeHigh;
+  uint8_t type;
+  uint8_t info;        // Exit reason and TT hit
+  uint8_t ply;
+  int8_t depth;        // 0 in the quiescence search, at most 127
+  uint16_t move;       // Entry: the move into the node; exit: the best move
+  int16_t value;       // Entry: alpha; exit: the value returned
+  int16_t beta;        // Entry only
+} TraceEvent;
+
+_Static_assert(sizeof(TraceEvent) == 16, "TraceEvent must be 16 bytes");
+
+#ifdef TRACE
+
+#define HasTrace 1
+
+extern bool TraceEnabled;
+void trace_enter_event(int ply, int depth, int move, int alpha, int beta);
+void trace_exit_event(int ply, int depth, int move, int value, int info);
+void trace_iteration_event(int depth, uint64_t nodes);
+
+// The checks of TraceEnabled are all that a search pays when tracing is
+// off; the recording itself stays out of line.
+
+#define trace_node_enter(ply, depth, move, alpha, beta) \
+  (__builtin_expect(TraceEnabled, 0) \
+   ? trace_enter_event(ply, depth, move, alpha, beta) : (void)0)
+#define trace_node_exit(ply, depth, move, value, reason, ttHit) \
+  (__builtin_expect(TraceEnabled, 0) \
+   ? trace_exit_event(ply, depth, move, value, (reason) | ((ttHit) ? TRACE_TT_HIT : 0)) \
+   : (void)0)
+#define trace_iteration(depth, nodes) \
+  (__builtin_expect(TraceEnabled, 0) ? trace_iteration_event(depth, nodes) : (void)0)
+
+#else
+
+#define HasTrace 0
+
+#define trace_node_enter(ply, depth, move, alpha, beta) ((void)0)
+#define trace_node_exit(ply, depth, move, value, reason, ttHit) ((void)0)
+#define trace_iteration(depth, nodes) ((void)0)
+
+#endif
+
+void trace_start(void);
+bool trace_dump(const char *path);
+void traceview_cmd(int argc, char **argv);
+
+#endif
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "stats.h"
+#include "tt.h"
+
+TranspositionTable TT;
+
+INLINE uint64_t tte_pack(TTEntry tte) {
+  uint64_t data;
+  memcpy(&data, &tte, sizeof(data));
+  return data;
+}
+
+INLINE TTEntry tte_unpack(uint64_t data) {
+  TTEntry tte;
+  memcpy(&tte, &data, sizeof(tte));
+  return tte;
+}
+
+// tt_resize() sets the size of the table in megabytes. The contents are
+// lost; it must not be called while a search is running.
+
+void tt_resize(size_t mbSize) {
+  size_t clusterCount = mbSize * 1024 * 1024 / sizeof(Cluster);
+  if (clusterCount == TT.clusterCount)
+    return;
+
+  free(TT.table);
+  TT.table = aligned_alloc(64, clusterCount * sizeof(Cluster));
+  if (!TT.table) {
+    fprintf(stderr, "Failed to allocate %zuMB for transposition table\n", mbSize);
+    exit(EXIT_FAILURE);
+  }
+  TT.clusterCount = clusterCount;
+  tt_clear();
+}
+
+void tt_clear(void) {
+  memset(TT.table, 0, TT.clusterCount * sizeof(Cluster));
+  atomic_store(&TT.generation8, 0);
+}
+
+void tt_free(void) {
+  free(TT.table);
+  TT.table = NULL;
+  TT.clusterCount = 0;
+}
+
+// tt_probe() looks up a position. On a hit the entry is copied to *tte and
+// its generation is refreshed, so that it is not replaced as stale. The
+// refresh is a compare-and-swap: if another thread has rewritten the entry
+// meanwhile, its store wins and the refresh is skipped.
+
+bool tt_probe(Key key, TTEntry *tte) {
+  Cluster *c = first_entry(key);
+  uint16_t key16 = key >> 48;
+  uint8_t generation8 = atomic_load_explicit(&TT.generation8, memory_order_relaxed);
+
+  stats_inc(STAT_TT_PROBE);
+  for (int i = 0; i < CLUSTER_SIZE; ++i) {
+    uint64_t data = atomic_load_explicit(&c->entry[i], memory_order_relaxed);
+    TTEntry e = tte_unpack(data);
+    if (e.key16 == key16 && e.depth8) {
+      if ((e.genBound8 & 0xFC) != generation8) {
+        e.genBound8 = generation8 | (e.genBound8 & 0x3);
+        atomic_compare_exchange_strong_explicit(&c->entry[i], &data, tte_pack(e),
+                                                memory_order_relaxed, memory_order_relaxed);
+      }
+      stats_inc(STAT_TT_HIT);
+      *tte = e;
+      return true;
+    }
+  }
+  return false;
+}
+
+// tt_save() stores a search result. The entry of the same position is
+// overwritten, keeping its move if the new result has none; otherwise the
+// entry with the lowest depth, less 8 plies per generation of age, is
+// replaced. An entry is not overwritten by a shallower non-exact result of
+// the same position.
+
+INLINE void save_entry(Key key, Value v, int bound, Depth d, Move m) {
+  Cluster *c = first_entry(key);
+  uint16_t key16 = key >> 48;
+  uint8_t generation8 = atomic_load_explicit(&TT.generation8, memory_order_relaxed);
+  int replace = 0, replaceValue = INT32_MAX;
+  TTEntry old = { 0 };
+
+  for (int i = 0; i < CLUSTER_SIZE; ++i) {
+    TTEntry e = tte_unpack(atomic_load_explicit(&c->entry[i], memory_order_relaxed));
+    if (!e.depth8 || e.key16 == key16) {
+      replace = i;
+      old = e;
+      break;
+    }
+    int age = (uint8_t)(generation8 - (e.genBound8 & 0xFC)) / 4;
+    int value = e.depth8 - 8 * age;
+    if (value < replaceValue) {
+      replace = i;
+      replaceValue = value;
+      old = e;
+    }
+  }
+
+  bool same = old.depth8 && old.key16 == key16;
+  if (same && bound != BOUND_EXACT && d - DEPTH_OFFSET < old.depth8 - 4)
+    return;
+
+  TTEntry e = {
+    .key16 = key16,
+    .move = m || !same ? m : old.move,
+    .value = v,
+    .genBound8 = generation8 | bound,
+    .depth8 = d - DEPTH_OFFSET
+  };
+  atomic_store_explicit(&c->entry[replace], tte_pack(e), memory_order_relaxed);
+}
+
+void tt_save(Key key, Value v, int bound, Depth d, Move m) {
+  save_entry(key, v, bound, d, m);
+  if (TT.share && d >= TT.shareDepth)
+    TT.share(key, v, bound, d, m);
+}
+
+// tt_import() stores a result received from elsewhere. Depths the table
+// cannot hold are dropped.
+
+void tt_import(Key key, Value v, int bound, Depth d, Move m) {
+  if (d > DEPTH_OFFSET && d < MAX_PLY)
+    save_entry(key, v, bound, d, m);
+}
+
+// tt_hashfull() samples the first clusters and returns the permille of
+// entries written in the current generation.
+
+int tt_hashfull(void) {
+  uint8_t generation8 = atomic_load_explicit(&TT.generation8, memory_order_relaxed);
+  int count = 0, clusters = TT.clusterCount < 250 ? TT.clusterCount : 250;
+
+  for (int i = 0; i < clusters; ++i)
+    for (int j = 0; j < CLUSTER_SIZE; ++j) {
+      TTEntry e = tte_unpack(atomic_load_explicit(&TT.table[i].entry[j], memory_order_relaxed));
+      count += e.depth8 && (e.genBound8 & 0xFC) == generation8;
+    }
+  return clusters ? count * 1000 / (clusters * CLUSTER_SIZE) : 0;
+}
@@ -0,0 +1,81 @@
+#ifndef TT_H_INCLUDED
+#define TT_H_INCLUDED
+
+#include <stdatomic.h>
+
+#include "types.h"
+
+// TTEntry is one 8 byte transposition table entry:
+//
+//  key16     16 bits  upper bits of the position key
+//  move      16 bits  best or refutation move
+//  value     16 bits  search value, mate scores relative to the node
+//  genBound8  8 bits  generation (bits 2-7) and bound type (bits 0-1)
+//  depth8     8 bits  depth - DEPTH_OFFSET, so that 0 marks an empty entry
+//
+// The table is shared by all search threads without locks. Every entry is
+// read and written as a single 64-bit word, so a probe sees either the old
+// or the new entry, never a mix of two. Two positions can still share a
+// key16, so a probed move must be checked for legality before it is played.
+
+typedef struct {
+  uint16_t key16;
+  uint16_t move;
+  int16_t value;
+  uint8_t genBound8;
+  uint8_t depth8;
+} TTEntry;
+
+enum { CLUSTER_SIZE = 4 };
+
+typedef struct {
+  _Atomic uint64_t entry[CLUSTER_SIZE];
+} Cluster;
+
+_Static_assert(sizeof(TTEntry) == 8, "TTEntry must be 8 bytes");
+_Static_assert(sizeof(Cluster) == 32, "Cluster must be 32 bytes");
+_Static_assert(MAX_PLY - DEPTH_OFFSET <= UINT8_MAX, "Search depth must fit depth8");
+
+// With a share hook set, tt_save() also hands every result of at least
+// shareDepth to it, e.g. to send it to other processes. tt_import() stores
+// a result without passing it on.
+
+typedef void (*TTShareHook)(Key key, Value v, int bound, Depth d, Move m);
+
+typedef struct {
+  Cluster *table;
+  size_t clusterCount;
+  _Atomic uint8_t generation8;
+  TTShareHook share;
+  Depth shareDepth;
+} TranspositionTable;
+
+extern TranspositionTable TT;
+
+void tt_resize(size_t mbSize);
+void tt_clear(void);
+void tt_free(void);
+bool tt_probe(Key key, TTEntry *tte);
+void tt_save(Key key, Value v, int bound, Depth d, Move m);
+void tt_import(Key key, Value v, int bound, Depth d, Move m);
+int tt_hashfull(void);
+
+// tt_new_search() starts a new generation. Entries of older generations
+// are preferred for replacement.
+
+INLINE void tt_new_search(void) {
+  atomic_fetch_add_explicit(&TT.generation8, 4, memory_order_relaxed);
+}
+
+INLINE int tte_bound(TTEntry *tte) { return tte->genBound8 & 0x3; }
+INLINE Depth tte_depth(TTEntry *tte) { return tte->depth8 + DEPTH_OFFSET; }
+
+// first_entry() returns the cluster of a key. The index is taken from the
+// low 32 bits by multiplication, so that the table size need not be a
+// power of two; key16 comes from the upper bits.
+
+INLINE Cluster *first_entry(Key key) {
+  return &TT.table[((uint32_t)key * (uint64_t)TT.clusterCount) >> 32];
+}
+
+#endif
@@ -0,0 +1,401 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "evaluate.h"
+#include "misc.h"
+#include "packed.h"
+#include "tune.h"
+
+// The tuner fits the evaluation parameters to game results. Every position
+// is traced once at load time into its coefficients, so that its value for
+// any parameters is a short dot product: the positions are kept in memory
+// as packed lists of (parameter, coefficient) pairs. An iteration computes
+// the logistic loss of all positions and its exact gradient, split across
+// threads, and takes one Adam or gradient descent step. The result is
+// written as the source tables of evaluate.c.
+
+enum { LINE_LENGTH = 512 };
+
+typedef struct {
+  uint16_t index;
+  int16_t coeff;
+} TuneTerm;
+
+typedef struct {
+  uint32_t first;        // First term in the pool
+  uint8_t count;
+  uint8_t result;        // 0, 1 or 2: white lost, drew or won
+  uint8_t phase;         // PHASE_ENDGAME to PHASE_MIDGAME
+  int16_t baseMg, baseEg;   // Material and tempo, from white's point of view
+} TuneEntry;
+
+typedef struct {
+  TuneEntry *entries;
+  size_t count, cap;
+  TuneTerm *terms;
+  size_t termCount, termCap;
+  uint64_t skipped, mismatches;
+  double weights[TUNE_NB][2];
+} Tuner;
+
+typedef struct {
+  Tuner *tuner;
+  size_t begin, end;
+  double k;
+  bool gradient;
+  double loss;
+  double grad[TUNE_NB][2];
+} TuneSlice;
+
+// add_position() traces the position and stores it with its result. The
+// trace is checked against the evaluation with the current parameters.
+
+static void add_position(Tuner *t, Position *pos, int result) {
+  EvalTrace trace;
+  Value v = evaluate_trace(pos, &trace);
+
+  if (!trace.linear) {
+    t->skipped++;
+    return;
+  }
+
+  Score score = trace.base;
+  for (int i = 0; i < TUNE_NB; ++i)
+    score += trace.coeff[i] * eval_param(i);
+  if (taper(score, trace.npm, trace.side) != v)
+    t->mismatches++;
+
+  if (t->count == t->cap) {
+    t->cap = t->cap ? 2 * t->cap : 1 << 16;
+    t->entries = realloc(t->entries, t->cap * sizeof(TuneEntry));
+  }
+  if (t->termCount + TUNE_NB > t->termCap) {
+    t->termCap = t->termCap ? 2 * t->termCap : 1 << 20;
+    t->terms = realloc(t->terms, t->termCap * sizeof(TuneTerm));
+  }
+
+  TuneEntry *e = &t->entries[t->count++];
+  Value npm = trace.npm < EndgameLimit ? EndgameLimit : trace.npm > MidgameLimit ? MidgameLimit : trace.npm;
+  int tempo = trace.side == WHITE ? Tempo : -Tempo;
+  e->first = t->termCount;
+  e->count = 0;
+  e->result = result + 1;
+  e->phase = ((npm - EndgameLimit) * PHASE_MIDGAME) / (MidgameLimit - EndgameLimit);
+  e->baseMg = mg_value(trace.base) + tempo;
+  e->baseEg = eg_value(trace.base) + tempo;
+  for (int i = 0; i < TUNE_NB; ++i)
+    if (trace.coeff[i]) {
+      t->terms[t->termCount++] = (TuneTerm){ i, trace.coeff[i] };
+      e->count++;
+    }
+}
+
+// parse_result() finds the game result in the text behind a FEN: "1-0",
+// "0-1" or "1/2-1/2", as in an EPD c9 opcode, or "[1.0]", "[0.5]" or
+// "[0.0]". It returns the result for white, or RESULT_NONE.
+
+static int parse_result(const char *s) {
+  if (strstr(s, "1/2-1/2") || strstr(s, "[0.5]"))
+    return RESULT_DRAW;
+  if (strstr(s, "1-0") || strstr(s, "[1.0]"))
+    return RESULT_WHITE_WIN;
+  if (strstr(s, "0-1") || strstr(s, "[0.0]"))
+    return RESULT_BLACK_WIN;
+  return RESULT_NONE;
+}
+
+// load_positions() reads the labelled positions of a file, packed records
+// if its name ends in .bin, else FEN or EPD lines. Positions without a
+// result are skipped.
+
+static bool load_positions(Tuner *t, const char *path, uint64_t limit) {
+  size_t len = strlen(path);
+  Position pos;
+
+  if (len > 4 && !strcmp(path + len - 4, ".bin")) {
+    PackedReader r;
+    if (!packed_reader_open(&r, path))
+      return false;
+    for (size_t i = 0; i < r.count && t->count < limit; ++i)
+      if (r.data[i].result == RESULT_NONE || !unpack_position(&r.data[i], &pos))
+        t->skipped++;
+      else
+        add_position(t, &pos, r.data[i].result);
+    packed_reader_close(&r);
+    return true;
+  }
+
+  FILE *in = fopen(path, "r");
+  char line[LINE_LENGTH];
+  if (!in)
+    return false;
+  while (t->count < limit && fgets(line, LINE_LENGTH, in)) {
+    const char *rest;
+    int result;
+    if (!line[strspn(line, " \t\r\n")] || line[0] == '#')
+      continue;
+    if (!(rest = parse_fen(&pos, line)) || (result = parse_result(rest)) == RESULT_NONE)
+      t->skipped++;
+    else
+      add_position(t, &pos, result);
+  }
+  fclose(in);
+  return true;
+}
+
+// tune_slice() sums the loss, and with gradient set its gradient, over a
+// slice of the positions. The predicted score of white is the logistic
+// function of k times the evaluation from white's point of view.
+
+static void *tune_slice(void *arg) {
+  TuneSlice *s = arg;
+  Tuner *t = s->tuner;
+  double (*w)[2] = t->weights;
+
+  s->loss = 0;
+  if (s->gradient)
+    memset(s->grad, 0, sizeof(s->grad));
+
+  for (size_t i = s->begin; i < s->end; ++i) {
+    const TuneEntry *e = &t->entries[i];
+    const TuneTerm *term = &t->terms[e->first];
+    double rho = e->phase / (double)PHASE_MIDGAME;
+    double mg = e->baseMg, eg = e->baseEg;
+
+    for (int j = 0; j < e->count; ++j) {
+      mg += term[j].coeff * w[term[j].index][MG];
+      eg += term[j].coeff * w[term[j].index][EG];
+    }
+    double p = 1 / (1 + exp(-s->k * (mg * rho + eg * (1 - rho))));
+    double r = e->result / 2.0;
+    s->loss -= r * log(p + 1e-12) + (1 - r) * log(1 - p + 1e-12);
+
+    if (s->gradient) {
+      double g = (p - r) * s->k;
+      for (int j = 0; j < e->count; ++j) {
+        s->grad[term[j].index][MG] += g * term[j].coeff * rho;
+        s->grad[term[j].index][EG] += g * term[j].coeff * (1 - rho);
+      }
+    }
+  }
+  return NULL;
+}
+
+// tune_pass() runs one pass over all positions on the given threads and
+// returns the mean loss; with grad it also returns the mean gradient.
+
+static double tune_pass(Tuner *t, TuneSlice *slices, int threads, double k,
+                        double (*grad)[2]) {
+  pthread_t *workers = malloc(threads * sizeof(pthread_t));
+  double loss = 0;
+
+  for (int i = 0; i < threads; ++i) {
+    slices[i].tuner = t;
+    slices[i].begin = t->count * i / threads;
+    slices[i].end = t->count * (i + 1) / threads;
+    slices[i].k = k;
+    slices[i].gradient = grad != NULL;
+    pthread_create(&workers[i], NULL, tune_slice, &slices[i]);
+  }
+  if (grad)
+    memset(grad, 0, TUNE_NB * sizeof(*grad));
+  for (int i = 0; i < threads; ++i) {
+    pthread_join(workers[i], NULL);
+    loss += slices[i].loss;
+    for (int j = 0; grad && j < TUNE_NB; ++j) {
+      grad[j][MG] += slices[i].grad[j][MG] / t->count;
+      grad[j][EG] += slices[i].grad[j][EG] / t->count;
+    }
+  }
+  free(workers);
+  return loss / t->count;
+}
+
+// fit_k() finds the scale of the logistic function that best fits the
+// current evaluation, by golden section search on its logarithm.
+
+static double fit_k(Tuner *t, TuneSlice *slices, int threads) {
+  const double phi = (sqrt(5) - 1) / 2;
+  double a = log(1e-4), b = log(1e-1);
+  double c = b - phi * (b - a), d = a + phi * (b - a);
+  double fc = tune_pass(t, slices, threads, exp(c), NULL);
+  double fd = tune_pass(t, slices, threads, exp(d), NULL);
+
+  for (int i = 0; i < 30; ++i)
+    if (fc < fd) {
+      b = d, d = c, fd = fc;
+      c = b - phi * (b - a);
+      fc = tune_pass(t, slices, threads, exp(c), NULL);
+    }
+    else {
+      a = c, c = d, fc = fd;
+      d = a + phi * (b - a);
+      fd = tune_pass(t, slices, threads, exp(d), NULL);
+    }
+  return exp((a + b) / 2);
+}
+
+// param_score() returns the rounded weights of parameter i as a score.
+
+static Score param_score(Tuner *t, int i, int sign) {
+  return make_score((int)lround(sign * t->weights[i][MG]), (int)lround(sign * t->weights[i][EG]));
+}
+
+static void print_score(FILE *out, Score s) {
+  fprintf(out, "S(%4d,%4d)", mg_value(s), eg_value(s));
+}
+
+// write_tables() writes the tuned parameters in the layout of the tables
+// in evaluate.c, ready to replace them.
+
+static void write_tables(Tuner *t, FILE *out) {
+  static const char *Names[] = { "Knight", "Bishop", "Rook", "Queen", "King" };
+
+  fprintf(out, "static const Score Bonus[][8][4] = {\n  { },\n  { },\n");
+  for (int pt = 0; pt < 5; ++pt) {
+    fprintf(out, "  { // %s\n", Names[pt]);
+    for (int r = 0; r < 8; ++r) {
+      fprintf(out, "   { ");
+      for (int f = 0; f < 4; ++f) {
+        print_score(out, param_score(t, TUNE_PSQT + pt * 32 + r * 4 + f, 1));
+        fprintf(out, f < 3 ? ", " : " }");
+      }
+      fprintf(out, r < 7 ? ",\n" : "\n");
+    }
+    fprintf(out, pt < 4 ? "  },\n" : "  }\n");
+  }
+  fprintf(out, "};\n\nstatic const Score PBonus[8][8] = {\n  { },\n");
+  for (int r = 0; r < 6; ++r) {
+    fprintf(out, "  { ");
+    for (int f = 0; f < 8; ++f) {
+      print_score(out, param_score(t, TUNE_PAWNS + r * 8 + f, 1));
+      fprintf(out, f < 7 ? ", " : " }");
+    }
+    fprintf(out, r < 5 ? ",\n" : "\n");
+  }
+  fprintf(out, "};\n\nconst Score MobilityBonus[8] = {\n  0, 0");
+  for (int i = 0; i < 4; ++i) {
+    fprintf(out, ", ");
+    print_score(out, param_score(t, TUNE_MOBILITY + i, 1));
+  }
+  fprintf(out, "\n};\n\nconst Score Isolated = ");
+  print_score(out, param_score(t, TUNE_ISOLATED, -1));
+  fprintf(out, ";\nconst Score Doubled  = ");
+  print_score(out, param_score(t, TUNE_DOUBLED, -1));
+  fprintf(out, ";\n\nconst Score PassedRank[8] = {\n  0");
+  for (int i = 0; i < 6; ++i) {
+    fprintf(out, ", ");
+    print_score(out, param_score(t, TUNE_PASSED + i, 1));
+  }
+  fprintf(out, "\n};\n");
+}
+
+// tune_cmd() parses "tune <file>... [iterations N] [lr X] [method adam|sgd]
+// [k X] [threads N] [limit N] [output <file>]" and tunes the evaluation
+// on the positions of all files. The options apply wherever they stand:
+// the files are loaded only once all are parsed, until limit positions
+// are loaded in total. Without k the scale of the logistic function is
+// fitted to the evaluation before tuning.
+
+void tune_cmd(int argc, char **argv) {
+  const char *output = "-";
+  int iterations = 500, threads = cpu_count();
+  double lr = 0, k = 0;
+  bool sgd = false;
+  uint64_t limit = UINT64_MAX;
+  const char **files = malloc((argc + 1) * sizeof(char *));
+  int fileCount = 0;
+  Tuner t;
+
+  memset(&t, 0, sizeof(t));
+  for (int i = 0; i < argc; ++i) {
+    if (!strcmp(argv[i], "iterations") && i + 1 < argc)
+      iterations = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "lr") && i + 1 < argc)
+      lr = atof(argv[++i]);
+    else if (!strcmp(argv[i], "method") && i + 1 < argc)
+      sgd = !strcmp(argv[++i], "sgd");
+    else if (!strcmp(argv[i], "k") && i + 1 < argc)
+      k = atof(argv[++i]);
+    else if (!strcmp(argv[i], "threads") && i + 1 < argc)
+      threads = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "limit") && i + 1 < argc)
+      limit = strtoull(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "output") && i + 1 < argc)
+      output = argv[++i];
+    else
+      files[fileCount++] = argv[i];
+  }
+  for (int i = 0; i < fileCount; ++i)
+    if (!load_positions(&t, files[i], limit)) {
+      fprintf(stderr, "tune: cannot read %s\n", files[i]);
+      exit(EXIT_FAILURE);
+    }
+  free(files);
+  if (!t.count) {
+    fprintf(stderr, "Usage: tune <file>... [iterations N] [lr X] [method adam|sgd]"
+                    " [k X] [threads N] [limit N] [output <file>]\n");
+    exit(EXIT_FAILURE);
+  }
+  if (threads < 1)
+    threads = 1;
+  if (!lr)
+    lr = sgd ? 1e5 : 1;
+
+  fprintf(stderr, "positions %llu skipped %llu terms %.1f per position, trace mismatches %llu\n",
+          (unsigned long long)t.count, (unsigned long long)t.skipped,
+          (double)t.termCount / t.count, (unsigned long long)t.mismatches);
+
+  for (int i = 0; i < TUNE_NB; ++i) {
+    t.weights[i][MG] = mg_value(eval_param(i));
+    t.weights[i][EG] = eg_value(eval_param(i));
+  }
+
+  TuneSlice *slices = malloc(threads * sizeof(TuneSlice));
+  if (!k)
+    k = fit_k(&t, slices, threads);
+  fprintf(stderr, "k %.6g initial loss %.6f\n", k, tune_pass(&t, slices, threads, k, NULL));
+
+  // Adam moments; gradient descent uses m as momentum
+  static double grad[TUNE_NB][2], m[TUNE_NB][2], v[TUNE_NB][2];
+  const double beta1 = 0.9, beta2 = 0.999;
+  double loss = 0;
+
+  for (int it = 1; it <= iterations; ++it) {
+    TimePoint start = now();
+    loss = tune_pass(&t, slices, threads, k, grad);
+    TimePoint elapsed = now() - start + 1;
+
+    for (int i = 0; i < TUNE_NB; ++i)
+      for (int p = MG; p <= EG; ++p) {
+        m[i][p] = beta1 * m[i][p] + (sgd ? 1 : 1 - beta1) * grad[i][p];
+        if (sgd)
+          t.weights[i][p] -= lr * m[i][p];
+        else {
+          v[i][p] = beta2 * v[i][p] + (1 - beta2) * grad[i][p] * grad[i][p];
+          double mh = m[i][p] / (1 - pow(beta1, it)), vh = v[i][p] / (1 - pow(beta2, it));
+          t.weights[i][p] -= lr * mh / (sqrt(vh) + 1e-8);
+        }
+      }
+
+    if (it == 1 || it % 10 == 0 || it == iterations)
+      fprintf(stderr, "iteration %d loss %.6f time %lld ms positions/sec %.0f\n",
+              it, loss, (long long)elapsed, t.count * 1000.0 / elapsed);
+  }
+  fprintf(stderr, "final loss %.6f\n", tune_pass(&t, slices, threads, k, NULL));
+
+  FILE *out = strcmp(output, "-") ? fopen(output, "w") : stdout;
+  if (!out) {
+    fprintf(stderr, "tune: cannot open %s\n", output);
+    exit(EXIT_FAILURE);
+  }
+  write_tables(&t, out);
+  if (out != stdout)
+    fclose(out);
+  free(slices);
+  free(t.entries);
+  free(t.terms);
+}
@@ -0,0 +1,6 @@
+#ifndef TUNE_H_INCLUDED
+#define TUNE_H_INCLUDED
+
+void tune_cmd(int argc, char **argv);
+
+#endif
@@ -71,6 +71,18 @@
 #define HasPext 0
 #endif
 
+#ifdef USE_AVX2
+#define HasAvx2 1
+#else
+#define HasAvx2 0
+#endif
+
+#ifdef USE_FILL_ATTACKS
+#define HasFillAttacks 1
+#else
+#define HasFillAttacks 0
+#endif
+
 #ifdef IS_64BIT
 #define Is64Bit 1
 #else
@@ -86,7 +98,7 @@
 typedef uint64_t Key;
 typedef uint64_t Bitboard;
 
-enum { MAX_MOVES = 256 };
+enum { MAX_MOVES = 256, MAX_PLY = 246 };
 
 // A move needs 16 bits to be stored
 //
@@ -129,7 +141,10 @@ enum { BOUND_NONE, BOUND_UPPER, BOUND_LOWER, BOUND_EXACT };
 enum {
   VALUE_ZERO = 0, VALUE_DRAW = 0,
   VALUE_KNOWN_WIN = 10000, VALUE_MATE = 32000,
-  VALUE_INFINITE = 32001, VALUE_NONE = 32002
+  VALUE_INFINITE = 32001, VALUE_NONE = 32002,
+
+  VALUE_MATE_IN_MAX_PLY  =  VALUE_MATE - MAX_PLY,
+  VALUE_MATED_IN_MAX_PLY = -VALUE_MATE + MAX_PLY
 };
 enum { PAWN = 1, KNIGHT, BISHOP, ROOK, QUEEN, KING };
 